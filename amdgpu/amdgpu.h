@@ -160,6 +160,29 @@ struct amdgpu_bo_alloc_request {
 	uint64_t flags;
 };
 
+/**
+ * Statistics of the buffer reuse cache of a device
+ *
+ * \sa amdgpu_device_set_bo_cache(), amdgpu_device_get_bo_cache_stats()
+ *
+*/
+struct amdgpu_bo_cache_stats {
+	/** Bytes of freed buffers currently held for reuse */
+	uint64_t bytes;
+
+	/** Freed buffers currently held for reuse */
+	uint32_t count;
+
+	/** Allocations served from the cache */
+	uint64_t hits;
+
+	/** Allocations the cache had no idle buffer for */
+	uint64_t misses;
+
+	/** Buffers released from the cache to the kernel */
+	uint64_t evictions;
+};
+
 /**
  * Special UMD specific information associated with buffer.
  *
@@ -532,6 +555,46 @@ int amdgpu_device_initialize(int fd,
 */
 int amdgpu_device_deinitialize(amdgpu_device_handle device_handle);
 
+/**
+ * Enable, resize or disable the buffer reuse cache of a device
+ *
+ * With the cache enabled, buffers allocated by amdgpu_bo_alloc() or
+ * amdgpu_bo_alloc_and_map() are not released to the kernel when their
+ * last reference goes away, but kept around until the GPU is done with
+ * them, to serve later allocations of the same size class, heap, flags
+ * and alignment.  Allocation sizes are rounded up to their size class,
+ * which wastes up to a quarter of the buffer.  A buffer allocated with
+ * amdgpu_bo_alloc_and_map() keeps its GPU mapping while cached.
+ *
+ * Buffers which have been exported as any type of handle, KMS handles
+ * included, or imported, had metadata set, were allocated with
+ * AMDGPU_GEM_CREATE_VRAM_CLEARED or still have mappings made with
+ * amdgpu_bo_va_op() when they are freed are never cached.
+ * Buffers not reused within about a second are released.
+ *
+ * \param   dev       - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   max_bytes - \c [in] Bytes of freed buffers to keep at most,
+ *                              0 disables the cache and releases all
+ *                              buffers held in it
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_device_get_bo_cache_stats()
+*/
+int amdgpu_device_set_bo_cache(amdgpu_device_handle dev, uint64_t max_bytes);
+
+/**
+ * Query the statistics of the buffer reuse cache of a device
+ *
+ * \param   dev   - \c [in]  Device handle. See #amdgpu_device_initialize()
+ * \param   stats - \c [out] Cache statistics
+ *
+ * \sa amdgpu_device_set_bo_cache()
+*/
+void amdgpu_device_get_bo_cache_stats(amdgpu_device_handle dev,
+				      struct amdgpu_bo_cache_stats *stats);
+
 /*
  * Memory Management
  *
@@ -555,6 +618,35 @@ int amdgpu_bo_alloc(amdgpu_device_handle dev,
 		    struct amdgpu_bo_alloc_request *alloc_buffer,
 		    amdgpu_bo_handle *buf_handle);
 
+/**
+ * Allocate memory and map it into the GPU virtual address space
+ *
+ * The buffer is mapped at a VA range of its own, which is unmapped and
+ * freed along with the buffer.  When the buffer reuse cache is enabled,
+ * the buffer and its mapping are reused together, saving the ioctls of
+ * both.
+ *
+ * \param   dev		 - \c [in] Device handle.
+ *				   See #amdgpu_device_initialize()
+ * \param   alloc_buffer - \c [in] Pointer to the structure describing an
+ *				   allocation request, its phys_alignment
+ *				   also applies to the VA
+ * \param   va_flags	 - \c [in] Flags for the VA range, see
+ *				   #AMDGPU_VA_RANGE_32_BIT
+ * \param   buf_handle	 - \c [out] Allocated buffer handle
+ * \param   va_address	 - \c [out] GPU virtual address of the buffer
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_free(), amdgpu_device_set_bo_cache()
+*/
+int amdgpu_bo_alloc_and_map(amdgpu_device_handle dev,
+			    struct amdgpu_bo_alloc_request *alloc_buffer,
+			    uint64_t va_flags,
+			    amdgpu_bo_handle *buf_handle,
+			    uint64_t *va_address);
+
 /**
  * Associate opaque data with buffer to be queried by another UMD
  *
@@ -597,6 +689,10 @@ int amdgpu_bo_query_info(amdgpu_bo_handle buf_handle,
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
+ * An exported buffer is never put in the reuse cache when freed.  A buffer
+ * exported as a KMS handle, e.g. for drmModeAddFB(), must not be freed
+ * while it is still a scanout framebuffer.
+ *
  * \sa amdgpu_bo_import()
  *
 */
@@ -907,6 +1003,38 @@ int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 				 uint64_t flags,
 				 uint32_t *expired);
 
+/**
+ *  Wait for all or any of several Command Buffer Submissions
+ *
+ * Fences already known to have signaled, because a fence with the same
+ * or a later sequence number on their ring was seen signaled, are not
+ * asked to the kernel about.  When waiting for all fences, only the last
+ * fence of each ring is waited for.  When waiting for any fence, the
+ * fences of different rings are polled in turn, for a slice of the
+ * timeout each, which can delay seeing a fence signal by as much.
+ *
+ * \param   fences      - \c [in] Array of fences to wait for
+ * \param   fence_count - \c [in] Number of fences
+ * \param   wait_all    - \c [in] Wait for all fences, or any of them
+ * \param   timeout_ns  - \c [in] Timeout value to wait
+ * \param   status      - \c [out] 0 on timeout\n
+ *				!0 - if all, or any, of the fences signaled
+ * \param   first       - \c [out] With wait_all false and status !0,
+ *				index of a fence which signaled; may be
+ *				NULL otherwise
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_query_fence_status()
+*/
+int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
+			  uint32_t fence_count,
+			  bool wait_all,
+			  uint64_t timeout_ns,
+			  uint32_t *status,
+			  uint32_t *first);
+
 /*
  * Query / Info API
  *
@@ -53,7 +53,26 @@ static void amdgpu_close_kms_handle(amdgpu_device_handle dev,
 	drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &args);
 }
 
-drm_private void amdgpu_bo_free_internal(amdgpu_bo_handle bo)
+static int amdgpu_bo_va_op_raw(amdgpu_bo_handle bo, uint64_t offset,
+			       uint64_t size, uint64_t addr, uint32_t ops)
+{
+	struct drm_amdgpu_gem_va va;
+
+	memset(&va, 0, sizeof(va));
+	va.handle = bo->handle;
+	va.operation = ops;
+	va.flags = AMDGPU_VM_PAGE_READABLE |
+		   AMDGPU_VM_PAGE_WRITEABLE |
+		   AMDGPU_VM_PAGE_EXECUTABLE;
+	va.va_address = addr;
+	va.offset_in_bo = offset;
+	va.map_size = ALIGN(size, getpagesize());
+
+	return drmCommandWriteRead(bo->dev->fd, DRM_AMDGPU_GEM_VA,
+				   &va, sizeof(va));
+}
+
+drm_private void amdgpu_bo_destroy(amdgpu_bo_handle bo)
 {
 	/* Remove the buffer from the hash tables. */
 	pthread_mutex_lock(&bo->dev->bo_table_mutex);
@@ -71,34 +90,53 @@ drm_private void amdgpu_bo_free_internal(amdgpu_bo_handle bo)
 		amdgpu_bo_cpu_unmap(bo);
 	}
 
+	if (bo->va_handle) {
+		amdgpu_bo_va_op_raw(bo, 0, bo->alloc_size,
+				    bo->va_handle->address, AMDGPU_VA_OP_UNMAP);
+		amdgpu_va_range_free(bo->va_handle);
+	}
+
 	amdgpu_close_kms_handle(bo->dev, bo->handle);
 	pthread_mutex_destroy(&bo->cpu_access_mutex);
 	free(bo);
 }
 
-int amdgpu_bo_alloc(amdgpu_device_handle dev,
-		    struct amdgpu_bo_alloc_request *alloc_buffer,
-		    amdgpu_bo_handle *buf_handle)
+drm_private void amdgpu_bo_free_internal(amdgpu_bo_handle bo)
+{
+	if (bo->reusable && atomic_read(&bo->va_map_count) == 0) {
+		/* Release CPU access, which is not reused. */
+		if (bo->cpu_map_count > 0) {
+			bo->cpu_map_count = 1;
+			amdgpu_bo_cpu_unmap(bo);
+		}
+
+		if (amdgpu_bo_cache_put(&bo->dev->bo_cache, bo))
+			return;
+	}
+
+	amdgpu_bo_destroy(bo);
+}
+
+static int amdgpu_bo_create(amdgpu_device_handle dev,
+			    struct amdgpu_bo_alloc_request *alloc_buffer,
+			    uint64_t size,
+			    amdgpu_bo_handle *buf_handle)
 {
 	struct amdgpu_bo *bo;
 	union drm_amdgpu_gem_create args;
 	unsigned heap = alloc_buffer->preferred_heap;
 	int r = 0;
 
-	/* It's an error if the heap is not specified */
-	if (!(heap & (AMDGPU_GEM_DOMAIN_GTT | AMDGPU_GEM_DOMAIN_VRAM)))
-		return -EINVAL;
-
 	bo = calloc(1, sizeof(struct amdgpu_bo));
 	if (!bo)
 		return -ENOMEM;
 
 	atomic_set(&bo->refcount, 1);
 	bo->dev = dev;
-	bo->alloc_size = alloc_buffer->alloc_size;
+	bo->alloc_size = size;
 
 	memset(&args, 0, sizeof(args));
-	args.in.bo_size = alloc_buffer->alloc_size;
+	args.in.bo_size = size;
 	args.in.alignment = alloc_buffer->phys_alignment;
 
 	/* Set the placement. */
@@ -114,6 +152,11 @@ int amdgpu_bo_alloc(amdgpu_device_handle dev,
 	}
 
 	bo->handle = args.out.handle;
+	bo->heap = heap;
+	bo->flags = alloc_buffer->flags;
+	bo->phys_alignment = alloc_buffer->phys_alignment;
+	/* A reused buffer would not be cleared again. */
+	bo->reusable = !(alloc_buffer->flags & AMDGPU_GEM_CREATE_VRAM_CLEARED);
 
 	pthread_mutex_init(&bo->cpu_access_mutex, NULL);
 
@@ -121,11 +164,83 @@ int amdgpu_bo_alloc(amdgpu_device_handle dev,
 	return 0;
 }
 
+int amdgpu_bo_alloc(amdgpu_device_handle dev,
+		    struct amdgpu_bo_alloc_request *alloc_buffer,
+		    amdgpu_bo_handle *buf_handle)
+{
+	unsigned heap = alloc_buffer->preferred_heap;
+	uint64_t size = alloc_buffer->alloc_size;
+
+	/* It's an error if the heap is not specified */
+	if (!(heap & (AMDGPU_GEM_DOMAIN_GTT | AMDGPU_GEM_DOMAIN_VRAM)))
+		return -EINVAL;
+
+	*buf_handle = amdgpu_bo_cache_get(&dev->bo_cache, &size, alloc_buffer,
+					  false, 0);
+	if (*buf_handle)
+		return 0;
+
+	return amdgpu_bo_create(dev, alloc_buffer, size, buf_handle);
+}
+
+int amdgpu_bo_alloc_and_map(amdgpu_device_handle dev,
+			    struct amdgpu_bo_alloc_request *alloc_buffer,
+			    uint64_t va_flags,
+			    amdgpu_bo_handle *buf_handle,
+			    uint64_t *va_address)
+{
+	unsigned heap = alloc_buffer->preferred_heap;
+	uint64_t size = alloc_buffer->alloc_size;
+	struct amdgpu_bo *bo;
+	int r;
+
+	/* It's an error if the heap is not specified */
+	if (!(heap & (AMDGPU_GEM_DOMAIN_GTT | AMDGPU_GEM_DOMAIN_VRAM)))
+		return -EINVAL;
+
+	/* A cached buffer comes with its mapping. */
+	bo = amdgpu_bo_cache_get(&dev->bo_cache, &size, alloc_buffer,
+				 true, va_flags);
+	if (bo) {
+		*buf_handle = bo;
+		*va_address = bo->va_handle->address;
+		return 0;
+	}
+
+	r = amdgpu_bo_create(dev, alloc_buffer, size, &bo);
+	if (r)
+		return r;
+
+	r = amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general, size,
+				  alloc_buffer->phys_alignment, 0, va_address,
+				  &bo->va_handle, va_flags);
+	if (r)
+		goto error_destroy;
+
+	r = amdgpu_bo_va_op_raw(bo, 0, size, *va_address, AMDGPU_VA_OP_MAP);
+	if (r) {
+		amdgpu_va_range_free(bo->va_handle);
+		bo->va_handle = NULL;
+		goto error_destroy;
+	}
+	bo->va_flags = va_flags;
+
+	*buf_handle = bo;
+	return 0;
+
+error_destroy:
+	amdgpu_bo_destroy(bo);
+	return r;
+}
+
 int amdgpu_bo_set_metadata(amdgpu_bo_handle bo,
 			   struct amdgpu_bo_metadata *info)
 {
 	struct drm_amdgpu_gem_metadata args = {};
 
+	/* The next user of a cached buffer would get the metadata. */
+	bo->reusable = false;
+
 	args.handle = bo->handle;
 	args.op = AMDGPU_GEM_METADATA_OP_SET_METADATA;
 	args.data.flags = info->flags;
@@ -257,6 +372,12 @@ int amdgpu_bo_export(amdgpu_bo_handle bo,
 {
 	int r;
 
+	/* Others may hold on to a shared buffer, even one only shared as
+	 * a KMS handle: it may be a scanout FB or in a BO list of another
+	 * user of the fd.
+	 */
+	bo->reusable = false;
+
 	switch (type) {
 	case amdgpu_bo_handle_type_gem_flink_name:
 		r = amdgpu_bo_export_flink(bo);
@@ -682,24 +803,22 @@ int amdgpu_bo_va_op(amdgpu_bo_handle bo,
 		     uint64_t flags,
 		     uint32_t ops)
 {
-	amdgpu_device_handle dev = bo->dev;
-	struct drm_amdgpu_gem_va va;
 	int r;
 
 	if (ops != AMDGPU_VA_OP_MAP && ops != AMDGPU_VA_OP_UNMAP)
 		return -EINVAL;
 
-	memset(&va, 0, sizeof(va));
-	va.handle = bo->handle;
-	va.operation = ops;
-	va.flags = AMDGPU_VM_PAGE_READABLE |
-		   AMDGPU_VM_PAGE_WRITEABLE |
-		   AMDGPU_VM_PAGE_EXECUTABLE;
-	va.va_address = addr;
-	va.offset_in_bo = offset;
-	va.map_size = ALIGN(size, getpagesize());
+	r = amdgpu_bo_va_op_raw(bo, offset, size, addr, ops);
 
-	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_GEM_VA, &va, sizeof(va));
+	/* A buffer freed with mappings left is not cached, as they would
+	 * outlive the VA ranges they are in.
+	 */
+	if (!r) {
+		if (ops == AMDGPU_VA_OP_MAP)
+			atomic_inc(&bo->va_map_count);
+		else
+			atomic_dec(&bo->va_map_count, 1);
+	}
 
 	return r;
 }
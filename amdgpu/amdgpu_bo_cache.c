@@ -0,0 +1,303 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file amdgpu_bo_cache.c
+ *
+ *  Reuse of freed buffers, along with their GPU mappings
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+/* buffers not reused within this long are released */
+#define AMDGPU_BO_CACHE_TIMEOUT_NS	1000000000ull
+
+static uint64_t amdgpu_bo_cache_time(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/* index of the most significant set bit, plus one (ie. 0 for v == 0): */
+static inline unsigned last_bit(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* Size class of @size, or -1 for sizes not cached.  The classes are 1, 2
+ * and 3 pages, then for each power of two 2^k (k >= 2) the sizes 2^k,
+ * 2^k*5/4, 2^k*6/4 and 2^k*7/4 pages.
+ */
+static int bucket_index(uint64_t size)
+{
+	uint32_t pages;
+	unsigned k, shift, quarter;
+
+	if (size == 0 || size > AMDGPU_BO_CACHE_MAX_SIZE)
+		return -1;
+
+	pages = (size + 4095) / 4096;
+	if (pages <= 4)
+		return pages - 1;
+
+	/* pages is in (2^k, 2^(k+1)], which is split in quarters: */
+	k = last_bit(pages - 1) - 1;
+	shift = k - 2;
+	quarter = (pages - (1 << k) + (1 << shift) - 1) >> shift;
+	return 3 + (k - 2) * 4 + quarter;
+}
+
+static uint64_t bucket_size(int index)
+{
+	unsigned k, quarter;
+
+	if (index < 4)
+		return (uint64_t)(index + 1) * 4096;
+
+	k = (index - 4) / 4 + 2;
+	quarter = (index - 4) % 4 + 1;
+	return ((1ull << k) + ((uint64_t)quarter << (k - 2))) * 4096;
+}
+
+drm_private void amdgpu_bo_cache_init(struct amdgpu_bo_cache *cache)
+{
+	int i;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	list_inithead(&cache->lru);
+	for (i = 0; i < AMDGPU_BO_CACHE_BUCKETS; i++)
+		list_inithead(&cache->buckets[i]);
+}
+
+static void evict(struct amdgpu_bo_cache *cache, struct amdgpu_bo *bo,
+		  struct list_head *evicted)
+{
+	list_del(&bo->bucket_link);
+	list_del(&bo->lru_link);
+	cache->bytes -= bo->alloc_size;
+	cache->count--;
+	cache->evictions++;
+	list_addtail(&bo->lru_link, evicted);
+}
+
+/* Evicts from the least recently freed end until at most @max_bytes are
+ * left, and the buffers freed before @expire.  Called with cache->lock
+ * held.
+ */
+static void cleanup_locked(struct amdgpu_bo_cache *cache, uint64_t max_bytes,
+			   uint64_t expire, struct list_head *evicted)
+{
+	struct amdgpu_bo *bo;
+
+	while (!LIST_IS_EMPTY(&cache->lru)) {
+		bo = LIST_ENTRY(struct amdgpu_bo, cache->lru.next, lru_link);
+		if (cache->bytes <= max_bytes && bo->free_time >= expire)
+			break;
+		evict(cache, bo, evicted);
+	}
+}
+
+/* Releases the buffers evicted, without holding the cache lock. */
+static void free_evicted(struct list_head *evicted)
+{
+	struct amdgpu_bo *bo, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, evicted, lru_link)
+		amdgpu_bo_destroy(bo);
+}
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_bo_cache *cache)
+{
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+	pthread_mutex_lock(&cache->lock);
+	cache->max_bytes = 0;
+	cleanup_locked(cache, 0, UINT64_MAX, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static bool bo_matches(struct amdgpu_bo *bo,
+		       struct amdgpu_bo_alloc_request *alloc_buffer,
+		       bool mapped, uint64_t va_flags)
+{
+	uint64_t alignment = alloc_buffer->phys_alignment;
+
+	if (bo->heap != alloc_buffer->preferred_heap ||
+	    bo->flags != alloc_buffer->flags)
+		return false;
+
+	/* alignments are powers of two */
+	if (alignment > bo->phys_alignment)
+		return false;
+
+	if (mapped)
+		return bo->va_handle && bo->va_flags == va_flags;
+	return !bo->va_handle;
+}
+
+/* The GPU is done with a cached buffer once, and for good. */
+static bool bo_idle(struct amdgpu_bo *bo)
+{
+	bool busy;
+
+	if (!bo->idle)
+		bo->idle = !amdgpu_bo_wait_for_idle(bo, 0, &busy) && !busy;
+	return bo->idle;
+}
+
+/**
+ * Takes an idle buffer for @alloc_buffer out of the cache, mapped at a VA
+ * range of its own with @va_flags if @mapped, or not mapped otherwise.
+ * Rounds @size up to its size class when the cache is enabled, for the
+ * buffer allocated on a miss to be cached when freed.
+ */
+drm_private amdgpu_bo_handle
+amdgpu_bo_cache_get(struct amdgpu_bo_cache *cache, uint64_t *size,
+		    struct amdgpu_bo_alloc_request *alloc_buffer,
+		    bool mapped, uint64_t va_flags)
+{
+	struct amdgpu_bo *bo = NULL, *entry;
+	int index;
+
+	pthread_mutex_lock(&cache->lock);
+
+	index = cache->max_bytes ? bucket_index(*size) : -1;
+	if (index < 0) {
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+	*size = bucket_size(index);
+
+	/* The oldest matching buffer is the most likely to be idle, and if
+	 * it is not, the newer ones will not be either.
+	 */
+	LIST_FOR_EACH_ENTRY(entry, &cache->buckets[index], bucket_link) {
+		if (bo_matches(entry, alloc_buffer, mapped, va_flags)) {
+			if (bo_idle(entry))
+				bo = entry;
+			break;
+		}
+	}
+
+	if (bo) {
+		list_del(&bo->bucket_link);
+		list_del(&bo->lru_link);
+		cache->bytes -= bo->alloc_size;
+		cache->count--;
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if (bo)
+		atomic_set(&bo->refcount, 1);
+	return bo;
+}
+
+/**
+ * Puts a freed buffer, which must be reusable and not be mapped with
+ * amdgpu_bo_va_op() or for CPU access, in the cache.
+ *
+ * \return  false if the buffer is not cached and is to be destroyed
+ */
+drm_private bool amdgpu_bo_cache_put(struct amdgpu_bo_cache *cache,
+				     struct amdgpu_bo *bo)
+{
+	struct list_head evicted;
+	uint64_t now;
+	int index;
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* Buffers allocated while the cache was disabled are not of the
+	 * size of their class.
+	 */
+	index = cache->max_bytes ? bucket_index(bo->alloc_size) : -1;
+	if (index < 0 || bo->alloc_size != bucket_size(index) ||
+	    bo->alloc_size > cache->max_bytes) {
+		pthread_mutex_unlock(&cache->lock);
+		return false;
+	}
+
+	now = amdgpu_bo_cache_time();
+	bo->free_time = now;
+	bo->idle = false;
+	list_addtail(&bo->lru_link, &cache->lru);
+	list_addtail(&bo->bucket_link, &cache->buckets[index]);
+	cache->bytes += bo->alloc_size;
+	cache->count++;
+
+	list_inithead(&evicted);
+	cleanup_locked(cache, cache->max_bytes,
+		       now > AMDGPU_BO_CACHE_TIMEOUT_NS ?
+		       now - AMDGPU_BO_CACHE_TIMEOUT_NS : 0, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+	return true;
+}
+
+int amdgpu_device_set_bo_cache(amdgpu_device_handle dev, uint64_t max_bytes)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+	pthread_mutex_lock(&cache->lock);
+	cache->max_bytes = max_bytes;
+	cleanup_locked(cache, max_bytes, 0, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+	return 0;
+}
+
+void amdgpu_device_get_bo_cache_stats(amdgpu_device_handle dev,
+				      struct amdgpu_bo_cache_stats *stats)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+
+	pthread_mutex_lock(&cache->lock);
+	stats->bytes = cache->bytes;
+	stats->count = cache->count;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -40,6 +40,9 @@
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
 
+/* how long amdgpu_cs_wait_fences() waits for one ring before the next */
+#define AMDGPU_CS_WAIT_ANY_SLICE_NS	100000
+
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
 
@@ -72,7 +75,11 @@ int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
 
 	r = pthread_mutex_init(&gpu_context->sequence_mutex, NULL);
 	if (r)
-		goto error;
+		goto error_free;
+
+	r = pthread_mutex_init(&gpu_context->fence_mutex, NULL);
+	if (r)
+		goto error_sequence_mutex;
 
 	/* Create the context */
 	memset(&args, 0, sizeof(args));
@@ -91,7 +98,10 @@ int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
 	return 0;
 
 error:
+	pthread_mutex_destroy(&gpu_context->fence_mutex);
+error_sequence_mutex:
 	pthread_mutex_destroy(&gpu_context->sequence_mutex);
+error_free:
 	free(gpu_context);
 	return r;
 }
@@ -114,6 +124,7 @@ int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 		return -EINVAL;
 
 	pthread_mutex_destroy(&context->sequence_mutex);
+	pthread_mutex_destroy(&context->fence_mutex);
 
 	/* now deal with kernel side */
 	memset(&args, 0, sizeof(args));
@@ -408,6 +419,66 @@ static int amdgpu_ioctl_wait_cs(amdgpu_context_handle context,
 	return 0;
 }
 
+static int amdgpu_cs_check_fence(struct amdgpu_cs_fence *fence)
+{
+	if (NULL == fence->context)
+		return -EINVAL;
+	if (fence->ip_type >= AMDGPU_HW_IP_NUM)
+		return -EINVAL;
+	if (fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
+	if (fence->ring >= AMDGPU_CS_MAX_RINGS)
+		return -EINVAL;
+	return 0;
+}
+
+/**
+ * Whether a fence is known to have signaled, without asking the kernel:
+ * sequence numbers of a ring signal in order.
+ */
+static bool amdgpu_cs_fence_signaled(struct amdgpu_cs_fence *fence)
+{
+	amdgpu_context_handle context = fence->context;
+	uint64_t seq;
+
+	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ)
+		return true;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	seq = context->signaled_seq[fence->ip_type][fence->ip_instance][fence->ring];
+	pthread_mutex_unlock(&context->fence_mutex);
+
+	return fence->fence <= seq;
+}
+
+static void amdgpu_cs_set_fence_signaled(struct amdgpu_cs_fence *fence)
+{
+	amdgpu_context_handle context = fence->context;
+	uint64_t *seq;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	seq = &context->signaled_seq[fence->ip_type][fence->ip_instance][fence->ring];
+	if (fence->fence > *seq)
+		*seq = fence->fence;
+	pthread_mutex_unlock(&context->fence_mutex);
+}
+
+static int amdgpu_cs_wait_fence(struct amdgpu_cs_fence *fence,
+				uint64_t timeout_ns,
+				uint64_t flags,
+				bool *busy)
+{
+	int r;
+
+	r = amdgpu_ioctl_wait_cs(fence->context, fence->ip_type,
+				 fence->ip_instance, fence->ring,
+				 fence->fence, timeout_ns, flags, busy);
+	if (!r && !*busy)
+		amdgpu_cs_set_fence_signaled(fence);
+
+	return r;
+}
+
 int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 				 uint64_t timeout_ns,
 				 uint64_t flags,
@@ -420,22 +491,17 @@ int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 		return -EINVAL;
 	if (NULL == expired)
 		return -EINVAL;
-	if (NULL == fence->context)
-		return -EINVAL;
-	if (fence->ip_type >= AMDGPU_HW_IP_NUM)
-		return -EINVAL;
-	if (fence->ring >= AMDGPU_CS_MAX_RINGS)
-		return -EINVAL;
-	if (fence->fence == AMDGPU_NULL_SUBMIT_SEQ) {
+	r = amdgpu_cs_check_fence(fence);
+	if (r)
+		return r;
+	if (amdgpu_cs_fence_signaled(fence)) {
 		*expired = true;
 		return 0;
 	}
 
 	*expired = false;
 
-	r = amdgpu_ioctl_wait_cs(fence->context, fence->ip_type,
-				fence->ip_instance, fence->ring,
-			       	fence->fence, timeout_ns, flags, &busy);
+	r = amdgpu_cs_wait_fence(fence, timeout_ns, flags, &busy);
 
 	if (!r && !busy)
 		*expired = true;
@@ -443,6 +509,158 @@ int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 	return r;
 }
 
+static bool amdgpu_cs_same_ring(struct amdgpu_cs_fence *a,
+				struct amdgpu_cs_fence *b)
+{
+	return a->context == b->context && a->ip_type == b->ip_type &&
+		a->ip_instance == b->ip_instance && a->ring == b->ring;
+}
+
+static int amdgpu_cs_wait_all_fences(struct amdgpu_cs_fence *fences,
+				     uint32_t fence_count,
+				     uint64_t timeout,
+				     uint32_t *status)
+{
+	uint32_t i, j;
+	bool busy;
+	int r;
+
+	for (i = 0; i < fence_count; i++) {
+		struct amdgpu_cs_fence *last = &fences[i];
+
+		if (amdgpu_cs_fence_signaled(last))
+			continue;
+
+		/* Once the last fence of the ring signals, so have the
+		 * others, this one included.
+		 */
+		for (j = i + 1; j < fence_count; j++) {
+			if (amdgpu_cs_same_ring(&fences[j], last) &&
+			    fences[j].fence > last->fence)
+				last = &fences[j];
+		}
+
+		r = amdgpu_cs_wait_fence(last, timeout,
+					 AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE,
+					 &busy);
+		if (r)
+			return r;
+		if (busy)
+			return 0;
+	}
+
+	*status = 1;
+	return 0;
+}
+
+static int amdgpu_cs_wait_any_fence(struct amdgpu_cs_fence *fences,
+				    uint32_t fence_count,
+				    uint64_t timeout,
+				    uint32_t *status,
+				    uint32_t *first)
+{
+	uint32_t *candidates;
+	uint32_t i, j, count = 0;
+	uint64_t slice = 0, deadline;
+	bool busy;
+	int r = 0;
+
+	for (i = 0; i < fence_count; i++) {
+		if (amdgpu_cs_fence_signaled(&fences[i])) {
+			*status = 1;
+			if (first)
+				*first = i;
+			return 0;
+		}
+	}
+
+	/* The first fence of each ring is the one to signal first. */
+	candidates = malloc(fence_count * sizeof(*candidates));
+	if (!candidates)
+		return -ENOMEM;
+
+	for (i = 0; i < fence_count; i++) {
+		for (j = 0; j < count; j++) {
+			struct amdgpu_cs_fence *other = &fences[candidates[j]];
+
+			if (amdgpu_cs_same_ring(&fences[i], other)) {
+				if (fences[i].fence < other->fence)
+					candidates[j] = i;
+				break;
+			}
+		}
+		if (j == count)
+			candidates[count++] = i;
+	}
+
+	/* Poll each ring first, then wait for them in turn. */
+	for (;;) {
+		for (j = 0; j < count; j++) {
+			deadline = count == 1 ? timeout :
+				amdgpu_cs_calculate_timeout(slice);
+			if (deadline > timeout)
+				deadline = timeout;
+
+			r = amdgpu_cs_wait_fence(&fences[candidates[j]],
+						 deadline,
+						 AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE,
+						 &busy);
+			if (r)
+				goto out;
+			if (!busy) {
+				*status = 1;
+				if (first)
+					*first = candidates[j];
+				goto out;
+			}
+		}
+
+		if (timeout != AMDGPU_TIMEOUT_INFINITE &&
+		    amdgpu_cs_calculate_timeout(0) >= timeout)
+			break;
+		slice = AMDGPU_CS_WAIT_ANY_SLICE_NS;
+	}
+
+out:
+	free(candidates);
+	return r;
+}
+
+int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
+			  uint32_t fence_count,
+			  bool wait_all,
+			  uint64_t timeout_ns,
+			  uint32_t *status,
+			  uint32_t *first)
+{
+	uint64_t timeout;
+	uint32_t i;
+	int r;
+
+	if (NULL == fences)
+		return -EINVAL;
+	if (NULL == status)
+		return -EINVAL;
+	if (fence_count == 0)
+		return -EINVAL;
+	for (i = 0; i < fence_count; i++) {
+		r = amdgpu_cs_check_fence(&fences[i]);
+		if (r)
+			return r;
+	}
+
+	*status = 0;
+
+	/* One deadline for all the waits. */
+	timeout = amdgpu_cs_calculate_timeout(timeout_ns);
+
+	if (wait_all)
+		return amdgpu_cs_wait_all_fences(fences, fence_count, timeout,
+						 status);
+	return amdgpu_cs_wait_any_fence(fences, fence_count, timeout,
+					status, first);
+}
+
 int amdgpu_cs_create_semaphore(amdgpu_semaphore_handle *sem)
 {
 	struct amdgpu_semaphore *gpu_semaphore;
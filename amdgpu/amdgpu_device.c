@@ -47,11 +47,22 @@
 #include "amdgpu_asic_id.h"
 
 #define PTR_TO_UINT(x) ((unsigned)((intptr_t)(x)))
-#define UINT_TO_PTR(x) ((void *)((intptr_t)(x)))
+
+#define AMDGPU_MAX_NODES 16
 
 static pthread_mutex_t fd_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct util_hash_table *fd_tab;
 
+/* Primary node of each render or control node of a GPU which has an
+ * amdgpu_device, protected by fd_mutex.  The entries go with the device,
+ * as after a hot-unplug the minors may be reused by another GPU.
+ */
+static struct {
+	dev_t node;
+	dev_t primary;
+} node_tab[AMDGPU_MAX_NODES];
+static unsigned node_count;
+
 static unsigned handle_hash(void *key)
 {
 	return PTR_TO_UINT(key);
@@ -64,41 +75,102 @@ static int handle_compare(void *key1, void *key2)
 
 static unsigned fd_hash(void *key)
 {
-	int fd = PTR_TO_UINT(key);
-	char *name = drmGetPrimaryDeviceNameFromFd(fd);
-	unsigned result = 0;
-	char *c;
+	struct amdgpu_device_key *k = key;
+	uint64_t hash = (uint64_t)k->rdev;
 
-	if (name == NULL)
-		return 0;
+	hash = hash * 31 + (uint64_t)k->dev;
+	hash = hash * 31 + (uint64_t)k->ino;
 
-	for (c = name; *c; ++c)
-		result += *c;
+	return (unsigned)(hash ^ (hash >> 32));
+}
 
-	free(name);
+static int fd_compare(void *key1, void *key2)
+{
+	struct amdgpu_device_key *k1 = key1;
+	struct amdgpu_device_key *k2 = key2;
 
-	return result;
+	return k1->rdev != k2->rdev || k1->dev != k2->dev ||
+		k1->ino != k2->ino;
 }
 
-static int fd_compare(void *key1, void *key2)
+/**
+* Get the key identifying the device an fd is open on
+*
+* Primary and render node fds of a GPU are to share an amdgpu_device, so
+* render and control nodes are keyed by their primary node.  That takes a
+* sysfs lookup, done once per node and remembered until the device is
+* freed.  Must be called with fd_mutex held.
+*
+* \param   fd   - \c [in]  File descriptor for AMD GPU device
+* \param   key  - \c [out] Key for fd_tab
+*
+* \return   0 on success\n
+*          <0 - Negative POSIX Error code
+*/
+static int amdgpu_device_get_key(int fd, struct amdgpu_device_key *key)
 {
-	int fd1 = PTR_TO_UINT(key1);
-	int fd2 = PTR_TO_UINT(key2);
-	char *name1 = drmGetPrimaryDeviceNameFromFd(fd1);
-	char *name2 = drmGetPrimaryDeviceNameFromFd(fd2);
-	int result;
-
-	if (name1 == NULL || name2 == NULL) {
-		free(name1);
-		free(name2);
+	struct stat st, primary_st;
+	unsigned i;
+	char *name;
+	int type;
+
+	memset(key, 0, sizeof(*key));
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	type = drmGetNodeTypeFromFd(fd);
+	if (type < 0) {
+		/* Not a DRM node, as in tests: the file is the device. */
+		key->dev = st.st_dev;
+		key->ino = st.st_ino;
+		return 0;
+	}
+
+	if (type == DRM_NODE_PRIMARY) {
+		key->rdev = st.st_rdev;
 		return 0;
 	}
 
-	result = strcmp(name1, name2);
-	free(name1);
-	free(name2);
+	for (i = 0; i < node_count; i++) {
+		if (node_tab[i].node == st.st_rdev) {
+			key->rdev = node_tab[i].primary;
+			return 0;
+		}
+	}
+
+	/* A render node without a primary node is a device of its own. */
+	key->rdev = st.st_rdev;
+	name = drmGetPrimaryDeviceNameFromFd(fd);
+	if (name && stat(name, &primary_st) == 0)
+		key->rdev = primary_st.st_rdev;
+	free(name);
+
+	/* too many nodes, look this one up every time */
+	if (node_count == AMDGPU_MAX_NODES)
+		return 0;
+
+	node_tab[node_count].node = st.st_rdev;
+	node_tab[node_count].primary = key->rdev;
+	node_count++;
+
+	return 0;
+}
+
+/**
+* Forget the render and control nodes keyed by \p key, once there is no
+* device for it.  Must be called with fd_mutex held.
+*/
+static void amdgpu_device_put_key(struct amdgpu_device_key *key)
+{
+	unsigned i = 0;
 
-	return result;
+	while (i < node_count) {
+		if (node_tab[i].primary == key->rdev)
+			node_tab[i] = node_tab[--node_count];
+		else
+			i++;
+	}
 }
 
 /**
@@ -131,6 +203,8 @@ static int amdgpu_get_auth(int fd, int *auth)
 
 static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 {
+	/* cached buffers give their VA ranges back */
+	amdgpu_bo_cache_fini(&dev->bo_cache);
 	amdgpu_vamgr_deinit(dev->vamgr);
 	free(dev->vamgr);
 	amdgpu_vamgr_deinit(dev->vamgr_32);
@@ -138,7 +212,10 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	util_hash_table_destroy(dev->bo_flink_names);
 	util_hash_table_destroy(dev->bo_handles);
 	pthread_mutex_destroy(&dev->bo_table_mutex);
-	util_hash_table_remove(fd_tab, UINT_TO_PTR(dev->fd));
+	pthread_mutex_lock(&fd_mutex);
+	util_hash_table_remove(fd_tab, &dev->key);
+	amdgpu_device_put_key(&dev->key);
+	pthread_mutex_unlock(&fd_mutex);
 	close(dev->fd);
 	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd))
 		close(dev->flink_fd);
@@ -173,6 +250,7 @@ int amdgpu_device_initialize(int fd,
 			     amdgpu_device_handle *device_handle)
 {
 	struct amdgpu_device *dev;
+	struct amdgpu_device_key key;
 	drmVersionPtr version;
 	int r;
 	int flag_auth = 0;
@@ -190,7 +268,12 @@ int amdgpu_device_initialize(int fd,
 		pthread_mutex_unlock(&fd_mutex);
 		return r;
 	}
-	dev = util_hash_table_get(fd_tab, UINT_TO_PTR(fd));
+	r = amdgpu_device_get_key(fd, &key);
+	if (r) {
+		pthread_mutex_unlock(&fd_mutex);
+		return r;
+	}
+	dev = util_hash_table_get(fd_tab, &key);
 	if (dev) {
 		r = amdgpu_get_auth(dev->fd, &flag_authexist);
 		if (r) {
@@ -209,12 +292,14 @@ int amdgpu_device_initialize(int fd,
 
 	dev = calloc(1, sizeof(struct amdgpu_device));
 	if (!dev) {
+		amdgpu_device_put_key(&key);
 		pthread_mutex_unlock(&fd_mutex);
 		return -ENOMEM;
 	}
 
 	dev->fd = -1;
 	dev->flink_fd = -1;
+	dev->key = key;
 
 	atomic_set(&dev->refcount, 1);
 
@@ -241,6 +326,7 @@ int amdgpu_device_initialize(int fd,
 						     handle_compare);
 	dev->bo_handles = util_hash_table_create(handle_hash, handle_compare);
 	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	amdgpu_bo_cache_init(&dev->bo_cache);
 
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
@@ -279,7 +365,7 @@ int amdgpu_device_initialize(int fd,
 	*major_version = dev->major_version;
 	*minor_version = dev->minor_version;
 	*device_handle = dev;
-	util_hash_table_set(fd_tab, UINT_TO_PTR(dev->fd), dev);
+	util_hash_table_set(fd_tab, &dev->key, dev);
 	pthread_mutex_unlock(&fd_mutex);
 
 	return 0;
@@ -295,6 +381,7 @@ cleanup:
 	if (dev->fd >= 0)
 		close(dev->fd);
 	free(dev);
+	amdgpu_device_put_key(&key);
 	pthread_mutex_unlock(&fd_mutex);
 	return r;
 }
@@ -31,11 +31,13 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sys/types.h>
 
 #include "libdrm_macros.h"
 #include "xf86atomic.h"
 #include "amdgpu.h"
 #include "util_double_list.h"
+#include "util_rb_tree.h"
 
 #define AMDGPU_CS_MAX_RINGS 8
 /* do not use below macro if b is not power of 2 aligned value */
@@ -46,8 +48,15 @@
 #define AMDGPU_INVALID_VA_ADDRESS	0xffffffffffffffff
 #define AMDGPU_NULL_SUBMIT_SEQ		0
 
+/* 4, 8 and 12KiB, then four size classes per power of two up to 64MiB */
+#define AMDGPU_BO_CACHE_BUCKETS		52
+#define AMDGPU_BO_CACHE_MAX_SIZE	(64ull << 20)
+
 struct amdgpu_bo_va_hole {
-	struct list_head list;
+	/* in amdgpu_bo_va_mgr::holes_by_offset */
+	struct util_rb_node offset_node;
+	/* in amdgpu_bo_va_mgr::holes_by_size */
+	struct util_rb_node size_node;
 	uint64_t offset;
 	uint64_t size;
 };
@@ -56,7 +65,10 @@ struct amdgpu_bo_va_mgr {
 	/* the start virtual address */
 	uint64_t va_offset;
 	uint64_t va_max;
-	struct list_head va_holes;
+	/* free ranges below va_offset, ordered by address and by
+	 * (size, address); none of them reaches up to va_offset */
+	struct util_rb_tree holes_by_offset;
+	struct util_rb_tree holes_by_size;
 	pthread_mutex_t bo_va_mutex;
 	uint32_t va_alignment;
 };
@@ -69,10 +81,40 @@ struct amdgpu_va {
 	struct amdgpu_bo_va_mgr *vamgr;
 };
 
+/**
+ * Freed buffers kept around for reuse, see amdgpu_device_set_bo_cache()
+ */
+struct amdgpu_bo_cache {
+	pthread_mutex_t lock;
+	/** 0 when the cache is disabled */
+	uint64_t max_bytes;
+	uint64_t bytes;
+	uint32_t count;
+	/** All cached buffers, least recently freed first */
+	struct list_head lru;
+	/** Cached buffers of each size class, least recently freed first */
+	struct list_head buckets[AMDGPU_BO_CACHE_BUCKETS];
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+/**
+ * Identity of the GPU an fd is open on: the device number of its
+ * primary node, or for files other than DRM nodes, the file itself.
+ */
+struct amdgpu_device_key {
+	dev_t rdev;
+	dev_t dev;
+	ino_t ino;
+};
+
 struct amdgpu_device {
 	atomic_t refcount;
 	int fd;
 	int flink_fd;
+	/** Key of the device in the table of initialized devices */
+	struct amdgpu_device_key key;
 	unsigned major_version;
 	unsigned minor_version;
 
@@ -88,6 +130,7 @@ struct amdgpu_device {
 	struct amdgpu_bo_va_mgr *vamgr;
 	/** The VA manager for the 32bit address space */
 	struct amdgpu_bo_va_mgr *vamgr_32;
+	struct amdgpu_bo_cache bo_cache;
 };
 
 struct amdgpu_bo {
@@ -102,6 +145,26 @@ struct amdgpu_bo {
 	pthread_mutex_t cpu_access_mutex;
 	void *cpu_ptr;
 	int cpu_map_count;
+
+	/** Allocation parameters, which cached buffers are matched by */
+	uint32_t heap;
+	uint64_t flags;
+	uint64_t phys_alignment;
+	/** Cleared once the buffer is shared or gets metadata */
+	bool reusable;
+	/** Known to be idle, while in the cache */
+	bool idle;
+
+	/** VA range of amdgpu_bo_alloc_and_map(), freed with the buffer */
+	amdgpu_va_handle va_handle;
+	uint64_t va_flags;
+	/** Mappings made with amdgpu_bo_va_op() */
+	atomic_t va_map_count;
+
+	/* in amdgpu_bo_cache::lru and amdgpu_bo_cache::buckets */
+	struct list_head lru_link;
+	struct list_head bucket_link;
+	uint64_t free_time;
 };
 
 struct amdgpu_bo_list {
@@ -118,6 +181,10 @@ struct amdgpu_context {
 	/* context id*/
 	uint32_t id;
 	uint64_t last_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/** Protects signaled_seq */
+	pthread_mutex_t fence_mutex;
+	/** Last sequence number of each ring seen signaled */
+	uint64_t signaled_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
 	struct list_head sem_list[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
 };
 
@@ -137,6 +204,20 @@ struct amdgpu_semaphore {
 
 drm_private void amdgpu_bo_free_internal(amdgpu_bo_handle bo);
 
+drm_private void amdgpu_bo_destroy(amdgpu_bo_handle bo);
+
+drm_private void amdgpu_bo_cache_init(struct amdgpu_bo_cache *cache);
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_bo_cache *cache);
+
+drm_private amdgpu_bo_handle
+amdgpu_bo_cache_get(struct amdgpu_bo_cache *cache, uint64_t *size,
+		    struct amdgpu_bo_alloc_request *alloc_buffer,
+		    bool mapped, uint64_t va_flags);
+
+drm_private bool amdgpu_bo_cache_put(struct amdgpu_bo_cache *cache,
+				     amdgpu_bo_handle bo);
+
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 		       uint64_t max, uint64_t alignment);
 
@@ -44,6 +44,148 @@ int amdgpu_va_range_query(amdgpu_device_handle dev,
 	return -EINVAL;
 }
 
+/* Holes passed over for lack of alignment before find_va() only looks at
+ * the ones large enough for any alignment.
+ */
+#define AMDGPU_VA_FIT_SCAN 64
+
+static struct amdgpu_bo_va_hole *offset_hole(struct util_rb_node *node)
+{
+	struct amdgpu_bo_va_hole *hole;
+
+	return node ? container_of(node, hole, offset_node) : NULL;
+}
+
+static struct amdgpu_bo_va_hole *size_hole(struct util_rb_node *node)
+{
+	struct amdgpu_bo_va_hole *hole;
+
+	return node ? container_of(node, hole, size_node) : NULL;
+}
+
+static void amdgpu_vamgr_insert_size(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole)
+{
+	struct util_rb_node *parent = NULL, *node = mgr->holes_by_size.root;
+	bool left = false;
+
+	while (node) {
+		struct amdgpu_bo_va_hole *h = size_hole(node);
+
+		parent = node;
+		left = hole->size < h->size ||
+		       (hole->size == h->size && hole->offset < h->offset);
+		node = left ? node->left : node->right;
+	}
+	util_rb_tree_insert_at(&mgr->holes_by_size, parent, &hole->size_node,
+			       left);
+}
+
+static void amdgpu_vamgr_insert_hole(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole)
+{
+	struct util_rb_node *parent = NULL, *node = mgr->holes_by_offset.root;
+	bool left = false;
+
+	while (node) {
+		parent = node;
+		left = hole->offset < offset_hole(node)->offset;
+		node = left ? node->left : node->right;
+	}
+	util_rb_tree_insert_at(&mgr->holes_by_offset, parent,
+			       &hole->offset_node, left);
+	amdgpu_vamgr_insert_size(mgr, hole);
+}
+
+static void amdgpu_vamgr_remove_hole(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole)
+{
+	util_rb_tree_remove(&mgr->holes_by_offset, &hole->offset_node);
+	util_rb_tree_remove(&mgr->holes_by_size, &hole->size_node);
+	free(hole);
+}
+
+/* Moves @hole to [@offset, @offset + @size), which must not cross any of
+ * its neighbours by address.
+ */
+static void amdgpu_vamgr_resize_hole(struct amdgpu_bo_va_mgr *mgr,
+				     struct amdgpu_bo_va_hole *hole,
+				     uint64_t offset, uint64_t size)
+{
+	util_rb_tree_remove(&mgr->holes_by_size, &hole->size_node);
+	hole->offset = offset;
+	hole->size = size;
+	amdgpu_vamgr_insert_size(mgr, hole);
+}
+
+/* The hole with the highest address not above @va. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_hole_below(struct amdgpu_bo_va_mgr *mgr, uint64_t va)
+{
+	struct util_rb_node *node = mgr->holes_by_offset.root;
+	struct amdgpu_bo_va_hole *best = NULL;
+
+	while (node) {
+		struct amdgpu_bo_va_hole *hole = offset_hole(node);
+
+		if (hole->offset <= va) {
+			best = hole;
+			node = node->right;
+		} else {
+			node = node->left;
+		}
+	}
+	return best;
+}
+
+/* The smallest hole of at least @size bytes, the lowest one of those. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_hole_fitting(struct amdgpu_bo_va_mgr *mgr, uint64_t size)
+{
+	struct util_rb_node *node = mgr->holes_by_size.root;
+	struct amdgpu_bo_va_hole *best = NULL;
+
+	while (node) {
+		struct amdgpu_bo_va_hole *hole = size_hole(node);
+
+		if (hole->size >= size) {
+			best = hole;
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return best;
+}
+
+/* Takes [@offset, @offset + @size) out of @hole, which contains it. */
+static uint64_t amdgpu_vamgr_carve(struct amdgpu_bo_va_mgr *mgr,
+				   struct amdgpu_bo_va_hole *hole,
+				   uint64_t offset, uint64_t size)
+{
+	uint64_t head = offset - hole->offset;
+	uint64_t tail = hole->offset + hole->size - (offset + size);
+	struct amdgpu_bo_va_hole *n;
+
+	if (head && tail) {
+		n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+		if (!n)
+			return AMDGPU_INVALID_VA_ADDRESS;
+		n->offset = offset + size;
+		n->size = tail;
+		amdgpu_vamgr_resize_hole(mgr, hole, hole->offset, head);
+		amdgpu_vamgr_insert_hole(mgr, n);
+	} else if (head) {
+		amdgpu_vamgr_resize_hole(mgr, hole, hole->offset, head);
+	} else if (tail) {
+		amdgpu_vamgr_resize_hole(mgr, hole, offset + size, tail);
+	} else {
+		amdgpu_vamgr_remove_hole(mgr, hole);
+	}
+
+	return offset;
+}
+
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 			      uint64_t max, uint64_t alignment)
 {
@@ -51,17 +193,20 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 	mgr->va_max = max;
 	mgr->va_alignment = alignment;
 
-	list_inithead(&mgr->va_holes);
+	util_rb_tree_init(&mgr->holes_by_offset);
+	util_rb_tree_init(&mgr->holes_by_size);
 	pthread_mutex_init(&mgr->bo_va_mutex, NULL);
 }
 
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr)
 {
-	struct amdgpu_bo_va_hole *hole, *tmp;
-	LIST_FOR_EACH_ENTRY_SAFE(hole, tmp, &mgr->va_holes, list) {
-		list_del(&hole->list);
-		free(hole);
+	struct util_rb_node *node;
+
+	while ((node = util_rb_tree_first(&mgr->holes_by_offset))) {
+		util_rb_tree_remove(&mgr->holes_by_offset, node);
+		free(offset_hole(node));
 	}
+	util_rb_tree_init(&mgr->holes_by_size);
 	pthread_mutex_destroy(&mgr->bo_va_mutex);
 }
 
@@ -71,6 +216,7 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 {
 	struct amdgpu_bo_va_hole *hole, *n;
 	uint64_t offset = 0, waste = 0;
+	unsigned i;
 
 	alignment = MAX2(alignment, mgr->va_alignment);
 	size = ALIGN(size, mgr->va_alignment);
@@ -79,47 +225,38 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 		return AMDGPU_INVALID_VA_ADDRESS;
 
 	pthread_mutex_lock(&mgr->bo_va_mutex);
-	/* TODO: using more appropriate way to track the holes */
 	/* first look for a hole */
-	LIST_FOR_EACH_ENTRY_SAFE(hole, n, &mgr->va_holes, list) {
-		if (base_required) {
-			if(hole->offset > base_required ||
-				(hole->offset + hole->size) < (base_required + size))
-				continue;
-			waste = base_required - hole->offset;
-			offset = base_required;
-		} else {
-			offset = hole->offset;
-			waste = offset % alignment;
-			waste = waste ? alignment - waste : 0;
-			offset += waste;
-			if (offset >= (hole->offset + hole->size)) {
-				continue;
-			}
-		}
-		if (!waste && hole->size == size) {
-			offset = hole->offset;
-			list_del(&hole->list);
-			free(hole);
+	if (base_required) {
+		hole = amdgpu_vamgr_hole_below(mgr, base_required);
+		if (hole && hole->offset + hole->size >= base_required + size) {
+			offset = amdgpu_vamgr_carve(mgr, hole, base_required,
+						    size);
 			pthread_mutex_unlock(&mgr->bo_va_mutex);
 			return offset;
 		}
-		if ((hole->size - waste) > size) {
-			if (waste) {
-				n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-				n->size = waste;
-				n->offset = hole->offset;
-				list_add(&n->list, &hole->list);
+	} else {
+		/* Best fit: the holes are visited from the smallest one
+		 * that is large enough up.  Only the holes less than
+		 * alignment bytes larger than size can be passed over for
+		 * lack of alignment, and after a few of those the search
+		 * skips to the holes which fit at any alignment.
+		 */
+		hole = amdgpu_vamgr_hole_fitting(mgr, size);
+		for (i = 0; hole; i++) {
+			if (i == AMDGPU_VA_FIT_SCAN) {
+				hole = amdgpu_vamgr_hole_fitting(mgr,
+					size + alignment - mgr->va_alignment);
+				if (!hole)
+					break;
 			}
-			hole->size -= (size + waste);
-			hole->offset += size + waste;
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			return offset;
-		}
-		if ((hole->size - waste) == size) {
-			hole->size = waste;
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			return offset;
+			offset = ALIGN(hole->offset, alignment);
+			if (offset - hole->offset + size <= hole->size) {
+				offset = amdgpu_vamgr_carve(mgr, hole, offset,
+							    size);
+				pthread_mutex_unlock(&mgr->bo_va_mutex);
+				return offset;
+			}
+			hole = size_hole(util_rb_node_next(&hole->size_node));
 		}
 	}
 
@@ -142,10 +279,15 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 	}
 
 	if (waste) {
+		/* FIXME on allocation failure we just lose virtual address
+		 * space
+		 */
 		n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-		n->size = waste;
-		n->offset = offset;
-		list_add(&n->list, &mgr->va_holes);
+		if (n) {
+			n->size = waste;
+			n->offset = offset;
+			amdgpu_vamgr_insert_hole(mgr, n);
+		}
 	}
 
 	offset += waste;
@@ -157,7 +299,7 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 drm_private void
 amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 {
-	struct amdgpu_bo_va_hole *hole;
+	struct amdgpu_bo_va_hole *hole, *next;
 
 	if (va == AMDGPU_INVALID_VA_ADDRESS)
 		return;
@@ -168,59 +310,47 @@ amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 	if ((va + size) == mgr->va_offset) {
 		mgr->va_offset = va;
 		/* Delete uppermost hole if it reaches the new top */
-		if (!LIST_IS_EMPTY(&mgr->va_holes)) {
-			hole = container_of(mgr->va_holes.next, hole, list);
-			if ((hole->offset + hole->size) == va) {
-				mgr->va_offset = hole->offset;
-				list_del(&hole->list);
-				free(hole);
-			}
+		hole = offset_hole(util_rb_tree_last(&mgr->holes_by_offset));
+		if (hole && (hole->offset + hole->size) == va) {
+			mgr->va_offset = hole->offset;
+			amdgpu_vamgr_remove_hole(mgr, hole);
 		}
 	} else {
-		struct amdgpu_bo_va_hole *next;
-
-		hole = container_of(&mgr->va_holes, hole, list);
-		LIST_FOR_EACH_ENTRY(next, &mgr->va_holes, list) {
-			if (next->offset < va)
-				break;
-			hole = next;
-		}
+		/* the holes right below and right above the range */
+		hole = amdgpu_vamgr_hole_below(mgr, va);
+		if (hole)
+			next = offset_hole(util_rb_node_next(&hole->offset_node));
+		else
+			next = offset_hole(util_rb_tree_first(&mgr->holes_by_offset));
 
-		if (&hole->list != &mgr->va_holes) {
-			/* Grow upper hole if it's adjacent */
-			if (hole->offset == (va + size)) {
+		if (next && next->offset == (va + size)) {
+			/* Grow upper hole if it's adjacent, and merge lower
+			 * hole if it's adjacent */
+			if (hole && (hole->offset + hole->size) == va) {
+				size += hole->size + next->size;
+				amdgpu_vamgr_remove_hole(mgr, next);
+				amdgpu_vamgr_resize_hole(mgr, hole,
+							 hole->offset, size);
+			} else {
+				amdgpu_vamgr_resize_hole(mgr, next, va,
+							 next->size + size);
+			}
+		} else if (hole && (hole->offset + hole->size) == va) {
+			/* Grow lower hole if it's adjacent */
+			amdgpu_vamgr_resize_hole(mgr, hole, hole->offset,
+						 hole->size + size);
+		} else {
+			/* FIXME on allocation failure we just lose virtual
+			 * address space maybe print a warning
+			 */
+			hole = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+			if (hole) {
+				hole->size = size;
 				hole->offset = va;
-				hole->size += size;
-				/* Merge lower hole if it's adjacent */
-				if (next != hole
-						&& &next->list != &mgr->va_holes
-						&& (next->offset + next->size) == va) {
-					next->size += hole->size;
-					list_del(&hole->list);
-					free(hole);
-				}
-				goto out;
+				amdgpu_vamgr_insert_hole(mgr, hole);
 			}
 		}
-
-		/* Grow lower hole if it's adjacent */
-		if (next != hole && &next->list != &mgr->va_holes &&
-				(next->offset + next->size) == va) {
-			next->size += size;
-			goto out;
-		}
-
-		/* FIXME on allocation failure we just lose virtual address space
-		 * maybe print a warning
-		 */
-		next = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-		if (next) {
-			next->size = size;
-			next->offset = va;
-			list_add(&next->list, &hole->list);
-		}
 	}
-out:
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
 }
 
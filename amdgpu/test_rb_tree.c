@@ -0,0 +1,208 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Unit test of the red-black tree behind the VA hole lookup: random
+ * inserts and removes of keyed nodes, with the tree's invariants checked
+ * after each.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util_double_list.h"
+#include "util_rb_tree.h"
+
+#define NR_SLOTS 1024
+
+struct item {
+	struct util_rb_node node;
+	unsigned key;
+	bool linked;
+};
+
+static struct item items[NR_SLOTS];
+
+static struct item *to_item(struct util_rb_node *node)
+{
+	struct item *item;
+
+	return node ? container_of(node, item, node) : NULL;
+}
+
+static bool is_black(const struct util_rb_node *node)
+{
+	return node == NULL || (node->parent & 1);
+}
+
+/* Checks the subtree at @node, whose parent is @parent, and returns its
+ * black height.
+ */
+static unsigned check_node(struct util_rb_node *node,
+			   struct util_rb_node *parent, unsigned *count)
+{
+	unsigned left, right;
+
+	if (!node)
+		return 1;
+
+	assert(util_rb_node_parent(node) == parent);
+
+	/* a red node has no red child */
+	if (!is_black(node)) {
+		assert(is_black(node->left));
+		assert(is_black(node->right));
+	}
+
+	/* nodes are ordered by key, equal keys in insertion order */
+	if (node->left)
+		assert(to_item(node->left)->key <= to_item(node)->key);
+	if (node->right)
+		assert(to_item(node->right)->key >= to_item(node)->key);
+
+	/* every path down has as many black nodes */
+	left = check_node(node->left, node, count);
+	right = check_node(node->right, node, count);
+	assert(left == right);
+
+	(*count)++;
+	return left + is_black(node);
+}
+
+static void check_tree(struct util_rb_tree *tree, unsigned expected)
+{
+	struct util_rb_node *node, *prev = NULL;
+	unsigned count = 0;
+
+	assert(is_black(tree->root));
+	check_node(tree->root, NULL, &count);
+	assert(count == expected);
+
+	/* the in-order walks agree with each other and with the keys */
+	count = 0;
+	for (node = util_rb_tree_first(tree); node;
+	     node = util_rb_node_next(node)) {
+		assert(to_item(node)->linked);
+		if (prev)
+			assert(to_item(prev)->key <= to_item(node)->key);
+		assert(util_rb_node_prev(node) == prev);
+		prev = node;
+		count++;
+	}
+	assert(count == expected);
+	assert(util_rb_tree_last(tree) == prev);
+}
+
+static void insert(struct util_rb_tree *tree, struct item *item)
+{
+	struct util_rb_node *parent = NULL, *node = tree->root;
+	bool left = false;
+
+	while (node) {
+		parent = node;
+		left = item->key < to_item(node)->key;
+		node = left ? node->left : node->right;
+	}
+	util_rb_tree_insert_at(tree, parent, &item->node, left);
+	item->linked = true;
+}
+
+static void
+test_ordered(void)
+{
+	struct util_rb_tree tree;
+	unsigned i;
+
+	/* ascending and then descending keys, the worst case for an
+	 * unbalanced tree
+	 */
+	util_rb_tree_init(&tree);
+	for (i = 0; i < NR_SLOTS; i++) {
+		items[i].key = i < NR_SLOTS / 2 ? i : NR_SLOTS - i;
+		insert(&tree, &items[i]);
+	}
+	check_tree(&tree, NR_SLOTS);
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		util_rb_tree_remove(&tree, &items[i].node);
+		items[i].linked = false;
+		if (i % 16 == 0)
+			check_tree(&tree, NR_SLOTS - i - 1);
+	}
+	assert(tree.root == NULL);
+	assert(util_rb_tree_first(&tree) == NULL);
+	assert(util_rb_tree_last(&tree) == NULL);
+}
+
+static void
+test_random(void)
+{
+	struct util_rb_tree tree;
+	unsigned i, j, count = 0;
+
+	util_rb_tree_init(&tree);
+	srandom(0);
+
+	for (i = 0; i < 100000; i++) {
+		j = random() % NR_SLOTS;
+
+		if (items[j].linked) {
+			util_rb_tree_remove(&tree, &items[j].node);
+			items[j].linked = false;
+			count--;
+		} else {
+			/* few enough keys for duplicates */
+			items[j].key = random() % (NR_SLOTS / 4);
+			insert(&tree, &items[j]);
+			count++;
+		}
+
+		if (i % 64 == 0)
+			check_tree(&tree, count);
+	}
+	check_tree(&tree, count);
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (items[i].linked) {
+			util_rb_tree_remove(&tree, &items[i].node);
+			items[i].linked = false;
+			check_tree(&tree, --count);
+		}
+	}
+	assert(tree.root == NULL);
+}
+
+int
+main(void)
+{
+	test_ordered();
+	test_random();
+	return 0;
+}
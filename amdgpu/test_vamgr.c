@@ -0,0 +1,275 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Unit test of the VA range allocator, which is pure userspace and so
+ * needs no hardware: random allocations at various alignments, some of
+ * them at a required address, and frees, with the holes checked after
+ * each against the ranges handed out.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define VA_START     (1ull << 20)
+#define VA_SIZE      (1ull << 32)
+#define VA_ALIGNMENT 4096
+#define NR_SLOTS     512
+
+struct range {
+	uint64_t offset;
+	uint64_t size;
+};
+
+static struct range slots[NR_SLOTS];
+
+static int
+compare_ranges(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+
+	return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+static struct amdgpu_bo_va_hole *
+hole_of(struct util_rb_node *node, bool by_size)
+{
+	struct amdgpu_bo_va_hole *hole;
+
+	if (!node)
+		return NULL;
+	return by_size ? container_of(node, hole, size_node) :
+			 container_of(node, hole, offset_node);
+}
+
+static void
+check_mgr(struct amdgpu_bo_va_mgr *mgr)
+{
+	static struct range ranges[2 * NR_SLOTS + 1];
+	struct amdgpu_bo_va_hole *hole, *prev = NULL;
+	struct util_rb_node *node;
+	unsigned nr_ranges = 0, nr_holes = 0, i;
+	uint64_t offset = VA_START;
+
+	/* the holes are sorted by address, apart from each other (or they
+	 * would have been merged) and below the top
+	 */
+	for (node = util_rb_tree_first(&mgr->holes_by_offset); node;
+	     node = util_rb_node_next(node)) {
+		hole = hole_of(node, false);
+		assert(hole->size > 0);
+		assert(hole->offset % VA_ALIGNMENT == 0);
+		assert(hole->size % VA_ALIGNMENT == 0);
+		if (prev)
+			assert(prev->offset + prev->size < hole->offset);
+		assert(hole->offset + hole->size < mgr->va_offset);
+
+		assert(nr_ranges < 2 * NR_SLOTS + 1);
+		ranges[nr_ranges].offset = hole->offset;
+		ranges[nr_ranges].size = hole->size;
+		nr_ranges++;
+		nr_holes++;
+		prev = hole;
+	}
+
+	/* the same holes are sorted by (size, address) */
+	prev = NULL;
+	for (node = util_rb_tree_first(&mgr->holes_by_size); node;
+	     node = util_rb_node_next(node)) {
+		hole = hole_of(node, true);
+		if (prev)
+			assert(prev->size < hole->size ||
+			       (prev->size == hole->size &&
+				prev->offset < hole->offset));
+		prev = hole;
+		nr_holes--;
+	}
+	assert(nr_holes == 0);
+
+	/* holes and allocations tile the range below the top */
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (slots[i].size)
+			ranges[nr_ranges++] = slots[i];
+	}
+	qsort(ranges, nr_ranges, sizeof(ranges[0]), compare_ranges);
+	for (i = 0; i < nr_ranges; i++) {
+		assert(ranges[i].offset == offset);
+		offset += ranges[i].size;
+	}
+	assert(offset == mgr->va_offset);
+	assert(mgr->va_offset <= mgr->va_max);
+}
+
+/* Whether [@offset, @offset + @size) is clear of the live allocations. */
+static bool
+range_is_free(uint64_t offset, uint64_t size)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (slots[i].size && slots[i].offset < offset + size &&
+		    offset < slots[i].offset + slots[i].size)
+			return false;
+	}
+	return true;
+}
+
+static uint64_t
+random_size(void)
+{
+	/* 1 to 64 pages, with the small ones more common */
+	return (1 + random() % (1 << (random() % 7))) * VA_ALIGNMENT;
+}
+
+static void
+test_random(void)
+{
+	struct amdgpu_bo_va_mgr mgr;
+	struct range freed = { 0, 0 };
+	uint64_t size, alignment, va;
+	unsigned i, j;
+
+	amdgpu_vamgr_init(&mgr, VA_START, VA_START + VA_SIZE, VA_ALIGNMENT);
+	srandom(0);
+
+	for (i = 0; i < 100000; i++) {
+		j = random() % NR_SLOTS;
+
+		if (slots[j].size) {
+			amdgpu_vamgr_free_va(&mgr, slots[j].offset,
+					     slots[j].size);
+			freed = slots[j];
+			slots[j].size = 0;
+		} else if (freed.size && random() % 4 == 0) {
+			/* the last range freed, back at its address if
+			 * nothing has taken it since
+			 */
+			va = amdgpu_vamgr_find_va(&mgr, freed.size,
+						  VA_ALIGNMENT, freed.offset);
+			if (range_is_free(freed.offset, freed.size)) {
+				assert(va == freed.offset);
+				slots[j] = freed;
+			} else {
+				assert(va == AMDGPU_INVALID_VA_ADDRESS);
+			}
+			freed.size = 0;
+		} else {
+			size = random_size();
+			alignment = (uint64_t)VA_ALIGNMENT << (random() % 6);
+			va = amdgpu_vamgr_find_va(&mgr, size, alignment, 0);
+			assert(va != AMDGPU_INVALID_VA_ADDRESS);
+			assert(va % alignment == 0);
+			assert(range_is_free(va, size));
+			slots[j].offset = va;
+			slots[j].size = size;
+		}
+
+		if (i % 64 == 0)
+			check_mgr(&mgr);
+	}
+	check_mgr(&mgr);
+
+	/* freeing everything leaves neither holes nor anything above */
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (slots[i].size) {
+			amdgpu_vamgr_free_va(&mgr, slots[i].offset,
+					     slots[i].size);
+			slots[i].size = 0;
+			check_mgr(&mgr);
+		}
+	}
+	assert(mgr.va_offset == VA_START);
+	assert(mgr.holes_by_offset.root == NULL);
+	assert(mgr.holes_by_size.root == NULL);
+
+	amdgpu_vamgr_deinit(&mgr);
+}
+
+static void
+test_full(void)
+{
+	struct amdgpu_bo_va_mgr mgr;
+	uint64_t va;
+	unsigned i;
+
+	/* room for NR_SLOTS / 2 pages */
+	amdgpu_vamgr_init(&mgr, VA_START,
+			  VA_START + NR_SLOTS / 2 * VA_ALIGNMENT, VA_ALIGNMENT);
+
+	for (i = 0; i < NR_SLOTS / 2; i++) {
+		va = amdgpu_vamgr_find_va(&mgr, VA_ALIGNMENT, 0, 0);
+		assert(va == VA_START + i * VA_ALIGNMENT);
+		slots[i].offset = va;
+		slots[i].size = VA_ALIGNMENT;
+	}
+	va = amdgpu_vamgr_find_va(&mgr, VA_ALIGNMENT, 0, 0);
+	assert(va == AMDGPU_INVALID_VA_ADDRESS);
+
+	/* every other page freed, which leaves no room for two */
+	for (i = 0; i < NR_SLOTS / 2; i += 2) {
+		amdgpu_vamgr_free_va(&mgr, slots[i].offset, slots[i].size);
+		slots[i].size = 0;
+	}
+	check_mgr(&mgr);
+	va = amdgpu_vamgr_find_va(&mgr, 2 * VA_ALIGNMENT, 0, 0);
+	assert(va == AMDGPU_INVALID_VA_ADDRESS);
+
+	/* and the pages freed are handed out again */
+	for (i = 0; i < NR_SLOTS / 2; i += 2) {
+		va = amdgpu_vamgr_find_va(&mgr, VA_ALIGNMENT, 0, 0);
+		assert(va != AMDGPU_INVALID_VA_ADDRESS);
+		assert(range_is_free(va, VA_ALIGNMENT));
+		slots[i].offset = va;
+		slots[i].size = VA_ALIGNMENT;
+	}
+	check_mgr(&mgr);
+	assert(mgr.holes_by_offset.root == NULL);
+
+	for (i = 0; i < NR_SLOTS / 2; i++) {
+		amdgpu_vamgr_free_va(&mgr, slots[i].offset, slots[i].size);
+		slots[i].size = 0;
+	}
+	check_mgr(&mgr);
+	assert(mgr.va_offset == VA_START);
+
+	amdgpu_vamgr_deinit(&mgr);
+}
+
+int
+main(void)
+{
+	test_full();
+	test_random();
+	return 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+
+#include "util_rb_tree.h"
+
+/* NULL leaves count as black. */
+static bool is_black(const struct util_rb_node *node)
+{
+	return node == NULL || (node->parent & 1);
+}
+
+static bool is_red(const struct util_rb_node *node)
+{
+	return !is_black(node);
+}
+
+static void set_black(struct util_rb_node *node)
+{
+	node->parent |= 1;
+}
+
+static void set_red(struct util_rb_node *node)
+{
+	node->parent &= ~(uintptr_t)1;
+}
+
+static void copy_color(struct util_rb_node *dst,
+		       const struct util_rb_node *src)
+{
+	dst->parent = (dst->parent & ~(uintptr_t)1) | (src->parent & 1);
+}
+
+static void set_parent(struct util_rb_node *node, struct util_rb_node *parent)
+{
+	node->parent = (node->parent & 1) | (uintptr_t)parent;
+}
+
+static struct util_rb_node *subtree_first(struct util_rb_node *node)
+{
+	while (node->left)
+		node = node->left;
+	return node;
+}
+
+static struct util_rb_node *subtree_last(struct util_rb_node *node)
+{
+	while (node->right)
+		node = node->right;
+	return node;
+}
+
+/* Puts @v, which may be NULL, in the place of @u under @u's parent. */
+static void replace(struct util_rb_tree *tree, struct util_rb_node *u,
+		    struct util_rb_node *v)
+{
+	struct util_rb_node *p = util_rb_node_parent(u);
+
+	if (p == NULL)
+		tree->root = v;
+	else if (p->left == u)
+		p->left = v;
+	else
+		p->right = v;
+
+	if (v)
+		set_parent(v, p);
+}
+
+static void rotate_left(struct util_rb_tree *tree, struct util_rb_node *x)
+{
+	struct util_rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left)
+		set_parent(y->left, x);
+	replace(tree, x, y);
+	y->left = x;
+	set_parent(x, y);
+}
+
+static void rotate_right(struct util_rb_tree *tree, struct util_rb_node *x)
+{
+	struct util_rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right)
+		set_parent(y->right, x);
+	replace(tree, x, y);
+	y->right = x;
+	set_parent(x, y);
+}
+
+drm_private void util_rb_tree_insert_at(struct util_rb_tree *tree,
+					struct util_rb_node *parent,
+					struct util_rb_node *node,
+					bool insert_left)
+{
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = (uintptr_t)parent;	/* red */
+
+	if (parent == NULL)
+		tree->root = node;
+	else if (insert_left)
+		parent->left = node;
+	else
+		parent->right = node;
+
+	/* A red parent is never the root, so there is a grandparent. */
+	while (is_red(util_rb_node_parent(node))) {
+		struct util_rb_node *p = util_rb_node_parent(node);
+		struct util_rb_node *g = util_rb_node_parent(p);
+		struct util_rb_node *uncle;
+
+		if (p == g->left) {
+			uncle = g->right;
+			if (is_red(uncle)) {
+				set_black(p);
+				set_black(uncle);
+				set_red(g);
+				node = g;
+				continue;
+			}
+			if (node == p->right) {
+				rotate_left(tree, p);
+				p = node;
+			}
+			set_black(p);
+			set_red(g);
+			rotate_right(tree, g);
+			break;
+		} else {
+			uncle = g->left;
+			if (is_red(uncle)) {
+				set_black(p);
+				set_black(uncle);
+				set_red(g);
+				node = g;
+				continue;
+			}
+			if (node == p->left) {
+				rotate_right(tree, p);
+				p = node;
+			}
+			set_black(p);
+			set_red(g);
+			rotate_left(tree, g);
+			break;
+		}
+	}
+
+	set_black(tree->root);
+}
+
+/* Restores the black height after a black node was unlinked above @x,
+ * which may be NULL and is then told apart from its sibling by @parent.
+ */
+static void remove_fixup(struct util_rb_tree *tree, struct util_rb_node *x,
+			 struct util_rb_node *parent)
+{
+	struct util_rb_node *w;
+
+	while (x != tree->root && is_black(x)) {
+		if (x == parent->left) {
+			w = parent->right;
+			if (is_red(w)) {
+				set_black(w);
+				set_red(parent);
+				rotate_left(tree, parent);
+				w = parent->right;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				set_red(w);
+				x = parent;
+				parent = util_rb_node_parent(x);
+				continue;
+			}
+			if (is_black(w->right)) {
+				set_black(w->left);
+				set_red(w);
+				rotate_right(tree, w);
+				w = parent->right;
+			}
+			copy_color(w, parent);
+			set_black(parent);
+			set_black(w->right);
+			rotate_left(tree, parent);
+		} else {
+			w = parent->left;
+			if (is_red(w)) {
+				set_black(w);
+				set_red(parent);
+				rotate_right(tree, parent);
+				w = parent->left;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				set_red(w);
+				x = parent;
+				parent = util_rb_node_parent(x);
+				continue;
+			}
+			if (is_black(w->left)) {
+				set_black(w->right);
+				set_red(w);
+				rotate_left(tree, w);
+				w = parent->left;
+			}
+			copy_color(w, parent);
+			set_black(parent);
+			set_black(w->left);
+			rotate_right(tree, parent);
+		}
+		x = tree->root;
+	}
+
+	if (x)
+		set_black(x);
+}
+
+drm_private void util_rb_tree_remove(struct util_rb_tree *tree,
+				     struct util_rb_node *node)
+{
+	struct util_rb_node *x, *parent;
+	bool removed_black;
+
+	if (node->left == NULL || node->right == NULL) {
+		x = node->left ? node->left : node->right;
+		parent = util_rb_node_parent(node);
+		removed_black = is_black(node);
+		replace(tree, node, x);
+	} else {
+		/* Move the successor, which has no left child, in the
+		 * place of @node.
+		 */
+		struct util_rb_node *y = subtree_first(node->right);
+
+		removed_black = is_black(y);
+		x = y->right;
+		if (util_rb_node_parent(y) == node) {
+			parent = y;
+		} else {
+			parent = util_rb_node_parent(y);
+			replace(tree, y, x);
+			y->right = node->right;
+			set_parent(y->right, y);
+		}
+		replace(tree, node, y);
+		y->left = node->left;
+		set_parent(y->left, y);
+		copy_color(y, node);
+	}
+
+	if (removed_black)
+		remove_fixup(tree, x, parent);
+}
+
+drm_private struct util_rb_node *
+util_rb_tree_first(const struct util_rb_tree *tree)
+{
+	return tree->root ? subtree_first(tree->root) : NULL;
+}
+
+drm_private struct util_rb_node *
+util_rb_tree_last(const struct util_rb_tree *tree)
+{
+	return tree->root ? subtree_last(tree->root) : NULL;
+}
+
+drm_private struct util_rb_node *util_rb_node_next(struct util_rb_node *node)
+{
+	struct util_rb_node *p;
+
+	if (node->right)
+		return subtree_first(node->right);
+
+	p = util_rb_node_parent(node);
+	while (p && node == p->right) {
+		node = p;
+		p = util_rb_node_parent(p);
+	}
+	return p;
+}
+
+drm_private struct util_rb_node *util_rb_node_prev(struct util_rb_node *node)
+{
+	struct util_rb_node *p;
+
+	if (node->left)
+		return subtree_last(node->left);
+
+	p = util_rb_node_parent(node);
+	while (p && node == p->left) {
+		node = p;
+		p = util_rb_node_parent(p);
+	}
+	return p;
+}
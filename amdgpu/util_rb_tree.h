@@ -0,0 +1,90 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * Intrusive red-black tree.
+ *
+ * The tree does not know how its nodes are ordered: callers walk it from
+ * util_rb_tree::root to find where a node goes, and hand the parent they
+ * found to util_rb_tree_insert_at().  Nodes are embedded in the caller's
+ * structures and recovered with container_of().
+ */
+
+#ifndef UTIL_RB_TREE_H
+#define UTIL_RB_TREE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+
+struct util_rb_node {
+	/* parent pointer, with the color in bit 0 */
+	uintptr_t parent;
+	struct util_rb_node *left;
+	struct util_rb_node *right;
+};
+
+struct util_rb_tree {
+	struct util_rb_node *root;
+};
+
+static inline void util_rb_tree_init(struct util_rb_tree *tree)
+{
+	tree->root = NULL;
+}
+
+static inline struct util_rb_node *
+util_rb_node_parent(const struct util_rb_node *node)
+{
+	return (struct util_rb_node *)(node->parent & ~(uintptr_t)1);
+}
+
+/**
+ * Links @node in as the left or right child of @parent, which must not
+ * have one on that side, or as the root when @parent is NULL, and
+ * rebalances the tree.
+ */
+drm_private void util_rb_tree_insert_at(struct util_rb_tree *tree,
+					struct util_rb_node *parent,
+					struct util_rb_node *node,
+					bool insert_left);
+
+drm_private void util_rb_tree_remove(struct util_rb_tree *tree,
+				     struct util_rb_node *node);
+
+drm_private struct util_rb_node *
+util_rb_tree_first(const struct util_rb_tree *tree);
+drm_private struct util_rb_node *
+util_rb_tree_last(const struct util_rb_tree *tree);
+
+/** In-order successor and predecessor of @node, or NULL. */
+drm_private struct util_rb_node *util_rb_node_next(struct util_rb_node *node);
+drm_private struct util_rb_node *util_rb_node_prev(struct util_rb_node *node);
+
+#endif /* UTIL_RB_TREE_H */
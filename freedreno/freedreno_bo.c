@@ -33,10 +33,30 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-drm_private void bo_del(struct fd_bo *bo);
+static struct fd_bo_table * get_table(struct fd_device *dev, uint32_t handle)
+{
+	return &dev->handle_table[handle % FD_TABLE_SHARDS];
+}
+
+drm_private void fd_bo_table_insert(struct fd_bo *bo)
+{
+	struct fd_bo_table *tbl = get_table(bo->dev, bo->handle);
+
+	pthread_mutex_lock(&tbl->lock);
+	drmHashInsert(tbl->table, bo->handle, bo);
+	pthread_mutex_unlock(&tbl->lock);
+}
 
-/* set buffer name, and add to table, call w/ table_lock held: */
+drm_private void fd_bo_table_remove(struct fd_bo *bo)
+{
+	struct fd_bo_table *tbl = get_table(bo->dev, bo->handle);
+
+	pthread_mutex_lock(&tbl->lock);
+	drmHashDelete(tbl->table, bo->handle);
+	pthread_mutex_unlock(&tbl->lock);
+}
+
+/* set buffer name, and add to table, call w/ share_lock held: */
 static void set_name(struct fd_bo *bo, uint32_t name)
 {
 	bo->name = name;
@@ -44,23 +64,20 @@ static void set_name(struct fd_bo *bo, uint32_t name)
 	drmHashInsert(bo->dev->name_table, name, bo);
 }
 
-/* lookup a buffer, call w/ table_lock held: */
+/* lookup a buffer, call w/ the table's lock held: */
 static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 {
 	struct fd_bo *bo = NULL;
 	if (!drmHashLookup(tbl, key, (void **)&bo)) {
 		/* found, incr refcnt and return: */
 		bo = fd_bo_ref(bo);
-
-		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
 	}
 	return bo;
 }
 
-/* allocate a new buffer object, call w/ table_lock held */
+/* allocate a new buffer object, call w/ @tbl lock held */
 static struct fd_bo * bo_from_handle(struct fd_device *dev,
-		uint32_t size, uint32_t handle)
+		struct fd_bo_table *tbl, uint32_t size, uint32_t handle)
 {
 	struct fd_bo *bo;
 
@@ -69,7 +86,7 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 		struct drm_gem_close req = {
 				.handle = handle,
 		};
-		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		fd_ioctl(dev, DRM_IOCTL_GEM_CLOSE, &req);
 		return NULL;
 	}
 	bo->dev = fd_device_ref(dev);
@@ -78,7 +95,7 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 	atomic_set(&bo->refcnt, 1);
 	list_inithead(&bo->list);
 	/* add ourself into the handle table: */
-	drmHashInsert(dev->handle_table, handle, bo);
+	drmHashInsert(tbl->table, handle, bo);
 	return bo;
 }
 
@@ -86,6 +103,7 @@ struct fd_bo *
 fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
 {
 	struct fd_bo *bo = NULL;
+	struct fd_bo_table *tbl;
 	uint32_t handle;
 	int ret;
 
@@ -94,13 +112,21 @@ fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
 		return bo;
 
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
+	if (ret == -ENOMEM) {
+		/* free what is cached, magazines included, and try again: */
+		fd_bo_cache_trim(&dev->bo_cache, 0);
+		ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
+	}
 	if (ret)
 		return NULL;
 
-	pthread_mutex_lock(&table_lock);
-	bo = bo_from_handle(dev, size, handle);
-	bo->bo_reuse = TRUE;
-	pthread_mutex_unlock(&table_lock);
+	tbl = get_table(dev, handle);
+	pthread_mutex_lock(&tbl->lock);
+	bo = bo_from_handle(dev, tbl, size, handle);
+	pthread_mutex_unlock(&tbl->lock);
+
+	if (bo)
+		bo->bo_reuse = TRUE;
 
 	return bo;
 }
@@ -108,18 +134,21 @@ fd_bo_new(struct fd_device *dev, uint32_t size, uint32_t flags)
 struct fd_bo *
 fd_bo_from_handle(struct fd_device *dev, uint32_t handle, uint32_t size)
 {
+	struct fd_bo_table *tbl = get_table(dev, handle);
 	struct fd_bo *bo = NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->share_lock);
+	pthread_mutex_lock(&tbl->lock);
 
-	bo = lookup_bo(dev->handle_table, handle);
+	bo = lookup_bo(tbl->table, handle);
 	if (bo)
 		goto out_unlock;
 
-	bo = bo_from_handle(dev, size, handle);
+	bo = bo_from_handle(dev, tbl, size, handle);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&tbl->lock);
+	pthread_mutex_unlock(&dev->share_lock);
 
 	return bo;
 }
@@ -129,15 +158,18 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 {
 	int ret, size;
 	uint32_t handle;
-	struct fd_bo *bo;
+	struct fd_bo_table *tbl;
+	struct fd_bo *bo = NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->share_lock);
 	ret = drmPrimeFDToHandle(dev->fd, fd, &handle);
-	if (ret) {
-		return NULL;
-	}
+	if (ret)
+		goto out_unlock_share;
+
+	tbl = get_table(dev, handle);
+	pthread_mutex_lock(&tbl->lock);
 
-	bo = lookup_bo(dev->handle_table, handle);
+	bo = lookup_bo(tbl->table, handle);
 	if (bo)
 		goto out_unlock;
 
@@ -145,10 +177,12 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 	size = lseek(fd, 0, SEEK_END);
 	lseek(fd, 0, SEEK_CUR);
 
-	bo = bo_from_handle(dev, size, handle);
+	bo = bo_from_handle(dev, tbl, size, handle);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&tbl->lock);
+out_unlock_share:
+	pthread_mutex_unlock(&dev->share_lock);
 
 	return bo;
 }
@@ -158,30 +192,35 @@ struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	struct drm_gem_open req = {
 			.name = name,
 	};
+	struct fd_bo_table *tbl;
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->share_lock);
 
 	/* check name table first, to see if bo is already open: */
 	bo = lookup_bo(dev->name_table, name);
 	if (bo)
 		goto out_unlock;
 
-	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
+	if (fd_ioctl(dev, DRM_IOCTL_GEM_OPEN, &req)) {
 		ERROR_MSG("gem-open failed: %s", strerror(errno));
 		goto out_unlock;
 	}
 
-	bo = lookup_bo(dev->handle_table, req.handle);
-	if (bo)
-		goto out_unlock;
+	tbl = get_table(dev, req.handle);
+	pthread_mutex_lock(&tbl->lock);
 
-	bo = bo_from_handle(dev, req.size, req.handle);
-	if (bo)
-		set_name(bo, name);
+	bo = lookup_bo(tbl->table, req.handle);
+	if (!bo) {
+		bo = bo_from_handle(dev, tbl, req.size, req.handle);
+		if (bo)
+			set_name(bo, name);
+	}
+
+	pthread_mutex_unlock(&tbl->lock);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->share_lock);
 
 	return bo;
 }
@@ -199,35 +238,36 @@ void fd_bo_del(struct fd_bo *bo)
 	if (!atomic_dec_and_test(&bo->refcnt))
 		return;
 
-	pthread_mutex_lock(&table_lock);
-
 	if (bo->bo_reuse && (fd_bo_cache_free(&dev->bo_cache, bo) == 0))
-		goto out;
+		return;
 
-	bo_del(bo);
-	fd_device_del_locked(dev);
-out:
-	pthread_mutex_unlock(&table_lock);
+	if (bo->bo_reuse) {
+		/* never shared, so can't race with import: */
+		fd_bo_table_remove(bo);
+		bo_del(bo);
+	} else {
+		pthread_mutex_lock(&dev->share_lock);
+		fd_bo_table_remove(bo);
+		if (bo->name)
+			drmHashDelete(dev->name_table, bo->name);
+		bo_del(bo);
+		pthread_mutex_unlock(&dev->share_lock);
+	}
+
+	fd_device_del(dev);
 }
 
-/* Called under table_lock */
+/* Called for bo's which are not (or no longer) in the handle table */
 drm_private void bo_del(struct fd_bo *bo)
 {
 	if (bo->map)
 		drm_munmap(bo->map, bo->size);
 
-	/* TODO probably bo's in bucket list get removed from
-	 * handle table??
-	 */
-
 	if (bo->handle) {
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		drmHashDelete(bo->dev->handle_table, bo->handle);
-		if (bo->name)
-			drmHashDelete(bo->dev->name_table, bo->name);
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		fd_ioctl(bo->dev, DRM_IOCTL_GEM_CLOSE, &req);
 	}
 
 	bo->funcs->destroy(bo);
@@ -241,14 +281,14 @@ int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 		};
 		int ret;
 
-		ret = drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_FLINK, &req);
+		ret = fd_ioctl(bo->dev, DRM_IOCTL_GEM_FLINK, &req);
 		if (ret) {
 			return ret;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		pthread_mutex_lock(&bo->dev->share_lock);
 		set_name(bo, req.name);
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&bo->dev->share_lock);
 		bo->bo_reuse = FALSE;
 	}
 
@@ -307,7 +347,43 @@ void * fd_bo_map(struct fd_bo *bo)
 /* a bit odd to take the pipe as an arg, but it's a, umm, quirk of kgsl.. */
 int fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
 {
-	return bo->funcs->cpu_prep(bo, pipe, op);
+	uint32_t fence;
+	enum fd_pipe_id id = fd_bo_get_fence(bo, &fence);
+	int ret = bo->funcs->cpu_prep(bo, pipe, op);
+
+	/* preparing for a write waits for all GPU access, so (at least)
+	 * the last submit known to have used the bo beforehand has
+	 * completed:
+	 */
+	if (!ret && (op & DRM_FREEDRENO_PREP_WRITE) && id)
+		fd_fence_retire(bo->dev, id, fence);
+
+	return ret;
+}
+
+drm_private int fd_bo_idle(struct fd_bo *bo)
+{
+	if (fd_bo_known_idle(bo))
+		return TRUE;
+
+	return fd_bo_cpu_prep(bo, NULL,
+			DRM_FREEDRENO_PREP_READ |
+			DRM_FREEDRENO_PREP_WRITE |
+			DRM_FREEDRENO_PREP_NOSYNC) == 0;
+}
+
+/* the GPU has made it (at least) as far as @fence on pipe @id: */
+drm_private void fd_fence_retire(struct fd_device *dev, enum fd_pipe_id id,
+		uint32_t fence)
+{
+	atomic_t *completed = &dev->completed_fence[id];
+	uint32_t old;
+
+	do {
+		old = atomic_read(completed);
+		if ((int32_t)(fence - old) <= 0)
+			return;
+	} while (atomic_cmpxchg(completed, old, fence) != (int)old);
 }
 
 void fd_bo_cpu_fini(struct fd_bo *bo)
@@ -34,8 +34,10 @@
 #include "freedreno_priv.h"
 
 
-drm_private void bo_del(struct fd_bo *bo);
-drm_private extern pthread_mutex_t table_lock;
+#define MAGAZINE_SIZE 16
+
+/* bo's looked at in a bucket for one which is known to be idle: */
+#define BUCKET_PROBES 4
 
 static void
 add_bucket(struct fd_bo_cache *cache, int size)
@@ -58,6 +60,11 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int course)
 {
 	unsigned long size, cache_max_size = 64 * 1024 * 1024;
 
+	cache->coarse = course;
+	cache->time = 0;
+	pthread_mutex_init(&cache->lock, NULL);
+	list_inithead(&cache->magazines);
+
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -82,18 +89,177 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int course)
 	}
 }
 
-/* Frees older cached buffers.  Called under table_lock */
-drm_private void
-fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+/* index of the most significant set bit, plus one (ie. 0 for v == 0): */
+static inline unsigned last_bit(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+{
+	uint32_t pages = (size + 4095) / 4096;
+	unsigned idx;
+
+	/* Rather than looping over the buckets, calculate our way to the
+	 * correct bucket, following the layout set up in fd_bo_cache_init():
+	 *
+	 *   coarse:  1, 2, 4, 8, ... pages
+	 *   fine:    1, 2, 3, then for each power of two 2^k (k >= 2) the
+	 *            sizes 2^k, 2^k*5/4, 2^k*6/4, 2^k*7/4 pages
+	 */
+	if (pages <= 1) {
+		idx = 0;
+	} else if (cache->coarse) {
+		idx = last_bit(pages - 1);
+	} else if (pages <= 4) {
+		idx = pages - 1;
+	} else {
+		/* pages is in (2^k, 2^(k+1)], which is split in quarters: */
+		unsigned k = last_bit(pages - 1) - 1;
+		unsigned shift = k - 2;
+		unsigned quarter = (pages - (1 << k) + (1 << shift) - 1) >> shift;
+		idx = 3 + (k - 2) * 4 + quarter;
+	}
+
+	if (idx >= (unsigned)cache->num_buckets)
+		return NULL;
+
+	assert(cache->cache_bucket[idx].size >= size);
+	assert((idx == 0) || (cache->cache_bucket[idx - 1].size < size));
+
+	return &cache->cache_bucket[idx];
+}
+
+/* Bytes held in the buckets and magazines together, and likewise for
+ * one size.  Without the lock, only a hint:
+ */
+static uint64_t cache_bytes(struct fd_bo_cache *cache)
+{
+	return cache->bytes +
+			(uint64_t)(unsigned)atomic_read(&cache->magazine_pages) * 4096;
+}
+
+static uint64_t bucket_bytes(struct fd_bo_bucket *bucket)
+{
+	return (uint64_t)(bucket->count +
+			atomic_read(&bucket->magazine_count)) * bucket->size;
+}
+
+/* Count @bo in, or out of, the magazine.  Called with mag->lock held */
+static void magazine_inc(struct fd_bo_magazine *mag, struct fd_bo *bo)
+{
+	mag->count++;
+	mag->bytes += bo->size;
+	atomic_inc(&get_bucket(mag->cache, bo->size)->magazine_count);
+	atomic_add(&mag->cache->magazine_pages, bo->size / 4096);
+}
+
+static void magazine_dec(struct fd_bo_magazine *mag, struct fd_bo *bo)
+{
+	mag->count--;
+	mag->bytes -= bo->size;
+	atomic_dec(&get_bucket(mag->cache, bo->size)->magazine_count, 1);
+	atomic_dec(&mag->cache->magazine_pages, bo->size / 4096);
+}
+
+/* Move a bo from it's bucket to @evicted.  Called with cache->lock held */
+static void evict(struct fd_bo_cache *cache, struct fd_bo_bucket *bucket,
+		struct fd_bo *bo, struct list_head *evicted)
+{
+	list_del(&bo->list);
+	list_addtail(&bo->list, evicted);
+	bucket->count--;
+	cache->bytes -= bo->size;
+	cache->evictions++;
+}
+
+/* Likewise for a magazine, called with cache->lock and mag->lock held */
+static void evict_from_magazine(struct fd_bo_cache *cache,
+		struct fd_bo_magazine *mag, struct fd_bo *bo,
+		struct list_head *evicted)
+{
+	list_del(&bo->list);
+	list_addtail(&bo->list, evicted);
+	magazine_dec(mag, bo);
+	cache->evictions++;
+}
+
+/* The order in which to evict: least recently freed first, and out of
+ * bo's freed at the same time, the biggest one first
+ */
+static int evict_before(struct fd_bo *bo, struct fd_bo *other,
+		time_t other_time, uint32_t other_size)
+{
+	if (!other)
+		return TRUE;
+	if (bo->free_time != other_time)
+		return bo->free_time < other_time;
+	return bo->size > other_size;
+}
+
+/* Find the bo of @size (of any size, if zero) in the magazines which is to
+ * be evicted first, if before *@oldest_bo, freed at *@oldest_time (or any,
+ * if NULL).  The bo's owner may take it as soon as its magazine lock is
+ * dropped, so it is only to be compared against with the lock taken
+ * again.  Called with cache->lock held
+ */
+static struct fd_bo_magazine * oldest_in_magazines(struct fd_bo_cache *cache,
+		uint32_t size, struct fd_bo **oldest_bo, time_t *oldest_time)
+{
+	struct fd_bo_magazine *mag, *oldest = NULL;
+	uint32_t oldest_size = *oldest_bo ? (*oldest_bo)->size : 0;
+	struct fd_bo *bo;
+
+	LIST_FOR_EACH_ENTRY(mag, &cache->magazines, node) {
+		pthread_mutex_lock(&mag->lock);
+		LIST_FOR_EACH_ENTRY(bo, &mag->list, list) {
+			if (size && (bo->size != size))
+				continue;
+			if (evict_before(bo, *oldest_bo, *oldest_time, oldest_size)) {
+				oldest = mag;
+				*oldest_bo = bo;
+				*oldest_time = bo->free_time;
+				oldest_size = bo->size;
+			}
+		}
+		pthread_mutex_unlock(&mag->lock);
+	}
+
+	return oldest;
+}
+
+/* Evict @bo from @mag, unless the owner has taken it meanwhile.  Called
+ * with cache->lock held
+ */
+static void evict_from_magazine_if_there(struct fd_bo_cache *cache,
+		struct fd_bo_magazine *mag, struct fd_bo *bo,
+		struct list_head *evicted)
+{
+	struct fd_bo *entry;
+
+	pthread_mutex_lock(&mag->lock);
+	LIST_FOR_EACH_ENTRY(entry, &mag->list, list) {
+		if (entry == bo) {
+			evict_from_magazine(cache, mag, bo, evicted);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mag->lock);
+}
+
+/* Moves older cached buffers to @evicted.  Called with cache->lock held */
+static void
+cleanup_locked(struct fd_bo_cache *cache, time_t time, struct list_head *evicted)
 {
+	struct fd_bo_magazine *mag;
+	struct fd_bo *bo, *tmp;
 	int i;
 
-	if (cache->time == time)
+	if (time && (cache->time == time))
 		return;
 
 	for (i = 0; i < cache->num_buckets; i++) {
 		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct fd_bo *bo;
 
 		while (!LIST_IS_EMPTY(&bucket->list)) {
 			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
@@ -102,61 +268,474 @@ fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
 			if (time && ((time - bo->free_time) <= 1))
 				break;
 
-			list_del(&bo->list);
-			bo_del(bo);
+			evict(cache, bucket, bo, evicted);
+		}
+	}
+
+	/* and likewise for bo's sitting in (possibly idle) threads' magazines: */
+	LIST_FOR_EACH_ENTRY(mag, &cache->magazines, node) {
+		pthread_mutex_lock(&mag->lock);
+		LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &mag->list, list) {
+			if (time && ((time - bo->free_time) <= 1))
+				break;
+			evict_from_magazine(cache, mag, bo, evicted);
 		}
+		pthread_mutex_unlock(&mag->lock);
 	}
 
 	cache->time = time;
 }
 
-static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+/* Evict from the head (least recently freed end) of @bucket, and then from
+ * the magazines, until bo's of its size fit within the per-bucket limit.
+ * Called with cache->lock held
+ */
+static void evict_bucket_to_limit(struct fd_bo_cache *cache,
+		struct fd_bo_bucket *bucket, struct list_head *evicted)
+{
+	if (!cache->max_bucket_bytes)
+		return;
+
+	while (bucket_bytes(bucket) > cache->max_bucket_bytes) {
+		struct fd_bo_magazine *mag;
+		struct fd_bo *bo = NULL;
+		time_t time = 0;
+
+		if (!LIST_IS_EMPTY(&bucket->list)) {
+			bo = LIST_FIRST_ENTRY(&bucket->list, struct fd_bo, list);
+			evict(cache, bucket, bo, evicted);
+			continue;
+		}
+
+		mag = oldest_in_magazines(cache, bucket->size, &bo, &time);
+		if (!mag)
+			break;
+		evict_from_magazine_if_there(cache, mag, bo, evicted);
+	}
+}
+
+/* Evict the least recently freed bo's until the buckets and magazines
+ * hold at most @max_bytes.  Called with cache->lock held
+ */
+static void evict_to_limit(struct fd_bo_cache *cache, uint64_t max_bytes,
+		struct list_head *evicted)
+{
+	while (cache_bytes(cache) > max_bytes) {
+		struct fd_bo_bucket *oldest = NULL;
+		struct fd_bo_magazine *mag;
+		struct fd_bo *bo, *oldest_bo = NULL;
+		time_t oldest_time = 0;
+		int i;
+
+		/* The head of each bucket is it's least recently freed bo.
+		 * Walk from the biggest bucket down, so that out of bo's freed
+		 * at the same time, the biggest one is evicted first:
+		 */
+		for (i = cache->num_buckets - 1; i >= 0; i--) {
+			struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
+
+			if (LIST_IS_EMPTY(&bucket->list))
+				continue;
+
+			bo = LIST_FIRST_ENTRY(&bucket->list, struct fd_bo, list);
+			if (evict_before(bo, oldest_bo, oldest_time,
+					oldest_bo ? oldest_bo->size : 0)) {
+				oldest = bucket;
+				oldest_bo = bo;
+				oldest_time = bo->free_time;
+			}
+		}
+
+		/* threads' magazines may hold older (or as old and bigger)
+		 * bo's still:
+		 */
+		mag = oldest_in_magazines(cache, 0, &oldest_bo, &oldest_time);
+		if (mag)
+			evict_from_magazine_if_there(cache, mag, oldest_bo, evicted);
+		else if (oldest)
+			evict(cache, oldest, oldest_bo, evicted);
+		else
+			break;
+	}
+}
+
+/* Evict until within both the per-bucket and total limits.  Called with
+ * cache->lock held
+ */
+static void evict_to_limits(struct fd_bo_cache *cache,
+		struct list_head *evicted)
 {
 	int i;
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
+	if (cache->max_bucket_bytes)
+		for (i = 0; i < cache->num_buckets; i++)
+			evict_bucket_to_limit(cache, &cache->cache_bucket[i], evicted);
+	if (cache->max_bytes)
+		evict_to_limit(cache, cache->max_bytes, evicted);
+}
+
+/* Is the cache over a limit, after adding a bo to @bucket?  Without the
+ * lock, only a hint
+ */
+static int over_limits(struct fd_bo_cache *cache, struct fd_bo_bucket *bucket)
+{
+	if (cache->max_bucket_bytes &&
+			(bucket_bytes(bucket) > cache->max_bucket_bytes))
+		return TRUE;
+	return cache->max_bytes && (cache_bytes(cache) > cache->max_bytes);
+}
+
+static void free_evicted(struct list_head *evicted)
+{
+	struct fd_bo *bo, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, evicted, list) {
+		list_del(&bo->list);
+		bo_del(bo);
+	}
+}
+
+/* Frees older cached buffers, or all of them if @time is zero */
+drm_private void
+fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+{
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&cache->lock);
+	cleanup_locked(cache, time, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+}
+
+drm_private void
+fd_bo_cache_set_limits(struct fd_bo_cache *cache, uint64_t max_bytes,
+		uint64_t max_bucket_bytes)
+{
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&cache->lock);
+	cache->max_bytes = max_bytes;
+	cache->max_bucket_bytes = max_bucket_bytes;
+	evict_to_limits(cache, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+}
+
+/* Frees everything in the magazines, and then the least recently freed
+ * bo's in the buckets until at most @max_bytes remain
+ */
+drm_private void
+fd_bo_cache_trim(struct fd_bo_cache *cache, uint64_t max_bytes)
+{
+	struct fd_bo_magazine *mag;
+	struct fd_bo *bo, *tmp;
+	struct list_head evicted;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&cache->lock);
+	LIST_FOR_EACH_ENTRY(mag, &cache->magazines, node) {
+		pthread_mutex_lock(&mag->lock);
+		LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &mag->list, list)
+			evict_from_magazine(cache, mag, bo, &evicted);
+		pthread_mutex_unlock(&mag->lock);
+	}
+	evict_to_limit(cache, max_bytes, &evicted);
+	pthread_mutex_unlock(&cache->lock);
+
+	free_evicted(&evicted);
+}
+
+drm_private void
+fd_bo_cache_get_stats(struct fd_bo_cache *cache, struct fd_bo_cache_stats *stats)
+{
+	struct fd_bo_magazine *mag;
+	int i;
+
+	pthread_mutex_lock(&cache->lock);
+	stats->bytes = cache->bytes;
+	stats->count = 0;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	for (i = 0; i < cache->num_buckets; i++)
+		stats->count += cache->cache_bucket[i].count;
+	LIST_FOR_EACH_ENTRY(mag, &cache->magazines, node) {
+		pthread_mutex_lock(&mag->lock);
+		stats->bytes += mag->bytes;
+		stats->count += mag->count;
+		stats->hits += mag->hits;
+		stats->misses += mag->misses;
+		pthread_mutex_unlock(&mag->lock);
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/* Magazines are found through one thread specific key for all caches,
+ * the value of which is the thread's first magazine, linked to the ones
+ * for other caches.  If the key can't be created, everything goes
+ * straight to the buckets.
+ */
+static pthread_once_t magazine_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazine_key;
+static int magazine_key_valid;
+
+/* serializes magazines going away with their thread against their cache
+ * going away:
+ */
+static pthread_mutex_t magazine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_to_buckets(struct fd_bo_cache *cache, struct list_head *list,
+		time_t time);
+
+/* Thread exit: return the bo's in the thread's magazines to the buckets */
+static void magazines_release(void *data)
+{
+	struct fd_bo_magazine *mag = data, *next;
+	struct fd_bo *bo;
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	pthread_mutex_lock(&magazine_lock);
+	for (; mag; mag = next) {
+		struct fd_bo_cache *cache = mag->cache;
+
+		next = mag->next;
+
+		if (cache) {
+			/* unlink the magazine first, evicting from it is done
+			 * with the cache lock held, so once it is off the list
+			 * nothing else can get at it's bo's:
+			 */
+			pthread_mutex_lock(&cache->lock);
+			list_del(&mag->node);
+			cache->hits += mag->hits;
+			cache->misses += mag->misses;
+			pthread_mutex_lock(&mag->lock);
+			LIST_FOR_EACH_ENTRY(bo, &mag->list, list)
+				magazine_dec(mag, bo);
+			pthread_mutex_unlock(&mag->lock);
+			pthread_mutex_unlock(&cache->lock);
+
+			add_to_buckets(cache, &mag->list, time.tv_sec);
+		}
+
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
+	}
+	pthread_mutex_unlock(&magazine_lock);
+}
+
+static void magazine_key_init(void)
+{
+	magazine_key_valid =
+			!pthread_key_create(&magazine_key, magazines_release);
+}
+
+drm_private void
+fd_bo_cache_fini(struct fd_bo_cache *cache)
+{
+	struct fd_bo_magazine *mag, *tmp;
+
+	fd_bo_cache_cleanup(cache, 0);
+
+	/* nothing else can be using the cache at this point, but the
+	 * (now empty) magazines belong to their threads, which free them
+	 * when they exit or next look for a magazine:
 	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
+	pthread_mutex_lock(&magazine_lock);
+	pthread_mutex_lock(&cache->lock);
+	LIST_FOR_EACH_ENTRY_SAFE(mag, tmp, &cache->magazines, node) {
+		list_del(&mag->node);
+		mag->cache = NULL;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	pthread_mutex_unlock(&magazine_lock);
+
+	pthread_mutex_destroy(&cache->lock);
+}
+
+/* Get the calling thread's magazine for @cache, creating it on first use,
+ * or NULL to go straight to the buckets.
+ */
+static struct fd_bo_magazine * get_magazine(struct fd_bo_cache *cache)
+{
+	struct fd_bo_magazine *first, *mag, **prev;
+
+	pthread_once(&magazine_once, magazine_key_init);
+	if (!magazine_key_valid)
+		return NULL;
+
+	first = pthread_getspecific(magazine_key);
+	for (mag = first; mag; mag = mag->next)
+		if (mag->cache == cache)
+			return mag;
+
+	mag = calloc(1, sizeof(*mag));
+	if (!mag)
+		return NULL;
+
+	pthread_mutex_init(&mag->lock, NULL);
+	list_inithead(&mag->list);
+	mag->cache = cache;
+	mag->next = first;
+
+	if (pthread_setspecific(magazine_key, mag)) {
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
+		return NULL;
+	}
+
+	/* free the thread's magazines for caches which have gone away: */
+	pthread_mutex_lock(&magazine_lock);
+	for (prev = &mag->next; *prev; ) {
+		struct fd_bo_magazine *old = *prev;
+
+		if (old->cache) {
+			prev = &old->next;
+			continue;
 		}
+
+		*prev = old->next;
+		pthread_mutex_destroy(&old->lock);
+		free(old);
 	}
+	pthread_mutex_unlock(&magazine_lock);
+
+	pthread_mutex_lock(&cache->lock);
+	list_addtail(&mag->node, &cache->magazines);
+	pthread_mutex_unlock(&cache->lock);
 
-	return NULL;
+	return mag;
 }
 
-static int is_idle(struct fd_bo *bo)
+/* @known_idle: only take a bo which is known to be idle from its fence,
+ * rather than asking the kernel
+ */
+static struct fd_bo *find_in_magazine(struct fd_bo_magazine *mag,
+		uint32_t size, uint32_t flags, int known_idle)
 {
-	return fd_bo_cpu_prep(bo, NULL,
-			DRM_FREEDRENO_PREP_READ |
-			DRM_FREEDRENO_PREP_WRITE |
-			DRM_FREEDRENO_PREP_NOSYNC) == 0;
+	struct fd_bo *bo = NULL, *entry;
+
+	pthread_mutex_lock(&mag->lock);
+	if (flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) {
+		/* MRU, without busy check, see find_in_bucket(): */
+		LIST_FOR_EACH_ENTRY_FROM_REV(entry, mag->list.prev, &mag->list, list) {
+			if (entry->size == size) {
+				bo = entry;
+				break;
+			}
+		}
+	} else {
+		/* bo's in the magazine were freed very recently, so if the
+		 * oldest matching one is still busy, the rest will be too:
+		 */
+		LIST_FOR_EACH_ENTRY(entry, &mag->list, list) {
+			if (entry->size == size) {
+				if (fd_bo_known_idle(entry)) {
+					bo = entry;
+				} else if (!known_idle) {
+					/* ask the kernel without holding the lock,
+					 * which cleaning up the cache takes with
+					 * the cache lock held:
+					 */
+					list_del(&entry->list);
+					magazine_dec(mag, entry);
+					pthread_mutex_unlock(&mag->lock);
+					if (fd_bo_idle(entry)) {
+						pthread_mutex_lock(&mag->lock);
+						mag->hits++;
+						pthread_mutex_unlock(&mag->lock);
+						return entry;
+					}
+					pthread_mutex_lock(&mag->lock);
+					list_add(&entry->list, &mag->list);
+					magazine_inc(mag, entry);
+				}
+				break;
+			}
+		}
+	}
+	if (bo) {
+		list_del(&bo->list);
+		magazine_dec(mag, bo);
+		mag->hits++;
+	}
+	pthread_mutex_unlock(&mag->lock);
+
+	return bo;
 }
 
-static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
+static struct fd_bo *find_in_bucket(struct fd_bo_cache *cache,
+		struct fd_bo_bucket *bucket, uint32_t flags)
 {
-	struct fd_bo *bo = NULL;
+	struct fd_bo *bo = NULL, *entry;
+	unsigned probes = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	if (flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) {
+		/* Like intel, take ALLOC_FOR_RENDER bo's from the list tail
+		 * (MRU, since likely to be in GPU cache) and skip the busy
+		 * check, since if it is only going to be a render target
+		 * then the GPU will serialize against prior usage anyway:
+		 */
+		if (!LIST_IS_EMPTY(&bucket->list))
+			bo = LIST_ENTRY(struct fd_bo, bucket->list.prev, list);
+	} else {
+		/* Otherwise take the least recently freed bo which its fence
+		 * says is idle.  Don't give up on the first busy one, there
+		 * may be idle bo's (ie. ones used on another ring) sitting
+		 * behind it, but only look a few deep:
+		 */
+		LIST_FOR_EACH_ENTRY(entry, &bucket->list, list) {
+			/* TODO check for compatible flags? */
+			if (fd_bo_known_idle(entry)) {
+				bo = entry;
+				break;
+			}
+			if (++probes == BUCKET_PROBES)
+				break;
+		}
+	}
+	if (bo) {
+		list_del(&bo->list);
+		bucket->count--;
+		cache->bytes -= bo->size;
+		cache->hits++;
+	} else if (!(flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER) &&
+			!LIST_IS_EMPTY(&bucket->list)) {
+		/* Failing that, ask the kernel about the least recently freed
+		 * bo, the most likely to be idle.  Take it out of the bucket
+		 * meanwhile, so the ioctl is done without holding the lock:
+		 */
+		entry = LIST_FIRST_ENTRY(&bucket->list, struct fd_bo, list);
+		list_del(&entry->list);
+		bucket->count--;
+		cache->bytes -= entry->size;
+		pthread_mutex_unlock(&cache->lock);
 
-	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
-	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
-	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
-	 */
-	pthread_mutex_lock(&table_lock);
-	if (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			list_del(&bo->list);
+		if (fd_bo_idle(entry))
+			bo = entry;
+
+		pthread_mutex_lock(&cache->lock);
+		if (bo) {
+			list_inithead(&bo->list);
+			cache->hits++;
 		} else {
-			bo = NULL;
+			/* still busy, put it back in front: */
+			list_add(&entry->list, &bucket->list);
+			bucket->count++;
+			cache->bytes += entry->size;
 		}
 	}
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&cache->lock);
 
 	return bo;
 }
@@ -167,56 +746,146 @@ fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t *size, uint32_t flags)
 {
 	struct fd_bo *bo = NULL;
 	struct fd_bo_bucket *bucket;
+	struct fd_bo_magazine *mag;
 
 	*size = ALIGN(*size, 4096);
 	bucket = get_bucket(cache, *size);
+	if (!bucket)
+		return NULL;
 
-	/* see if we can be green and recycle: */
+	*size = bucket->size;
+
+	mag = get_magazine(cache);
+
+	/* see if we can be green and recycle.  Our own magazine is the
+	 * cheapest place to look (no cache lock).  For render targets, where
+	 * we want the MRU bo anyways, it is also the best place.  Otherwise
+	 * its bo's are the most recently freed, and the least likely to be
+	 * idle, so first only take one which its fence says is idle, then
+	 * try the buckets, and only then ask the kernel about the magazine:
+	 */
 retry:
-	if (bucket) {
-		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
-		if (bo) {
-			if (bo->funcs->madvise(bo, TRUE) <= 0) {
-				/* we've lost the backing pages, delete and try again: */
-				pthread_mutex_lock(&table_lock);
-				bo_del(bo);
-				pthread_mutex_unlock(&table_lock);
-				goto retry;
-			}
-			atomic_set(&bo->refcnt, 1);
-			fd_device_ref(bo->dev);
-			return bo;
+	bo = NULL;
+	if (mag)
+		bo = find_in_magazine(mag, bucket->size, flags, TRUE);
+
+	if (!bo)
+		bo = find_in_bucket(cache, bucket, flags);
+
+	if (!bo && mag && !(flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER))
+		bo = find_in_magazine(mag, bucket->size, flags, FALSE);
+
+	if (bo && (bo->funcs->madvise(bo, TRUE) <= 0)) {
+		/* we've lost the backing pages, delete and try again: */
+		bo_del(bo);
+		goto retry;
+	}
+
+	if (!bo) {
+		if (mag) {
+			pthread_mutex_lock(&mag->lock);
+			mag->misses++;
+			pthread_mutex_unlock(&mag->lock);
+		} else {
+			pthread_mutex_lock(&cache->lock);
+			cache->misses++;
+			pthread_mutex_unlock(&cache->lock);
 		}
+		return NULL;
+	}
+
+	atomic_set(&bo->refcnt, 1);
+	fd_device_ref(bo->dev);
+	fd_bo_table_insert(bo);
+
+	return bo;
+}
+
+/* Move bo's from @list into their buckets, and evict what doesn't fit */
+static void add_to_buckets(struct fd_bo_cache *cache, struct list_head *list,
+		time_t time)
+{
+	struct list_head evicted;
+	struct fd_bo *bo, *tmp;
+
+	list_inithead(&evicted);
+
+	pthread_mutex_lock(&cache->lock);
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, list, list) {
+		struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+
+		list_del(&bo->list);
+		list_addtail(&bo->list, &bucket->list);
+		bucket->count++;
+		cache->bytes += bo->size;
 	}
+	evict_to_limits(cache, &evicted);
+	cleanup_locked(cache, time, &evicted);
+	pthread_mutex_unlock(&cache->lock);
 
-	return NULL;
+	free_evicted(&evicted);
 }
 
 drm_private int
 fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
 {
 	struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+	struct fd_bo_magazine *mag;
+	struct fd_device *dev = bo->dev;
+	struct list_head spill;
+	struct timespec time;
 
 	/* see if we can be green and recycle: */
-	if (bucket) {
-		struct timespec time;
+	if (!bucket || (bucket->size != bo->size))
+		return -1;
 
-		bo->funcs->madvise(bo, FALSE);
+	/* don't bother with bo's which would immediately be evicted: */
+	if ((cache->max_bytes && (bo->size > cache->max_bytes)) ||
+			(cache->max_bucket_bytes && (bo->size > cache->max_bucket_bytes)))
+		return -1;
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
+	/* cached bo's are not visible to lookup by handle: */
+	fd_bo_table_remove(bo);
 
-		bo->free_time = time.tv_sec;
-		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
+	/* wherever it ends up, the kernel may take the backing pages of a
+	 * cached bo when memory gets tight:
+	 */
+	bo->funcs->madvise(bo, FALSE);
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	bo->free_time = time.tv_sec;
+
+	list_inithead(&spill);
+
+	mag = get_magazine(cache);
+	if (mag) {
+		pthread_mutex_lock(&mag->lock);
+		list_addtail(&bo->list, &mag->list);
+		magazine_inc(mag, bo);
+		if (mag->count > MAGAZINE_SIZE) {
+			/* spill the older half of the magazine into the buckets: */
+			while (mag->count > MAGAZINE_SIZE / 2) {
+				struct fd_bo *old = LIST_ENTRY(struct fd_bo,
+						mag->list.next, list);
+				list_del(&old->list);
+				list_addtail(&old->list, &spill);
+				magazine_dec(mag, old);
+			}
+		}
+		pthread_mutex_unlock(&mag->lock);
+	} else {
+		list_addtail(&bo->list, &spill);
+	}
 
-		/* bo's in the bucket cache don't have a ref and
-		 * don't hold a ref to the dev:
-		 */
-		fd_device_del_locked(bo->dev);
+	/* the magazine counts against the limits too: */
+	if (!LIST_IS_EMPTY(&spill) || (cache->time != time.tv_sec) ||
+			over_limits(cache, bucket))
+		add_to_buckets(cache, &spill, time.tv_sec);
 
-		return 0;
-	}
+	/* bo's in the bucket cache don't have a ref and
+	 * don't hold a ref to the dev:
+	 */
+	fd_device_del(dev);
 
-	return -1;
+	return 0;
 }
@@ -37,8 +37,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 struct fd_device * kgsl_device_new(int fd);
 struct fd_device * msm_device_new(int fd);
 
@@ -81,13 +79,27 @@ out:
 	if (!dev)
 		return NULL;
 
+	fd_device_init(dev, fd);
+
+	return dev;
+}
+
+/* common initialization, once the backend has created the device: */
+drm_private void fd_device_init(struct fd_device *dev, int fd)
+{
+	int i;
+
 	atomic_set(&dev->refcnt, 1);
 	dev->fd = fd;
-	dev->handle_table = drmHashCreate();
+	dev->ioctl = drmIoctl;
+	for (i = 0; i < FD_TABLE_SHARDS; i++) {
+		pthread_mutex_init(&dev->handle_table[i].lock, NULL);
+		dev->handle_table[i].table = drmHashCreate();
+	}
 	dev->name_table = drmHashCreate();
+	pthread_mutex_init(&dev->share_lock, NULL);
+	pthread_mutex_init(&dev->fence_lock, NULL);
 	fd_bo_cache_init(&dev->bo_cache, FALSE);
-
-	return dev;
 }
 
 /* like fd_device_new() but creates it's own private dup() of the fd
@@ -110,38 +122,49 @@ struct fd_device * fd_device_ref(struct fd_device *dev)
 	return dev;
 }
 
-static void fd_device_del_impl(struct fd_device *dev)
+void fd_device_del(struct fd_device *dev)
 {
-	fd_bo_cache_cleanup(&dev->bo_cache, 0);
-	drmHashDestroy(dev->handle_table);
+	int i;
+
+	if (!atomic_dec_and_test(&dev->refcnt))
+		return;
+
+	fd_bo_cache_fini(&dev->bo_cache);
+	for (i = 0; i < FD_TABLE_SHARDS; i++) {
+		drmHashDestroy(dev->handle_table[i].table);
+		pthread_mutex_destroy(&dev->handle_table[i].lock);
+	}
 	drmHashDestroy(dev->name_table);
+	pthread_mutex_destroy(&dev->share_lock);
+	pthread_mutex_destroy(&dev->fence_lock);
 	if (dev->closefd)
 		close(dev->fd);
 	dev->funcs->destroy(dev);
 }
 
-drm_private void fd_device_del_locked(struct fd_device *dev)
+int fd_device_fd(struct fd_device *dev)
 {
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	fd_device_del_impl(dev);
+	return dev->fd;
 }
 
-void fd_device_del(struct fd_device *dev)
+enum fd_version fd_device_version(struct fd_device *dev)
 {
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	pthread_mutex_lock(&table_lock);
-	fd_device_del_impl(dev);
-	pthread_mutex_unlock(&table_lock);
+	return dev->version;
 }
 
-int fd_device_fd(struct fd_device *dev)
+void fd_device_set_cache_limits(struct fd_device *dev, uint64_t max_bytes,
+		uint64_t max_bucket_bytes)
 {
-	return dev->fd;
+	fd_bo_cache_set_limits(&dev->bo_cache, max_bytes, max_bucket_bytes);
 }
 
-enum fd_version fd_device_version(struct fd_device *dev)
+void fd_device_trim_cache(struct fd_device *dev, uint64_t max_bytes)
 {
-	return dev->version;
+	fd_bo_cache_trim(&dev->bo_cache, max_bytes);
+}
+
+void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats)
+{
+	fd_bo_cache_get_stats(&dev->bo_cache, stats);
 }
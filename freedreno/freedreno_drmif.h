@@ -74,6 +74,10 @@ enum fd_param_id {
 #define DRM_FREEDRENO_GEM_CACHE_WBACKWA   0x00800000
 #define DRM_FREEDRENO_GEM_CACHE_MASK      0x00f00000
 #define DRM_FREEDRENO_GEM_GPUREADONLY     0x01000000
+/* hint that the bo will only be used as a render target, so a recently
+ * freed (but possibly still busy) bo can be recycled from the cache:
+ */
+#define DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER 0x02000000
 
 /* bo access flags: (keep aligned to MSM_PREP_x) */
 #define DRM_FREEDRENO_PREP_READ           0x01
@@ -96,6 +100,30 @@ enum fd_version {
 };
 enum fd_version fd_device_version(struct fd_device *dev);
 
+/* Freed bo's are kept in a cache for reuse.  By default the cache only
+ * evicts bo's which have not been reused for a couple of seconds, but it
+ * can also be limited to a total number of bytes, and/or a number of bytes
+ * per size bucket (zero meaning no limit).  Exceeding a limit evicts the
+ * least recently freed bo's first.
+ */
+struct fd_bo_cache_stats {
+	uint64_t bytes;          /* bytes currently held in the cache */
+	uint32_t count;          /* bo's currently held in the cache */
+	uint64_t hits;           /* allocations served from the cache */
+	uint64_t misses;         /* allocations not served from the cache */
+	uint64_t evictions;      /* bo's freed from the cache */
+};
+
+void fd_device_set_cache_limits(struct fd_device *dev, uint64_t max_bytes,
+		uint64_t max_bucket_bytes);
+/* free cached bo's until at most max_bytes remain, ie. in response to
+ * memory pressure.  Allocating a bo failing for lack of memory frees
+ * all cached bo's and tries again:
+ */
+void fd_device_trim_cache(struct fd_device *dev, uint64_t max_bytes);
+void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats);
+
 /* pipe functions:
  */
 
@@ -107,6 +135,23 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp);
 /* timeout in nanosec */
 int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout);
+/* With async submit enabled, fd_ringbuffer_flush() and flush2() queue the
+ * submit to a per-pipe submit thread and return without waiting for the
+ * kernel.  Submits on a pipe still reach the kernel in the order they were
+ * flushed.  From then on, the timestamps of the pipe's submits are seqno's
+ * of the pipe rather than kernel fences, which are only known once the
+ * thread has done the submit: only fd_pipe_wait() (or fd_bo_cpu_prep() on
+ * a bo of the submit) waits for the thread.  Not supported with kgsl.
+ */
+int fd_pipe_set_async_submit(struct fd_pipe *pipe, int enable);
+/* wait until all queued submits have been handed to the kernel: */
+void fd_pipe_drain_submits(struct fd_pipe *pipe);
+/* With async submit, flush2() returns -1 for the out-fence, which is
+ * taken with this, by the timestamp of the submit, once the submit has
+ * been done.  Returns -1 if there is none (not requested, already taken,
+ * or for one of the submits before the last 64).
+ */
+int fd_pipe_get_fence_fd(struct fd_pipe *pipe, uint32_t timestamp);
 
 
 /* buffer-object functions:
@@ -130,4 +175,31 @@ void * fd_bo_map(struct fd_bo *bo);
 int fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op);
 void fd_bo_cpu_fini(struct fd_bo *bo);
 
+/* sub-allocation functions:
+ *
+ * Small buffers (up to 4KB) are handed out as ranges of larger, shared,
+ * slab bo's, saving GEM objects and submit bo table entries.  Larger
+ * sub-allocations get a bo of their own.  Sub-allocations are aligned to
+ * at least 64 bytes.  A freed sub-allocation is only reused once the GPU
+ * is done with it: fd_suballoc_del() takes the timestamp of the last
+ * submit which used it (see fd_ringbuffer_timestamp()), or zero if it
+ * was never submitted.  slab_size of zero picks a default.
+ */
+
+struct fd_slab_allocator;
+
+struct fd_suballoc {
+	struct fd_bo *bo;        /* backing bo */
+	uint32_t offset;         /* offset of the sub-allocation in bo */
+	uint32_t size;
+};
+
+struct fd_slab_allocator * fd_slab_allocator_new(struct fd_pipe *pipe,
+		uint32_t slab_size, uint32_t flags);
+void fd_slab_allocator_del(struct fd_slab_allocator *slabs);
+struct fd_suballoc * fd_suballoc_new(struct fd_slab_allocator *slabs,
+		uint32_t size);
+void fd_suballoc_del(struct fd_suballoc *sa, uint32_t timestamp);
+void * fd_suballoc_map(struct fd_suballoc *sa);
+
 #endif /* FREEDRENO_DRMIF_H_ */
@@ -70,6 +70,40 @@ int fd_pipe_get_param(struct fd_pipe *pipe,
 	return pipe->funcs->get_param(pipe, param, value);
 }
 
+int fd_pipe_set_async_submit(struct fd_pipe *pipe, int enable)
+{
+	if (!pipe->funcs->set_async_submit)
+		return enable ? -ENOTSUP : 0;
+	return pipe->funcs->set_async_submit(pipe, enable);
+}
+
+void fd_pipe_drain_submits(struct fd_pipe *pipe)
+{
+	if (pipe->funcs->drain_submits)
+		pipe->funcs->drain_submits(pipe);
+}
+
+int fd_pipe_get_fence_fd(struct fd_pipe *pipe, uint32_t timestamp)
+{
+	if (!pipe->funcs->get_fence_fd)
+		return -1;
+	return pipe->funcs->get_fence_fd(pipe, timestamp);
+}
+
+/* the kernel fence of a timestamp of the pipe.  With async submit, that is
+ * only known once the submit thread has done the submit, which this waits
+ * for if @wait, or returns FALSE otherwise:
+ */
+drm_private int fd_pipe_fence(struct fd_pipe *pipe, uint32_t timestamp,
+		int wait, uint32_t *fence)
+{
+	if (!pipe->funcs->fence) {
+		*fence = timestamp;
+		return TRUE;
+	}
+	return pipe->funcs->fence(pipe, timestamp, wait, fence);
+}
+
 int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 {
 	return fd_pipe_wait_timeout(pipe, timestamp, ~0);
@@ -78,5 +112,12 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout)
 {
-	return pipe->funcs->wait(pipe, timestamp, timeout);
+	uint32_t fence;
+	int ret;
+
+	fd_pipe_fence(pipe, timestamp, TRUE, &fence);
+	ret = pipe->funcs->wait(pipe, fence, timeout);
+	if (!ret)
+		fd_fence_retire(pipe->dev, pipe->id, fence);
+	return ret;
 }
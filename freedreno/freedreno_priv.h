@@ -72,13 +72,56 @@ struct fd_device_funcs {
 
 struct fd_bo_bucket {
 	uint32_t size;
+	uint32_t count;
+	atomic_t magazine_count;   /* bo's of this size in magazines */
 	struct list_head list;
 };
 
+/* Small per-thread cache of recently freed bo's, sitting in front of the
+ * shared buckets, so that most alloc/free pairs don't need to take the
+ * cache lock.  The lock is only contended when the cache is cleaned up
+ * or over its limits.  When its thread exits, the magazine's bo's go
+ * back to the buckets.
+ */
+struct fd_bo_magazine {
+	pthread_mutex_t lock;
+	struct fd_bo_cache *cache; /* NULL once the cache is gone */
+	struct fd_bo_magazine *next; /* the thread's magazine for other caches */
+	struct list_head node;     /* entry in fd_bo_cache::magazines */
+	struct list_head list;     /* cached bo's, oldest first */
+	unsigned count;
+	uint64_t bytes;
+	uint64_t hits, misses;
+};
+
 struct fd_bo_cache {
 	struct fd_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
+	int coarse;
 	time_t time;
+
+	/* protects the buckets, and the list of magazines: */
+	pthread_mutex_t lock;
+
+	/* bytes held in the buckets, and pages in the magazines (updated
+	 * without the lock).  The limits (zero for no limit) apply to both
+	 * together:
+	 */
+	uint64_t bytes;
+	atomic_t magazine_pages;
+	uint64_t max_bytes, max_bucket_bytes;
+
+	/* allocations which didn't go via a magazine, and evictions: */
+	uint64_t hits, misses, evictions;
+
+	struct list_head magazines;
+};
+
+#define FD_TABLE_SHARDS 16
+
+struct fd_bo_table {
+	pthread_mutex_t lock;
+	void *table;
 };
 
 struct fd_device {
@@ -94,29 +137,117 @@ struct fd_device {
 	 * We end up needing two tables, because DRM_IOCTL_GEM_OPEN always
 	 * returns a new handle.  So we need to figure out if the bo is already
 	 * open in the process first, before calling gem-open.
+	 *
+	 * The handle table is split into shards (by handle), each with it's
+	 * own lock.  Bo's in the bo cache are not in the handle table.
+	 *
+	 * The name table is only used for shared bo's, and is protected by
+	 * share_lock, which also serializes importing bo's against closing
+	 * shared bo's (since importing could otherwise find a handle which
+	 * is about to be closed).
 	 */
-	void *handle_table, *name_table;
+	struct fd_bo_table handle_table[FD_TABLE_SHARDS];
+	void *name_table;
+	pthread_mutex_t share_lock;
 
 	const struct fd_device_funcs *funcs;
 
 	struct fd_bo_cache bo_cache;
 
+	/* GEM and driver ioctls on the device go through here.  This is
+	 * drmIoctl(), unless replaced after fd_device_init() (ie. with a
+	 * userspace fake of the kernel, for testing):
+	 */
+	int (*ioctl)(int fd, unsigned long request, void *arg);
+
+	/* per pipe, the newest fence known to have completed, so checking
+	 * if a bo is idle (see fd_bo_idle()) is usually just a compare.
+	 * This lives in the device rather than the fd_pipe, since all the
+	 * fd_pipe's with the same id share the kernel's fences:
+	 */
+	atomic_t completed_fence[FD_PIPE_MAX];
+
+	/* protects the fence tracking of the device's bo's (last_fence and
+	 * last_pipe, and whatever the backend tracks alongside), which is
+	 * updated by whichever thread flushes a submit:
+	 */
+	pthread_mutex_t fence_lock;
+
 	int closefd;        /* call close(fd) upon destruction */
 };
 
+static inline int fd_ioctl(struct fd_device *dev, unsigned long request,
+		void *arg)
+{
+	return dev->ioctl(dev->fd, request, arg);
+}
+
+/* like drmCommandWrite()/drmCommandWriteRead(), but dispatched through
+ * dev->ioctl:
+ */
+static inline int fd_command(struct fd_device *dev, unsigned long dir,
+		unsigned long index, void *data, unsigned long size)
+{
+	unsigned long request = DRM_IOC(dir, DRM_IOCTL_BASE,
+			DRM_COMMAND_BASE + index, size);
+	if (fd_ioctl(dev, request, data))
+		return -errno;
+	return 0;
+}
+
+static inline int fd_command_write(struct fd_device *dev,
+		unsigned long index, void *data, unsigned long size)
+{
+	return fd_command(dev, DRM_IOC_WRITE, index, data, size);
+}
+
+static inline int fd_command_write_read(struct fd_device *dev,
+		unsigned long index, void *data, unsigned long size)
+{
+	return fd_command(dev, DRM_IOC_READ|DRM_IOC_WRITE, index, data, size);
+}
+
 drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
+drm_private void fd_bo_cache_fini(struct fd_bo_cache *cache);
 drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
 drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
 drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
+drm_private void fd_bo_cache_set_limits(struct fd_bo_cache *cache,
+		uint64_t max_bytes, uint64_t max_bucket_bytes);
+drm_private void fd_bo_cache_trim(struct fd_bo_cache *cache, uint64_t max_bytes);
+drm_private void fd_bo_cache_get_stats(struct fd_bo_cache *cache,
+		struct fd_bo_cache_stats *stats);
+
+drm_private void fd_device_init(struct fd_device *dev, int fd);
+
+/* add/remove bo to/from the handle table: */
+drm_private void fd_bo_table_insert(struct fd_bo *bo);
+drm_private void fd_bo_table_remove(struct fd_bo *bo);
 
-/* for where @table_lock is already held: */
-drm_private void fd_device_del_locked(struct fd_device *dev);
+/* close and free a bo which is not in the handle table: */
+drm_private void bo_del(struct fd_bo *bo);
+
+/* NOSYNC busy check, which only asks the kernel if the bo's last fence
+ * is not known to have completed:
+ */
+drm_private int fd_bo_idle(struct fd_bo *bo);
+drm_private void fd_fence_retire(struct fd_device *dev, enum fd_pipe_id id,
+		uint32_t fence);
+drm_private int fd_pipe_fence(struct fd_pipe *pipe, uint32_t timestamp,
+		int wait, uint32_t *fence);
 
 struct fd_pipe_funcs {
 	struct fd_ringbuffer * (*ringbuffer_new)(struct fd_pipe *pipe, uint32_t size);
 	int (*get_param)(struct fd_pipe *pipe, enum fd_param_id param, uint64_t *value);
 	int (*wait)(struct fd_pipe *pipe, uint32_t timestamp, uint64_t timeout);
+	/* optional: */
+	int (*set_async_submit)(struct fd_pipe *pipe, int enable);
+	void (*drain_submits)(struct fd_pipe *pipe);
+	/* if timestamps are not (always) kernel fences, see fd_pipe_fence(): */
+	int (*fence)(struct fd_pipe *pipe, uint32_t timestamp, int wait,
+			uint32_t *fence);
+	int (*get_fence_fd)(struct fd_pipe *pipe, uint32_t timestamp);
 	void (*destroy)(struct fd_pipe *pipe);
 };
 
@@ -166,6 +297,101 @@ struct fd_bo {
 	int bo_reuse;
 	struct list_head list;   /* bucket-list entry */
 	time_t free_time;        /* time when added to bucket-list */
+
+	/* the fence of the last submit which used the bo, and the pipe it
+	 * was submitted to.  last_pipe is zero if not known (never submitted,
+	 * or by a backend which doesn't track fences), or FD_PIPE_MAX if the
+	 * bo was used on more than one pipe.  Protected by dev->fence_lock:
+	 */
+	uint32_t last_fence;
+	enum fd_pipe_id last_pipe;
+};
+
+static inline int fd_fence_done(struct fd_device *dev, enum fd_pipe_id id,
+		uint32_t fence)
+{
+	uint32_t completed = atomic_read(&dev->completed_fence[id]);
+	return (int32_t)(fence - completed) <= 0;
+}
+
+/* record that the submit with the given fence used the bo, once the
+ * fence is known.  Called by the backend, while it still holds a
+ * reference to the bo for the submit, with dev->fence_lock held:
+ */
+static inline void fd_bo_set_fence(struct fd_bo *bo, struct fd_pipe *pipe,
+		uint32_t fence)
+{
+	if (bo->last_pipe && (bo->last_pipe != pipe->id)) {
+		bo->last_pipe = FD_PIPE_MAX;
+		return;
+	}
+	bo->last_pipe = pipe->id;
+	bo->last_fence = fence;
+}
+
+/* the pipe and fence of the last submit known to have used the bo, or
+ * zero if not known (see fd_bo::last_pipe):
+ */
+static inline enum fd_pipe_id fd_bo_get_fence(struct fd_bo *bo,
+		uint32_t *fence)
+{
+	enum fd_pipe_id id;
+
+	pthread_mutex_lock(&bo->dev->fence_lock);
+	id = bo->last_pipe;
+	*fence = bo->last_fence;
+	pthread_mutex_unlock(&bo->dev->fence_lock);
+
+	return (id < FD_PIPE_MAX) ? id : 0;
+}
+
+/* is the bo known to be idle, without asking the kernel? */
+static inline int fd_bo_known_idle(struct fd_bo *bo)
+{
+	uint32_t fence;
+	enum fd_pipe_id id = fd_bo_get_fence(bo, &fence);
+
+	return id && fd_fence_done(bo->dev, id, fence);
+}
+
+/*
+ * Slab sub-allocator: sizes up to FD_SLAB_MAX_ORDER are rounded up to a
+ * power of two size class, and carved out of slab bo's of that class.
+ * Larger sizes get a bo of their own.
+ */
+#define FD_SLAB_MIN_ORDER 6       /* 64 bytes */
+#define FD_SLAB_MAX_ORDER 12      /* 4KB */
+#define FD_SLAB_NUM_CLASSES (FD_SLAB_MAX_ORDER - FD_SLAB_MIN_ORDER + 1)
+
+struct fd_slab;
+
+struct fd_slab_entry {
+	struct fd_suballoc base;
+	struct fd_slab *slab;      /* NULL for a bo of its own */
+	struct list_head node;     /* slab's free list, or the reclaim list */
+	uint32_t timestamp;        /* last submit to use the entry, once freed */
+};
+
+struct fd_slab {
+	struct list_head node;     /* class's list of slabs with free entries */
+	struct fd_slab_allocator *slabs;
+	struct fd_bo *bo;
+	unsigned order;
+	unsigned nr_entries, nr_free;
+	struct list_head free_entries;
+	struct fd_slab_entry entries[];
+};
+
+struct fd_slab_allocator {
+	struct fd_pipe *pipe;
+	uint32_t slab_size;
+	uint32_t flags;
+	pthread_mutex_t lock;
+	struct list_head classes[FD_SLAB_NUM_CLASSES];
+	/* freed entries of each class, in the order they were freed, waiting
+	 * for the GPU:
+	 */
+	struct list_head reclaim[FD_SLAB_NUM_CLASSES];
 };
 
 #define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
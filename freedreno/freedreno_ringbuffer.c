@@ -37,7 +37,8 @@
 #include "freedreno_ringbuffer.h"
 
 struct fd_ringbuffer *
-fd_ringbuffer_new(struct fd_pipe *pipe, uint32_t size)
+fd_ringbuffer_new_flags(struct fd_pipe *pipe, uint32_t size,
+		enum fd_ringbuffer_flags flags)
 {
 	struct fd_ringbuffer *ring;
 
@@ -45,6 +46,7 @@ fd_ringbuffer_new(struct fd_pipe *pipe, uint32_t size)
 	if (!ring)
 		return NULL;
 
+	ring->flags = flags;
 	ring->pipe = pipe;
 	ring->start = ring->funcs->hostptr(ring);
 	ring->end = &(ring->start[ring->size/4]);
@@ -54,6 +56,12 @@ fd_ringbuffer_new(struct fd_pipe *pipe, uint32_t size)
 	return ring;
 }
 
+struct fd_ringbuffer *
+fd_ringbuffer_new(struct fd_pipe *pipe, uint32_t size)
+{
+	return fd_ringbuffer_new_flags(pipe, size, 0);
+}
+
 void fd_ringbuffer_del(struct fd_ringbuffer *ring)
 {
 	fd_ringbuffer_reset(ring);
@@ -118,6 +126,19 @@ void fd_ringbuffer_reloc(struct fd_ringbuffer *ring,
 	ring->funcs->emit_reloc(ring, reloc);
 }
 
+void fd_ringbuffer_reloc_suballoc(struct fd_ringbuffer *ring,
+		const struct fd_suballoc *sa, const struct fd_reloc *reloc)
+{
+	struct fd_reloc r = *reloc;
+
+	assert(reloc->offset < sa->size);
+
+	r.bo = sa->bo;
+	r.offset += sa->offset;
+
+	ring->funcs->emit_reloc(ring, &r);
+}
+
 void fd_ringbuffer_emit_reloc_ring(struct fd_ringbuffer *ring,
 		struct fd_ringmarker *target, struct fd_ringmarker *end)
 {
@@ -40,6 +40,18 @@
 struct fd_ringbuffer_funcs;
 struct fd_ringmarker;
 
+enum fd_ringbuffer_flags {
+	/* Ringbuffer is reused for many submits, rather than a new one
+	 * being created for each submit.  Its backing cmd buffers (and
+	 * the tables for the submit ioctl) are recycled across flushes,
+	 * and the references to the bo's used by the last submit are only
+	 * dropped at the next flush, if they are not used again.  A
+	 * growable persistent ringbuffer can continue to be used after a
+	 * flush.
+	 */
+	FD_RINGBUFFER_PERSISTENT = 0x1,
+};
+
 struct fd_ringbuffer {
 	int size;
 	uint32_t *cur, *end, *start, *last_start;
@@ -47,10 +59,13 @@ struct fd_ringbuffer {
 	const struct fd_ringbuffer_funcs *funcs;
 	uint32_t last_timestamp;
 	struct fd_ringbuffer *parent;
+	enum fd_ringbuffer_flags flags;
 };
 
 struct fd_ringbuffer * fd_ringbuffer_new(struct fd_pipe *pipe,
 		uint32_t size);
+struct fd_ringbuffer * fd_ringbuffer_new_flags(struct fd_pipe *pipe,
+		uint32_t size, enum fd_ringbuffer_flags flags);
 void fd_ringbuffer_del(struct fd_ringbuffer *ring);
 void fd_ringbuffer_set_parent(struct fd_ringbuffer *ring,
 		struct fd_ringbuffer *parent);
@@ -58,6 +73,7 @@ void fd_ringbuffer_reset(struct fd_ringbuffer *ring);
 int fd_ringbuffer_flush(struct fd_ringbuffer *ring);
 /* in_fence_fd: -1 for no in-fence, else fence fd
  * out_fence_fd: NULL for no output-fence requested, else ptr to return out-fence
+ *   (with async submit, see fd_pipe_get_fence_fd())
  */
 int fd_ringbuffer_flush2(struct fd_ringbuffer *ring, int in_fence_fd,
 		int *out_fence_fd);
@@ -81,6 +97,11 @@ struct fd_reloc {
 };
 
 void fd_ringbuffer_reloc(struct fd_ringbuffer *ring, const struct fd_reloc *reloc);
+/* like fd_ringbuffer_reloc(), but to a sub-allocation: reloc->bo is
+ * ignored, and reloc->offset is relative to the start of sa:
+ */
+void fd_ringbuffer_reloc_suballoc(struct fd_ringbuffer *ring,
+		const struct fd_suballoc *sa, const struct fd_reloc *reloc);
 will_be_deprecated void fd_ringbuffer_emit_reloc_ring(struct fd_ringbuffer *ring,
 		struct fd_ringmarker *target, struct fd_ringmarker *end);
 uint32_t fd_ringbuffer_cmd_count(struct fd_ringbuffer *ring);
@@ -0,0 +1,290 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <assert.h>
+
+#include "freedreno_drmif.h"
+#include "freedreno_priv.h"
+
+#define DEFAULT_SLAB_SIZE (64 * 1024)
+
+struct fd_slab_allocator *
+fd_slab_allocator_new(struct fd_pipe *pipe, uint32_t slab_size, uint32_t flags)
+{
+	struct fd_slab_allocator *slabs;
+	int i;
+
+	slabs = calloc(1, sizeof(*slabs));
+	if (!slabs) {
+		ERROR_MSG("allocation failed");
+		return NULL;
+	}
+
+	if (!slab_size)
+		slab_size = DEFAULT_SLAB_SIZE;
+
+	slabs->pipe = pipe;
+	/* each slab holds at least one entry of the largest class: */
+	slabs->slab_size = ALIGN(slab_size, 1 << FD_SLAB_MAX_ORDER);
+	slabs->flags = flags;
+	pthread_mutex_init(&slabs->lock, NULL);
+	for (i = 0; i < FD_SLAB_NUM_CLASSES; i++) {
+		list_inithead(&slabs->classes[i]);
+		list_inithead(&slabs->reclaim[i]);
+	}
+
+	return slabs;
+}
+
+static struct fd_slab *
+slab_new(struct fd_slab_allocator *slabs, unsigned order)
+{
+	unsigned i, nr = slabs->slab_size >> order;
+	struct fd_slab *slab;
+
+	slab = calloc(1, sizeof(*slab) + nr * sizeof(slab->entries[0]));
+	if (!slab)
+		return NULL;
+
+	slab->bo = fd_bo_new(slabs->pipe->dev, slabs->slab_size, slabs->flags);
+	if (!slab->bo) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->slabs = slabs;
+	slab->order = order;
+	slab->nr_entries = slab->nr_free = nr;
+	list_inithead(&slab->free_entries);
+
+	for (i = 0; i < nr; i++) {
+		struct fd_slab_entry *entry = &slab->entries[i];
+		entry->base.bo = slab->bo;
+		entry->base.offset = i << order;
+		entry->slab = slab;
+		list_addtail(&entry->node, &slab->free_entries);
+	}
+
+	return slab;
+}
+
+static void
+slab_del(struct fd_slab *slab)
+{
+	list_del(&slab->node);
+	fd_bo_del(slab->bo);
+	free(slab);
+}
+
+/* return an entry to its slab, which must be done with by the GPU: */
+static void
+slab_put_entry(struct fd_slab_allocator *slabs, struct fd_slab_entry *entry)
+{
+	struct fd_slab *slab = entry->slab;
+	struct list_head *head = &slabs->classes[slab->order - FD_SLAB_MIN_ORDER];
+
+	/* reuse the most recently freed entries first, they are likely
+	 * still in the CPU cache:
+	 */
+	list_add(&entry->node, &slab->free_entries);
+
+	if (slab->nr_free++ == 0) {
+		list_add(&slab->node, head);
+	} else if ((slab->nr_free == slab->nr_entries) &&
+			!((head->next == &slab->node) && (head->prev == &slab->node))) {
+		/* keep one empty slab per class around, but no more: */
+		slab_del(slab);
+	}
+}
+
+static int
+entry_idle(struct fd_slab_allocator *slabs, struct fd_slab_entry *entry)
+{
+	struct fd_pipe *pipe = slabs->pipe;
+	uint32_t fence;
+
+	/* with async submit, the submit might not even be with the kernel: */
+	if (!fd_pipe_fence(pipe, entry->timestamp, FALSE, &fence))
+		return FALSE;
+
+	if (fd_fence_done(pipe->dev, pipe->id, fence))
+		return TRUE;
+
+	/* if the slab bo is idle, then so is every submit that used any part
+	 * of it, including the one which last used the entry:
+	 */
+	if (fd_bo_idle(entry->slab->bo)) {
+		fd_fence_retire(pipe->dev, pipe->id, fence);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* move entries of a class which the GPU is done with back to their slabs.
+ * Entries are freed in roughly timestamp order, so the ones freed after a
+ * busy entry are most likely busy as well: stop at the first busy one,
+ * which costs at most one ioctl.  An entry stuck behind one with a later
+ * timestamp is reclaimed once that is done.
+ */
+static void
+reclaim(struct fd_slab_allocator *slabs, unsigned class)
+{
+	struct fd_slab_entry *entry, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(entry, tmp, &slabs->reclaim[class], node) {
+		if (!entry_idle(slabs, entry))
+			break;
+		list_del(&entry->node);
+		slab_put_entry(slabs, entry);
+	}
+}
+
+static struct fd_suballoc *
+bo_suballoc_new(struct fd_slab_allocator *slabs, uint32_t size)
+{
+	struct fd_slab_entry *entry = calloc(1, sizeof(*entry));
+
+	if (!entry)
+		return NULL;
+
+	entry->base.bo = fd_bo_new(slabs->pipe->dev, size, slabs->flags);
+	if (!entry->base.bo) {
+		free(entry);
+		return NULL;
+	}
+	entry->base.size = size;
+
+	return &entry->base;
+}
+
+struct fd_suballoc *
+fd_suballoc_new(struct fd_slab_allocator *slabs, uint32_t size)
+{
+	struct fd_slab_entry *entry = NULL;
+	struct list_head *head;
+	struct fd_slab *slab;
+	unsigned order = FD_SLAB_MIN_ORDER, class;
+
+	if (size > (1 << FD_SLAB_MAX_ORDER))
+		return bo_suballoc_new(slabs, size);
+
+	while ((1u << order) < size)
+		order++;
+
+	class = order - FD_SLAB_MIN_ORDER;
+	head = &slabs->classes[class];
+
+	pthread_mutex_lock(&slabs->lock);
+
+	if (LIST_IS_EMPTY(head))
+		reclaim(slabs, class);
+
+	if (LIST_IS_EMPTY(head)) {
+		slab = slab_new(slabs, order);
+		if (!slab) {
+			ERROR_MSG("slab allocation failed");
+			goto out_unlock;
+		}
+		list_add(&slab->node, head);
+	}
+
+	slab = LIST_FIRST_ENTRY(head, struct fd_slab, node);
+	entry = LIST_FIRST_ENTRY(&slab->free_entries, struct fd_slab_entry, node);
+	list_del(&entry->node);
+	if (--slab->nr_free == 0)
+		list_del(&slab->node);
+
+	entry->base.size = size;
+
+out_unlock:
+	pthread_mutex_unlock(&slabs->lock);
+
+	return entry ? &entry->base : NULL;
+}
+
+void fd_suballoc_del(struct fd_suballoc *sa, uint32_t timestamp)
+{
+	struct fd_slab_entry *entry = (struct fd_slab_entry *)sa;
+	struct fd_slab_allocator *slabs;
+
+	/* a bo of its own goes back to the bo cache, which deals with the
+	 * bo still being busy:
+	 */
+	if (!entry->slab) {
+		fd_bo_del(sa->bo);
+		free(entry);
+		return;
+	}
+
+	slabs = entry->slab->slabs;
+
+	pthread_mutex_lock(&slabs->lock);
+	if (timestamp) {
+		entry->timestamp = timestamp;
+		list_addtail(&entry->node,
+				&slabs->reclaim[entry->slab->order - FD_SLAB_MIN_ORDER]);
+	} else {
+		slab_put_entry(slabs, entry);
+	}
+	pthread_mutex_unlock(&slabs->lock);
+}
+
+void * fd_suballoc_map(struct fd_suballoc *sa)
+{
+	char *map = fd_bo_map(sa->bo);
+	return map ? map + sa->offset : NULL;
+}
+
+/* all sub-allocations must have been freed.  Slab bo's which are still
+ * busy are kept alive by the bo cache.
+ */
+void fd_slab_allocator_del(struct fd_slab_allocator *slabs)
+{
+	struct fd_slab_entry *entry, *tmp_entry;
+	struct fd_slab *slab, *tmp_slab;
+	int i;
+
+	for (i = 0; i < FD_SLAB_NUM_CLASSES; i++) {
+		LIST_FOR_EACH_ENTRY_SAFE(entry, tmp_entry, &slabs->reclaim[i], node) {
+			list_del(&entry->node);
+			slab_put_entry(slabs, entry);
+		}
+	}
+
+	for (i = 0; i < FD_SLAB_NUM_CLASSES; i++) {
+		LIST_FOR_EACH_ENTRY_SAFE(slab, tmp_slab, &slabs->classes[i], node) {
+			assert(slab->nr_free == slab->nr_entries);
+			slab_del(slab);
+		}
+	}
+
+	pthread_mutex_destroy(&slabs->lock);
+	free(slabs);
+}
@@ -45,7 +45,7 @@ static int bo_allocate(struct msm_bo *msm_bo)
 		 * doesn't actually do anything (other than giving us
 		 * the offset)
 		 */
-		ret = drmCommandWriteRead(bo->dev->fd, DRM_MSM_GEM_INFO,
+		ret = fd_command_write_read(bo->dev, DRM_MSM_GEM_INFO,
 				&req, sizeof(req));
 		if (ret) {
 			ERROR_MSG("alloc failed: %s", strerror(errno));
@@ -70,14 +70,29 @@ static int msm_bo_offset(struct fd_bo *bo, uint64_t *offset)
 
 static int msm_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
 {
+	struct msm_bo *msm_bo = to_msm_bo(bo);
 	struct drm_msm_gem_cpu_prep req = {
 			.handle = bo->handle,
 			.op = op,
 	};
+	struct fd_pipe *queued_pipe;
+	uint32_t queued_seqno, fence;
+
+	pthread_mutex_lock(&bo->dev->fence_lock);
+	queued_pipe = msm_bo->queued_pipe;
+	queued_seqno = msm_bo->queued_seqno;
+	pthread_mutex_unlock(&bo->dev->fence_lock);
+
+	/* the kernel only knows the bo is busy once the submit thread has
+	 * done the last submit which uses it:
+	 */
+	if (queued_pipe && !msm_pipe_fence(queued_pipe, queued_seqno,
+			!(op & DRM_FREEDRENO_PREP_NOSYNC), &fence))
+		return -EBUSY;
 
 	get_abs_timeout(&req.timeout, 5000000000);
 
-	return drmCommandWrite(bo->dev->fd, DRM_MSM_GEM_CPU_PREP, &req, sizeof(req));
+	return fd_command_write(bo->dev, DRM_MSM_GEM_CPU_PREP, &req, sizeof(req));
 }
 
 static void msm_bo_cpu_fini(struct fd_bo *bo)
@@ -86,7 +101,7 @@ static void msm_bo_cpu_fini(struct fd_bo *bo)
 			.handle = bo->handle,
 	};
 
-	drmCommandWrite(bo->dev->fd, DRM_MSM_GEM_CPU_FINI, &req, sizeof(req));
+	fd_command_write(bo->dev, DRM_MSM_GEM_CPU_FINI, &req, sizeof(req));
 }
 
 static int msm_bo_madvise(struct fd_bo *bo, int willneed)
@@ -101,7 +116,7 @@ static int msm_bo_madvise(struct fd_bo *bo, int willneed)
 	if (bo->dev->version < FD_VERSION_MADVISE)
 		return willneed;
 
-	ret = drmCommandWriteRead(bo->dev->fd, DRM_MSM_GEM_MADVISE, &req, sizeof(req));
+	ret = fd_command_write_read(bo->dev, DRM_MSM_GEM_MADVISE, &req, sizeof(req));
 	if (ret)
 		return ret;
 
@@ -133,7 +148,7 @@ drm_private int msm_bo_new_handle(struct fd_device *dev,
 	};
 	int ret;
 
-	ret = drmCommandWriteRead(dev->fd, DRM_MSM_GEM_NEW,
+	ret = fd_command_write_read(dev, DRM_MSM_GEM_NEW,
 			&req, sizeof(req));
 	if (ret)
 		return ret;
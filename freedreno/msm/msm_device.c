@@ -39,7 +39,7 @@
 static void msm_device_destroy(struct fd_device *dev)
 {
 	struct msm_device *msm_dev = to_msm_device(dev);
-	fd_bo_cache_cleanup(&msm_dev->ring_cache, 0);
+	fd_bo_cache_fini(&msm_dev->ring_cache);
 	free(msm_dev);
 }
 
@@ -42,7 +42,7 @@ static int query_param(struct fd_pipe *pipe, uint32_t param,
 	};
 	int ret;
 
-	ret = drmCommandWriteRead(pipe->dev->fd, DRM_MSM_GET_PARAM,
+	ret = fd_command_write_read(pipe->dev, DRM_MSM_GET_PARAM,
 			&req, sizeof(req));
 	if (ret)
 		return ret;
@@ -88,7 +88,7 @@ static int msm_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 
 	get_abs_timeout(&req.timeout, timeout);
 
-	ret = drmCommandWrite(dev->fd, DRM_MSM_WAIT_FENCE, &req, sizeof(req));
+	ret = fd_command_write(dev, DRM_MSM_WAIT_FENCE, &req, sizeof(req));
 	if (ret) {
 		ERROR_MSG("wait-fence failed! %d (%s)", ret, strerror(errno));
 		return ret;
@@ -97,9 +97,18 @@ static int msm_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 	return 0;
 }
 
+drm_private int msm_pipe_submit(struct fd_pipe *pipe,
+		struct drm_msm_gem_submit *req)
+{
+	return fd_command_write_read(pipe->dev, DRM_MSM_GEM_SUBMIT,
+			req, sizeof(*req));
+}
+
 static void msm_pipe_destroy(struct fd_pipe *pipe)
 {
 	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	msm_pipe_set_async_submit(pipe, FALSE);
+	msm_pipe_fini_seqnos(pipe);
 	free(msm_pipe);
 }
 
@@ -107,6 +116,10 @@ static const struct fd_pipe_funcs funcs = {
 		.ringbuffer_new = msm_ringbuffer_new,
 		.get_param = msm_pipe_get_param,
 		.wait = msm_pipe_wait,
+		.set_async_submit = msm_pipe_set_async_submit,
+		.drain_submits = msm_pipe_drain_submits,
+		.fence = msm_pipe_fence,
+		.get_fence_fd = msm_pipe_get_fence_fd,
 		.destroy = msm_pipe_destroy,
 };
 
@@ -40,7 +40,6 @@
 struct msm_device {
 	struct fd_device base;
 	struct fd_bo_cache ring_cache;
-	unsigned ring_cnt;
 };
 
 static inline struct msm_device * to_msm_device(struct fd_device *x)
@@ -50,12 +49,89 @@ static inline struct msm_device * to_msm_device(struct fd_device *x)
 
 drm_private struct fd_device * msm_device_new(int fd);
 
+/* A submit queued to the pipe's submit thread.  The job owns everything
+ * the submit ioctl needs (and the references to the bo's in the submit),
+ * so that the ringbuffers can be reused while the job is queued:
+ */
+struct msm_submit_job {
+	struct list_head node;
+	uint32_t seqno;
+	struct drm_msm_gem_submit req;
+	int in_fence_fd;
+	int ret;
+
+	/* tables for the submit ioctl: */
+	struct drm_msm_gem_submit_bo *bos;
+	uint32_t max_bos;
+	struct drm_msm_gem_submit_cmd *cmds;
+	uint32_t max_cmds;
+	struct drm_msm_gem_submit_reloc *relocs;
+	uint32_t nr_relocs, max_relocs;
+
+	struct fd_bo **bo_refs;
+	uint32_t nr_bo_refs, max_bo_refs;
+
+	/* cmd buffers of the flushed ringbuffer, to be freed (or reused, for
+	 * persistent ringbuffers) once the submit has been done:
+	 */
+	struct list_head cmd_list;
+};
+
+struct msm_submit_queue {
+	struct fd_pipe *pipe;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;        /* signaled on new jobs, or to stop */
+	pthread_cond_t done_cond;   /* signaled when a job is done */
+	struct list_head pending, done, free;
+	unsigned nr_pending;
+	int stop;
+};
+
+drm_private struct msm_submit_queue * msm_submit_queue_new(struct fd_pipe *pipe);
+drm_private void msm_submit_queue_del(struct msm_submit_queue *queue);
+drm_private struct msm_submit_job * msm_submit_queue_get_job(
+		struct msm_submit_queue *queue);
+drm_private void msm_submit_queue_put_job(struct msm_submit_queue *queue,
+		struct msm_submit_job *job);
+drm_private uint32_t msm_submit_queue_push(struct msm_submit_queue *queue,
+		struct msm_submit_job *job);
+drm_private void msm_submit_queue_wait(struct msm_submit_queue *queue,
+		uint32_t seqno);
+drm_private void msm_submit_queue_drain(struct msm_submit_queue *queue);
+drm_private struct msm_submit_job * msm_submit_queue_pop_done(
+		struct msm_submit_queue *queue);
+
+/* number of submits whose kernel fence (and out-fence) a pipe keeps: */
+#define MSM_FENCE_WINDOW 64
+
 struct msm_pipe {
 	struct fd_pipe base;
 	uint32_t pipe;
 	uint32_t gpu_id;
 	uint32_t gmem;
 	uint32_t chip_id;
+
+	/* only with async submit enabled: */
+	struct msm_submit_queue *queue;
+
+	/* fence of the last submit, until async submit is first enabled: */
+	uint32_t last_fence;
+
+	/* Once async submit has been enabled, the timestamps of the pipe's
+	 * submits are seqno's of its own, since the kernel fence is only
+	 * known once the submit thread has done the submit.  The fences of
+	 * the last MSM_FENCE_WINDOW submits are kept at seqno % window,
+	 * along with their out-fence until it is taken.  Protected by the
+	 * queue's lock while there is a queue:
+	 */
+	int use_seqnos;
+	uint32_t last_seqno;        /* seqno of the last (queued) submit */
+	uint32_t submitted_seqno;   /* seqno of the last submit done */
+	struct {
+		uint32_t fence;
+		int fence_fd;
+	} fences[MSM_FENCE_WINDOW];
 };
 
 static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
@@ -65,20 +141,39 @@ static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
 
 drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 		enum fd_pipe_id id);
+drm_private int msm_pipe_submit(struct fd_pipe *pipe,
+		struct drm_msm_gem_submit *req);
+drm_private int msm_pipe_set_async_submit(struct fd_pipe *pipe, int enable);
+drm_private void msm_pipe_drain_submits(struct fd_pipe *pipe);
+drm_private uint32_t msm_pipe_add_submitted(struct fd_pipe *pipe,
+		uint32_t fence, int fence_fd);
+drm_private int msm_pipe_fence(struct fd_pipe *pipe, uint32_t timestamp,
+		int wait, uint32_t *fence);
+drm_private int msm_pipe_get_fence_fd(struct fd_pipe *pipe,
+		uint32_t timestamp);
+drm_private void msm_pipe_fini_seqnos(struct fd_pipe *pipe);
 
 drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 		uint32_t size);
+drm_private uint32_t msm_ringbuffer_nr_allocs(struct fd_ringbuffer *ring);
+drm_private void msm_ringbuffer_reclaim_jobs(struct fd_pipe *pipe);
 
 struct msm_bo {
 	struct fd_bo base;
 	uint64_t offset;
 	uint64_t presumed;
-	/* to avoid excess hashtable lookups, cache the ring this bo was
-	 * last emitted on (since that will probably also be the next ring
-	 * it is emitted on)
+	/* to avoid excess hashtable lookups, cache the idx this bo had in
+	 * the submit it was last emitted on (since that will probably also
+	 * be the next submit it is emitted on)
 	 */
-	unsigned current_ring_seqno;
 	uint32_t idx;
+	/* the pipe and seqno of the last async submit of the bo, until the
+	 * job is reclaimed, as the kernel doesn't know about the submit
+	 * (and so about the bo being busy) until the submit thread has
+	 * done it.  Protected by dev->fence_lock:
+	 */
+	struct fd_pipe *queued_pipe;
+	uint32_t queued_seqno;
 };
 
 static inline struct msm_bo * to_msm_bo(struct fd_bo *x)
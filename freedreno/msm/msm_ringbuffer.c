@@ -50,6 +50,12 @@ struct msm_cmd {
 	uint32_t nr_relocs, max_relocs;
 
 	uint32_t size;
+
+	/* the submit this cmd buffer was last added to, and the idx of its
+	 * first entry in that submit's cmds table, so that get_cmd() does
+	 * not have to search the whole table:
+	 */
+	uint32_t seqno, cmd_idx;
 };
 
 struct msm_ringbuffer {
@@ -75,6 +81,13 @@ struct msm_ringbuffer {
 	struct fd_bo **bos;
 	uint32_t nr_bos, max_bos;
 
+	/* for FD_RINGBUFFER_PERSISTENT, the bo's of the previous submit,
+	 * whose references are handed over to the current submit if they
+	 * are used again.  Entries which were handed over are NULL:
+	 */
+	struct fd_bo **retained_bos;
+	uint32_t nr_retained_bos, max_retained_bos;
+
 	/* should have matching entries in submit.cmds: */
 	struct msm_cmd **cmds;
 	uint32_t nr_cmds, max_cmds;
@@ -90,13 +103,31 @@ struct msm_ringbuffer {
 	 */
 	struct list_head cmd_list;
 
+	/* for FD_RINGBUFFER_PERSISTENT, cmd buffers from previous submits,
+	 * oldest first, to be reused once the GPU is done with them:
+	 */
+	struct list_head cmd_pool;
+
 	int is_growable;
 	unsigned cmd_count;
 
-	unsigned seqno;
+	/* number of allocations (of cmd buffers, or to grow tables) since
+	 * the last flush, and in the last flush:
+	 */
+	uint32_t nr_allocs, last_nr_allocs;
 
-	/* maps fd_bo to idx: */
-	void *bo_table;
+	/* identifies the current submit, see msm_cmd::seqno: */
+	uint32_t seqno;
+
+	/* maps fd_bo to idx in bos table.  Open addressed (keyed on bo
+	 * handle), and reused across flushes: entries which don't match
+	 * the current bo_table_gen are empty, so clearing the table after
+	 * a flush is just a matter of bumping the generation.
+	 */
+	struct msm_bo_table_entry {
+		uint32_t gen, idx;
+	} *bo_table;
+	uint32_t bo_table_size, bo_table_gen;
 };
 
 static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
@@ -106,19 +137,36 @@ static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
 
 #define INIT_SIZE 0x1000
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
-drm_private extern pthread_mutex_t table_lock;
+static atomic_t submit_seqno;
+
+/* submit seqno's are unique across rings, so that a target cmd buffer
+ * which is referenced from multiple parent rings is never mistaken as
+ * being already part of another ring's submit:
+ */
+static uint32_t next_seqno(void)
+{
+	uint32_t seqno;
+
+	/* zero is reserved for newly created cmd buffers: */
+	do {
+		seqno = atomic_inc_return(&submit_seqno);
+	} while (seqno == 0);
+
+	return seqno;
+}
 
 static void ring_bo_del(struct fd_device *dev, struct fd_bo *bo)
 {
 	int ret;
 
-	pthread_mutex_lock(&table_lock);
-	ret = fd_bo_cache_free(&to_msm_device(dev)->ring_cache, bo);
-	pthread_mutex_unlock(&table_lock);
-
-	if (ret == 0)
-		return;
+	/* a queued (async) submit can still hold a reference to the bo,
+	 * in which case it cannot go back to the cache:
+	 */
+	if (atomic_read(&bo->refcnt) == 1) {
+		ret = fd_bo_cache_free(&to_msm_device(dev)->ring_cache, bo);
+		if (ret == 0)
+			return;
+	}
 
 	fd_bo_del(bo);
 }
@@ -146,35 +194,63 @@ static void ring_cmd_del(struct msm_cmd *cmd)
 	if (cmd->ring_bo)
 		ring_bo_del(cmd->ring->pipe->dev, cmd->ring_bo);
 	list_del(&cmd->list);
-	to_msm_ringbuffer(cmd->ring)->cmd_count--;
 	free(cmd->relocs);
 	free(cmd);
 }
 
+/* find a cmd buffer of at least the requested size in the pool, which the
+ * GPU is done with.  Submits retire in order, so if the oldest candidate
+ * is still busy, there is no point in checking the rest:
+ */
+static struct msm_cmd * ring_cmd_reuse(struct fd_ringbuffer *ring, uint32_t size)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_cmd *cmd;
+
+	LIST_FOR_EACH_ENTRY(cmd, &msm_ring->cmd_pool, list) {
+		if (fd_bo_size(cmd->ring_bo) < size)
+			continue;
+		if (!fd_bo_idle(cmd->ring_bo))
+			return NULL;
+		list_del(&cmd->list);
+		cmd->nr_relocs = 0;
+		return cmd;
+	}
+
+	return NULL;
+}
+
 static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
-	struct msm_cmd *cmd = calloc(1, sizeof(*cmd));
+	struct msm_cmd *cmd;
 
+	cmd = ring_cmd_reuse(ring, size);
+	if (cmd)
+		goto out;
+
+	cmd = calloc(1, sizeof(*cmd));
 	if (!cmd)
 		return NULL;
 
 	cmd->ring = ring;
 	cmd->ring_bo = ring_bo_new(ring->pipe->dev, size);
-	if (!cmd->ring_bo)
-		goto fail;
+	if (!cmd->ring_bo) {
+		free(cmd);
+		return NULL;
+	}
+
+	msm_ring->nr_allocs++;
 
+out:
 	list_addtail(&cmd->list, &msm_ring->cmd_list);
 	msm_ring->cmd_count++;
 
 	return cmd;
-
-fail:
-	ring_cmd_del(cmd);
-	return NULL;
 }
 
-static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
+static void *grow(struct msm_ringbuffer *msm_ring, void *ptr, uint32_t nr,
+		uint32_t *max, uint32_t sz)
 {
 	if ((nr + 1) > *max) {
 		if ((*max * 2) < (nr + 1))
@@ -182,12 +258,13 @@ static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 		else
 			*max = *max * 2;
 		ptr = realloc(ptr, *max * sz);
+		msm_ring->nr_allocs++;
 	}
 	return ptr;
 }
 
-#define APPEND(x, name) ({ \
-	(x)->name = grow((x)->name, (x)->nr_ ## name, &(x)->max_ ## name, sizeof((x)->name[0])); \
+#define APPEND(msm_ring, x, name) ({ \
+	(x)->name = grow(msm_ring, (x)->name, (x)->nr_ ## name, &(x)->max_ ## name, sizeof((x)->name[0])); \
 	(x)->nr_ ## name ++; \
 })
 
@@ -201,16 +278,91 @@ static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 static uint32_t append_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
-	uint32_t idx;
+	uint32_t idx, hint;
 
-	idx = APPEND(&msm_ring->submit, bos);
-	idx = APPEND(msm_ring, bos);
+	idx = APPEND(msm_ring, &msm_ring->submit, bos);
+	idx = APPEND(msm_ring, msm_ring, bos);
 
 	msm_ring->submit.bos[idx].flags = 0;
 	msm_ring->submit.bos[idx].handle = bo->handle;
 	msm_ring->submit.bos[idx].presumed = to_msm_bo(bo)->presumed;
 
-	msm_ring->bos[idx] = fd_bo_ref(bo);
+	/* msm_bo->idx still is the bo's idx in the previous submit, if it
+	 * was in one, so take over the reference from there if we can:
+	 */
+	hint = to_msm_bo(bo)->idx;
+	if ((hint < msm_ring->nr_retained_bos) &&
+			(msm_ring->retained_bos[hint] == bo)) {
+		msm_ring->retained_bos[hint] = NULL;
+		msm_ring->bos[idx] = bo;
+	} else {
+		msm_ring->bos[idx] = fd_bo_ref(bo);
+	}
+
+	return idx;
+}
+
+static inline uint32_t bo_hash(uint32_t handle)
+{
+	return handle * 2654435761u;
+}
+
+static void bo_table_resize(struct msm_ringbuffer *msm_ring, uint32_t size)
+{
+	struct msm_bo_table_entry *table = calloc(size, sizeof(*table));
+	uint32_t i, j, mask = size - 1;
+
+	/* keep the old table if we cannot grow, it still works, just
+	 * with longer probe sequences:
+	 */
+	if (!table)
+		return;
+
+	msm_ring->nr_allocs++;
+
+	free(msm_ring->bo_table);
+	msm_ring->bo_table = table;
+	msm_ring->bo_table_size = size;
+	msm_ring->bo_table_gen = 1;
+
+	for (i = 0; i < msm_ring->nr_bos; i++) {
+		j = bo_hash(msm_ring->bos[i]->handle) & mask;
+		while (table[j].gen == msm_ring->bo_table_gen)
+			j = (j + 1) & mask;
+		table[j].gen = msm_ring->bo_table_gen;
+		table[j].idx = i;
+	}
+}
+
+static uint32_t bo_table_lookup(struct fd_ringbuffer *ring, struct fd_bo *bo)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_bo_table_entry *entry;
+	uint32_t i, mask, idx;
+
+	if (!msm_ring->bo_table)
+		bo_table_resize(msm_ring, 64);
+
+	mask = msm_ring->bo_table_size - 1;
+	i = bo_hash(bo->handle) & mask;
+
+	for (;;) {
+		entry = &msm_ring->bo_table[i];
+		if (entry->gen != msm_ring->bo_table_gen)
+			break;
+		if (msm_ring->bos[entry->idx] == bo)
+			return entry->idx;
+		i = (i + 1) & mask;
+	}
+
+	/* not found, add it: */
+	idx = append_bo(ring, bo);
+	entry->gen = msm_ring->bo_table_gen;
+	entry->idx = idx;
+
+	/* keep load factor below 1/2: */
+	if ((msm_ring->nr_bos * 2) > msm_ring->bo_table_size)
+		bo_table_resize(msm_ring, msm_ring->bo_table_size * 2);
 
 	return idx;
 }
@@ -221,27 +373,16 @@ static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t fl
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct msm_bo *msm_bo = to_msm_bo(bo);
 	uint32_t idx;
-	pthread_mutex_lock(&idx_lock);
-	if (msm_bo->current_ring_seqno == msm_ring->seqno) {
-		idx = msm_bo->idx;
-	} else {
-		void *val;
-
-		if (!msm_ring->bo_table)
-			msm_ring->bo_table = drmHashCreate();
 
-		if (!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
-			/* found */
-			idx = (uint32_t)(uintptr_t)val;
-		} else {
-			idx = append_bo(ring, bo);
-			val = (void *)(uintptr_t)idx;
-			drmHashInsert(msm_ring->bo_table, bo->handle, val);
-		}
-		msm_bo->current_ring_seqno = msm_ring->seqno;
+	/* msm_bo->idx is only a hint (the bo could be used on multiple
+	 * rings, potentially from different threads), so validate it:
+	 */
+	idx = msm_bo->idx;
+	if ((idx >= msm_ring->nr_bos) || (msm_ring->bos[idx] != bo)) {
+		idx = bo_table_lookup(ring, bo);
 		msm_bo->idx = idx;
 	}
-	pthread_mutex_unlock(&idx_lock);
+
 	if (flags & FD_RELOC_READ)
 		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
 	if (flags & FD_RELOC_WRITE)
@@ -249,13 +390,6 @@ static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t fl
 	return idx;
 }
 
-static int check_cmd_bo(struct fd_ringbuffer *ring,
-		struct drm_msm_gem_submit_cmd *cmd, struct fd_bo *bo)
-{
-	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
-	return msm_ring->submit.bos[cmd->submit_idx].handle == bo->handle;
-}
-
 /* Ensure that submit has corresponding entry in cmds table for the
  * target cmdstream buffer:
  */
@@ -266,20 +400,30 @@ static void get_cmd(struct fd_ringbuffer *ring, struct msm_cmd *target_cmd,
 	struct drm_msm_gem_submit_cmd *cmd;
 	uint32_t i;
 
-	/* figure out if we already have a cmd buf: */
-	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
-		cmd = &msm_ring->submit.cmds[i];
-		if ((cmd->submit_offset == submit_offset) &&
-				(cmd->size == size) &&
-				(cmd->type == type) &&
-				check_cmd_bo(ring, cmd, target_cmd->ring_bo))
-			return;
+	/* figure out if we already have a cmd buf.  If the target was added
+	 * to this submit, its first entry is at cmd_idx, and that is almost
+	 * always the one we want.  Only if the same cmd buffer is used with
+	 * different offsets/sizes do we need to look at the entries after:
+	 */
+	if (target_cmd->seqno == msm_ring->seqno) {
+		for (i = target_cmd->cmd_idx; i < msm_ring->submit.nr_cmds; i++) {
+			cmd = &msm_ring->submit.cmds[i];
+			if ((msm_ring->cmds[i] == target_cmd) &&
+					(cmd->submit_offset == submit_offset) &&
+					(cmd->size == size) &&
+					(cmd->type == type))
+				return;
+		}
 	}
 
 	/* create cmd buf if not: */
-	i = APPEND(&msm_ring->submit, cmds);
-	APPEND(msm_ring, cmds);
+	i = APPEND(msm_ring, &msm_ring->submit, cmds);
+	APPEND(msm_ring, msm_ring, cmds);
 	msm_ring->cmds[i] = target_cmd;
+	if (target_cmd->seqno != msm_ring->seqno) {
+		target_cmd->seqno = msm_ring->seqno;
+		target_cmd->cmd_idx = i;
+	}
 	cmd = &msm_ring->submit.cmds[i];
 	cmd->type = type;
 	cmd->submit_idx = bo2idx(ring, target_cmd->ring_bo, FD_RELOC_READ);
@@ -295,19 +439,23 @@ static void * msm_ringbuffer_hostptr(struct fd_ringbuffer *ring)
 	return fd_bo_map(current_cmd(ring)->ring_bo);
 }
 
+/* reloc's are emitted in order, so they are sorted by submit_offset and
+ * we can binary search for the first one at or after offset:
+ */
 static uint32_t find_next_reloc_idx(struct msm_cmd *msm_cmd,
 		uint32_t start, uint32_t offset)
 {
-	uint32_t i;
+	uint32_t lo = start, hi = msm_cmd->nr_relocs;
 
-	/* a binary search would be more clever.. */
-	for (i = start; i < msm_cmd->nr_relocs; i++) {
-		struct drm_msm_gem_submit_reloc *reloc = &msm_cmd->relocs[i];
-		if (reloc->submit_offset >= offset)
-			return i;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (msm_cmd->relocs[mid].submit_offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	return i;
+	return lo;
 }
 
 static void delete_cmds(struct msm_ringbuffer *msm_ring)
@@ -317,6 +465,41 @@ static void delete_cmds(struct msm_ringbuffer *msm_ring)
 	LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &msm_ring->cmd_list, list) {
 		ring_cmd_del(cmd);
 	}
+	msm_ring->cmd_count = 0;
+}
+
+static void drop_retained_bos(struct msm_ringbuffer *msm_ring)
+{
+	unsigned i;
+
+	for (i = 0; i < msm_ring->nr_retained_bos; i++)
+		if (msm_ring->retained_bos[i])
+			fd_bo_del(msm_ring->retained_bos[i]);
+	msm_ring->nr_retained_bos = 0;
+}
+
+/* start the next submit in a growable persistent ring, with a cmd buffer
+ * from the pool if possible:
+ */
+static void restart_cmds(struct fd_ringbuffer *ring)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_cmd *cmd, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &msm_ring->cmd_list, list) {
+		list_del(&cmd->list);
+		list_addtail(&cmd->list, &msm_ring->cmd_pool);
+	}
+	msm_ring->cmd_count = 0;
+
+	if (!ring_cmd_new(ring, ring->size)) {
+		ERROR_MSG("allocation failed");
+		return;
+	}
+
+	ring->start = fd_bo_map(current_cmd(ring)->ring_bo);
+	ring->end = &(ring->start[ring->size/4]);
+	ring->cur = ring->last_start = ring->start;
 }
 
 static void flush_reset(struct fd_ringbuffer *ring)
@@ -324,10 +507,22 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	unsigned i;
 
-	for (i = 0; i < msm_ring->nr_bos; i++) {
-		struct msm_bo *msm_bo = to_msm_bo(msm_ring->bos[i]);
-		msm_bo->current_ring_seqno = 0;
-		fd_bo_del(&msm_bo->base);
+	if (ring->flags & FD_RINGBUFFER_PERSISTENT) {
+		struct fd_bo **bos = msm_ring->retained_bos;
+		uint32_t max_bos = msm_ring->max_retained_bos;
+
+		/* drop the bo's which were not used again, and keep the
+		 * ones of this submit for the next one:
+		 */
+		drop_retained_bos(msm_ring);
+		msm_ring->retained_bos = msm_ring->bos;
+		msm_ring->nr_retained_bos = msm_ring->nr_bos;
+		msm_ring->max_retained_bos = msm_ring->max_bos;
+		msm_ring->bos = bos;
+		msm_ring->max_bos = max_bos;
+	} else {
+		for (i = 0; i < msm_ring->nr_bos; i++)
+			fd_bo_del(msm_ring->bos[i]);
 	}
 
 	/* for each of the cmd buffers, clear their reloc's: */
@@ -340,14 +535,26 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	msm_ring->submit.nr_bos = 0;
 	msm_ring->nr_cmds = 0;
 	msm_ring->nr_bos = 0;
+	msm_ring->seqno = next_seqno();
 
-	if (msm_ring->bo_table) {
-		drmHashDestroy(msm_ring->bo_table);
-		msm_ring->bo_table = NULL;
+	/* empty the bo table, which only needs actual clearing when the
+	 * generation wraps around:
+	 */
+	if (++msm_ring->bo_table_gen == 0) {
+		if (msm_ring->bo_table)
+			memset(msm_ring->bo_table, 0, msm_ring->bo_table_size *
+					sizeof(msm_ring->bo_table[0]));
+		msm_ring->bo_table_gen = 1;
 	}
 
+	msm_ring->last_nr_allocs = msm_ring->nr_allocs;
+	msm_ring->nr_allocs = 0;
+
 	if (msm_ring->is_growable) {
-		delete_cmds(msm_ring);
+		if (ring->flags & FD_RINGBUFFER_PERSISTENT)
+			restart_cmds(ring);
+		else
+			delete_cmds(msm_ring);
 	} else {
 		/* in old mode, just reset the # of relocs: */
 		current_cmd(ring)->nr_relocs = 0;
@@ -395,6 +602,195 @@ static void dump_submit(struct msm_ringbuffer *msm_ring)
 	}
 }
 
+/* Recycle the jobs which the submit thread is done with, and everything
+ * they were holding on to.  Only done from the application's side, since
+ * it touches ringbuffer state:
+ */
+drm_private void msm_ringbuffer_reclaim_jobs(struct fd_pipe *pipe)
+{
+	struct msm_submit_queue *queue = to_msm_pipe(pipe)->queue;
+	struct msm_submit_job *job;
+	struct msm_cmd *cmd, *tmp;
+	uint32_t i;
+
+	while ((job = msm_submit_queue_pop_done(queue))) {
+		pthread_mutex_lock(&pipe->dev->fence_lock);
+		for (i = 0; i < job->nr_bo_refs; i++) {
+			struct msm_bo *msm_bo = to_msm_bo(job->bo_refs[i]);
+			if ((msm_bo->queued_pipe == pipe) &&
+					(msm_bo->queued_seqno == job->seqno))
+				msm_bo->queued_pipe = NULL;
+			if (!job->ret)
+				fd_bo_set_fence(job->bo_refs[i], pipe, job->req.fence);
+		}
+		pthread_mutex_unlock(&pipe->dev->fence_lock);
+
+		/* not with the fence lock held, which looking for an idle bo
+		 * in the bo cache takes with the cache's locks held:
+		 */
+		for (i = 0; i < job->nr_bo_refs; i++)
+			fd_bo_del(job->bo_refs[i]);
+		job->nr_bo_refs = 0;
+
+		LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &job->cmd_list, list) {
+			if (cmd->ring->flags & FD_RINGBUFFER_PERSISTENT) {
+				list_del(&cmd->list);
+				list_addtail(&cmd->list,
+						&to_msm_ringbuffer(cmd->ring)->cmd_pool);
+			} else {
+				ring_cmd_del(cmd);
+			}
+		}
+
+		if (job->in_fence_fd != -1)
+			close(job->in_fence_fd);
+
+		msm_submit_queue_put_job(queue, job);
+	}
+}
+
+#define SWAP(a, b) do { \
+	__typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; \
+} while (0)
+
+/* Queue the submit to the pipe's submit thread.  The job takes over the
+ * submit's tables (in exchange for the tables of a recycled job), the bo
+ * references and the ring's own cmd buffers.  Reloc's are copied, since
+ * the reloc tables belong to the cmd buffers, which might be target rings
+ * which get reused.
+ */
+static int flush_async(struct fd_ringbuffer *ring, struct msm_submit_job *job,
+		struct drm_msm_gem_submit *req, int *out_fence_fd)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_submit_queue *queue = to_msm_pipe(ring->pipe)->queue;
+	struct msm_cmd *cmd, *tmp;
+	uint32_t i, nr_relocs = 0, seqno;
+
+	/* find the reloc's of each cmd, stashing the idx of the first one
+	 * in cmd->relocs until we know where they go:
+	 */
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
+		struct drm_msm_gem_submit_cmd *submit_cmd = &msm_ring->submit.cmds[i];
+		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
+		uint32_t a = find_next_reloc_idx(msm_cmd, 0, submit_cmd->submit_offset);
+		uint32_t b = find_next_reloc_idx(msm_cmd, a,
+				submit_cmd->submit_offset + submit_cmd->size);
+		submit_cmd->relocs = a;
+		submit_cmd->nr_relocs = (b > a) ? b - a : 0;
+		nr_relocs += submit_cmd->nr_relocs;
+	}
+
+	if (nr_relocs > job->max_relocs) {
+		job->max_relocs = nr_relocs;
+		job->relocs = realloc(job->relocs,
+				job->max_relocs * sizeof(job->relocs[0]));
+		msm_ring->nr_allocs++;
+	}
+
+	job->nr_relocs = 0;
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
+		struct drm_msm_gem_submit_cmd *submit_cmd = &msm_ring->submit.cmds[i];
+		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
+		struct drm_msm_gem_submit_reloc *relocs =
+				&job->relocs[job->nr_relocs];
+
+		memcpy(relocs, &msm_cmd->relocs[submit_cmd->relocs],
+				submit_cmd->nr_relocs * sizeof(*relocs));
+		submit_cmd->relocs = VOID2U64(relocs);
+		job->nr_relocs += submit_cmd->nr_relocs;
+	}
+
+	req->bos = VOID2U64(msm_ring->submit.bos);
+	req->nr_bos = msm_ring->submit.nr_bos;
+	req->cmds = VOID2U64(msm_ring->submit.cmds);
+	req->nr_cmds = msm_ring->submit.nr_cmds;
+	if (job->in_fence_fd != -1)
+		req->fence_fd = job->in_fence_fd;
+	job->req = *req;
+
+	SWAP(job->bos, msm_ring->submit.bos);
+	SWAP(job->max_bos, msm_ring->submit.max_bos);
+	SWAP(job->cmds, msm_ring->submit.cmds);
+	SWAP(job->max_cmds, msm_ring->submit.max_cmds);
+
+	SWAP(job->bo_refs, msm_ring->bos);
+	SWAP(job->max_bo_refs, msm_ring->max_bos);
+	job->nr_bo_refs = msm_ring->nr_bos;
+	msm_ring->nr_bos = 0;
+
+	/* in old mode, the ring keeps using its one cmd buffer: */
+	if (msm_ring->is_growable) {
+		LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &msm_ring->cmd_list, list) {
+			list_del(&cmd->list);
+			list_addtail(&cmd->list, &job->cmd_list);
+		}
+		msm_ring->cmd_count = 0;
+	}
+
+	DEBUG_MSG("queued: nr_cmds=%u, nr_bos=%u", req->nr_cmds, req->nr_bos);
+
+	seqno = msm_submit_queue_push(queue, job);
+
+	/* the job stays ours until reclaimed, the thread only does the ioctl: */
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++)
+		msm_ring->cmds[i]->ring->last_timestamp = seqno;
+
+	pthread_mutex_lock(&ring->pipe->dev->fence_lock);
+	for (i = 0; i < job->nr_bo_refs; i++) {
+		struct msm_bo *msm_bo = to_msm_bo(job->bo_refs[i]);
+		struct fd_pipe *queued_pipe = msm_bo->queued_pipe;
+		uint32_t queued_seqno = msm_bo->queued_seqno, fence;
+
+		/* only one queued submit is tracked per bo, so make sure one
+		 * on another pipe is with the kernel first (rarely the case),
+		 * without holding up others meanwhile:
+		 */
+		if (queued_pipe && (queued_pipe != ring->pipe)) {
+			pthread_mutex_unlock(&ring->pipe->dev->fence_lock);
+			msm_pipe_fence(queued_pipe, queued_seqno, TRUE, &fence);
+			pthread_mutex_lock(&ring->pipe->dev->fence_lock);
+		}
+		msm_bo->queued_pipe = ring->pipe;
+		msm_bo->queued_seqno = seqno;
+	}
+	pthread_mutex_unlock(&ring->pipe->dev->fence_lock);
+
+	/* the out-fence is kept until taken with fd_pipe_get_fence_fd(): */
+	if (out_fence_fd)
+		*out_fence_fd = -1;
+
+	flush_reset(ring);
+
+	return 0;
+}
+
+static struct msm_submit_job * get_job(struct fd_ringbuffer *ring,
+		int in_fence_fd)
+{
+	struct msm_submit_queue *queue = to_msm_pipe(ring->pipe)->queue;
+	struct msm_submit_job *job;
+
+	/* recycle what the submit thread is done with first: */
+	msm_ringbuffer_reclaim_jobs(ring->pipe);
+
+	job = msm_submit_queue_get_job(queue);
+	if (!job)
+		return NULL;
+
+	/* the caller can close the in-fence once we return: */
+	if (in_fence_fd != -1) {
+		job->in_fence_fd = dup(in_fence_fd);
+		if (job->in_fence_fd < 0) {
+			job->in_fence_fd = -1;
+			msm_submit_queue_put_job(queue, job);
+			return NULL;
+		}
+	}
+
+	return job;
+}
+
 static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start,
 		int in_fence_fd, int *out_fence_fd)
 {
@@ -416,6 +812,18 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 
 	finalize_current_cmd(ring, last_start);
 
+	if (to_msm_pipe(ring->pipe)->queue) {
+		struct msm_submit_job *job = get_job(ring, in_fence_fd);
+		if (job)
+			return flush_async(ring, job, &req, out_fence_fd);
+
+		/* if we cannot queue it, submit it directly, but only after
+		 * what is already queued:
+		 */
+		ERROR_MSG("could not queue submit");
+		msm_pipe_drain_submits(ring->pipe);
+	}
+
 	/* needs to be after get_cmd() as that could create bos/cmds table: */
 	req.bos = VOID2U64(msm_ring->submit.bos),
 	req.nr_bos = msm_ring->submit.nr_bos;
@@ -434,20 +842,38 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 
 	DEBUG_MSG("nr_cmds=%u, nr_bos=%u", req.nr_cmds, req.nr_bos);
 
-	ret = drmCommandWriteRead(ring->pipe->dev->fd, DRM_MSM_GEM_SUBMIT,
-			&req, sizeof(req));
+	ret = msm_pipe_submit(ring->pipe, &req);
 	if (ret) {
 		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
 		dump_submit(msm_ring);
-	} else if (!ret) {
+	} else {
+		struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
+		uint32_t timestamp = req.fence;
+
+		/* once async submit has been enabled, timestamps are seqno's,
+		 * and with async submit, out-fences are taken by seqno too:
+		 */
+		if (msm_pipe->use_seqnos) {
+			timestamp = msm_pipe_add_submitted(ring->pipe, req.fence,
+					(out_fence_fd && msm_pipe->queue) ? req.fence_fd : -1);
+		} else {
+			msm_pipe->last_fence = req.fence;
+		}
+
 		/* update timestamp on all rings associated with submit: */
 		for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
 			struct msm_cmd *msm_cmd = msm_ring->cmds[i];
-			msm_cmd->ring->last_timestamp = req.fence;
+			msm_cmd->ring->last_timestamp = timestamp;
 		}
 
+		/* and on all bo's, before flush_reset() can drop them: */
+		pthread_mutex_lock(&ring->pipe->dev->fence_lock);
+		for (i = 0; i < msm_ring->nr_bos; i++)
+			fd_bo_set_fence(msm_ring->bos[i], ring->pipe, req.fence);
+		pthread_mutex_unlock(&ring->pipe->dev->fence_lock);
+
 		if (out_fence_fd) {
-			*out_fence_fd = req.fence_fd;
+			*out_fence_fd = msm_pipe->queue ? -1 : req.fence_fd;
 		}
 	}
 
@@ -475,7 +901,7 @@ static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
 	struct msm_bo *msm_bo = to_msm_bo(r->bo);
 	struct drm_msm_gem_submit_reloc *reloc;
 	struct msm_cmd *cmd = current_cmd(ring);
-	uint32_t idx = APPEND(cmd, relocs);
+	uint32_t idx = APPEND(to_msm_ringbuffer(ring), cmd, relocs);
 	uint32_t addr;
 
 	reloc = &cmd->relocs[idx];
@@ -486,6 +912,10 @@ static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
 	reloc->shift = r->shift;
 	reloc->submit_offset = offset_bytes(ring->cur, ring->start);
 
+	/* find_next_reloc_idx() relies on reloc's being sorted: */
+	assert((idx == 0) ||
+			(cmd->relocs[idx - 1].submit_offset <= reloc->submit_offset));
+
 	addr = msm_bo->presumed;
 	if (r->shift < 0)
 		addr >>= -r->shift;
@@ -534,13 +964,35 @@ static uint32_t msm_ringbuffer_cmd_count(struct fd_ringbuffer *ring)
 	return to_msm_ringbuffer(ring)->cmd_count;
 }
 
+/* for debugging/benchmarking, the number of allocations which building
+ * the last submit needed.  For a persistent ring in steady state, this
+ * should be zero:
+ */
+drm_private uint32_t msm_ringbuffer_nr_allocs(struct fd_ringbuffer *ring)
+{
+	return to_msm_ringbuffer(ring)->last_nr_allocs;
+}
+
 static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_cmd *cmd, *tmp;
+
+	/* queued submits can reference the ring: */
+	msm_pipe_drain_submits(ring->pipe);
 
+	/* tear down like a non-persistent ring, plus what was kept around: */
+	ring->flags &= ~FD_RINGBUFFER_PERSISTENT;
 	flush_reset(ring);
 	delete_cmds(msm_ring);
 
+	drop_retained_bos(msm_ring);
+	LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &msm_ring->cmd_pool, list) {
+		ring_cmd_del(cmd);
+	}
+
+	free(msm_ring->retained_bos);
+	free(msm_ring->bo_table);
 	free(msm_ring->submit.cmds);
 	free(msm_ring->submit.bos);
 	free(msm_ring->bos);
@@ -578,7 +1030,9 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 	}
 
 	list_inithead(&msm_ring->cmd_list);
-	msm_ring->seqno = ++to_msm_device(pipe->dev)->ring_cnt;
+	list_inithead(&msm_ring->cmd_pool);
+	msm_ring->bo_table_gen = 1;
+	msm_ring->seqno = next_seqno();
 
 	ring = &msm_ring->base;
 	ring->funcs = &funcs;
@@ -0,0 +1,406 @@
+/* -*- mode: C; c-file-style: "k&r"; tab-width 4; indent-tabs-mode: t; -*- */
+
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "msm_priv.h"
+
+/*
+ * Asynchronous submit: each pipe with async submit enabled has a thread
+ * which does the submit ioctl for the jobs queued by msm_ringbuffer_flush(),
+ * in the order they were queued.  Jobs which the thread is done with are
+ * put on the done list, and only recycled on the application's side (see
+ * msm_ringbuffer_reclaim_jobs()), so that the thread never touches any
+ * ringbuffer or bo state.
+ *
+ * A queued submit gets a seqno of the pipe's rather than waiting for its
+ * kernel fence, and the thread records the fence of each seqno as it goes
+ * (see msm_pipe::fences), so only waiting on a timestamp or on a bo of a
+ * submit which the thread hasn't got to yet has to wait for the thread.
+ */
+
+/* if the submit thread falls behind, make the application wait rather
+ * than let the queue (and with it latency) grow without bounds:
+ */
+#define MAX_PENDING 8
+
+/* has the submit with this seqno not been done yet? */
+static int seqno_pending(struct msm_pipe *msm_pipe, uint32_t seqno)
+{
+	return (int32_t)(seqno - msm_pipe->submitted_seqno) > 0;
+}
+
+/* record the fence of the next submit done, with the queue's lock held if
+ * there is a queue.  A failed submit has nothing to wait for beyond what
+ * was submitted before it:
+ */
+static void add_submitted(struct msm_pipe *msm_pipe, uint32_t seqno,
+		int ret, uint32_t fence, int fence_fd)
+{
+	uint32_t prev = msm_pipe->fences[(seqno - 1) % MSM_FENCE_WINDOW].fence;
+	uint32_t idx = seqno % MSM_FENCE_WINDOW;
+
+	/* nobody took the out-fence of the submit in the slot before: */
+	if (msm_pipe->fences[idx].fence_fd != -1)
+		close(msm_pipe->fences[idx].fence_fd);
+
+	msm_pipe->fences[idx].fence = ret ? prev : fence;
+	msm_pipe->fences[idx].fence_fd = ret ? -1 : fence_fd;
+	msm_pipe->submitted_seqno = seqno;
+}
+
+static void *submit_thread(void *arg)
+{
+	struct msm_submit_queue *queue = arg;
+	struct msm_submit_job *job;
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		while (LIST_IS_EMPTY(&queue->pending) && !queue->stop)
+			pthread_cond_wait(&queue->cond, &queue->lock);
+
+		if (LIST_IS_EMPTY(&queue->pending))
+			break;
+
+		job = LIST_FIRST_ENTRY(&queue->pending, struct msm_submit_job, node);
+		pthread_mutex_unlock(&queue->lock);
+
+		job->ret = msm_pipe_submit(queue->pipe, &job->req);
+		if (job->ret) {
+			ERROR_MSG("submit failed: %d (%s)", job->ret,
+					strerror(-job->ret));
+		}
+
+		pthread_mutex_lock(&queue->lock);
+		list_del(&job->node);
+		list_addtail(&job->node, &queue->done);
+		queue->nr_pending--;
+		add_submitted(to_msm_pipe(queue->pipe), job->seqno, job->ret,
+				job->req.fence,
+				(job->req.flags & MSM_SUBMIT_FENCE_FD_OUT) ?
+						job->req.fence_fd : -1);
+		pthread_cond_broadcast(&queue->done_cond);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+drm_private struct msm_submit_queue * msm_submit_queue_new(struct fd_pipe *pipe)
+{
+	struct msm_submit_queue *queue = calloc(1, sizeof(*queue));
+
+	if (!queue)
+		return NULL;
+
+	queue->pipe = pipe;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	pthread_cond_init(&queue->done_cond, NULL);
+	list_inithead(&queue->pending);
+	list_inithead(&queue->done);
+	list_inithead(&queue->free);
+
+	if (pthread_create(&queue->thread, NULL, submit_thread, queue)) {
+		ERROR_MSG("could not create submit thread");
+		pthread_cond_destroy(&queue->done_cond);
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->lock);
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+static void job_free(struct msm_submit_job *job)
+{
+	free(job->bos);
+	free(job->cmds);
+	free(job->relocs);
+	free(job->bo_refs);
+	free(job);
+}
+
+/* the queue must be drained, and the done jobs reclaimed: */
+drm_private void msm_submit_queue_del(struct msm_submit_queue *queue)
+{
+	struct msm_submit_job *job, *tmp;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = 1;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	assert(LIST_IS_EMPTY(&queue->pending));
+	assert(LIST_IS_EMPTY(&queue->done));
+
+	LIST_FOR_EACH_ENTRY_SAFE(job, tmp, &queue->free, node)
+		job_free(job);
+
+	pthread_cond_destroy(&queue->done_cond);
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
+/* get an empty job, recycling one (and its tables) if possible: */
+drm_private struct msm_submit_job * msm_submit_queue_get_job(
+		struct msm_submit_queue *queue)
+{
+	struct msm_submit_job *job = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	if (!LIST_IS_EMPTY(&queue->free)) {
+		job = LIST_FIRST_ENTRY(&queue->free, struct msm_submit_job, node);
+		list_del(&job->node);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	if (!job) {
+		job = calloc(1, sizeof(*job));
+		if (!job)
+			return NULL;
+		list_inithead(&job->cmd_list);
+	}
+
+	job->in_fence_fd = -1;
+
+	return job;
+}
+
+drm_private void msm_submit_queue_put_job(struct msm_submit_queue *queue,
+		struct msm_submit_job *job)
+{
+	pthread_mutex_lock(&queue->lock);
+	list_addtail(&job->node, &queue->free);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/* queue a job, returns the seqno to wait for it with: */
+drm_private uint32_t msm_submit_queue_push(struct msm_submit_queue *queue,
+		struct msm_submit_job *job)
+{
+	uint32_t seqno;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->nr_pending >= MAX_PENDING)
+		pthread_cond_wait(&queue->done_cond, &queue->lock);
+	seqno = job->seqno = ++to_msm_pipe(queue->pipe)->last_seqno;
+	list_addtail(&job->node, &queue->pending);
+	queue->nr_pending++;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return seqno;
+}
+
+/* wait until the job with the specified seqno was handed to the kernel: */
+drm_private void msm_submit_queue_wait(struct msm_submit_queue *queue,
+		uint32_t seqno)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (seqno_pending(to_msm_pipe(queue->pipe), seqno))
+		pthread_cond_wait(&queue->done_cond, &queue->lock);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+drm_private void msm_submit_queue_drain(struct msm_submit_queue *queue)
+{
+	uint32_t seqno;
+
+	pthread_mutex_lock(&queue->lock);
+	seqno = to_msm_pipe(queue->pipe)->last_seqno;
+	pthread_mutex_unlock(&queue->lock);
+
+	msm_submit_queue_wait(queue, seqno);
+}
+
+drm_private struct msm_submit_job * msm_submit_queue_pop_done(
+		struct msm_submit_queue *queue)
+{
+	struct msm_submit_job *job = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+	if (!LIST_IS_EMPTY(&queue->done)) {
+		job = LIST_FIRST_ENTRY(&queue->done, struct msm_submit_job, node);
+		list_del(&job->node);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+drm_private int msm_pipe_set_async_submit(struct fd_pipe *pipe, int enable)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+
+	if (!!enable == !!msm_pipe->queue)
+		return 0;
+
+	if (enable) {
+		/* Switch the pipe's timestamps over to seqno's.  The ones
+		 * handed out so far are kernel fences up to last_fence, and
+		 * resolve to last_fence, which is later but not by much:
+		 */
+		if (!msm_pipe->use_seqnos) {
+			unsigned i;
+
+			for (i = 0; i < MSM_FENCE_WINDOW; i++) {
+				msm_pipe->fences[i].fence = msm_pipe->last_fence;
+				msm_pipe->fences[i].fence_fd = -1;
+			}
+			msm_pipe->last_seqno = msm_pipe->last_fence;
+			msm_pipe->submitted_seqno = msm_pipe->last_fence;
+			msm_pipe->use_seqnos = TRUE;
+		}
+
+		msm_pipe->queue = msm_submit_queue_new(pipe);
+		if (!msm_pipe->queue)
+			return -ENOMEM;
+	} else {
+		msm_pipe_drain_submits(pipe);
+		msm_submit_queue_del(msm_pipe->queue);
+		msm_pipe->queue = NULL;
+	}
+
+	return 0;
+}
+
+drm_private void msm_pipe_drain_submits(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+
+	if (!msm_pipe->queue)
+		return;
+
+	msm_submit_queue_drain(msm_pipe->queue);
+	msm_ringbuffer_reclaim_jobs(pipe);
+}
+
+/* a seqno for a submit which was done directly rather than queued: */
+drm_private uint32_t msm_pipe_add_submitted(struct fd_pipe *pipe,
+		uint32_t fence, int fence_fd)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_submit_queue *queue = msm_pipe->queue;
+	uint32_t seqno;
+
+	if (queue)
+		pthread_mutex_lock(&queue->lock);
+	seqno = ++msm_pipe->last_seqno;
+	add_submitted(msm_pipe, seqno, 0, fence, fence_fd);
+	if (queue) {
+		pthread_cond_broadcast(&queue->done_cond);
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	return seqno;
+}
+
+/* Resolve a timestamp of the pipe to the kernel fence, if the submit has
+ * been done, or once it has if @wait.  Returns FALSE if it is still
+ * queued.  Seqno's older than the window resolve to a later fence, which
+ * is only waiting for a bit longer than needed:
+ */
+drm_private int msm_pipe_fence(struct fd_pipe *pipe, uint32_t timestamp,
+		int wait, uint32_t *fence)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_submit_queue *queue = msm_pipe->queue;
+	int ret = TRUE;
+
+	if (!msm_pipe->use_seqnos) {
+		*fence = timestamp;
+		return TRUE;
+	}
+
+	if (queue) {
+		pthread_mutex_lock(&queue->lock);
+		while (wait && seqno_pending(msm_pipe, timestamp))
+			pthread_cond_wait(&queue->done_cond, &queue->lock);
+	}
+
+	if (seqno_pending(msm_pipe, timestamp))
+		ret = FALSE;
+	else
+		*fence = msm_pipe->fences[timestamp % MSM_FENCE_WINDOW].fence;
+
+	if (queue)
+		pthread_mutex_unlock(&queue->lock);
+
+	return ret;
+}
+
+/* take the out-fence of an async submit, once it has been done: */
+drm_private int msm_pipe_get_fence_fd(struct fd_pipe *pipe,
+		uint32_t timestamp)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_submit_queue *queue = msm_pipe->queue;
+	int fence_fd = -1;
+
+	if (!msm_pipe->use_seqnos)
+		return -1;
+
+	if (queue) {
+		pthread_mutex_lock(&queue->lock);
+		while (seqno_pending(msm_pipe, timestamp))
+			pthread_cond_wait(&queue->done_cond, &queue->lock);
+	}
+
+	/* the slot is the submit's, unless a later one has taken it over: */
+	if (!seqno_pending(msm_pipe, timestamp) &&
+			(msm_pipe->submitted_seqno - timestamp) < MSM_FENCE_WINDOW) {
+		uint32_t idx = timestamp % MSM_FENCE_WINDOW;
+		fence_fd = msm_pipe->fences[idx].fence_fd;
+		msm_pipe->fences[idx].fence_fd = -1;
+	}
+
+	if (queue)
+		pthread_mutex_unlock(&queue->lock);
+
+	return fence_fd;
+}
+
+/* close the out-fences which nobody took, async submit must be disabled: */
+drm_private void msm_pipe_fini_seqnos(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	unsigned i;
+
+	if (!msm_pipe->use_seqnos)
+		return;
+
+	for (i = 0; i < MSM_FENCE_WINDOW; i++) {
+		if (msm_pipe->fences[i].fence_fd != -1)
+			close(msm_pipe->fences[i].fence_fd);
+		msm_pipe->fences[i].fence_fd = -1;
+	}
+}
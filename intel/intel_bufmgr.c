@@ -293,6 +293,57 @@ drm_intel_bo_busy(drm_intel_bo *bo)
 	return 0;
 }
 
+/**
+ * Returns 1 if any of the @count buffers in @bo_array is busy.  The
+ * buffers must all come from the same bufmgr.
+ */
+int
+drm_intel_bo_busy_many(drm_intel_bo **bo_array, int count)
+{
+	int i;
+
+	if (count == 0)
+		return 0;
+
+	if (bo_array[0]->bufmgr->bo_busy_many)
+		return bo_array[0]->bufmgr->bo_busy_many(bo_array, count);
+
+	for (i = 0; i < count; i++) {
+		if (drm_intel_bo_busy(bo_array[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Waits for all of the @count buffers in @bo_array to be idle, giving up
+ * after @timeout_ns, or never if it is negative.  The buffers must all
+ * come from the same bufmgr.
+ *
+ * Returns 0 once all are idle, -ETIME on timeout, or another negative
+ * error.  Without support for timed waits, any timeout other than 0
+ * waits forever, as with drm_intel_gem_bo_wait().
+ */
+int
+drm_intel_bo_wait_many(drm_intel_bo **bo_array, int count, int64_t timeout_ns)
+{
+	int i;
+
+	if (count == 0)
+		return 0;
+
+	if (bo_array[0]->bufmgr->bo_wait_many)
+		return bo_array[0]->bufmgr->bo_wait_many(bo_array, count,
+							  timeout_ns);
+
+	if (timeout_ns == 0)
+		return drm_intel_bo_busy_many(bo_array, count) ? -ETIME : 0;
+
+	for (i = 0; i < count; i++)
+		drm_intel_bo_wait_rendering(bo_array[i]);
+	return 0;
+}
+
 int
 drm_intel_bo_madvise(drm_intel_bo *bo, int madv)
 {
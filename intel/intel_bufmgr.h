@@ -34,6 +34,7 @@
 #ifndef INTEL_BUFMGR_H
 #define INTEL_BUFMGR_H
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -163,6 +164,9 @@ int drm_intel_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 			    uint32_t * swizzle_mode);
 int drm_intel_bo_flink(drm_intel_bo *bo, uint32_t * name);
 int drm_intel_bo_busy(drm_intel_bo *bo);
+int drm_intel_bo_busy_many(drm_intel_bo **bo_array, int count);
+int drm_intel_bo_wait_many(drm_intel_bo **bo_array, int count,
+			   int64_t timeout_ns);
 int drm_intel_bo_madvise(drm_intel_bo *bo, int madv);
 int drm_intel_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable);
 int drm_intel_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset);
@@ -178,8 +182,62 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_softpin_va(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+void drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					      uint64_t max_bytes);
+
+/** Counters of the cache of CPU, WC and GTT mappings of BOs. */
+struct drm_intel_gem_vma_stats {
+	/** Mappings held for BOs not currently mapped, and their size. */
+	unsigned long count;
+	uint64_t bytes;
+	/** Map calls that found the mapping already in place. */
+	uint64_t hits;
+	/** Map calls that had to create the mapping. */
+	uint64_t misses;
+	/** Mappings torn down to stay within the cache limits. */
+	uint64_t evictions;
+};
+
+void drm_intel_bufmgr_gem_get_vma_stats(drm_intel_bufmgr *bufmgr,
+					struct drm_intel_gem_vma_stats *stats);
+
+/** Counters of one size bucket of the BO reuse cache. */
+struct drm_intel_gem_bucket_stats {
+	/** Size of the BOs held in this bucket. */
+	unsigned long size;
+	/** BOs currently held, and the bytes they account for. */
+	unsigned long count;
+	uint64_t bytes;
+	/** Allocations served from the bucket. */
+	uint64_t hits;
+	/** Allocations of this size that had to create a new BO. */
+	uint64_t misses;
+	/** Cached BOs found purged by the kernel under memory pressure. */
+	uint64_t purges;
+};
+
+int drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+					 struct drm_intel_gem_bucket_stats *stats,
+					 int max_buckets);
+
+/** Counters of the relocation lists recycled between BOs. */
+struct drm_intel_gem_reloc_stats {
+	/** Lists held for reuse, and their size. */
+	unsigned long count;
+	uint64_t bytes;
+	/** Lists allocated, including to grow one that was full. */
+	uint64_t allocs;
+	/** Lists taken from the ones held for reuse. */
+	uint64_t reuses;
+	/** Most relocations a BO has been freed with, sizing new lists. */
+	unsigned long high_water;
+};
+
+void drm_intel_bufmgr_gem_get_reloc_stats(drm_intel_bufmgr *bufmgr,
+					  struct drm_intel_gem_reloc_stats *stats);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -263,8 +321,51 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+void drm_intel_decode_set_json_output(struct drm_intel_decode *ctx, FILE *out);
 void drm_intel_decode(struct drm_intel_decode *ctx);
 
+/** A decoded packet, as reported to drm_intel_decode_visitor::packet. */
+struct drm_intel_decode_packet {
+	/** GPU address of the packet. */
+	uint32_t offset;
+	/** First DWORD of the packet, holding its type and opcode. */
+	uint32_t header;
+	/** Packet name, such as "3DSTATE_VS", or "UNKNOWN". */
+	const char *name;
+	/** DWORDs the packet was decoded as, including the header. */
+	uint32_t length;
+	/** Packet contents, valid during the callback only. */
+	const uint32_t *data;
+};
+
+/**
+ * Callbacks receiving the decode instead of the text output.  Any of
+ * them may be NULL.  \c field is called for each DWORD as it is decoded,
+ * with a printf-style description the callback can format or ignore;
+ * \c packet follows once the packet is complete.  \c message receives
+ * diagnostics about malformed packets.
+ */
+#if defined(__GNUC__) && (__GNUC__ >= 4)
+#define DRM_INTEL_DECODE_PRINTFLIKE(f, a) __attribute__ ((format(__printf__, f, a)))
+#else
+#define DRM_INTEL_DECODE_PRINTFLIKE(f, a)
+#endif
+
+struct drm_intel_decode_visitor {
+	void (*field)(void *data, uint32_t offset, unsigned int index,
+		      uint32_t value, const char *fmt, va_list va)
+		DRM_INTEL_DECODE_PRINTFLIKE(5, 0);
+	void (*packet)(void *data, const struct drm_intel_decode_packet *packet);
+	void (*message)(void *data, const char *fmt, va_list va)
+		DRM_INTEL_DECODE_PRINTFLIKE(2, 0);
+};
+
+#undef DRM_INTEL_DECODE_PRINTFLIKE
+
+void drm_intel_decode_set_visitor(struct drm_intel_decode *ctx,
+				  const struct drm_intel_decode_visitor *visitor,
+				  void *data);
+
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
 		       uint32_t offset,
 		       uint64_t *result);
@@ -41,6 +41,7 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,6 +62,7 @@
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
+#include "intel_vma_heap.h"
 #include "string.h"
 
 #include "i915_drm.h"
@@ -105,8 +107,32 @@ typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 struct drm_intel_gem_bo_bucket {
 	drmMMListHead head;
 	unsigned long size;
+
+	/* statistics, protected by bufmgr_gem->lock */
+	unsigned long count;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t purges;
+};
+
+/**
+ * Batches submitted to the same context and ring complete in order, so
+ * knowing that one has completed tells the same of all earlier ones.
+ * The slot of a destroyed context is reused by the next new timeline;
+ * batches older than its first one ran on a previous timeline.
+ */
+struct drm_intel_gem_timeline {
+	uint32_t ctx_id;
+	unsigned int ring;
+	bool in_use;
+	/** Serial of the first batch on the timeline */
+	uint64_t first;
+	/** Serial of the last batch known to have completed */
+	uint64_t completed;
 };
 
+#define DRM_INTEL_GEM_MAX_TIMELINES 16
+
 typedef struct _drm_intel_bufmgr_gem {
 	drm_intel_bufmgr bufmgr;
 
@@ -124,6 +150,28 @@ typedef struct _drm_intel_bufmgr_gem {
 	int exec_size;
 	int exec_count;
 
+	/**
+	 * Stamp of the validation list being built; BOs carrying it are
+	 * already on the list (validate_gen) or have had their relocations
+	 * walked (walk_gen).  Bumping it empties the list in O(1).
+	 */
+	uint32_t exec_gen;
+	/** Serial of the last execbuffer, and the timelines they ran on */
+	uint64_t exec_serial;
+	struct drm_intel_gem_timeline timelines[DRM_INTEL_GEM_MAX_TIMELINES];
+	int num_timelines;	/* slots used so far, in use or free */
+
+	/** Explicit stack for walking the relocation tree, reused per exec */
+	struct drm_intel_reloc_walk *walk_stack;
+	int walk_stack_size;
+
+	/** Relocation stores of freed BOs, held for reuse */
+	drmMMListHead reloc_stores;
+	int reloc_store_count;
+	/** Most relocations or softpin targets a BO has been freed with */
+	int reloc_high_water;
+	uint64_t reloc_store_allocs, reloc_store_reuses;
+
 	/** Array of lists of cached gem objects of power-of-two sizes */
 	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
@@ -136,6 +184,11 @@ typedef struct _drm_intel_bufmgr_gem {
 
 	drmMMListHead vma_cache;
 	int vma_count, vma_open, vma_max;
+	uint64_t vma_bytes, vma_max_bytes;
+	uint64_t vma_hits, vma_misses, vma_evictions;
+
+	/** GPU addresses BOs are softpinned at, with softpin_va */
+	struct intel_vma_heap va_heap;
 
 	uint64_t gtt_size;
 	int available_fences;
@@ -149,6 +202,10 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int bo_reuse : 1;
 	unsigned int no_exec : 1;
 	unsigned int has_vebox : 1;
+	unsigned int has_exec_no_reloc : 1;
+	unsigned int has_handle_lut : 1;
+	unsigned int has_wc_mmap : 1;
+	unsigned int softpin_va : 1;
 	bool fenced_relocs;
 
 	struct {
@@ -160,10 +217,31 @@ typedef struct _drm_intel_bufmgr_gem {
 
 #define DRM_INTEL_RELOC_FENCE (1<<0)
 
-typedef struct _drm_intel_reloc_target_info {
+/** Unused relocation stores kept by the bufmgr for reuse */
+#define DRM_INTEL_RELOC_STORE_CACHE 16
+/** Smallest number of entries a relocation store is created with */
+#define DRM_INTEL_RELOC_STORE_MIN 16
+
+/**
+ * Storage for the relocations and softpin targets of a BO, in a single
+ * allocation following this header: the relocation entries passed to
+ * the kernel, the target of each, the softpin targets, and the flags of
+ * each relocation, each array \c capacity entries long.  When the BO is
+ * freed its store goes back to the bufmgr for the next BO to use, so
+ * that a steady stream of batches allocates none.
+ */
+struct drm_intel_reloc_store {
+	/** Link in bufmgr_gem->reloc_stores, while unused */
+	drmMMListHead link;
+	int capacity;
+};
+
+/** A BO whose relocations are being walked, and the next one to visit */
+struct drm_intel_reloc_walk {
 	drm_intel_bo *bo;
-	int flags;
-} drm_intel_reloc_target;
+	int next;
+	int need_fence;
+};
 
 struct _drm_intel_bo_gem {
 	drm_intel_bo bo;
@@ -184,9 +262,12 @@ struct _drm_intel_bo_gem {
 
 	/**
 	 * Index of the buffer within the validation list while preparing a
-	 * batchbuffer execution.
+	 * batchbuffer execution, valid while validate_gen matches
+	 * bufmgr_gem->exec_gen.
 	 */
 	int validate_index;
+	uint32_t validate_gen;
+	uint32_t walk_gen;
 
 	/**
 	 * Current tiling mode
@@ -197,20 +278,22 @@ struct _drm_intel_bo_gem {
 
 	time_t free_time;
 
-	/** Array passed to the DRM containing relocation information. */
-	struct drm_i915_gem_relocation_entry *relocs;
 	/**
-	 * Array of info structs corresponding to relocs[i].target_handle etc
+	 * Store holding the arrays below, NULL until the first relocation
+	 * or softpin target is added.
 	 */
-	drm_intel_reloc_target *reloc_target_info;
+	struct drm_intel_reloc_store *reloc_store;
+	/** Array passed to the DRM containing relocation information. */
+	struct drm_i915_gem_relocation_entry *relocs;
+	/** Target BO and DRM_INTEL_RELOC_* flags of each of relocs */
+	drm_intel_bo **reloc_target_bo;
+	uint8_t *reloc_flags;
 	/** Number of entries in relocs */
 	int reloc_count;
 	/** Array of BOs that are referenced by this buffer and will be softpinned */
 	drm_intel_bo **softpin_target;
 	/** Number softpinned BOs that are referenced by this buffer */
 	int softpin_target_count;
-	/** Maximum amount of softpinned BOs that are referenced by this buffer */
-	int softpin_target_size;
 
 	/** Mapped address for the buffer, saved across map/unmap cycles */
 	void *mem_virtual;
@@ -261,6 +344,15 @@ struct _drm_intel_bo_gem {
 	 */
 	bool idle;
 
+	/**
+	 * Serial of the last execbuffer the buffer was part of, and the
+	 * index of the timeline it ran on.  The timeline is -1 when the
+	 * buffer was submitted to several since it was last known idle, in
+	 * which case only the kernel can tell when it is.
+	 */
+	uint64_t last_exec;
+	int timeline;
+
 	/**
 	 * Boolean of whether this buffer was allocated with userptr
 	 */
@@ -280,6 +372,12 @@ struct _drm_intel_bo_gem {
 	 */
 	bool is_softpin;
 
+	/**
+	 * Address range the buffer is softpinned at, when it was assigned
+	 * by the bufmgr rather than the user.
+	 */
+	struct intel_vma_block *va;
+
 	/**
 	 * Size in bytes of this buffer and its relocation descendents.
 	 *
@@ -407,21 +505,44 @@ drm_intel_gem_bo_tile_pitch(drm_intel_bufmgr_gem *bufmgr_gem,
 	return i;
 }
 
+static inline int
+fls_long(unsigned long v)
+{
+	return v ? (int)(sizeof(v) * 8) - __builtin_clzl(v) : 0;
+}
+
+/**
+ * Returns the smallest bucket holding BOs of at least @size bytes.
+ *
+ * init_cache_buckets() lays the buckets out as 4K, 8K and 12K, then four
+ * per power of two from 16K on, at 1, 1.25, 1.5 and 1.75 times the
+ * power.  So the index follows from the highest bit of the size and the
+ * quarter above it that the size falls in.
+ */
 static struct drm_intel_gem_bo_bucket *
 drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
 				 unsigned long size)
 {
-	int i;
+	unsigned long pow2;
+	int order, i;
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
+	if (size <= 16384) {
+		i = size ? (size - 1) / 4096 : 0;
+	} else {
+		/* size lies in (pow2, 2 * pow2] */
+		order = fls_long(size - 1) - 1;
+		pow2 = 1UL << order;
+		i = 3 + 4 * (order - 14) +
+			((size - pow2 + (pow2 >> 2) - 1) >> (order - 2));
 	}
 
-	return NULL;
+	if (i >= bufmgr_gem->num_buckets)
+		return NULL;
+
+	assert(bufmgr_gem->cache_bucket[i].size >= size);
+	assert(i == 0 || bufmgr_gem->cache_bucket[i - 1].size < size);
+
+	return &bufmgr_gem->cache_bucket[i];
 }
 
 static void
@@ -433,7 +554,7 @@ drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
 		drm_intel_bo *bo = bufmgr_gem->exec_bos[i];
 		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-		if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL) {
+		if (bo_gem->reloc_store == NULL) {
 			DBG("%2d: %d %s(%s)\n", i, bo_gem->gem_handle,
 			    bo_gem->is_softpin ? "*" : "",
 			    bo_gem->name);
@@ -441,7 +562,7 @@ drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
 		}
 
 		for (j = 0; j < bo_gem->reloc_count; j++) {
-			drm_intel_bo *target_bo = bo_gem->reloc_target_info[j].bo;
+			drm_intel_bo *target_bo = bo_gem->reloc_target_bo[j];
 			drm_intel_bo_gem *target_gem =
 			    (drm_intel_bo_gem *) target_bo;
 
@@ -501,7 +622,7 @@ drm_intel_add_validate_buffer(drm_intel_bo *bo)
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int index;
 
-	if (bo_gem->validate_index != -1)
+	if (bo_gem->validate_gen == bufmgr_gem->exec_gen)
 		return;
 
 	/* Extend the array of validation entries as necessary. */
@@ -522,6 +643,7 @@ drm_intel_add_validate_buffer(drm_intel_bo *bo)
 
 	index = bufmgr_gem->exec_count;
 	bo_gem->validate_index = index;
+	bo_gem->validate_gen = bufmgr_gem->exec_gen;
 	/* Fill in array entry */
 	bufmgr_gem->exec_objects[index].handle = bo_gem->gem_handle;
 	bufmgr_gem->exec_objects[index].relocation_count = bo_gem->reloc_count;
@@ -547,7 +669,7 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	if (bo_gem->is_softpin)
 		flags |= EXEC_OBJECT_PINNED;
 
-	if (bo_gem->validate_index != -1) {
+	if (bo_gem->validate_gen == bufmgr_gem->exec_gen) {
 		bufmgr_gem->exec2_objects[bo_gem->validate_index].flags |= flags;
 		return;
 	}
@@ -570,12 +692,15 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 
 	index = bufmgr_gem->exec_count;
 	bo_gem->validate_index = index;
+	bo_gem->validate_gen = bufmgr_gem->exec_gen;
 	/* Fill in array entry */
 	bufmgr_gem->exec2_objects[index].handle = bo_gem->gem_handle;
 	bufmgr_gem->exec2_objects[index].relocation_count = bo_gem->reloc_count;
 	bufmgr_gem->exec2_objects[index].relocs_ptr = (uintptr_t)bo_gem->relocs;
 	bufmgr_gem->exec2_objects[index].alignment = bo->align;
-	bufmgr_gem->exec2_objects[index].offset = bo_gem->is_softpin ?
+	/* I915_EXEC_NO_RELOC compares this with where the BO ends up */
+	bufmgr_gem->exec2_objects[index].offset =
+		bo_gem->is_softpin || bufmgr_gem->has_exec_no_reloc ?
 		bo->offset64 : 0;
 	bufmgr_gem->exec_bos[index] = bo;
 	bufmgr_gem->exec2_objects[index].flags = flags;
@@ -624,33 +749,312 @@ drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
 	bo_gem->reloc_tree_size = size + alignment;
 }
 
+static size_t
+drm_intel_reloc_store_size(int capacity)
+{
+	return ALIGN(sizeof(struct drm_intel_reloc_store), 8) +
+		capacity * (sizeof(struct drm_i915_gem_relocation_entry) +
+			    2 * sizeof(drm_intel_bo *) + sizeof(uint8_t));
+}
+
+static void
+drm_intel_gem_bo_attach_reloc_store(drm_intel_bo_gem *bo_gem,
+				    struct drm_intel_reloc_store *store)
+{
+	char *arrays = (char *)store +
+		ALIGN(sizeof(struct drm_intel_reloc_store), 8);
+
+	bo_gem->reloc_store = store;
+	bo_gem->relocs = (struct drm_i915_gem_relocation_entry *)arrays;
+	bo_gem->reloc_target_bo = (drm_intel_bo **)(bo_gem->relocs +
+						    store->capacity);
+	bo_gem->softpin_target = bo_gem->reloc_target_bo + store->capacity;
+	bo_gem->reloc_flags = (uint8_t *)(bo_gem->softpin_target +
+					  store->capacity);
+}
+
+/**
+ * Returns a store of at least @capacity entries: the smallest one held
+ * for reuse that is large enough, or a new one.
+ */
+static struct drm_intel_reloc_store *
+drm_intel_gem_get_reloc_store_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				     int capacity)
+{
+	struct drm_intel_reloc_store *store, *best = NULL;
+
+	DRMLISTFOREACHENTRY(store, &bufmgr_gem->reloc_stores, link) {
+		if (store->capacity >= capacity &&
+		    (best == NULL || store->capacity < best->capacity))
+			best = store;
+	}
+
+	if (best) {
+		DRMLISTDEL(&best->link);
+		bufmgr_gem->reloc_store_count--;
+		bufmgr_gem->reloc_store_reuses++;
+		return best;
+	}
+
+	store = malloc(drm_intel_reloc_store_size(capacity));
+	if (store == NULL)
+		return NULL;
+
+	store->capacity = capacity;
+	bufmgr_gem->reloc_store_allocs++;
+	return store;
+}
+
+/** Holds on to @store for reuse, dropping the smallest one if full. */
+static void
+drm_intel_gem_put_reloc_store_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				     struct drm_intel_reloc_store *store)
+{
+	if (bufmgr_gem->reloc_store_count == DRM_INTEL_RELOC_STORE_CACHE) {
+		struct drm_intel_reloc_store *iter, *smallest = store;
+
+		DRMLISTFOREACHENTRY(iter, &bufmgr_gem->reloc_stores, link) {
+			if (iter->capacity < smallest->capacity)
+				smallest = iter;
+		}
+
+		if (smallest == store) {
+			free(store);
+			return;
+		}
+
+		DRMLISTDEL(&smallest->link);
+		free(smallest);
+		bufmgr_gem->reloc_store_count--;
+	}
+
+	DRMLISTADD(&store->link, &bufmgr_gem->reloc_stores);
+	bufmgr_gem->reloc_store_count++;
+}
+
+/**
+ * Makes room for @count relocations, and as many softpin targets, in
+ * the store of @bo_gem.  A BO's first store is sized for as many as
+ * any BO freed so far had, as far as they fit in the BO; stores are
+ * doubled when full.
+ */
 static int
-drm_intel_setup_reloc_list(drm_intel_bo *bo)
+drm_intel_gem_bo_reserve_relocs(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo_gem *bo_gem, int count)
 {
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
-	unsigned int max_relocs = bufmgr_gem->max_relocs;
+	struct drm_intel_reloc_store *old = bo_gem->reloc_store, *store;
+	struct drm_i915_gem_relocation_entry *relocs = bo_gem->relocs;
+	drm_intel_bo **reloc_target_bo = bo_gem->reloc_target_bo;
+	drm_intel_bo **softpin_target = bo_gem->softpin_target;
+	uint8_t *reloc_flags = bo_gem->reloc_flags;
+	int capacity;
+
+	if (old && count <= old->capacity)
+		return 0;
 
-	if (bo->size / 4 < max_relocs)
-		max_relocs = bo->size / 4;
+	pthread_mutex_lock(&bufmgr_gem->lock);
 
-	bo_gem->relocs = malloc(max_relocs *
-				sizeof(struct drm_i915_gem_relocation_entry));
-	bo_gem->reloc_target_info = malloc(max_relocs *
-					   sizeof(drm_intel_reloc_target));
-	if (bo_gem->relocs == NULL || bo_gem->reloc_target_info == NULL) {
+	if (old) {
+		capacity = old->capacity * 2;
+	} else {
+		capacity = bufmgr_gem->reloc_high_water;
+		if ((unsigned long)capacity > bo_gem->bo.size / 4)
+			capacity = bo_gem->bo.size / 4;
+		if (capacity < DRM_INTEL_RELOC_STORE_MIN)
+			capacity = DRM_INTEL_RELOC_STORE_MIN;
+	}
+	if (capacity < count)
+		capacity = count;
+
+	store = drm_intel_gem_get_reloc_store_locked(bufmgr_gem, capacity);
+	if (store == NULL) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
 		bo_gem->has_error = true;
+		return -ENOMEM;
+	}
+
+	drm_intel_gem_bo_attach_reloc_store(bo_gem, store);
+	if (old) {
+		memcpy(bo_gem->relocs, relocs,
+		       bo_gem->reloc_count * sizeof(*relocs));
+		memcpy(bo_gem->reloc_target_bo, reloc_target_bo,
+		       bo_gem->reloc_count * sizeof(*reloc_target_bo));
+		memcpy(bo_gem->reloc_flags, reloc_flags,
+		       bo_gem->reloc_count * sizeof(*reloc_flags));
+		memcpy(bo_gem->softpin_target, softpin_target,
+		       bo_gem->softpin_target_count * sizeof(*softpin_target));
+		drm_intel_gem_put_reloc_store_locked(bufmgr_gem, old);
+	}
+
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return 0;
+}
+
+/**
+ * Hands the store of @bo_gem back to the bufmgr, noting how much of it
+ * was used to size the next ones.
+ */
+static void
+drm_intel_gem_bo_release_reloc_store_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+					    drm_intel_bo_gem *bo_gem)
+{
+	int used = MAX2(bo_gem->reloc_count, bo_gem->softpin_target_count);
 
-		free (bo_gem->relocs);
-		bo_gem->relocs = NULL;
+	if (bo_gem->reloc_store == NULL)
+		return;
 
-		free (bo_gem->reloc_target_info);
-		bo_gem->reloc_target_info = NULL;
+	if (bufmgr_gem->reloc_high_water < used)
+		bufmgr_gem->reloc_high_water = used;
 
-		return 1;
+	drm_intel_gem_put_reloc_store_locked(bufmgr_gem, bo_gem->reloc_store);
+	bo_gem->reloc_store = NULL;
+	bo_gem->relocs = NULL;
+	bo_gem->reloc_target_bo = NULL;
+	bo_gem->reloc_flags = NULL;
+	bo_gem->softpin_target = NULL;
+}
+
+/**
+ * The timeline of the buffer's last execbuffer, or -1 if that was on
+ * several, or its slot has been reused by another timeline since.
+ */
+static int
+drm_intel_gem_bo_timeline_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				 drm_intel_bo_gem *bo_gem)
+{
+	if (bo_gem->timeline < 0 ||
+	    bo_gem->last_exec < bufmgr_gem->timelines[bo_gem->timeline].first)
+		return -1;
+
+	return bo_gem->timeline;
+}
+
+/**
+ * Whether the buffer is known to be idle without asking the kernel:
+ * either it was found idle since its last execbuffer, or a later batch
+ * on the same timeline was.  Only valid for buffers we don't share,
+ * as others may be busy in other processes.
+ */
+static bool
+drm_intel_gem_bo_known_idle_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				   drm_intel_bo_gem *bo_gem)
+{
+	int timeline;
+
+	if (!bo_gem->reusable)
+		return false;
+
+	if (bo_gem->idle || bo_gem->last_exec == 0)
+		return true;
+
+	timeline = drm_intel_gem_bo_timeline_locked(bufmgr_gem, bo_gem);
+	return timeline >= 0 &&
+	       bo_gem->last_exec <= bufmgr_gem->timelines[timeline].completed;
+}
+
+/**
+ * Records that the kernel found the buffer idle, as of its execbuffer
+ * @serial on @timeline, which were sampled before asking.
+ */
+static void
+drm_intel_gem_bo_mark_idle_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				  drm_intel_bo_gem *bo_gem,
+				  uint64_t serial, int timeline)
+{
+	/* not if it was submitted again meanwhile */
+	if (bo_gem->last_exec == serial)
+		bo_gem->idle = true;
+
+	/* nor for the timeline which reused the slot meanwhile */
+	if (timeline >= 0 &&
+	    bufmgr_gem->timelines[timeline].first <= serial &&
+	    bufmgr_gem->timelines[timeline].completed < serial)
+		bufmgr_gem->timelines[timeline].completed = serial;
+}
+
+/**
+ * Finds the timeline of (@ctx_id, @ring), or starts it with the
+ * execbuffer @serial in a free slot.
+ */
+static int
+drm_intel_gem_timeline_lookup_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				     uint32_t ctx_id, unsigned int ring,
+				     uint64_t serial)
+{
+	struct drm_intel_gem_timeline *tl;
+	int i, free_slot = -1;
+
+	for (i = 0; i < bufmgr_gem->num_timelines; i++) {
+		tl = &bufmgr_gem->timelines[i];
+		if (!tl->in_use) {
+			if (free_slot < 0)
+				free_slot = i;
+		} else if (tl->ctx_id == ctx_id && tl->ring == ring) {
+			return i;
+		}
 	}
 
-	return 0;
+	if (free_slot < 0) {
+		/* out of slots, buffers on further timelines are always
+		 * queried, until a context is destroyed
+		 */
+		if (i == DRM_INTEL_GEM_MAX_TIMELINES)
+			return -1;
+		free_slot = bufmgr_gem->num_timelines++;
+	}
+
+	tl = &bufmgr_gem->timelines[free_slot];
+	tl->ctx_id = ctx_id;
+	tl->ring = ring;
+	tl->in_use = true;
+	tl->first = serial;
+	tl->completed = 0;
+	return free_slot;
+}
+
+/**
+ * Frees the slots of the timelines of @ctx_id.  Its id may be reused by
+ * the kernel for a new context, whose batches are not ordered against
+ * those of the old one.
+ */
+static void
+drm_intel_gem_timelines_release_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				       uint32_t ctx_id)
+{
+	int i;
+
+	for (i = 0; i < bufmgr_gem->num_timelines; i++) {
+		if (bufmgr_gem->timelines[i].ctx_id == ctx_id)
+			bufmgr_gem->timelines[i].in_use = false;
+	}
+}
+
+/**
+ * Stamps the buffers of the validation list with the serial of the
+ * execbuffer just submitted on (@ctx_id, @ring).
+ */
+static void
+drm_intel_gem_mark_exec_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+			       uint32_t ctx_id, unsigned int ring)
+{
+	uint64_t serial = ++bufmgr_gem->exec_serial;
+	int timeline, i;
+
+	timeline = drm_intel_gem_timeline_lookup_locked(bufmgr_gem,
+							ctx_id, ring, serial);
+
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+
+		if (!drm_intel_gem_bo_known_idle_locked(bufmgr_gem, bo_gem) &&
+		    drm_intel_gem_bo_timeline_locked(bufmgr_gem,
+						     bo_gem) != timeline)
+			bo_gem->timeline = -1;
+		else
+			bo_gem->timeline = timeline;
+		bo_gem->last_exec = serial;
+	}
 }
 
 static int
@@ -659,17 +1063,33 @@ drm_intel_gem_bo_busy(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_busy busy;
-	int ret;
+	uint64_t serial;
+	int timeline, ret;
 
 	if (bo_gem->reusable && bo_gem->idle)
 		return false;
 
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (drm_intel_gem_bo_known_idle_locked(bufmgr_gem, bo_gem)) {
+		bo_gem->idle = true;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return false;
+	}
+	serial = bo_gem->last_exec;
+	timeline = bo_gem->timeline;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
 	memclear(busy);
 	busy.handle = bo_gem->gem_handle;
 
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_BUSY, &busy);
 	if (ret == 0) {
-		bo_gem->idle = !busy.busy;
+		if (!busy.busy) {
+			pthread_mutex_lock(&bufmgr_gem->lock);
+			drm_intel_gem_bo_mark_idle_locked(bufmgr_gem, bo_gem,
+							  serial, timeline);
+			pthread_mutex_unlock(&bufmgr_gem->lock);
+		}
 		return busy.busy;
 	} else {
 		return false;
@@ -716,10 +1136,56 @@ drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 			break;
 
 		DRMLISTDEL(&bo_gem->head);
+		bucket->count--;
+		bucket->purges++;
 		drm_intel_gem_bo_free(&bo_gem->bo);
 	}
 }
 
+/**
+ * Softpins the BO at an address from the bufmgr's heap, once
+ * drm_intel_bufmgr_gem_enable_softpin_va() has been called, so that it
+ * never needs relocating.  BOs keep their address while in the cache.
+ * Should the heap run out, the BO is left to relocations as usual.
+ */
+static void
+drm_intel_gem_bo_assign_va_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				  drm_intel_bo_gem *bo_gem,
+				  unsigned int alignment)
+{
+	uint64_t align = alignment > 4096 ? alignment : 4096;
+
+	if (!bufmgr_gem->softpin_va)
+		return;
+
+	if (bo_gem->va && (bo_gem->va->offset & (align - 1))) {
+		intel_vma_heap_free(&bufmgr_gem->va_heap, bo_gem->va);
+		bo_gem->va = NULL;
+		bo_gem->is_softpin = false;
+	}
+
+	if (!bo_gem->va) {
+		/* softpinned by the user */
+		if (bo_gem->is_softpin)
+			return;
+
+		bo_gem->va = intel_vma_heap_alloc(&bufmgr_gem->va_heap,
+						  ALIGN(bo_gem->bo.size, 4096),
+						  align);
+		if (!bo_gem->va) {
+			DBG("bo_assign_va: out of address space for %d (%s)\n",
+			    bo_gem->gem_handle, bo_gem->name);
+			return;
+		}
+
+		bo_gem->is_softpin = true;
+		bo_gem->bo.offset64 = bo_gem->va->offset;
+		bo_gem->bo.offset = bo_gem->va->offset;
+	}
+
+	bo_gem->use_48b_address_range = true;
+}
+
 static drm_intel_bo *
 drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 				const char *name,
@@ -755,8 +1221,12 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 		bo_size = bucket->size;
 	}
 
+	/* Get a buffer out of the cache if available.  The lock only
+	 * covers taking the BO off the bucket list: once off the list it is
+	 * ours, and the busy, madvise and tiling ioctls are done unlocked
+	 * so they do not serialize allocations from other threads.
+	 */
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Get a buffer out of the cache if available */
 retry:
 	alloc_from_cache = false;
 	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
@@ -767,9 +1237,6 @@ retry:
 			 */
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
-			alloc_from_cache = true;
-			bo_gem->bo.align = alignment;
 		} else {
 			assert(alignment == 0);
 			/* For non-render-target BOs (where we're probably
@@ -781,36 +1248,55 @@ retry:
 			 */
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
 		}
+		DRMLISTDEL(&bo_gem->head);
+		bucket->count--;
+		bucket->hits++;
+		alloc_from_cache = true;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-		if (alloc_from_cache) {
-			if (!drm_intel_gem_bo_madvise_internal
-			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
-								    bucket);
-				goto retry;
-			}
+	if (alloc_from_cache && !for_render &&
+	    drm_intel_gem_bo_busy(&bo_gem->bo)) {
+		/* Still busy: put it back where it was for the next
+		 * allocation to check.
+		 */
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		DRMLISTADD(&bo_gem->head, &bucket->head);
+		bucket->count++;
+		bucket->hits--;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		alloc_from_cache = false;
+	}
 
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
+	if (alloc_from_cache) {
+		bo_gem->bo.align = alignment;
+
+		if (!drm_intel_gem_bo_madvise_internal
+		    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
+			pthread_mutex_lock(&bufmgr_gem->lock);
+			bucket->hits--;
+			bucket->purges++;
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem,
+							    bucket);
+			goto retry;
 		}
-	}
 
-	if (!alloc_from_cache) {
+		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride)) {
+			pthread_mutex_lock(&bufmgr_gem->lock);
+			bucket->hits--;
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			goto retry;
+		}
+	} else {
 		struct drm_i915_gem_create create;
 
 		bo_gem = calloc(1, sizeof(*bo_gem));
 		if (!bo_gem)
-			goto err;
+			return NULL;
 
 		/* drm_intel_gem_bo_free calls DRMLISTDEL() for an uninitialized
 		   list (vma_list), so better set the list head here */
@@ -826,7 +1312,7 @@ retry:
 			       &create);
 		if (ret != 0) {
 			free(bo_gem);
-			goto err;
+			return NULL;
 		}
 
 		bo_gem->gem_handle = create.handle;
@@ -838,14 +1324,21 @@ retry:
 		bo_gem->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
 		bo_gem->stride = 0;
 
+		/* Publish the handle before anything else can fail, so that
+		 * the error path below can free the BO as any other.
+		 */
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		HASH_ADD(handle_hh, bufmgr_gem->handle_table,
+			 gem_handle, sizeof(bo_gem->gem_handle),
+			 bo_gem);
+		if (bucket != NULL)
+			bucket->misses++;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
 		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
 							 tiling_mode,
 							 stride))
 			goto err_free;
-
-		HASH_ADD(handle_hh, bufmgr_gem->handle_table,
-			 gem_handle, sizeof(bo_gem->gem_handle),
-			 bo_gem);
 	}
 
 	bo_gem->name = name;
@@ -857,8 +1350,13 @@ retry:
 	bo_gem->reusable = true;
 	bo_gem->use_48b_address_range = false;
 
+	if (bufmgr_gem->softpin_va) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_assign_va_locked(bufmgr_gem, bo_gem, alignment);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
@@ -866,8 +1364,8 @@ retry:
 	return &bo_gem->bo;
 
 err_free:
+	pthread_mutex_lock(&bufmgr_gem->lock);
 	drm_intel_gem_bo_free(&bo_gem->bo);
-err:
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 	return NULL;
 }
@@ -1015,6 +1513,7 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	bo_gem->has_error = false;
 	bo_gem->reusable = false;
 	bo_gem->use_48b_address_range = false;
+	drm_intel_gem_bo_assign_va_locked(bufmgr_gem, bo_gem, 0);
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -1163,6 +1662,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 	bo_gem->global_name = handle;
 	bo_gem->reusable = false;
 	bo_gem->use_48b_address_range = false;
+	drm_intel_gem_bo_assign_va_locked(bufmgr_gem, bo_gem, 0);
 
 	HASH_ADD(handle_hh, bufmgr_gem->handle_table,
 		 gem_handle, sizeof(bo_gem->gem_handle), bo_gem);
@@ -1206,21 +1706,30 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
 		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes -= bo_gem->bo.size;
 	}
 	if (bo_gem->wc_virtual) {
 		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
 		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes -= bo_gem->bo.size;
 	}
 	if (bo_gem->gtt_virtual) {
 		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_bytes -= bo_gem->bo.size;
 	}
 
 	if (bo_gem->global_name)
 		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
 	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
 
+	/* The kernel evicts the object should the address be reused while
+	 * it is still active.
+	 */
+	if (bo_gem->va)
+		intel_vma_heap_free(&bufmgr_gem->va_heap, bo_gem->va);
+
 	/* Close this object */
 	memclear(close);
 	close.handle = bo_gem->gem_handle;
@@ -1271,6 +1780,7 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 				break;
 
 			DRMLISTDEL(&bo_gem->head);
+			bucket->count--;
 
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
@@ -1279,22 +1789,42 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 	bufmgr_gem->time = time;
 }
 
+/** Number of mappings of the BO, each accounted for in the VMA cache */
+static int drm_intel_gem_bo_vma_mappings(drm_intel_bo_gem *bo_gem)
+{
+	return !!bo_gem->mem_virtual + !!bo_gem->wc_virtual +
+		!!bo_gem->gtt_virtual;
+}
+
+/**
+ * Unmaps the least recently used mappings of BOs not currently mapped,
+ * until both the count limit (leaving room for the open ones) and the
+ * byte budget of the VMA cache are met.
+ */
 static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 {
 	int limit;
 
-	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
-	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
+	DBG("%s: cached=%d (%llu bytes), open=%d, limit=%d (%llu bytes)\n",
+	    __FUNCTION__, bufmgr_gem->vma_count,
+	    (unsigned long long)bufmgr_gem->vma_bytes, bufmgr_gem->vma_open,
+	    bufmgr_gem->vma_max,
+	    (unsigned long long)bufmgr_gem->vma_max_bytes);
 
-	if (bufmgr_gem->vma_max < 0)
+	if (bufmgr_gem->vma_max < 0 && bufmgr_gem->vma_max_bytes == 0)
 		return;
 
 	/* We may need to evict a few entries in order to create new mmaps */
-	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
+	if (bufmgr_gem->vma_max < 0)
+		limit = INT_MAX;
+	else
+		limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
 	if (limit < 0)
 		limit = 0;
 
-	while (bufmgr_gem->vma_count > limit) {
+	while (bufmgr_gem->vma_count > limit ||
+	       (bufmgr_gem->vma_max_bytes &&
+		bufmgr_gem->vma_bytes > bufmgr_gem->vma_max_bytes)) {
 		drm_intel_bo_gem *bo_gem;
 
 		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
@@ -1307,16 +1837,22 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
 			bo_gem->mem_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes -= bo_gem->bo.size;
+			bufmgr_gem->vma_evictions++;
 		}
 		if (bo_gem->wc_virtual) {
 			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
 			bo_gem->wc_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes -= bo_gem->bo.size;
+			bufmgr_gem->vma_evictions++;
 		}
 		if (bo_gem->gtt_virtual) {
 			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 			bo_gem->gtt_virtual = NULL;
 			bufmgr_gem->vma_count--;
+			bufmgr_gem->vma_bytes -= bo_gem->bo.size;
+			bufmgr_gem->vma_evictions++;
 		}
 	}
 }
@@ -1324,28 +1860,24 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				       drm_intel_bo_gem *bo_gem)
 {
+	int n = drm_intel_gem_bo_vma_mappings(bo_gem);
+
 	bufmgr_gem->vma_open--;
 	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
-		bufmgr_gem->vma_count++;
+	bufmgr_gem->vma_count += n;
+	bufmgr_gem->vma_bytes += n * bo_gem->bo.size;
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
 static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				      drm_intel_bo_gem *bo_gem)
 {
+	int n = drm_intel_gem_bo_vma_mappings(bo_gem);
+
 	bufmgr_gem->vma_open++;
 	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
-		bufmgr_gem->vma_count--;
+	bufmgr_gem->vma_count -= n;
+	bufmgr_gem->vma_bytes -= n * bo_gem->bo.size;
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
@@ -1359,15 +1891,16 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 
 	/* Unreference all the target buffers */
 	for (i = 0; i < bo_gem->reloc_count; i++) {
-		if (bo_gem->reloc_target_info[i].bo != bo) {
+		if (bo_gem->reloc_target_bo[i] != bo) {
 			drm_intel_gem_bo_unreference_locked_timed(bo_gem->
-								  reloc_target_info[i].bo,
+								  reloc_target_bo[i],
 								  time);
 		}
 	}
 	for (i = 0; i < bo_gem->softpin_target_count; i++)
 		drm_intel_gem_bo_unreference_locked_timed(bo_gem->softpin_target[i],
 								  time);
+	drm_intel_gem_bo_release_reloc_store_locked(bufmgr_gem, bo_gem);
 	bo_gem->reloc_count = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->softpin_target_count = 0;
@@ -1375,21 +1908,6 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	DBG("bo_unreference final: %d (%s)\n",
 	    bo_gem->gem_handle, bo_gem->name);
 
-	/* release memory associated with this object */
-	if (bo_gem->reloc_target_info) {
-		free(bo_gem->reloc_target_info);
-		bo_gem->reloc_target_info = NULL;
-	}
-	if (bo_gem->relocs) {
-		free(bo_gem->relocs);
-		bo_gem->relocs = NULL;
-	}
-	if (bo_gem->softpin_target) {
-		free(bo_gem->softpin_target);
-		bo_gem->softpin_target = NULL;
-		bo_gem->softpin_target_size = 0;
-	}
-
 	/* Clear any left-over mappings */
 	if (bo_gem->map_count) {
 		DBG("bo freed with non-zero map-count %d\n", bo_gem->map_count);
@@ -1409,6 +1927,7 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		bo_gem->validate_index = -1;
 
 		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		bucket->count++;
 	} else {
 		drm_intel_gem_bo_free(bo);
 	}
@@ -1448,6 +1967,44 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 	}
 }
 
+/**
+ * Creates the CPU mapping of the BO, or its WC mapping, which the VMA
+ * cache then keeps around across map/unmap cycles.  The caller holds the
+ * lock, and a map_count on the BO.
+ */
+static void *
+drm_intel_gem_bo_mmap_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+			     drm_intel_bo_gem *bo_gem, bool wc)
+{
+	struct drm_i915_gem_mmap mmap_arg;
+	void *ptr;
+
+	bufmgr_gem->vma_misses++;
+
+	memclear(mmap_arg);
+	mmap_arg.handle = bo_gem->gem_handle;
+	mmap_arg.size = bo_gem->bo.size;
+	if (wc)
+		mmap_arg.flags = I915_MMAP_WC;
+	if (drmIoctl(bufmgr_gem->fd,
+		     DRM_IOCTL_I915_GEM_MMAP,
+		     &mmap_arg)) {
+		DBG("%s:%d: Error mapping buffer %d (%s): %s .\n",
+		    __FILE__, __LINE__, bo_gem->gem_handle,
+		    bo_gem->name, strerror(errno));
+		return NULL;
+	}
+
+	VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
+	ptr = (void *)(uintptr_t) mmap_arg.addr_ptr;
+	if (wc)
+		bo_gem->wc_virtual = ptr;
+	else
+		bo_gem->mem_virtual = ptr;
+
+	return ptr;
+}
+
 static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
@@ -1466,6 +2023,11 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
+	if (bo_gem->mem_virtual)
+		bufmgr_gem->vma_hits++;
+	else
+		bufmgr_gem->vma_misses++;
+
 	if (!bo_gem->mem_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
@@ -1534,6 +2096,11 @@ map_gtt(drm_intel_bo *bo)
 	if (bo_gem->map_count++ == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
+	if (bo_gem->gtt_virtual)
+		bufmgr_gem->vma_hits++;
+	else
+		bufmgr_gem->vma_misses++;
+
 	/* Get a mapping of the buffer if we haven't before. */
 	if (bo_gem->gtt_virtual == NULL) {
 		struct drm_i915_gem_mmap_gtt mmap_arg;
@@ -1738,6 +2305,100 @@ drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo)
 	return drm_intel_gem_bo_unmap(bo);
 }
 
+/**
+ * Uploads through a CPU mapping of the BO on LLC platforms, where it is
+ * coherent with the GPU, or through a WC mapping otherwise, rather than
+ * having the kernel copy the data for pwrite.  The mapping is kept in
+ * the VMA cache for the next upload.
+ *
+ * Only done when the BO is idle, as the kernel would otherwise stall
+ * for us, and untiled, as pwrite through a fence would detile.  Returns
+ * nonzero to have the caller fall back to pwrite, as when the BO can't
+ * be moved to the domain of the mapping, or the range is out of bounds,
+ * which pwrite then rejects.
+ */
+static int
+drm_intel_gem_bo_upload_mapped(drm_intel_bo *bo, unsigned long offset,
+			       unsigned long size, const void *data)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	bool wc = !bufmgr_gem->has_llc;
+	void *ptr;
+
+	if (wc && !bufmgr_gem->has_wc_mmap)
+		return -ENODEV;
+
+	if (offset > bo->size || size > bo->size - offset)
+		return -EINVAL;
+
+	if (bo_gem->tiling_mode != I915_TILING_NONE)
+		return -EINVAL;
+
+	if (drm_intel_gem_bo_busy(bo))
+		return -EBUSY;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (bo_gem->map_count++ == 0)
+		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+
+	ptr = wc ? bo_gem->wc_virtual : bo_gem->mem_virtual;
+	if (ptr) {
+		bufmgr_gem->vma_hits++;
+	} else if ((bufmgr_gem->vma_max < 0 ||
+		    bufmgr_gem->vma_count <
+		    bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open) &&
+		   (bufmgr_gem->vma_max_bytes == 0 ||
+		    bufmgr_gem->vma_bytes + bo->size <=
+		    bufmgr_gem->vma_max_bytes)) {
+		/* Don't map the BO if that would evict another BO's
+		 * mapping, when the working set exceeds the cache every
+		 * upload would pay for an mmap and munmap.
+		 */
+		ptr = drm_intel_gem_bo_mmap_locked(bufmgr_gem, bo_gem, wc);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	/* Move the BO to the domain written through, CPU as in
+	 * drm_intel_gem_bo_map() or GTT (which WC writes bypass the CPU
+	 * caches for too) as in drm_intel_gem_bo_map_gtt(), so that the
+	 * GPU caches are flushed and the kernel flushes ours before the
+	 * next use.  If it won't, leave the upload to pwrite.
+	 */
+	if (ptr) {
+		struct drm_i915_gem_set_domain set_domain;
+
+		memclear(set_domain);
+		set_domain.handle = bo_gem->gem_handle;
+		set_domain.read_domains = wc ? I915_GEM_DOMAIN_GTT :
+					       I915_GEM_DOMAIN_CPU;
+		set_domain.write_domain = set_domain.read_domains;
+		if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_SET_DOMAIN,
+			     &set_domain) != 0) {
+			DBG("%s:%d: Error setting domain %d: %s\n",
+			    __FILE__, __LINE__, bo_gem->gem_handle,
+			    strerror(errno));
+			ptr = NULL;
+		}
+	}
+
+	/* Holding a map_count keeps the mapping out of the VMA cache, so
+	 * it can't be unmapped under us while copying.
+	 */
+	if (ptr) {
+		memcpy((char *)ptr + offset, data, size);
+		if (wc)
+			__sync_synchronize(); /* flush the WC buffers */
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (--bo_gem->map_count == 0)
+		drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ptr ? 0 : -ENOSPC;
+}
+
 static int
 drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
 			 unsigned long size, const void *data)
@@ -1750,6 +2411,9 @@ drm_intel_gem_bo_subdata(drm_intel_bo *bo, unsigned long offset,
 	if (bo_gem->is_userptr)
 		return -EINVAL;
 
+	if (drm_intel_gem_bo_upload_mapped(bo, offset, size, data) == 0)
+		return 0;
+
 	memclear(pwrite);
 	pwrite.handle = bo_gem->gem_handle;
 	pwrite.offset = offset;
@@ -1863,7 +2527,8 @@ drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_i915_gem_wait wait;
-	int ret;
+	uint64_t serial;
+	int timeline, ret;
 
 	if (!bufmgr_gem->has_wait_timeout) {
 		DBG("%s:%d: Timed wait is not supported. Falling back to "
@@ -1876,6 +2541,11 @@ drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 		}
 	}
 
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	serial = bo_gem->last_exec;
+	timeline = bo_gem->timeline;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
 	memclear(wait);
 	wait.bo_handle = bo_gem->gem_handle;
 	wait.timeout_ns = timeout_ns;
@@ -1883,6 +2553,159 @@ drm_intel_gem_bo_wait(drm_intel_bo *bo, int64_t timeout_ns)
 	if (ret == -1)
 		return -errno;
 
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_bo_mark_idle_locked(bufmgr_gem, bo_gem, serial, timeline);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
+/** A buffer to ask the kernel about, and its state when picked. */
+struct drm_intel_gem_wait_target {
+	drm_intel_bo *bo;
+	uint64_t serial;
+	int timeline;
+};
+
+/**
+ * Picks the buffers of @bo_array the kernel needs asking about, into
+ * @targets: for each timeline, only the buffer submitted last, as it
+ * being idle implies the others are, and every buffer that is shared or
+ * on several timelines.  Buffers known to be idle are left out.
+ */
+static int
+drm_intel_gem_pick_wait_targets(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo **bo_array, int count,
+				struct drm_intel_gem_wait_target *targets)
+{
+	int per_timeline[DRM_INTEL_GEM_MAX_TIMELINES];
+	int i, n = 0;
+
+	for (i = 0; i < DRM_INTEL_GEM_MAX_TIMELINES; i++)
+		per_timeline[i] = -1;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	for (i = 0; i < count; i++) {
+		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
+		struct drm_intel_gem_wait_target *target;
+
+		int timeline;
+
+		if (drm_intel_gem_bo_known_idle_locked(bufmgr_gem, bo_gem))
+			continue;
+
+		timeline = drm_intel_gem_bo_timeline_locked(bufmgr_gem, bo_gem);
+		if (bo_gem->reusable && timeline >= 0) {
+			int *slot = &per_timeline[timeline];
+
+			if (*slot >= 0) {
+				target = &targets[*slot];
+				if (target->serial < bo_gem->last_exec) {
+					target->bo = bo_array[i];
+					target->serial = bo_gem->last_exec;
+				}
+				continue;
+			}
+			*slot = n;
+		}
+
+		target = &targets[n++];
+		target->bo = bo_array[i];
+		target->serial = bo_gem->last_exec;
+		target->timeline = timeline;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return n;
+}
+
+static int
+drm_intel_gem_bo_busy_many(drm_intel_bo **bo_array, int count)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem =
+		(drm_intel_bufmgr_gem *) bo_array[0]->bufmgr;
+	struct drm_intel_gem_wait_target stack_targets[32], *targets;
+	int busy = 0, i, n;
+
+	targets = stack_targets;
+	if (count > (int)ARRAY_SIZE(stack_targets)) {
+		targets = malloc(count * sizeof(*targets));
+		if (!targets) {
+			for (i = 0; i < count && !busy; i++)
+				busy = drm_intel_gem_bo_busy(bo_array[i]);
+			return busy;
+		}
+	}
+
+	n = drm_intel_gem_pick_wait_targets(bufmgr_gem, bo_array, count,
+					    targets);
+	for (i = 0; i < n && !busy; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(targets[i].bo);
+		struct drm_i915_gem_busy req;
+
+		memclear(req);
+		req.handle = bo_gem->gem_handle;
+		if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_BUSY, &req))
+			continue;
+
+		if (req.busy) {
+			busy = 1;
+		} else {
+			pthread_mutex_lock(&bufmgr_gem->lock);
+			drm_intel_gem_bo_mark_idle_locked(bufmgr_gem, bo_gem,
+							  targets[i].serial,
+							  targets[i].timeline);
+			pthread_mutex_unlock(&bufmgr_gem->lock);
+		}
+	}
+
+	if (targets != stack_targets)
+		free(targets);
+	return busy;
+}
+
+static int
+drm_intel_gem_bo_wait_many(drm_intel_bo **bo_array, int count,
+			   int64_t timeout_ns)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem =
+		(drm_intel_bufmgr_gem *) bo_array[0]->bufmgr;
+	struct drm_intel_gem_wait_target stack_targets[32], *targets;
+	struct timespec now;
+	int64_t deadline = 0, remaining = timeout_ns;
+	int ret = 0, i, n;
+
+	targets = stack_targets;
+	if (count > (int)ARRAY_SIZE(stack_targets)) {
+		targets = malloc(count * sizeof(*targets));
+		if (!targets)
+			return -ENOMEM;
+	}
+
+	if (timeout_ns > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		deadline = now.tv_sec * 1000000000ll + now.tv_nsec + timeout_ns;
+	}
+
+	/* drm_intel_gem_bo_wait() records what it finds idle */
+	n = drm_intel_gem_pick_wait_targets(bufmgr_gem, bo_array, count,
+					    targets);
+	for (i = 0; i < n; i++) {
+		if (timeout_ns > 0 && i > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = deadline -
+				(now.tv_sec * 1000000000ll + now.tv_nsec);
+			if (remaining < 0)
+				remaining = 0;
+		}
+
+		ret = drm_intel_gem_bo_wait(targets[i].bo, remaining);
+		if (ret)
+			break;
+	}
+
+	if (targets != stack_targets)
+		free(targets);
 	return ret;
 }
 
@@ -1926,6 +2749,7 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 	free(bufmgr_gem->exec2_objects);
 	free(bufmgr_gem->exec_objects);
 	free(bufmgr_gem->exec_bos);
+	free(bufmgr_gem->walk_stack);
 
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
@@ -1956,6 +2780,18 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 				"i915 kernel driver may not be sane!\n", errno);
 	}
 
+	while (!DRMLISTEMPTY(&bufmgr_gem->reloc_stores)) {
+		struct drm_intel_reloc_store *store =
+			DRMLISTENTRY(struct drm_intel_reloc_store,
+				     bufmgr_gem->reloc_stores.next, link);
+
+		DRMLISTDEL(&store->link);
+		free(store);
+	}
+
+	if (bufmgr_gem->softpin_va)
+		intel_vma_heap_fini(&bufmgr_gem->va_heap);
+
 	free(bufmgr);
 }
 
@@ -1995,13 +2831,14 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	if (target_bo_gem->tiling_mode == I915_TILING_NONE)
 		need_fence = false;
 
-	/* Create a new relocation list if needed */
-	if (bo_gem->relocs == NULL && drm_intel_setup_reloc_list(bo))
-		return -ENOMEM;
-
 	/* Check overflow */
 	assert(bo_gem->reloc_count < bufmgr_gem->max_relocs);
 
+	/* Create or grow the relocation list if needed */
+	if (drm_intel_gem_bo_reserve_relocs(bufmgr_gem, bo_gem,
+					    bo_gem->reloc_count + 1))
+		return -ENOMEM;
+
 	/* Check args */
 	assert(offset <= bo->size - 4);
 	assert((write_domain & (write_domain - 1)) == 0);
@@ -2024,14 +2861,14 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 		bo_gem->reloc_tree_fences += target_bo_gem->reloc_tree_fences;
 	}
 
-	bo_gem->reloc_target_info[bo_gem->reloc_count].bo = target_bo;
+	bo_gem->reloc_target_bo[bo_gem->reloc_count] = target_bo;
 	if (target_bo != bo)
 		drm_intel_gem_bo_reference(target_bo);
 	if (fenced_command)
-		bo_gem->reloc_target_info[bo_gem->reloc_count].flags =
+		bo_gem->reloc_flags[bo_gem->reloc_count] =
 			DRM_INTEL_RELOC_FENCE;
 	else
-		bo_gem->reloc_target_info[bo_gem->reloc_count].flags = 0;
+		bo_gem->reloc_flags[bo_gem->reloc_count] = 0;
 
 	bo_gem->relocs[bo_gem->reloc_count].offset = offset;
 	bo_gem->relocs[bo_gem->reloc_count].delta = target_offset;
@@ -2071,18 +2908,10 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 	if (target_bo_gem == bo_gem)
 		return -EINVAL;
 
-	if (bo_gem->softpin_target_count == bo_gem->softpin_target_size) {
-		int new_size = bo_gem->softpin_target_size * 2;
-		if (new_size == 0)
-			new_size = bufmgr_gem->max_relocs;
-
-		bo_gem->softpin_target = realloc(bo_gem->softpin_target, new_size *
-				sizeof(drm_intel_bo *));
-		if (!bo_gem->softpin_target)
-			return -ENOMEM;
+	if (drm_intel_gem_bo_reserve_relocs(bufmgr_gem, bo_gem,
+					    bo_gem->softpin_target_count + 1))
+		return -ENOMEM;
 
-		bo_gem->softpin_target_size = new_size;
-	}
 	bo_gem->softpin_target[bo_gem->softpin_target_count] = target_bo;
 	drm_intel_gem_bo_reference(target_bo);
 	bo_gem->softpin_target_count++;
@@ -2155,7 +2984,7 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 	pthread_mutex_lock(&bufmgr_gem->lock);
 
 	for (i = start; i < bo_gem->reloc_count; i++) {
-		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->reloc_target_info[i].bo;
+		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->reloc_target_bo[i];
 		if (&target_bo_gem->bo != bo) {
 			bo_gem->reloc_tree_fences -= target_bo_gem->reloc_tree_fences;
 			drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo,
@@ -2174,74 +3003,156 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 
 }
 
-/**
- * Walk the tree of relocations rooted at BO and accumulate the list of
- * validations to be performed and update the relocation buffers with
- * index values into the validation list.
- */
-static void
-drm_intel_gem_bo_process_reloc(drm_intel_bo *bo)
+static int
+drm_intel_gem_walk_push(drm_intel_bufmgr_gem *bufmgr_gem, int depth,
+			drm_intel_bo *bo, int need_fence)
 {
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	int i;
+	struct drm_intel_reloc_walk *walk;
 
-	if (bo_gem->relocs == NULL)
-		return;
+	if (depth == bufmgr_gem->walk_stack_size) {
+		int new_size = bufmgr_gem->walk_stack_size * 2;
 
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
+		if (new_size == 0)
+			new_size = 16;
 
-		if (target_bo == bo)
-			continue;
+		walk = realloc(bufmgr_gem->walk_stack,
+			       sizeof(*walk) * new_size);
+		if (walk == NULL)
+			return -ENOMEM;
 
-		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
+		bufmgr_gem->walk_stack = walk;
+		bufmgr_gem->walk_stack_size = new_size;
+	}
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc(target_bo);
+	walk = &bufmgr_gem->walk_stack[depth];
+	walk->bo = bo;
+	walk->next = 0;
+	walk->need_fence = need_fence;
+	to_bo_gem(bo)->walk_gen = bufmgr_gem->exec_gen;
 
-		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer(target_bo);
-	}
+	return 0;
 }
 
-static void
-drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
+/**
+ * Walk the tree of relocations rooted at BO and accumulate the list of
+ * validations to be performed, with every target ahead of the buffers
+ * referencing it and BO itself last.
+ *
+ * The walk is depth-first, on an explicit stack rather than recursing,
+ * and the relocations of a BO referenced from several places are only
+ * walked the first time: the later references just merge their flags
+ * into its validation entry.  With exec2, softpin targets are walked
+ * after the relocation targets.
+ */
+static int
+drm_intel_gem_bo_build_validation_list(drm_intel_bo *bo, bool exec2)
 {
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
-	int i;
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	int depth;
 
-	if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL)
-		return;
+	/* Start a new list; zero is left to BOs never validated. */
+	if (++bufmgr_gem->exec_gen == 0)
+		bufmgr_gem->exec_gen = 1;
 
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
+	if (drm_intel_gem_walk_push(bufmgr_gem, 0, bo, false))
+		return -ENOMEM;
+	depth = 1;
+
+	while (depth > 0) {
+		struct drm_intel_reloc_walk *walk =
+			&bufmgr_gem->walk_stack[depth - 1];
+		drm_intel_bo_gem *bo_gem = to_bo_gem(walk->bo);
+		int softpin_count = exec2 ? bo_gem->softpin_target_count : 0;
+		drm_intel_bo *target_bo;
 		int need_fence;
 
-		if (target_bo == bo)
-			continue;
+		if (walk->next < bo_gem->reloc_count) {
+			target_bo = bo_gem->reloc_target_bo[walk->next];
+			need_fence = (bo_gem->reloc_flags[walk->next] &
+				      DRM_INTEL_RELOC_FENCE);
+		} else if (walk->next < bo_gem->reloc_count + softpin_count) {
+			target_bo = bo_gem->softpin_target[walk->next -
+							   bo_gem->reloc_count];
+			need_fence = false;
+		} else {
+			/* All the targets are on the list, add the BO itself. */
+			if (bo_gem->reloc_count + softpin_count > 0)
+				drm_intel_gem_bo_mark_mmaps_incoherent(walk->bo);
 
-		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
+			if (exec2)
+				drm_intel_add_validate_buffer2(walk->bo,
+							       walk->need_fence);
+			else
+				drm_intel_add_validate_buffer(walk->bo);
+			depth--;
+			continue;
+		}
+		walk->next++;
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		if (target_bo == walk->bo)
+			continue;
 
-		need_fence = (bo_gem->reloc_target_info[i].flags &
-			      DRM_INTEL_RELOC_FENCE);
+		if (to_bo_gem(target_bo)->walk_gen == bufmgr_gem->exec_gen) {
+			/* Already walked, and as relocations can't form a
+			 * cycle, already on the list too.
+			 */
+			if (exec2)
+				drm_intel_add_validate_buffer2(target_bo,
+							       need_fence);
+			continue;
+		}
 
-		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer2(target_bo, need_fence);
+		/* Continue walking the tree depth-first. */
+		if (drm_intel_gem_walk_push(bufmgr_gem, depth, target_bo,
+					    need_fence))
+			return -ENOMEM;
+		depth++;
 	}
 
-	for (i = 0; i < bo_gem->softpin_target_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->softpin_target[i];
+	return 0;
+}
 
-		if (target_bo == bo)
-			continue;
+/**
+ * Finish the relocations of the validation list for exec2: with
+ * I915_EXEC_HANDLE_LUT, point them at validation list indices rather
+ * than GEM handles, and with I915_EXEC_NO_RELOC, flag the BOs they
+ * write to, as the kernel won't look at the write domains of skipped
+ * relocations.
+ *
+ * Returns whether every relocation still presumes its target at the
+ * offset last reported by the kernel, which NO_RELOC relies on: it only
+ * processes relocations when some BO has to move.
+ */
+static bool
+drm_intel_gem_prepare_relocs2(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	bool presumed_valid = true;
+	int i, j;
 
-		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
-		drm_intel_gem_bo_process_reloc2(target_bo);
-		drm_intel_add_validate_buffer2(target_bo, false);
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+
+		for (j = 0; j < bo_gem->reloc_count; j++) {
+			struct drm_i915_gem_relocation_entry *reloc =
+				&bo_gem->relocs[j];
+			drm_intel_bo *target_bo = bo_gem->reloc_target_bo[j];
+			int index = to_bo_gem(target_bo)->validate_index;
+
+			if (bufmgr_gem->has_handle_lut)
+				reloc->target_handle = index;
+
+			if (!bufmgr_gem->has_exec_no_reloc)
+				continue;
+
+			if (reloc->presumed_offset != target_bo->offset64)
+				presumed_valid = false;
+			if (reloc->write_domain)
+				bufmgr_gem->exec2_objects[index].flags |=
+					EXEC_OBJECT_WRITE;
+		}
 	}
+
+	return presumed_valid;
 }
 
 
@@ -2315,13 +3226,12 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		return -ENOMEM;
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc(bo);
-
-	/* Add the batch buffer to the validation list.  There are no
+	/* Set up the validate list, the batch buffer last.  There are no
 	 * relocations pointing to it.
 	 */
-	drm_intel_add_validate_buffer(bo);
+	ret = drm_intel_gem_bo_build_validation_list(bo, false);
+	if (ret)
+		goto skip_execution;
 
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t) bufmgr_gem->exec_objects;
@@ -2351,7 +3261,11 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		}
 	}
 	drm_intel_update_buffer_offsets(bufmgr_gem);
+	if (ret == 0)
+		drm_intel_gem_mark_exec_locked(bufmgr_gem, 0,
+					       I915_EXEC_RENDER);
 
+skip_execution:
 	if (bufmgr_gem->bufmgr.debug)
 		drm_intel_gem_dump_validation_list(bufmgr_gem);
 
@@ -2361,7 +3275,6 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		bo_gem->idle = false;
 
 		/* Disconnect the buffer from the validate list */
-		bo_gem->validate_index = -1;
 		bufmgr_gem->exec_bos[i] = NULL;
 	}
 	bufmgr_gem->exec_count = 0;
@@ -2404,13 +3317,20 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
-	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
-
-	/* Add the batch buffer to the validation list.  There are no relocations
-	 * pointing to it.
+	/* Set up the validate list, the batch buffer last.  There are no
+	 * relocations pointing to it.
 	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+	ret = drm_intel_gem_bo_build_validation_list(bo, true);
+	if (ret)
+		goto skip_execution;
+
+	if (bufmgr_gem->has_handle_lut || bufmgr_gem->has_exec_no_reloc) {
+		if (drm_intel_gem_prepare_relocs2(bufmgr_gem) &&
+		    bufmgr_gem->has_exec_no_reloc)
+			flags |= I915_EXEC_NO_RELOC;
+		if (bufmgr_gem->has_handle_lut)
+			flags |= I915_EXEC_HANDLE_LUT;
+	}
 
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
@@ -2447,6 +3367,15 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		}
 	}
 	drm_intel_update_buffer_offsets2(bufmgr_gem);
+	if (ret == 0) {
+		unsigned int ring = flags & (I915_EXEC_RING_MASK |
+					     I915_EXEC_BSD_MASK);
+
+		if (ring == I915_EXEC_DEFAULT)
+			ring = I915_EXEC_RENDER;
+		drm_intel_gem_mark_exec_locked(bufmgr_gem,
+					       ctx ? ctx->ctx_id : 0, ring);
+	}
 
 skip_execution:
 	if (bufmgr_gem->bufmgr.debug)
@@ -2458,7 +3387,6 @@ skip_execution:
 		bo_gem->idle = false;
 
 		/* Disconnect the buffer from the validate list */
-		bo_gem->validate_index = -1;
 		bufmgr_gem->exec_bos[i] = NULL;
 	}
 	bufmgr_gem->exec_count = 0;
@@ -2613,8 +3541,16 @@ drm_intel_gem_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 static int
 drm_intel_gem_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
+	if (bo_gem->va) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		intel_vma_heap_free(&bufmgr_gem->va_heap, bo_gem->va);
+		bo_gem->va = NULL;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
 	bo_gem->is_softpin = true;
 	bo->offset64 = offset;
 	bo->offset = offset;
@@ -2682,6 +3618,7 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 	bo_gem->has_error = false;
 	bo_gem->reusable = false;
 	bo_gem->use_48b_address_range = false;
+	drm_intel_gem_bo_assign_va_locked(bufmgr_gem, bo_gem, 0);
 
 	memclear(get_tiling);
 	get_tiling.handle = bo_gem->gem_handle;
@@ -2780,6 +3717,40 @@ drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
 		bufmgr_gem->fenced_relocs = true;
 }
 
+/**
+ * Enables softpinning of every BO allocated from now on, at a GPU address
+ * assigned by the bufmgr.  The offset of such BOs is known as soon as
+ * they are allocated, and relocations to them are not passed to the
+ * kernel, so batches can be written with the final addresses.
+ *
+ * Addresses are assigned between 4GiB and 2^47, so all these BOs can be
+ * placed in the 48-bit address range.  The low 4GiB is left to BOs
+ * allocated before, and to those softpinned by the user.
+ *
+ * Requires softpin support and a full 48-bit PPGTT, or returns -ENODEV.
+ */
+int
+drm_intel_bufmgr_gem_enable_softpin_va(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	int ret = 0;
+
+	if (!bufmgr_gem->bufmgr.bo_set_softpin_offset ||
+	    !bufmgr_gem->bufmgr.bo_use_48b_address_range)
+		return -ENODEV;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (!bufmgr_gem->softpin_va) {
+		ret = intel_vma_heap_init(&bufmgr_gem->va_heap, 1ull << 32,
+					  (1ull << 47) - (1ull << 32));
+		if (ret == 0)
+			bufmgr_gem->softpin_va = true;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
 /**
  * Return the additional aperture space required by the tree of buffer objects
  * rooted at bo.
@@ -2800,7 +3771,7 @@ drm_intel_gem_bo_get_aperture_space(drm_intel_bo *bo)
 	for (i = 0; i < bo_gem->reloc_count; i++)
 		total +=
 		    drm_intel_gem_bo_get_aperture_space(bo_gem->
-							reloc_target_info[i].bo);
+							reloc_target_bo[i]);
 
 	return total;
 }
@@ -2847,7 +3818,7 @@ drm_intel_gem_bo_clear_aperture_space_flag(drm_intel_bo *bo)
 
 	for (i = 0; i < bo_gem->reloc_count; i++)
 		drm_intel_gem_bo_clear_aperture_space_flag(bo_gem->
-							   reloc_target_info[i].bo);
+							   reloc_target_bo[i]);
 }
 
 /**
@@ -2979,11 +3950,11 @@ _drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 	int i;
 
 	for (i = 0; i < bo_gem->reloc_count; i++) {
-		if (bo_gem->reloc_target_info[i].bo == target_bo)
+		if (bo_gem->reloc_target_bo[i] == target_bo)
 			return 1;
-		if (bo == bo_gem->reloc_target_info[i].bo)
+		if (bo == bo_gem->reloc_target_bo[i])
 			continue;
-		if (_drm_intel_gem_bo_references(bo_gem->reloc_target_info[i].bo,
+		if (_drm_intel_gem_bo_references(bo_gem->reloc_target_bo[i],
 						target_bo))
 			return 1;
 	}
@@ -3060,6 +4031,93 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+/**
+ * Limits the memory mapped by the VMA cache for BOs not currently mapped
+ * to @max_bytes, on top of the limit on the number of mappings set with
+ * drm_intel_bufmgr_gem_set_vma_cache_size().  Zero means no limit.
+ */
+void
+drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					 uint64_t max_bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_max_bytes = max_bytes;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+void
+drm_intel_bufmgr_gem_get_vma_stats(drm_intel_bufmgr *bufmgr,
+				   struct drm_intel_gem_vma_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->count = bufmgr_gem->vma_count;
+	stats->bytes = bufmgr_gem->vma_bytes;
+	stats->hits = bufmgr_gem->vma_hits;
+	stats->misses = bufmgr_gem->vma_misses;
+	stats->evictions = bufmgr_gem->vma_evictions;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Fills @stats with the counters of the relocation lists the bufmgr
+ * recycles between BOs.
+ */
+void
+drm_intel_bufmgr_gem_get_reloc_stats(drm_intel_bufmgr *bufmgr,
+				     struct drm_intel_gem_reloc_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_reloc_store *store;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->count = bufmgr_gem->reloc_store_count;
+	stats->bytes = 0;
+	DRMLISTFOREACHENTRY(store, &bufmgr_gem->reloc_stores, link)
+		stats->bytes += drm_intel_reloc_store_size(store->capacity);
+	stats->allocs = bufmgr_gem->reloc_store_allocs;
+	stats->reuses = bufmgr_gem->reloc_store_reuses;
+	stats->high_water = bufmgr_gem->reloc_high_water;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Fills @stats with the counters of up to @max_buckets buckets of the BO
+ * reuse cache, smallest first, and returns the total number of buckets.
+ * @stats may be NULL to only query that number.
+ */
+int
+drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+				     struct drm_intel_gem_bucket_stats *stats,
+				     int max_buckets)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	int i;
+
+	if (stats == NULL)
+		max_buckets = 0;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	for (i = 0; i < bufmgr_gem->num_buckets && i < max_buckets; i++) {
+		struct drm_intel_gem_bo_bucket *bucket =
+		    &bufmgr_gem->cache_bucket[i];
+
+		stats[i].size = bucket->size;
+		stats[i].count = bucket->count;
+		stats[i].bytes = (uint64_t)bucket->count * bucket->size;
+		stats[i].hits = bucket->hits;
+		stats[i].misses = bucket->misses;
+		stats[i].purges = bucket->purges;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return bufmgr_gem->num_buckets;
+}
+
 static int
 parse_devid_override(const char *devid_override)
 {
@@ -3204,6 +4262,10 @@ drm_intel_gem_context_destroy(drm_intel_context *ctx)
 		fprintf(stderr, "DRM_IOCTL_I915_GEM_CONTEXT_DESTROY failed: %s\n",
 			strerror(errno));
 
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_timelines_release_locked(bufmgr_gem, ctx->ctx_id);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
 	free(ctx);
 }
 
@@ -3405,6 +4467,7 @@ void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 
 		if (bo_gem->map_count++ == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+		bufmgr_gem->vma_misses++;
 
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
@@ -3447,29 +4510,15 @@ void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	if (!bo_gem->mem_virtual) {
-		struct drm_i915_gem_mmap mmap_arg;
-
 		if (bo_gem->map_count++ == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
-		memclear(mmap_arg);
-		mmap_arg.handle = bo_gem->gem_handle;
-		mmap_arg.size = bo->size;
-		if (drmIoctl(bufmgr_gem->fd,
-			     DRM_IOCTL_I915_GEM_MMAP,
-			     &mmap_arg)) {
-			DBG("%s:%d: Error mapping buffer %d (%s): %s .\n",
-			    __FILE__, __LINE__, bo_gem->gem_handle,
-			    bo_gem->name, strerror(errno));
-			if (--bo_gem->map_count == 0)
-				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
-		} else {
-			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
-			bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
-		}
+		if (!drm_intel_gem_bo_mmap_locked(bufmgr_gem, bo_gem, false) &&
+		    --bo_gem->map_count == 0)
+			drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 	}
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -3489,30 +4538,15 @@ void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	if (!bo_gem->wc_virtual) {
-		struct drm_i915_gem_mmap mmap_arg;
-
 		if (bo_gem->map_count++ == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
-		memclear(mmap_arg);
-		mmap_arg.handle = bo_gem->gem_handle;
-		mmap_arg.size = bo->size;
-		mmap_arg.flags = I915_MMAP_WC;
-		if (drmIoctl(bufmgr_gem->fd,
-			     DRM_IOCTL_I915_GEM_MMAP,
-			     &mmap_arg)) {
-			DBG("%s:%d: Error mapping buffer %d (%s): %s .\n",
-			    __FILE__, __LINE__, bo_gem->gem_handle,
-			    bo_gem->name, strerror(errno));
-			if (--bo_gem->map_count == 0)
-				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
-		} else {
-			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
-			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
-		}
+		if (!drm_intel_gem_bo_mmap_locked(bufmgr_gem, bo_gem, true) &&
+		    --bo_gem->map_count == 0)
+			drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 	}
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -3644,6 +4678,18 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_vebox = (ret == 0) & (*gp.value > 0);
 
+	gp.param = I915_PARAM_MMAP_VERSION;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_wc_mmap = ret == 0 && *gp.value > 0;
+
+	gp.param = I915_PARAM_HAS_EXEC_NO_RELOC;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_exec_no_reloc = exec2 && ret == 0 && *gp.value > 0;
+
+	gp.param = I915_PARAM_HAS_EXEC_HANDLE_LUT;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_handle_lut = exec2 && ret == 0 && *gp.value > 0;
+
 	gp.param = I915_PARAM_HAS_EXEC_SOFTPIN;
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	if (ret == 0 && *gp.value > 0)
@@ -3715,6 +4761,8 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	} else
 		bufmgr_gem->bufmgr.bo_exec = drm_intel_gem_bo_exec;
 	bufmgr_gem->bufmgr.bo_busy = drm_intel_gem_bo_busy;
+	bufmgr_gem->bufmgr.bo_busy_many = drm_intel_gem_bo_busy_many;
+	bufmgr_gem->bufmgr.bo_wait_many = drm_intel_gem_bo_wait_many;
 	bufmgr_gem->bufmgr.bo_madvise = drm_intel_gem_bo_madvise;
 	bufmgr_gem->bufmgr.destroy = drm_intel_bufmgr_gem_unref;
 	bufmgr_gem->bufmgr.debug = 0;
@@ -3729,6 +4777,7 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	init_cache_buckets(bufmgr_gem);
 
 	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
+	DRMINITLISTHEAD(&bufmgr_gem->reloc_stores);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
 
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
@@ -261,6 +261,19 @@ struct _drm_intel_bufmgr {
 	 */
 	int (*bo_busy) (drm_intel_bo *bo);
 
+	/**
+	 * Returns 1 if any of the buffers is busy, like bo_busy, but in as
+	 * few queries of the kernel as possible.
+	 */
+	int (*bo_busy_many) (drm_intel_bo **bo_array, int count);
+
+	/**
+	 * Waits for all of the buffers to be idle, for at most timeout_ns
+	 * (forever if negative).  Returns 0, or -ETIME on timeout.
+	 */
+	int (*bo_wait_many) (drm_intel_bo **bo_array, int count,
+			     int64_t timeout_ns);
+
 	/**
 	 * Specify the volatility of the buffer.
 	 * \param bo Buffer to create a name for
@@ -82,20 +82,72 @@ struct drm_intel_decode {
 	bool dump_past_end;
 
 	bool overflowed;
+
+	/** @{
+	 * i915 S2/S4 immediate state, needed to decode inline vertices.
+	 */
+	uint32_t saved_s2, saved_s4;
+	char saved_s2_set, saved_s4_set;
+	/** @} */
+
+	/**
+	 * DWORDs readable from \c data.  This is \c count while
+	 * decoding straight out of the caller's buffer, and includes the
+	 * padding while decoding out of \c window.
+	 */
+	uint32_t avail;
+
+	/**
+	 * Copy of the end of the batch followed by a pad of obviously
+	 * undefined data, used once a packet could read past the end of
+	 * the caller's buffer.  Kept around for the next decode.
+	 */
+	uint32_t *window;
+	uint32_t window_size;
+
+	/** @{
+	 * Opcode dispatch tables for this generation, indexed by the
+	 * opcode bits of the header.  Entries are 1 + the index of the
+	 * packet in the matching opcodes_*[] table, or 0 if unknown.
+	 */
+	uint8_t dispatch_mi[64];
+	uint8_t dispatch_2d[128];
+	uint8_t dispatch_3d_1d[256];
+	uint8_t dispatch_3d[32];
+	uint8_t dispatch_3d_965[0x2000];
+	/** @} */
+
+	/** @{
+	 * Where the decode is reported.  Defaults to the text output to
+	 * \c out, with the context as the data.
+	 */
+	const struct drm_intel_decode_visitor *visitor;
+	void *visitor_data;
+	/** @} */
+
+	/** Name of the packet being decoded, or NULL if unknown. */
+	const char *packet_name;
+
+	/** @{
+	 * JSON array members describing the fields of the packet being
+	 * decoded, for the JSON output.
+	 */
+	char *json_fields;
+	size_t json_fields_len, json_fields_size;
+	/** @} */
 };
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+/* DWORDs of 0xd0 padding that statically sized packets may read past
+ * the end of the batch without length checks.
+ */
+#define DECODE_PAD	1024
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
 #endif
 
 #define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(out, "Buffer size too small in %s (%d < %d)\n",	\
+    msg_out(ctx, "Buffer size too small in %s (%d < %d)\n",	\
 	    (_name), (_count), (_len));				\
     return _count;						\
 } while (0)
@@ -111,33 +163,48 @@ static float int_as_float(uint32_t intval)
 	return uval.f;
 }
 
+static void DRM_PRINTFLIKE(2, 3)
+msg_out(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	va_list va;
+
+	if (!ctx->visitor->message)
+		return;
+
+	va_start(va, fmt);
+	ctx->visitor->message(ctx->visitor_data, fmt, va);
+	va_end(va);
+}
+
+/**
+ * Names the packet being decoded, before its first DWORD is described.
+ * The name is reported to the visitor along with the packet.
+ */
+static void
+packet_begin(struct drm_intel_decode *ctx, const char *name)
+{
+	ctx->packet_name = name;
+}
+
 static void DRM_PRINTFLIKE(3, 4)
 instr_out(struct drm_intel_decode *ctx, unsigned int index,
 	  const char *fmt, ...)
 {
 	va_list va;
-	const char *parseinfo;
-	uint32_t offset = ctx->hw_offset + index * 4;
 
 	if (index > ctx->count) {
 		if (!ctx->overflowed) {
-			fprintf(out, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
+			msg_out(ctx, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
 			ctx->overflowed = true;
 		}
 		return;
 	}
 
-	if (offset == head_offset)
-		parseinfo = "HEAD";
-	else if (offset == tail_offset)
-		parseinfo = "TAIL";
-	else
-		parseinfo = "    ";
-
-	fprintf(out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
-		ctx->data[index], index == 0 ? "" : "   ");
 	va_start(va, fmt);
-	vfprintf(out, fmt, va);
+	if (ctx->visitor->field)
+		ctx->visitor->field(ctx->visitor_data,
+				    ctx->hw_offset + index * 4, index,
+				    ctx->data[index], fmt, va);
 	va_end(va);
 }
 
@@ -148,6 +215,7 @@ decode_MI_SET_CONTEXT(struct drm_intel_decode *ctx)
 	if (ctx->gen > 7)
 		return 1;
 
+	packet_begin(ctx, "MI_SET_CONTEXT");
 	instr_out(ctx, 0, "MI_SET_CONTEXT\n");
 	instr_out(ctx, 1, "gtt offset = 0x%x%s%s\n",
 		  data & ~0xfff,
@@ -191,6 +259,7 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	}
 
 	if (ctx->gen <= 5) {
+		packet_begin(ctx, "MI_WAIT_FOR_EVENT");
 		instr_out(ctx, 0, "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
 			  data & (1<<18)? ", pipe B start vblank wait": "",
 			  data & (1<<17)? ", pipe A start vblank wait": "",
@@ -207,6 +276,7 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 			  data & (1<<2)? ", plane A pending flip wait": "",
 			  data & (1<<1)? ", plane A scan line wait": "");
 	} else {
+		packet_begin(ctx, "MI_WAIT_FOR_EVENT");
 		instr_out(ctx, 0, "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s\n",
 			  data & (1<<20)? ", sprite C pending flip wait": "", /* ivb */
 			  cc_wait,
@@ -225,65 +295,64 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+struct opcode_mi {
+	uint32_t opcode;
+	int len_mask;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct opcode_mi opcodes_mi[] = {
+	{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
+	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
+	{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
+	{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
+	{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
+	{ 0x04, 0, 1, 1, "MI_FLUSH" },
+	{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
+	{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
+	{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
+	{ 0x00, 0, 1, 1, "MI_NOOP" },
+	{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
+	{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
+	{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
+	{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
+	{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
+	{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
+	{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
+	{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
+	{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
+	{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
+	{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
+	{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
+	{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
+};
+
 static int
 decode_mi(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len = -1;
 	const char *post_sync_op = "";
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		int len_mask;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_mi[] = {
-		{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
-		{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-		{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
-		{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
-		{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
-		{ 0x04, 0, 1, 1, "MI_FLUSH" },
-		{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
-		{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
-		{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
-		{ 0x00, 0, 1, 1, "MI_NOOP" },
-		{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
-		{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
-		{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
-		{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
-		{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
-		{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
-		{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
-		{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
-		{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
-		{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
-		{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
-		{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
-		{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
-	}, *opcode_mi = NULL;
+	const struct opcode_mi *opcode_mi = NULL;
 
 	/* check instruction length */
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			len = 1;
-			if (opcodes_mi[opcode].max_len > 1) {
-				len =
-				    (data[0] & opcodes_mi[opcode].len_mask) + 2;
-				if (len < opcodes_mi[opcode].min_len
-				    || len > opcodes_mi[opcode].max_len) {
-					fprintf(out,
-						"Bad length (%d) in %s, [%d, %d]\n",
-						len, opcodes_mi[opcode].name,
-						opcodes_mi[opcode].min_len,
-						opcodes_mi[opcode].max_len);
-				}
+	opcode = ctx->dispatch_mi[(data[0] & 0x1f800000) >> 23];
+	if (opcode) {
+		opcode_mi = &opcodes_mi[opcode - 1];
+		len = 1;
+		if (opcode_mi->max_len > 1) {
+			len = (data[0] & opcode_mi->len_mask) + 2;
+			if (len < opcode_mi->min_len ||
+			    len > opcode_mi->max_len) {
+				msg_out(ctx,
+					"Bad length (%d) in %s, [%d, %d]\n",
+					len, opcode_mi->name,
+					opcode_mi->min_len,
+					opcode_mi->max_len);
 			}
-			opcode_mi = &opcodes_mi[opcode];
-			break;
 		}
 	}
 
@@ -292,9 +361,11 @@ decode_mi(struct drm_intel_decode *ctx)
 
 	switch ((data[0] & 0x1f800000) >> 23) {
 	case 0x0a:
+		packet_begin(ctx, "MI_BATCH_BUFFER_END");
 		instr_out(ctx, 0, "MI_BATCH_BUFFER_END\n");
 		return -1;
 	case 0x16:
+		packet_begin(ctx, "MI_SEMAPHORE_MBOX");
 		instr_out(ctx, 0, "MI_SEMAPHORE_MBOX%s%s%s%s %u\n",
 			  data[0] & (1 << 22) ? " global gtt," : "",
 			  data[0] & (1 << 21) ? " update semaphore," : "",
@@ -305,6 +376,7 @@ decode_mi(struct drm_intel_decode *ctx)
 		instr_out(ctx, 2, "address\n");
 		return len;
 	case 0x21:
+		packet_begin(ctx, "MI_STORE_DATA_INDEX");
 		instr_out(ctx, 0, "MI_STORE_DATA_INDEX%s\n",
 			  data[0] & (1 << 21) ? " use per-process HWS," : "");
 		instr_out(ctx, 1, "index\n");
@@ -313,6 +385,7 @@ decode_mi(struct drm_intel_decode *ctx)
 			instr_out(ctx, 3, "upper dword\n");
 		return len;
 	case 0x00:
+		packet_begin(ctx, "MI_NOOP");
 		if (data[0] & (1 << 22))
 			instr_out(ctx, 0,
 				  "MI_NOOP write NOPID reg, val=0x%x\n",
@@ -335,6 +408,7 @@ decode_mi(struct drm_intel_decode *ctx)
 			post_sync_op = "write TIMESTAMP";
 			break;
 		}
+		packet_begin(ctx, "MI_FLUSH_DW");
 		instr_out(ctx, 0,
 			  "MI_FLUSH_DW%s%s%s%s post_sync_op='%s' %s%s\n",
 			  data[0] & (1 << 22) ?
@@ -361,6 +435,7 @@ decode_mi(struct drm_intel_decode *ctx)
 		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
 			unsigned int i;
 
+			packet_begin(ctx, opcodes_mi[opcode].name);
 			instr_out(ctx, 0, "%s\n",
 				  opcodes_mi[opcode].name);
 			for (i = 1; i < len; i++) {
@@ -378,6 +453,7 @@ decode_mi(struct drm_intel_decode *ctx)
 static void
 decode_2d_br00(struct drm_intel_decode *ctx, const char *cmd)
 {
+	packet_begin(ctx, cmd);
 	instr_out(ctx, 0,
 		  "%s (rgb %sabled, alpha %sabled, src tile %d, dst tile %d)\n",
 		  cmd,
@@ -419,47 +495,51 @@ decode_2d_br01(struct drm_intel_decode *ctx)
 
 }
 
+/* Opcode, length range and name of packets with no fields worth decoding. */
+struct opcode_desc {
+	uint32_t opcode;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct opcode_desc opcodes_2d[] = {
+	{ 0x40, 5, 5, "COLOR_BLT" },
+	{ 0x43, 6, 6, "SRC_COPY_BLT" },
+	{ 0x01, 8, 8, "XY_SETUP_BLT" },
+	{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
+	{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
+	{ 0x24, 2, 2, "XY_PIXEL_BLT" },
+	{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
+	{ 0x26, 4, 4, "Y_TEXT_BLT" },
+	{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
+	{ 0x50, 6, 6, "XY_COLOR_BLT" },
+	{ 0x51, 6, 6, "XY_PAT_BLT" },
+	{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
+	{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
+	{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
+	{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
+	{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
+	{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
+	{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
+	{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
+	{ 0x55, 9, 9, "XY_FULL_BLT" },
+	{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
+	{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
+	{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
+	{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
+	{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
+};
+
 static int
 decode_2d(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len;
 	uint32_t *data = ctx->data;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_2d[] = {
-		{ 0x40, 5, 5, "COLOR_BLT" },
-		{ 0x43, 6, 6, "SRC_COPY_BLT" },
-		{ 0x01, 8, 8, "XY_SETUP_BLT" },
-		{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
-		{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
-		{ 0x24, 2, 2, "XY_PIXEL_BLT" },
-		{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
-		{ 0x26, 4, 4, "Y_TEXT_BLT" },
-		{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
-		{ 0x50, 6, 6, "XY_COLOR_BLT" },
-		{ 0x51, 6, 6, "XY_PAT_BLT" },
-		{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
-		{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
-		{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
-		{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
-		{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
-		{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
-		{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
-		{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
-		{ 0x55, 9, 9, "XY_FULL_BLT" },
-		{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
-		{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
-		{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
-		{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
-		{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
-	};
-
 	switch ((data[0] & 0x1fc00000) >> 22) {
 	case 0x25:
+		packet_begin(ctx, "XY_SCANLINES_BLT");
 		instr_out(ctx, 0,
 			  "XY_SCANLINES_BLT (pattern seed (%d, %d), dst tile %d)\n",
 			  (data[0] >> 12) & 0x8,
@@ -467,7 +547,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SCANLINES_BLT\n");
+			msg_out(ctx, "Bad count in XY_SCANLINES_BLT\n");
 
 		instr_out(ctx, 1, "dest (%d,%d)\n",
 			  data[1] & 0xffff, data[1] >> 16);
@@ -479,7 +559,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SETUP_BLT\n");
+			msg_out(ctx, "Bad count in XY_SETUP_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "cliprect (%d,%d)\n",
@@ -497,7 +577,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SETUP_CLIP_BLT\n");
+			msg_out(ctx, "Bad count in XY_SETUP_CLIP_BLT\n");
 
 		instr_out(ctx, 1, "cliprect (%d,%d)\n",
 			  data[1] & 0xffff, data[2] >> 16);
@@ -509,7 +589,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 9)
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
 
 		decode_2d_br01(ctx);
@@ -529,7 +609,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 6)
-			fprintf(out, "Bad count in XY_COLOR_BLT\n");
+			msg_out(ctx, "Bad count in XY_COLOR_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "(%d,%d)\n",
@@ -544,7 +624,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SRC_COPY_BLT\n");
+			msg_out(ctx, "Bad count in XY_SRC_COPY_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "dst (%d,%d)\n",
@@ -560,29 +640,28 @@ decode_2d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_2d) / sizeof(opcodes_2d[0]);
-	     opcode++) {
-		if ((data[0] & 0x1fc00000) >> 22 == opcodes_2d[opcode].opcode) {
-			unsigned int i;
-
-			len = 1;
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_2d[opcode].name);
-			if (opcodes_2d[opcode].max_len > 1) {
-				len = (data[0] & 0x000000ff) + 2;
-				if (len < opcodes_2d[opcode].min_len ||
-				    len > opcodes_2d[opcode].max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcodes_2d[opcode].name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	opcode = ctx->dispatch_2d[(data[0] & 0x1fc00000) >> 22];
+	if (opcode) {
+		const struct opcode_desc *opcode_2d = &opcodes_2d[opcode - 1];
+		unsigned int i;
+
+		len = 1;
+		packet_begin(ctx, opcode_2d->name);
+		instr_out(ctx, 0, "%s\n", opcode_2d->name);
+		if (opcode_2d->max_len > 1) {
+			len = (data[0] & 0x000000ff) + 2;
+			if (len < opcode_2d->min_len ||
+			    len > opcode_2d->max_len) {
+				msg_out(ctx, "Bad count in %s\n",
+					opcode_2d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "2D UNKNOWN\n");
@@ -599,20 +678,25 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 	switch (opcode) {
 	case 0x11:
+		packet_begin(ctx, "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE");
 		instr_out(ctx, 0,
 			  "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE\n");
 		return 1;
 	case 0x10:
+		packet_begin(ctx, "3DSTATE_SCISSOR_ENABLE");
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_ENABLE %s\n",
 			  data[0] & 1 ? "enabled" : "disabled");
 		return 1;
 	case 0x01:
+		packet_begin(ctx, "3DSTATE_MAP_COORD_SET_I830");
 		instr_out(ctx, 0, "3DSTATE_MAP_COORD_SET_I830\n");
 		return 1;
 	case 0x0a:
+		packet_begin(ctx, "3DSTATE_MAP_CUBE_I830");
 		instr_out(ctx, 0, "3DSTATE_MAP_CUBE_I830\n");
 		return 1;
 	case 0x05:
+		packet_begin(ctx, "3DSTATE_MAP_TEX_STREAM_I830");
 		instr_out(ctx, 0, "3DSTATE_MAP_TEX_STREAM_I830\n");
 		return 1;
 	}
@@ -624,9 +708,10 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 /** Sets the string dstname to describe the destination of the PS instruction */
 static void
-i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
+i915_get_instruction_dst(struct drm_intel_decode *ctx, int i, char *dstname,
+			 int do_mask)
 {
-	uint32_t a0 = data[i];
+	uint32_t a0 = ctx->data[i];
 	int dst_nr = (a0 >> 14) & 0xf;
 	char dstmask[8];
 	const char *sat;
@@ -661,22 +746,22 @@ i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
 	switch ((a0 >> 19) & 0x7) {
 	case 0:
 		if (dst_nr > 15)
-			fprintf(out, "bad destination reg R%d\n", dst_nr);
+			msg_out(ctx, "bad destination reg R%d\n", dst_nr);
 		sprintf(dstname, "R%d%s%s", dst_nr, dstmask, sat);
 		break;
 	case 4:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oC%d\n", dst_nr);
+			msg_out(ctx, "bad destination reg oC%d\n", dst_nr);
 		sprintf(dstname, "oC%s%s", dstmask, sat);
 		break;
 	case 5:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oD%d\n", dst_nr);
+			msg_out(ctx, "bad destination reg oD%d\n", dst_nr);
 		sprintf(dstname, "oD%s%s", dstmask, sat);
 		break;
 	case 6:
 		if (dst_nr > 3)
-			fprintf(out, "bad destination reg U%d\n", dst_nr);
+			msg_out(ctx, "bad destination reg U%d\n", dst_nr);
 		sprintf(dstname, "U%d%s%s", dst_nr, dstmask, sat);
 		break;
 	default:
@@ -707,13 +792,14 @@ i915_get_channel_swizzle(uint32_t select)
 }
 
 static void
-i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_src_name(struct drm_intel_decode *ctx,
+			      uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			msg_out(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -725,39 +811,41 @@ i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			msg_out(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 2:
 		sprintf(name, "C%d", src_nr);
 		if (src_nr > 31)
-			fprintf(out, "bad src reg %s\n", name);
+			msg_out(ctx, "bad src reg %s\n", name);
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			msg_out(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			msg_out(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	case 6:
 		sprintf(name, "U%d", src_nr);
 		if (src_nr > 3)
-			fprintf(out, "bad src reg %s\n", name);
+			msg_out(ctx, "bad src reg %s\n", name);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		msg_out(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
 }
 
-static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src0(struct drm_intel_decode *ctx,
+				       int i, char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a0 = data[i];
 	uint32_t a1 = data[i + 1];
 	int src_nr = (a0 >> 2) & 0x1f;
@@ -767,15 +855,17 @@ static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a1 >> 16) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a0 >> 7) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a0 >> 7) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src1(struct drm_intel_decode *ctx,
+				       int i, char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a1 = data[i + 1];
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a1 >> 8) & 0x1f;
@@ -785,15 +875,17 @@ static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 24) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a1 >> 13) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a1 >> 13) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src2(struct drm_intel_decode *ctx,
+				       int i, char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a2 >> 16) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a2 >> 12) & 0xf);
@@ -802,7 +894,7 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 0) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a2 >> 21) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a2 >> 21) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
@@ -810,13 +902,14 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 }
 
 static void
-i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_addr(struct drm_intel_decode *ctx,
+			  uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			msg_out(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -828,22 +921,22 @@ i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			msg_out(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			msg_out(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			msg_out(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		msg_out(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
@@ -855,8 +948,8 @@ i915_decode_alu1(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
 
 	instr_out(ctx, i++, "%s: %s %s, %s\n", instr_prefix,
 		  op_name, dst, src0);
@@ -870,9 +963,9 @@ i915_decode_alu2(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1);
@@ -886,10 +979,10 @@ i915_decode_alu3(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100], src2[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
-	i915_get_instruction_src2(ctx->data, i, src2);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
+	i915_get_instruction_src2(ctx, i, src2);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1, src2);
@@ -907,8 +1000,8 @@ i915_decode_tex(struct drm_intel_decode *ctx, int i,
 	char addr_name[100];
 	int sampler_nr;
 
-	i915_get_instruction_dst(ctx->data, i, dst_name, 0);
-	i915_get_instruction_addr((t1 >> 24) & 0x7,
+	i915_get_instruction_dst(ctx, i, dst_name, 0);
+	i915_get_instruction_addr(ctx, (t1 >> 24) & 0x7,
 				  (t1 >> 17) & 0xf, addr_name);
 	sampler_nr = t0 & 0xf;
 
@@ -934,30 +1027,30 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 	case 1:
 		sprintf(dcl_mask, ".%s%s%s%s", dcl_x, dcl_y, dcl_z, dcl_w);
 		if (strcmp(dcl_mask, ".") == 0)
-			fprintf(out, "bad (empty) dcl mask\n");
+			msg_out(ctx, "bad (empty) dcl mask\n");
 
 		if (dcl_nr > 10)
-			fprintf(out, "bad T%d dcl register number\n", dcl_nr);
+			msg_out(ctx, "bad T%d dcl register number\n", dcl_nr);
 		if (dcl_nr < 8) {
 			if (strcmp(dcl_mask, ".x") != 0 &&
 			    strcmp(dcl_mask, ".xy") != 0 &&
 			    strcmp(dcl_mask, ".xz") != 0 &&
 			    strcmp(dcl_mask, ".w") != 0 &&
 			    strcmp(dcl_mask, ".xyzw") != 0) {
-				fprintf(out, "bad T%d.%s dcl mask\n", dcl_nr,
+				msg_out(ctx, "bad T%d.%s dcl mask\n", dcl_nr,
 					dcl_mask);
 			}
 			instr_out(ctx, i++, "%s: DCL T%d%s\n",
 				  instr_prefix, dcl_nr, dcl_mask);
 		} else {
 			if (strcmp(dcl_mask, ".xz") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				msg_out(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				msg_out(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xzw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				msg_out(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 
 			if (dcl_nr == 8) {
@@ -993,7 +1086,7 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 			break;
 		}
 		if (dcl_nr > 15)
-			fprintf(out, "bad S%d dcl register number\n", dcl_nr);
+			msg_out(ctx, "bad S%d dcl register number\n", dcl_nr);
 		instr_out(ctx, i++, "%s: DCL S%d %s\n",
 			  instr_prefix, dcl_nr, sampletype);
 		instr_out(ctx, i++, "%s\n", instr_prefix);
@@ -1267,6 +1360,33 @@ decode_sample_filter(uint32_t mode)
 	return "";
 }
 
+struct opcode_3d_1d {
+	uint32_t opcode;
+	int i830_only;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+};
+
+static const struct opcode_3d_1d opcodes_3d_1d[] = {
+	{ 0x86, 0, 4, 4, "3DSTATE_CHROMA_KEY" },
+	{ 0x88, 0, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
+	{ 0x99, 0, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
+	{ 0x9a, 0, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
+	{ 0x98, 0, 2, 2, "3DSTATE_DEFAULT_Z" },
+	{ 0x97, 0, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
+	{ 0x9d, 0, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
+	{ 0x9e, 0, 4, 4, "3DSTATE_MONO_FILTER" },
+	{ 0x89, 0, 4, 4, "3DSTATE_FOG_MODE" },
+	{ 0x8f, 0, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
+	{ 0x83, 0, 2, 2, "3DSTATE_SPAN_STIPPLE" },
+	{ 0x8c, 1, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830" },
+	{ 0x8b, 1, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830" },
+	{ 0x8d, 1, 3, 3, "3DSTATE_W_STATE_I830" },
+	{ 0x01, 1, 2, 2, "3DSTATE_COLOR_FACTOR_I830" },
+	{ 0x02, 1, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830"},
+};
+
 static int
 decode_3d_1d(struct drm_intel_decode *ctx)
 {
@@ -1275,31 +1395,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
 	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		int i830_only;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d_1d[] = {
-		{ 0x86, 0, 4, 4, "3DSTATE_CHROMA_KEY" },
-		{ 0x88, 0, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
-		{ 0x99, 0, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
-		{ 0x9a, 0, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
-		{ 0x98, 0, 2, 2, "3DSTATE_DEFAULT_Z" },
-		{ 0x97, 0, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
-		{ 0x9d, 0, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
-		{ 0x9e, 0, 4, 4, "3DSTATE_MONO_FILTER" },
-		{ 0x89, 0, 4, 4, "3DSTATE_FOG_MODE" },
-		{ 0x8f, 0, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
-		{ 0x83, 0, 2, 2, "3DSTATE_SPAN_STIPPLE" },
-		{ 0x8c, 1, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830" },
-		{ 0x8b, 1, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830" },
-		{ 0x8d, 1, 3, 3, "3DSTATE_W_STATE_I830" },
-		{ 0x01, 1, 2, 2, "3DSTATE_COLOR_FACTOR_I830" },
-		{ 0x02, 1, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830"},
-	}, *opcode_3d_1d;
+	const struct opcode_3d_1d *opcode_3d_1d;
 
 	opcode = (data[0] & 0x00ff0000) >> 16;
 
@@ -1311,6 +1407,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		 * required in another, and 0 length LOAD_INDIRECTs
 		 * appear to cause no harm at least.
 		 */
+		packet_begin(ctx, "3DSTATE_LOAD_INDIRECT");
 		instr_out(ctx, 0, "3DSTATE_LOAD_INDIRECT\n");
 		len = (data[0] & 0x000000ff) + 1;
 		i = 1;
@@ -1338,11 +1435,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			instr_out(ctx, i++, "PSC.1\n");
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
+			msg_out(ctx, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
 			return len;
 		}
 		return len;
 	case 0x04:
+		packet_begin(ctx, "3DSTATE_LOAD_STATE_IMMEDIATE_1");
 		instr_out(ctx, 0,
 			  "3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		len = (data[0] & 0x0000000f) + 2;
@@ -1354,12 +1452,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					int tex_num;
 
 					if (word == 2) {
-						saved_s2_set = 1;
-						saved_s2 = data[i];
+						ctx->saved_s2_set = 1;
+						ctx->saved_s2 = data[i];
 					}
 					if (word == 4) {
-						saved_s4_set = 1;
-						saved_s4 = data[i];
+						ctx->saved_s4_set = 1;
+						ctx->saved_s4 = data[i];
 					}
 
 					switch (word) {
@@ -1388,43 +1486,43 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								 tex_num *
 								 4) & 0xf) {
 							case 0:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=2D ",
 									tex_num);
 								break;
 							case 1:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=3D ",
 									tex_num);
 								break;
 							case 2:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=4D ",
 									tex_num);
 								break;
 							case 3:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=1D ",
 									tex_num);
 								break;
 							case 4:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=2D_16 ",
 									tex_num);
 								break;
 							case 5:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=4D_16 ",
 									tex_num);
 								break;
 							case 0xf:
-								fprintf(out,
+								msg_out(ctx,
 									"%i=NP ",
 									tex_num);
 								break;
 							}
 						}
-						fprintf(out, "\n");
+						msg_out(ctx, "\n");
 
 						break;
 					case 3:
@@ -1725,11 +1823,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		}
 		return len;
 	case 0x03:
+		packet_begin(ctx, "3DSTATE_LOAD_STATE_IMMEDIATE_2");
 		instr_out(ctx, 0,
 			  "3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		len = (data[0] & 0x0000000f) + 2;
@@ -1775,11 +1874,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		}
 		return len;
 	case 0x00:
+		packet_begin(ctx, "3DSTATE_MAP_STATE");
 		instr_out(ctx, 0, "3DSTATE_MAP_STATE\n");
 		len = (data[0] & 0x0000003f) + 2;
 		instr_out(ctx, 1, "mask\n");
@@ -1977,11 +2077,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_MAP_STATE\n");
+			msg_out(ctx, "Bad count in 3DSTATE_MAP_STATE\n");
 			return len;
 		}
 		return len;
 	case 0x06:
+		packet_begin(ctx, "3DSTATE_PIXEL_SHADER_CONSTANTS");
 		instr_out(ctx, 0,
 			  "3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		len = (data[0] & 0x000000ff) + 2;
@@ -2004,15 +2105,16 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		}
 		return len;
 	case 0x05:
+		packet_begin(ctx, "3DSTATE_PIXEL_SHADER_PROGRAM");
 		instr_out(ctx, 0, "3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		len = (data[0] & 0x000000ff) + 2;
 		if ((len - 1) % 3 != 0 || len > 370) {
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		}
 		i = 1;
@@ -2028,6 +2130,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 	case 0x01:
 		if (IS_GEN2(devid))
 			break;
+		packet_begin(ctx, "3DSTATE_SAMPLER_STATE");
 		instr_out(ctx, 0, "3DSTATE_SAMPLER_STATE\n");
 		instr_out(ctx, 1, "mask\n");
 		len = (data[0] & 0x0000003f) + 2;
@@ -2090,16 +2193,17 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_SAMPLER_STATE\n");
+			msg_out(ctx, "Bad count in 3DSTATE_SAMPLER_STATE\n");
 		}
 		return len;
 	case 0x85:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 2)
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
 
+		packet_begin(ctx, "3DSTATE_DEST_BUFFER_VARIABLES");
 		instr_out(ctx, 0,
 			  "3DSTATE_DEST_BUFFER_VARIABLES\n");
 
@@ -2167,7 +2271,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 			len = (data[0] & 0x0000000f) + 2;
 			if (len != 3)
-				fprintf(out,
+				msg_out(ctx,
 					"Bad count in 3DSTATE_BUFFER_INFO\n");
 
 			switch ((data[1] >> 24) & 0x7) {
@@ -2188,6 +2292,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			else if (data[1] & (1 << 22))
 				tiling = data[1] & (1 << 21) ? "Y" : "X";
 
+			packet_begin(ctx, "3DSTATE_BUFFER_INFO");
 			instr_out(ctx, 0, "3DSTATE_BUFFER_INFO\n");
 			instr_out(ctx, 1,
 				  "%s, tiling = %s, pitch=%d\n", name, tiling,
@@ -2200,9 +2305,10 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 3)
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
 
+		packet_begin(ctx, "3DSTATE_SCISSOR_RECTANGLE");
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_RECTANGLE\n");
 		instr_out(ctx, 1, "(%d,%d)\n",
 			  data[1] & 0xffff, data[1] >> 16);
@@ -2214,9 +2320,10 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 5)
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
 
+		packet_begin(ctx, "3DSTATE_DRAWING_RECTANGLE");
 		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
 		instr_out(ctx, 1, "%s\n",
 			  data[1] & (1 << 30) ? "depth ofs disabled " : "");
@@ -2232,8 +2339,9 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 7)
-			fprintf(out, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
+			msg_out(ctx, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
 
+		packet_begin(ctx, "3DSTATE_CLEAR_PARAMETERS");
 		instr_out(ctx, 0, "3DSTATE_CLEAR_PARAMETERS\n");
 		instr_out(ctx, 1, "prim_type=%s, clear=%s%s%s\n",
 			  data[1] & (1 << 16) ? "CLEAR_RECT" : "ZONE_INIT",
@@ -2249,31 +2357,27 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d_1d); idx++) {
-		opcode_3d_1d = &opcodes_3d_1d[idx];
-		if (opcode_3d_1d->i830_only && !IS_GEN2(devid))
-			continue;
-
-		if (((data[0] & 0x00ff0000) >> 16) == opcode_3d_1d->opcode) {
-			len = 1;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcode_3d_1d->name);
-			if (opcode_3d_1d->max_len > 1) {
-				len = (data[0] & 0x0000ffff) + 2;
-				if (len < opcode_3d_1d->min_len ||
-				    len > opcode_3d_1d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d_1d->name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	idx = ctx->dispatch_3d_1d[opcode];
+	if (idx) {
+		opcode_3d_1d = &opcodes_3d_1d[idx - 1];
+		len = 1;
+
+		packet_begin(ctx, opcode_3d_1d->name);
+		instr_out(ctx, 0, "%s\n", opcode_3d_1d->name);
+		if (opcode_3d_1d->max_len > 1) {
+			len = (data[0] & 0x0000ffff) + 2;
+			if (len < opcode_3d_1d->min_len ||
+			    len > opcode_3d_1d->max_len) {
+				msg_out(ctx, "Bad count in %s\n",
+					opcode_3d_1d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d_1d opcode = 0x%x\n",
@@ -2289,8 +2393,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	char immediate = (data[0] & (1 << 23)) == 0;
 	unsigned int len, i, j, ret;
 	const char *primtype;
-	int original_s2 = saved_s2;
-	int original_s4 = saved_s4;
+	int original_s2 = ctx->saved_s2;
+	int original_s4 = ctx->saved_s4;
 
 	switch ((data[0] >> 18) & 0xf) {
 	case 0x0:
@@ -2325,8 +2429,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 		break;
 	case 0xa:
 		primtype = "CLEAR_RECT";
-		saved_s4 = 3 << 6;
-		saved_s2 = ~0;
+		ctx->saved_s4 = 3 << 6;
+		ctx->saved_s2 = ~0;
 		break;
 	default:
 		primtype = "unknown";
@@ -2336,12 +2440,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	/* XXX: 3DPRIM_DIB not supported */
 	if (immediate) {
 		len = (data[0] & 0x0003ffff) + 2;
+		packet_begin(ctx, "3DPRIMITIVE");
 		instr_out(ctx, 0, "3DPRIMITIVE inline %s\n",
 			  primtype);
 		if (count < len)
 			BUFFER_FAIL(count, len, "3DPRIMITIVE inline");
-		if (!saved_s2_set || !saved_s4_set) {
-			fprintf(out, "unknown vertex format\n");
+		if (!ctx->saved_s2_set || !ctx->saved_s4_set) {
+			msg_out(ctx, "unknown vertex format\n");
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i,
 					  "           vertex data (%f float)\n",
@@ -2356,13 +2461,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
     if (i < len)							\
 	instr_out(ctx, i, " V%d."fmt"\n", vertex, __VA_ARGS__); \
     else								\
-	fprintf(out, " missing data in V%d\n", vertex);			\
+	msg_out(ctx, " missing data in V%d\n", vertex);			\
     i++;								\
 } while (0)
 
 				VERTEX_OUT("X = %f", int_as_float(data[i]));
 				VERTEX_OUT("Y = %f", int_as_float(data[i]));
-				switch (saved_s4 >> 6 & 0x7) {
+				switch (ctx->saved_s4 >> 6 & 0x7) {
 				case 0x1:
 					VERTEX_OUT("Z = %f",
 						   int_as_float(data[i]));
@@ -2380,10 +2485,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 						   int_as_float(data[i]));
 					break;
 				default:
-					fprintf(out, "bad S4 position mask\n");
+					msg_out(ctx, "bad S4 position mask\n");
 				}
 
-				if (saved_s4 & (1 << 10)) {
+				if (ctx->saved_s4 & (1 << 10)) {
 					VERTEX_OUT
 					    ("color = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2391,7 +2496,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 11)) {
+				if (ctx->saved_s4 & (1 << 11)) {
 					VERTEX_OUT
 					    ("spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2399,11 +2504,11 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 12))
+				if (ctx->saved_s4 & (1 << 12))
 					VERTEX_OUT("width = 0x%08x)", data[i]);
 
 				for (tc = 0; tc <= 7; tc++) {
-					switch ((saved_s2 >> (tc * 4)) & 0xf) {
+					switch ((ctx->saved_s2 >> (tc * 4)) & 0xf) {
 					case 0x0:
 						VERTEX_OUT("T%d.X = %f", tc,
 							   int_as_float(data
@@ -2458,7 +2563,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					case 0xf:
 						break;
 					default:
-						fprintf(out,
+						msg_out(ctx,
 							"bad S2.T%d format\n",
 							tc);
 					}
@@ -2477,6 +2582,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 				BUFFER_FAIL(count, (len + 1) / 2 + 1,
 					    "3DPRIMITIVE random indirect");
 			}
+			packet_begin(ctx, "3DPRIMITIVE");
 			instr_out(ctx, 0,
 				  "3DPRIMITIVE random indirect %s (%d)\n",
 				  primtype, len);
@@ -2503,7 +2609,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 							  data[i] >> 16);
 					}
 				}
-				fprintf(out,
+				msg_out(ctx,
 					"3DPRIMITIVE: no terminator found in index buffer\n");
 				ret = count;
 				goto out;
@@ -2526,6 +2632,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			goto out;
 		} else {
 			/* sequential vertex access */
+			packet_begin(ctx, "3DPRIMITIVE");
 			instr_out(ctx, 0,
 				  "3DPRIMITIVE sequential indirect %s, %d starting from "
 				  "%d\n", primtype, len, data[1] & 0xffff);
@@ -2536,34 +2643,30 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	}
 
 out:
-	saved_s2 = original_s2;
-	saved_s4 = original_s4;
+	ctx->saved_s2 = original_s2;
+	ctx->saved_s4 = original_s4;
 	return ret;
 }
 
+static const struct opcode_desc opcodes_3d_915[] = {
+	{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
+	{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
+	{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
+	{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
+	{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
+};
+
 static int
 decode_3d(struct drm_intel_decode *ctx)
 {
 	uint32_t opcode;
 	unsigned int idx;
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
-		{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
-		{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
-		{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
-		{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
-	}, *opcode_3d;
+	const struct opcode_desc *opcode_3d;
 
 	opcode = (data[0] & 0x1f000000) >> 24;
 
@@ -2576,26 +2679,26 @@ decode_3d(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if (opcode == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
+	idx = ctx->dispatch_3d[opcode];
+	if (idx) {
+		unsigned int len = 1, i;
+
+		opcode_3d = &opcodes_3d_915[idx - 1];
+		packet_begin(ctx, opcode_3d->name);
+		instr_out(ctx, 0, "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & 0xff) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				msg_out(ctx, "Bad count in %s\n",
+					opcode_3d->name);
 			}
+		}
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d opcode = 0x%x\n", opcode);
@@ -2728,7 +2831,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	uint32_t *data = ctx->data;
 
 	if (len != 3)
-		fprintf(out, "Bad count in URB_FENCE\n");
+		msg_out(ctx, "Bad count in URB_FENCE\n");
 
 	vs_fence = data[1] & 0x3ff;
 	gs_fence = (data[1] >> 10) & 0x3ff;
@@ -2737,6 +2840,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	vfe_fence = (data[2] >> 10) & 0x3ff;
 	cs_fence = (data[2] >> 20) & 0x7ff;
 
+	packet_begin(ctx, "URB_FENCE");
 	instr_out(ctx, 0, "URB_FENCE: %s%s%s%s%s%s\n",
 		  (data[0] >> 13) & 1 ? "cs " : "",
 		  (data[0] >> 12) & 1 ? "vfe " : "",
@@ -2751,13 +2855,13 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 		  "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
 		  sf_fence, vfe_fence, cs_fence);
 	if (gs_fence < vs_fence)
-		fprintf(out, "gs fence < vs fence!\n");
+		msg_out(ctx, "gs fence < vs fence!\n");
 	if (clip_fence < gs_fence)
-		fprintf(out, "clip fence < gs fence!\n");
+		msg_out(ctx, "clip fence < gs fence!\n");
 	if (sf_fence < clip_fence)
-		fprintf(out, "sf fence < clip fence!\n");
+		msg_out(ctx, "sf fence < clip fence!\n");
 	if (cs_fence < sf_fence)
-		fprintf(out, "cs fence < sf fence!\n");
+		msg_out(ctx, "cs fence < sf fence!\n");
 
 	return len;
 }
@@ -2798,6 +2902,7 @@ state_max_out(struct drm_intel_decode *ctx, unsigned int index,
 static int
 gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS_CC");
 	instr_out(ctx, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_CC\n");
 	instr_out(ctx, 1, "pointer to CC viewport\n");
 
@@ -2807,6 +2912,7 @@ gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP");
 	instr_out(ctx, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP\n");
 	instr_out(ctx, 1, "pointer to SF_CLIP viewport\n");
 
@@ -2816,6 +2922,7 @@ gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_BLEND_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_BLEND_STATE_POINTERS");
 	instr_out(ctx, 0, "3DSTATE_BLEND_STATE_POINTERS\n");
 	instr_out(ctx, 1, "pointer to BLEND_STATE at 0x%08x (%s)\n",
 		  ctx->data[1] & ~1,
@@ -2827,6 +2934,7 @@ gen7_3DSTATE_BLEND_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS");
 	instr_out(ctx, 0, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS\n");
 	instr_out(ctx, 1,
 		  "pointer to DEPTH_STENCIL_STATE at 0x%08x (%s)\n",
@@ -2839,6 +2947,7 @@ gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_HIER_DEPTH_BUFFER(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_HIER_DEPTH_BUFFER");
 	instr_out(ctx, 0, "3DSTATE_HIER_DEPTH_BUFFER\n");
 	instr_out(ctx, 1, "pitch %db\n",
 		  (ctx->data[1] & 0x1ffff) + 1);
@@ -2850,6 +2959,7 @@ gen7_3DSTATE_HIER_DEPTH_BUFFER(struct drm_intel_decode *ctx)
 static int
 gen6_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CC_STATE_POINTERS");
 	instr_out(ctx, 0, "3DSTATE_CC_STATE_POINTERS\n");
 	instr_out(ctx, 1, "blend change %d\n", ctx->data[1] & 1);
 	instr_out(ctx, 2, "depth stencil change %d\n",
@@ -2862,6 +2972,7 @@ gen6_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CC_STATE_POINTERS");
 	instr_out(ctx, 0, "3DSTATE_CC_STATE_POINTERS\n");
 	instr_out(ctx, 1, "pointer to COLOR_CALC_STATE at 0x%08x "
 		  "(%s)\n",
@@ -2890,24 +3001,28 @@ gen7_3DSTATE_URB_unit(struct drm_intel_decode *ctx, const char *unit)
 static int
 gen7_3DSTATE_URB_VS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_URB_VS");
 	return gen7_3DSTATE_URB_unit(ctx, "VS");
 }
 
 static int
 gen7_3DSTATE_URB_HS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_URB_HS");
 	return gen7_3DSTATE_URB_unit(ctx, "HS");
 }
 
 static int
 gen7_3DSTATE_URB_DS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_URB_DS");
 	return gen7_3DSTATE_URB_unit(ctx, "DS");
 }
 
 static int
 gen7_3DSTATE_URB_GS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_URB_GS");
 	return gen7_3DSTATE_URB_unit(ctx, "GS");
 }
 
@@ -2935,30 +3050,35 @@ gen7_3DSTATE_CONSTANT(struct drm_intel_decode *ctx, const char *unit)
 static int
 gen7_3DSTATE_CONSTANT_VS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CONSTANT_VS");
 	return gen7_3DSTATE_CONSTANT(ctx, "VS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_GS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CONSTANT_GS");
 	return gen7_3DSTATE_CONSTANT(ctx, "GS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_PS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CONSTANT_PS");
 	return gen7_3DSTATE_CONSTANT(ctx, "PS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_DS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CONSTANT_DS");
 	return gen7_3DSTATE_CONSTANT(ctx, "DS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_HS(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_CONSTANT_HS");
 	return gen7_3DSTATE_CONSTANT(ctx, "HS");
 }
 
@@ -2966,6 +3086,7 @@ gen7_3DSTATE_CONSTANT_HS(struct drm_intel_decode *ctx)
 static int
 gen6_3DSTATE_WM(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DSTATE_WM");
 	instr_out(ctx, 0, "3DSTATE_WM\n");
 	instr_out(ctx, 1, "kernel start pointer 0\n");
 	instr_out(ctx, 2,
@@ -3068,6 +3189,7 @@ gen7_3DSTATE_WM(struct drm_intel_decode *ctx)
 		break;
 	}
 
+	packet_begin(ctx, "3DSTATE_WM");
 	instr_out(ctx, 0, "3DSTATE_WM\n");
 	instr_out(ctx, 1, "(%s%s%s%s%s%s)%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
 		  (ctx->data[1] & (1 << 11)) ? "PP " : "",
@@ -3099,6 +3221,7 @@ gen7_3DSTATE_WM(struct drm_intel_decode *ctx)
 static int
 gen4_3DPRIMITIVE(struct drm_intel_decode *ctx)
 {
+	packet_begin(ctx, "3DPRIMITIVE");
 	instr_out(ctx, 0,
 		  "3DPRIMITIVE: %s %s\n",
 		  get_965_prim_type((ctx->data[0] >> 10) & 0x1f),
@@ -3117,6 +3240,7 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 {
 	bool indirect = !!(ctx->data[0] & (1 << 10));
 
+	packet_begin(ctx, "3DPRIMITIVE");
 	instr_out(ctx, 0,
 		  "3DPRIMITIVE: %s%s\n",
 		  indirect ? " indirect" : "",
@@ -3133,6 +3257,107 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 	return 7;
 }
 
+struct opcode_3d_965 {
+	uint32_t opcode;
+	uint32_t len_mask;
+	int unsigned min_len;
+	int unsigned max_len;
+	const char *name;
+	int gen;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+static const struct opcode_3d_965 opcodes_3d_965[] = {
+	{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
+	{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
+	{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
+	{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
+	{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
+	{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
+	{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
+	{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
+	{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
+	{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
+	{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
+	{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
+	{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
+	{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
+	{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
+	{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
+	{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
+	{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
+	{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
+	{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
+	{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
+	{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
+	{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
+	{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
+	{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
+	{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
+	{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
+	{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
+	{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
+	{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
+	{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
+	{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
+	{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
+	{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
+	{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
+	{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
+	{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
+	{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
+	{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
+	{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
+	{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
+	{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
+	{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
+	{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
+	{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
+	{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
+	{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
+	{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
+	{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
+	{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
+	{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
+	{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
+	{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
+	{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
+	{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
+	{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
+	{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
+	{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
+	{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
+	{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
+	{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
+	{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
+	{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
+};
+
 static int
 decode_3d_965(struct drm_intel_decode *ctx)
 {
@@ -3142,119 +3367,13 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	const char *desc1 = NULL;
 	uint32_t *data = ctx->data;
 	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		uint32_t len_mask;
-		int unsigned min_len;
-		int unsigned max_len;
-		const char *name;
-		int gen;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_3d[] = {
-		{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
-		{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
-		{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
-		{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
-		{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
-		{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
-		{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
-		{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
-		{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
-		{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
-		{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
-		{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
-		{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
-		{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
-		{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
-		{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
-		{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
-		{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
-		{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
-		{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
-		{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
-		{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
-		{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
-		{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
-		{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
-		{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
-		{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
-		{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
-		{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
-		{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
-		{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
-		{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
-		{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
-		{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
-		{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
-		{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
-		{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
-		{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
-		{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
-		{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
-		{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
-		{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
-		{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
-		{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
-		{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
-		{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
-		{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
-		{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
-		{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
-		{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
-		{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
-		{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
-		{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
-		{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
-		{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
-		{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
-		{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
-		{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
-		{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
-		{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
-		{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
-		{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
-		{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
-		{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
-		{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
-		{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
-		{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
-		{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
-		{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
-		{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
-		{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
-		{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
-		{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
-		{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
-		{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
-		{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
-		{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
-	}, *opcode_3d = NULL;
+	const struct opcode_3d_965 *opcode_3d = NULL;
 
 	opcode = (data[0] & 0xffff0000) >> 16;
 
-	for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++) {
-		if (opcode != opcodes_3d[i].opcode)
-			continue;
-
-		/* If it's marked as not our gen, skip. */
-		if (opcodes_3d[i].gen && opcodes_3d[i].gen != ctx->gen)
-			continue;
-
-		opcode_3d = &opcodes_3d[i];
-		break;
-	}
+	i = ctx->dispatch_3d_965[opcode & 0x1fff];
+	if (i)
+		opcode_3d = &opcodes_3d_965[i - 1];
 
 	if (opcode_3d) {
 		if (opcode_3d->max_len == 1)
@@ -3264,7 +3383,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		if (len < opcode_3d->min_len ||
 		    len > opcode_3d->max_len) {
-			fprintf(out, "Bad length %d in %s, expected %d-%d\n",
+			msg_out(ctx, "Bad length %d in %s, expected %d-%d\n",
 				len, opcode_3d->name,
 				opcode_3d->min_len, opcode_3d->max_len);
 		}
@@ -3276,6 +3395,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	case 0x6000:
 		return i965_decode_urb_fence(ctx, len);
 	case 0x6001:
+		packet_begin(ctx, "CS_URB_STATE");
 		instr_out(ctx, 0, "CS_URB_STATE\n");
 		instr_out(ctx, 1,
 			  "entry_size: %d [%d bytes], n_entries: %d\n",
@@ -3283,6 +3403,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			  (((data[1] >> 4) & 0x1f) + 1) * 64, data[1] & 0x7);
 		return len;
 	case 0x6002:
+		packet_begin(ctx, "CONSTANT_BUFFER");
 		instr_out(ctx, 0, "CONSTANT_BUFFER: %s\n",
 			  (data[0] >> 8) & 1 ? "valid" : "invalid");
 		instr_out(ctx, 1,
@@ -3291,6 +3412,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x6101:
 		i = 0;
+		packet_begin(ctx, "STATE_BASE_ADDRESS");
 		instr_out(ctx, 0, "STATE_BASE_ADDRESS\n");
 		i++;
 
@@ -3301,7 +3423,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		else
 			sba_len = 6;
 		if (len != sba_len)
-			fprintf(out, "Bad count in STATE_BASE_ADDRESS\n");
+			msg_out(ctx, "Bad count in STATE_BASE_ADDRESS\n");
 
 		state_base_out(ctx, i++, "general");
 		state_base_out(ctx, i++, "surface");
@@ -3320,6 +3442,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		return len;
 	case 0x7800:
+		packet_begin(ctx, "3DSTATE_PIPELINED_POINTERS");
 		instr_out(ctx, 0, "3DSTATE_PIPELINED_POINTERS\n");
 		instr_out(ctx, 1, "VS state\n");
 		instr_out(ctx, 2, "GS state\n");
@@ -3330,9 +3453,10 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x7801:
 		if (len != 6 && len != 4)
-			fprintf(out,
+			msg_out(ctx,
 				"Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
 		if (len == 6) {
+			packet_begin(ctx, "3DSTATE_BINDING_TABLE_POINTERS");
 			instr_out(ctx, 0,
 				  "3DSTATE_BINDING_TABLE_POINTERS\n");
 			instr_out(ctx, 1, "VS binding table\n");
@@ -3341,6 +3465,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			instr_out(ctx, 4, "SF binding table\n");
 			instr_out(ctx, 5, "WM binding table\n");
 		} else {
+			packet_begin(ctx, "3DSTATE_BINDING_TABLE_POINTERS");
 			instr_out(ctx, 0,
 				  "3DSTATE_BINDING_TABLE_POINTERS: VS mod %d, "
 				  "GS mod %d, PS mod %d\n",
@@ -3354,6 +3479,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		return len;
 	case 0x7802:
+		packet_begin(ctx, "3DSTATE_SAMPLER_STATE_POINTERS");
 		instr_out(ctx, 0,
 			  "3DSTATE_SAMPLER_STATE_POINTERS: VS mod %d, "
 			  "GS mod %d, PS mod %d\n", (data[0] & (1 << 8)) != 0,
@@ -3368,6 +3494,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (ctx->gen == 7)
 			break;
 
+		packet_begin(ctx, "3DSTATE_URB");
 		instr_out(ctx, 0, "3DSTATE_URB\n");
 		instr_out(ctx, 1,
 			  "VS entries %d, alloc size %d (1024bit row)\n",
@@ -3379,7 +3506,8 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7808:
 		if ((len - 1) % 4 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+			msg_out(ctx, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+		packet_begin(ctx, "3DSTATE_VERTEX_BUFFERS");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_BUFFERS\n");
 
 		for (i = 1; i < len;) {
@@ -3404,7 +3532,8 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7809:
 		if ((len + 1) % 2 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+			msg_out(ctx, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+		packet_begin(ctx, "3DSTATE_VERTEX_ELEMENTS");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_ELEMENTS\n");
 
 		for (i = 1; i < len;) {
@@ -3428,6 +3557,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x780d:
+		packet_begin(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS");
 		instr_out(ctx, 0,
 			  "3DSTATE_VIEWPORT_STATE_POINTERS\n");
 		instr_out(ctx, 1, "clip\n");
@@ -3436,17 +3566,20 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x780a:
+		packet_begin(ctx, "3DSTATE_INDEX_BUFFER");
 		instr_out(ctx, 0, "3DSTATE_INDEX_BUFFER\n");
 		instr_out(ctx, 1, "beginning buffer address\n");
 		instr_out(ctx, 2, "ending buffer address\n");
 		return len;
 
 	case 0x780f:
+		packet_begin(ctx, "3DSTATE_SCISSOR_POINTERS");
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_POINTERS\n");
 		instr_out(ctx, 1, "scissor rect offset\n");
 		return len;
 
 	case 0x7810:
+		packet_begin(ctx, "3DSTATE_VS");
 		instr_out(ctx, 0, "3DSTATE_VS\n");
 		instr_out(ctx, 1, "kernel pointer\n");
 		instr_out(ctx, 2,
@@ -3467,6 +3600,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7811:
+		packet_begin(ctx, "3DSTATE_GS");
 		instr_out(ctx, 0, "3DSTATE_GS\n");
 		instr_out(ctx, 1, "kernel pointer\n");
 		instr_out(ctx, 2,
@@ -3492,6 +3626,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7812:
+		packet_begin(ctx, "3DSTATE_CLIP");
 		instr_out(ctx, 0, "3DSTATE_CLIP\n");
 		instr_out(ctx, 1,
 			  "UserClip distance cull test mask 0x%x\n",
@@ -3523,6 +3658,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (ctx->gen == 7)
 			break;
 
+		packet_begin(ctx, "3DSTATE_SF");
 		instr_out(ctx, 0, "3DSTATE_SF\n");
 		instr_out(ctx, 1,
 			  "Attrib Out %d, Attrib Swizzle %sable, VUE read length %d, "
@@ -3584,6 +3720,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7900:
+		packet_begin(ctx, "3DSTATE_DRAWING_RECTANGLE");
 		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
 		instr_out(ctx, 1, "top left: %d,%d\n",
 			  data[1] & 0xffff, (data[1] >> 16) & 0xffff);
@@ -3595,6 +3732,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7905:
+		packet_begin(ctx, "3DSTATE_DEPTH_BUFFER");
 		instr_out(ctx, 0, "3DSTATE_DEPTH_BUFFER\n");
 		if (IS_GEN5(devid) || IS_GEN6(devid))
 			instr_out(ctx, 1,
@@ -3632,7 +3770,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	case 0x7a00:
 		if (IS_GEN6(devid) || IS_GEN7(devid)) {
 			if (len != 4 && len != 5)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				msg_out(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[1] >> 14) & 0x3) {
 			case 0:
@@ -3648,6 +3786,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 				desc1 = "TIMESTAMP write";
 				break;
 			}
+			packet_begin(ctx, "PIPE_CONTROL");
 			instr_out(ctx, 0, "PIPE_CONTROL\n");
 			instr_out(ctx, 1,
 				  "%s, %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
@@ -3698,7 +3837,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			return len;
 		} else {
 			if (len != 4)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				msg_out(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[0] >> 14) & 0x3) {
 			case 0:
@@ -3714,6 +3853,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 				desc1 = "TIMESTAMP write";
 				break;
 			}
+			packet_begin(ctx, "PIPE_CONTROL");
 			instr_out(ctx, 0,
 				  "PIPE_CONTROL: %s, %sdepth stall, %sRC write flush, "
 				  "%sinst flush\n",
@@ -3732,6 +3872,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (opcode_3d->func) {
 			return opcode_3d->func(ctx);
 		} else {
+			packet_begin(ctx, opcode_3d->name);
 			instr_out(ctx, 0, "%s\n", opcode_3d->name);
 
 			for (i = 1; i < len; i++) {
@@ -3746,36 +3887,32 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static const struct opcode_desc opcodes_3d_i830[] = {
+	{ 0x02, 1, 1, "3DSTATE_MODES_3" },
+	{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
+	{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
+	{ 0x05, 1, 1, "3DSTATE_VFT0" },
+	{ 0x06, 1, 1, "3DSTATE_AA" },
+	{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
+	{ 0x08, 1, 1, "3DSTATE_MODES_1" },
+	{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
+	{ 0x0a, 1, 1, "3DSTATE_VFT1" },
+	{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
+	{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
+	{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
+	{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
+	{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x16, 1, 1, "3DSTATE_MODES_4"},
+};
+
 static int
 decode_3d_i830(struct drm_intel_decode *ctx)
 {
 	unsigned int idx;
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x02, 1, 1, "3DSTATE_MODES_3" },
-		{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
-		{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
-		{ 0x05, 1, 1, "3DSTATE_VFT0" },
-		{ 0x06, 1, 1, "3DSTATE_AA" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
-		{ 0x08, 1, 1, "3DSTATE_MODES_1" },
-		{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
-		{ 0x0a, 1, 1, "3DSTATE_VFT1" },
-		{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
-		{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
-		{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x16, 1, 1, "3DSTATE_MODES_4"},
-	}, *opcode_3d;
+	const struct opcode_desc *opcode_3d;
 
 	opcode = (data[0] & 0x1f000000) >> 24;
 
@@ -3788,26 +3925,26 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if ((data[0] & 0x1f000000) >> 24 == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
+	idx = ctx->dispatch_3d[opcode];
+	if (idx) {
+		unsigned int len = 1, i;
+
+		opcode_3d = &opcodes_3d_i830[idx - 1];
+		packet_begin(ctx, opcode_3d->name);
+		instr_out(ctx, 0, "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & 0xff) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				msg_out(ctx, "Bad count in %s\n",
+					opcode_3d->name);
 			}
+		}
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+		return len;
 	}
 
 	instr_out(ctx, 0, "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
@@ -3815,6 +3952,222 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static void DRM_PRINTFLIKE(5, 0)
+text_field(void *data, uint32_t offset, unsigned int index, uint32_t value,
+	   const char *fmt, va_list va)
+{
+	struct drm_intel_decode *ctx = data;
+	const char *parseinfo;
+
+	if (offset == ctx->head)
+		parseinfo = "HEAD";
+	else if (offset == ctx->tail)
+		parseinfo = "TAIL";
+	else
+		parseinfo = "    ";
+
+	fprintf(ctx->out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
+		value, index == 0 ? "" : "   ");
+	vfprintf(ctx->out, fmt, va);
+}
+
+static void
+text_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	struct drm_intel_decode *ctx = data;
+
+	fflush(ctx->out);
+}
+
+static void DRM_PRINTFLIKE(2, 0)
+text_message(void *data, const char *fmt, va_list va)
+{
+	struct drm_intel_decode *ctx = data;
+
+	vfprintf(ctx->out, fmt, va);
+}
+
+static const struct drm_intel_decode_visitor text_visitor = {
+	.field = text_field,
+	.packet = text_packet,
+	.message = text_message,
+};
+
+/* Longest string the JSON output writes; longer ones are truncated. */
+#define JSON_STRING_MAX	256
+
+/**
+ * Writes the first \p len characters of \p str to \p dst as a JSON
+ * string, which takes up to 2 + 6 * \p len bytes, and returns its end.
+ */
+static char *
+json_escape(char *dst, const char *str, size_t len)
+{
+	size_t i;
+
+	*dst++ = '"';
+	for (i = 0; i < len; i++) {
+		if (str[i] == '"' || str[i] == '\\') {
+			*dst++ = '\\';
+			*dst++ = str[i];
+		} else if (str[i] == '\n') {
+			*dst++ = '\\';
+			*dst++ = 'n';
+		} else if ((unsigned char)str[i] < 0x20) {
+			dst += sprintf(dst, "\\u%04x", str[i]);
+		} else {
+			*dst++ = str[i];
+		}
+	}
+	*dst++ = '"';
+
+	return dst;
+}
+
+static void
+json_string(FILE *out, const char *str)
+{
+	char buf[2 + 6 * JSON_STRING_MAX];
+	size_t len = strlen(str);
+
+	if (len > JSON_STRING_MAX)
+		len = JSON_STRING_MAX;
+
+	fwrite(buf, 1, json_escape(buf, str, len) - buf, out);
+}
+
+/* Adds the description of a DWORD to those of the packet, without the
+ * newline ending it.  The field is left out if there is no memory for it.
+ */
+static void DRM_PRINTFLIKE(5, 0)
+json_field(void *data, uint32_t offset, unsigned int index, uint32_t value,
+	   const char *fmt, va_list va)
+{
+	struct drm_intel_decode *ctx = data;
+	char desc[JSON_STRING_MAX + 1], *end;
+	size_t len, size;
+	int ret;
+
+	ret = vsnprintf(desc, sizeof(desc), fmt, va);
+	if (ret < 0)
+		return;
+	len = (size_t)ret < sizeof(desc) ? (size_t)ret : sizeof(desc) - 1;
+	while (len > 0 && (desc[len - 1] == '\n' || desc[len - 1] == ' '))
+		len--;
+
+	size = ctx->json_fields_len + 32 + 2 + 6 * len;
+	if (size > ctx->json_fields_size) {
+		char *fields;
+
+		size = size > 2 * ctx->json_fields_size ?
+			size : 2 * ctx->json_fields_size;
+		fields = realloc(ctx->json_fields, size);
+		if (!fields)
+			return;
+		ctx->json_fields = fields;
+		ctx->json_fields_size = size;
+	}
+
+	end = ctx->json_fields + ctx->json_fields_len;
+	end += sprintf(end, "%s{\"dword\":%u,\"desc\":",
+		       ctx->json_fields_len ? "," : "", index);
+	end = json_escape(end, desc, len);
+	*end++ = '}';
+	ctx->json_fields_len = end - ctx->json_fields;
+}
+
+/* The JSON output is one object per line, with the raw DWORDs of each
+ * packet and the descriptions of its fields the text output would print.
+ */
+static void
+json_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	struct drm_intel_decode *ctx = data;
+	uint32_t i;
+
+	fprintf(ctx->out, "{\"offset\":%u,\"header\":%u,\"name\":",
+		packet->offset, packet->header);
+	json_string(ctx->out, packet->name);
+	fprintf(ctx->out, ",\"length\":%u,\"data\":[", packet->length);
+	for (i = 0; i < packet->length; i++)
+		fprintf(ctx->out, i ? ",%u" : "%u", packet->data[i]);
+	fputs("],\"fields\":[", ctx->out);
+	fwrite(ctx->json_fields, 1, ctx->json_fields_len, ctx->out);
+	fputs("]}\n", ctx->out);
+
+	ctx->json_fields_len = 0;
+}
+
+static void DRM_PRINTFLIKE(2, 0)
+json_message(void *data, const char *fmt, va_list va)
+{
+	struct drm_intel_decode *ctx = data;
+	char msg[JSON_STRING_MAX + 1];
+
+	vsnprintf(msg, sizeof(msg), fmt, va);
+	fputs("{\"message\":", ctx->out);
+	json_string(ctx->out, msg);
+	fputs("}\n", ctx->out);
+}
+
+static const struct drm_intel_decode_visitor json_visitor = {
+	.field = json_field,
+	.packet = json_packet,
+	.message = json_message,
+};
+
+static void
+dispatch_set(uint8_t *table, uint32_t opcode, unsigned int idx)
+{
+	assert(idx < 255);
+
+	/* The first entry for an opcode wins, as with the old lookups. */
+	if (!table[opcode])
+		table[opcode] = idx + 1;
+}
+
+static void
+decode_build_dispatch(struct drm_intel_decode *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_mi); i++)
+		dispatch_set(ctx->dispatch_mi, opcodes_mi[i].opcode, i);
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_2d); i++)
+		dispatch_set(ctx->dispatch_2d, opcodes_2d[i].opcode, i);
+
+	if (ctx->gen >= 4) {
+		for (i = 0; i < ARRAY_SIZE(opcodes_3d_965); i++) {
+			/* If it's marked as not our gen, skip. */
+			if (opcodes_3d_965[i].gen &&
+			    opcodes_3d_965[i].gen != ctx->gen)
+				continue;
+
+			dispatch_set(ctx->dispatch_3d_965,
+				     opcodes_3d_965[i].opcode & 0x1fff, i);
+		}
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(opcodes_3d_1d); i++) {
+		if (opcodes_3d_1d[i].i830_only && ctx->gen != 2)
+			continue;
+
+		dispatch_set(ctx->dispatch_3d_1d, opcodes_3d_1d[i].opcode, i);
+	}
+
+	if (ctx->gen == 3) {
+		for (i = 0; i < ARRAY_SIZE(opcodes_3d_915); i++)
+			dispatch_set(ctx->dispatch_3d,
+				     opcodes_3d_915[i].opcode, i);
+	} else {
+		for (i = 0; i < ARRAY_SIZE(opcodes_3d_i830); i++)
+			dispatch_set(ctx->dispatch_3d,
+				     opcodes_3d_i830[i].opcode, i);
+	}
+}
+
 struct drm_intel_decode *
 drm_intel_decode_context_alloc(uint32_t devid)
 {
@@ -3826,6 +4179,8 @@ drm_intel_decode_context_alloc(uint32_t devid)
 
 	ctx->devid = devid;
 	ctx->out = stdout;
+	ctx->visitor = &text_visitor;
+	ctx->visitor_data = ctx;
 
 	if (IS_GEN9(devid))
 		ctx->gen = 9;
@@ -3846,12 +4201,19 @@ drm_intel_decode_context_alloc(uint32_t devid)
 		ctx->gen = 2;
 	}
 
+	decode_build_dispatch(ctx);
+
 	return ctx;
 }
 
 void
 drm_intel_decode_context_free(struct drm_intel_decode *ctx)
 {
+	if (!ctx)
+		return;
+
+	free(ctx->window);
+	free(ctx->json_fields);
 	free(ctx);
 }
 
@@ -3884,11 +4246,145 @@ drm_intel_decode_set_output_file(struct drm_intel_decode *ctx,
 				 FILE *output)
 {
 	ctx->out = output;
+	drm_intel_decode_set_visitor(ctx, NULL, NULL);
+}
+
+/**
+ * Writes the decode to \p output as JSON instead of text: one object
+ * per line with the offset, header, name, length, DWORDs and field
+ * descriptions of each packet, and one per diagnostic message.
+ */
+void
+drm_intel_decode_set_json_output(struct drm_intel_decode *ctx,
+				 FILE *output)
+{
+	ctx->out = output;
+	drm_intel_decode_set_visitor(ctx, &json_visitor, ctx);
+}
+
+/**
+ * Hands the decode to \p visitor instead of writing it out.  Passing
+ * NULL goes back to the text output.
+ */
+void
+drm_intel_decode_set_visitor(struct drm_intel_decode *ctx,
+			     const struct drm_intel_decode_visitor *visitor,
+			     void *data)
+{
+	if (!visitor) {
+		visitor = &text_visitor;
+		data = ctx;
+	}
+
+	ctx->visitor = visitor;
+	ctx->visitor_data = data;
+}
+
+/**
+ * Returns an upper bound on the DWORDs the decoder for the packet at
+ * ctx->data may look at: the widest length field its header could have,
+ * plus the padding statically sized packets are allowed to run into.
+ */
+static uint32_t
+decode_packet_extent(struct drm_intel_decode *ctx)
+{
+	uint32_t header = ctx->data[0];
+	uint32_t len_mask;
+
+	switch (header >> 29) {
+	case 0x0:
+	case 0x2:
+		len_mask = 0xff;
+		break;
+	case 0x3:
+		if (ctx->gen <= 3 && (header & 0x1f000000) >> 24 == 0x1f)
+			len_mask = 0x3ffff;
+		else
+			len_mask = 0xffff;
+		break;
+	default:
+		len_mask = 0;
+		break;
+	}
+
+	return (header & len_mask) + 2 + DECODE_PAD;
+}
+
+/**
+ * Makes sure \p extent DWORDs can be read from ctx->data.
+ *
+ * Packets are decoded straight out of the caller's buffer until one
+ * could run past its end.  From there on the rest of the batch is
+ * decoded out of ctx->window, which repeats the remaining DWORDs and
+ * pads them with 0xd0 so that the output does not depend on whatever
+ * follows the batch in memory.
+ */
+static bool
+decode_reserve(struct drm_intel_decode *ctx, uint32_t extent)
+{
+	uint32_t size = ctx->count + DECODE_PAD;
+	uint32_t *window;
+
+	if (extent <= ctx->avail)
+		return true;
+
+	if (extent > size)
+		size = extent;
+
+	if (size > ctx->window_size) {
+		size_t offset = 0;
+		bool in_window = ctx->window &&
+			ctx->data >= ctx->window &&
+			ctx->data < ctx->window + ctx->window_size;
+
+		if (in_window)
+			offset = ctx->data - ctx->window;
+
+		window = realloc(ctx->window, size * sizeof(uint32_t));
+		if (!window) {
+			msg_out(ctx, "ERROR: out of memory decoding batchbuffer\n");
+			return false;
+		}
+
+		ctx->window = window;
+		ctx->window_size = size;
+		if (in_window)
+			ctx->data = window + offset;
+	}
+
+	memmove(ctx->window, ctx->data, ctx->count * sizeof(uint32_t));
+	memset(ctx->window + ctx->count, 0xd0,
+	       (size - ctx->count) * sizeof(uint32_t));
+	ctx->data = ctx->window;
+	ctx->avail = size;
+
+	return true;
+}
+
+/* Reports the packet at ctx->data, once its DWORDs have been decoded. */
+static void
+packet_out(struct drm_intel_decode *ctx, uint32_t len)
+{
+	struct drm_intel_decode_packet packet;
+
+	if (!ctx->visitor->packet)
+		return;
+
+	packet.offset = ctx->hw_offset;
+	packet.header = ctx->data[0];
+	packet.name = ctx->packet_name ? ctx->packet_name : "UNKNOWN";
+	packet.length = len < ctx->count ? len : ctx->count;
+	packet.data = ctx->data;
+
+	ctx->visitor->packet(ctx->visitor_data, &packet);
 }
 
 /**
  * Decodes an i830-i915 batch buffer, writing the output to stdout.
  *
+ * The decode state lives in \p ctx, so separate contexts may decode in
+ * parallel.  The batch is read in place and is not modified.
+ *
  * \param data batch buffer contents
  * \param count number of DWORDs to decode in the batch buffer
  * \param hw_offset hardware address for the buffer
@@ -3899,54 +4395,41 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 	int ret;
 	unsigned int index = 0;
 	uint32_t devid;
-	int size = ctx->base_count * 4;
-	void *temp;
 
 	if (!ctx)
 		return;
 
-	/* Put a scratch page full of obviously undefined data after
-	 * the batchbuffer.  This lets us avoid a bunch of length
-	 * checking in statically sized packets.
-	 */
-	temp = malloc(size + 4096);
-	memcpy(temp, ctx->base_data, size);
-	memset((char *)temp + size, 0xd0, 4096);
-	ctx->data = temp;
-
+	ctx->data = ctx->base_data;
 	ctx->hw_offset = ctx->base_hw_offset;
 	ctx->count = ctx->base_count;
+	ctx->avail = ctx->count;
 
 	devid = ctx->devid;
-	head_offset = ctx->head;
-	tail_offset = ctx->tail;
-	out = ctx->out;
 
-	saved_s2_set = 0;
-	saved_s4_set = 1;
+	ctx->saved_s2_set = 0;
+	ctx->saved_s4_set = 1;
+
+	/* DWORDs dumped after the last packet of the previous batch are
+	 * not part of any packet
+	 */
+	ctx->json_fields_len = 0;
 
 	while (ctx->count > 0) {
+		bool batch_end = false;
+
 		index = 0;
+		ctx->packet_name = NULL;
+
+		if (!decode_reserve(ctx, decode_packet_extent(ctx)))
+			break;
 
 		switch ((ctx->data[index] & 0xe0000000) >> 29) {
 		case 0x0:
 			ret = decode_mi(ctx);
 
-			/* If MI_BATCHBUFFER_END happened, then dump
-			 * the rest of the output in case we some day
-			 * want it in debugging, but don't decode it
-			 * since it'll just confuse in the common
-			 * case.
-			 */
 			if (ret == -1) {
-				if (ctx->dump_past_end) {
-					index++;
-				} else {
-					for (index = index + 1; index < ctx->count;
-					     index++) {
-						instr_out(ctx, index, "\n");
-					}
-				}
+				batch_end = true;
+				index++;
 			} else
 				index += ret;
 			break;
@@ -3969,15 +4452,25 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 			index++;
 			break;
 		}
-		fflush(out);
+		packet_out(ctx, index);
+
+		/* If MI_BATCHBUFFER_END happened, then dump
+		 * the rest of the output in case we some day
+		 * want it in debugging, but don't decode it
+		 * since it'll just confuse in the common
+		 * case.
+		 */
+		if (batch_end && !ctx->dump_past_end) {
+			for (; index < ctx->count; index++)
+				instr_out(ctx, index, "\n");
+		}
 
 		if (ctx->count < index)
 			break;
 
 		ctx->count -= index;
+		ctx->avail -= index;
 		ctx->data += index;
 		ctx->hw_offset += 4 * index;
 	}
-
-	free(temp);
 }
@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "intel_vma_heap.h"
+
+/* Free blocks of [2^n, 2^(n+1)) bytes live on free[n]. */
+static int
+size_class(uint64_t size)
+{
+	return 63 - __builtin_clzll(size);
+}
+
+static void
+add_free(struct intel_vma_heap *heap, struct intel_vma_block *block)
+{
+	int n = size_class(block->size);
+
+	/* at the head, so that recently freed addresses are reused first */
+	DRMLISTADD(&block->free_link, &heap->free[n]);
+	heap->free_mask |= 1ull << n;
+	block->free = true;
+}
+
+static void
+remove_free(struct intel_vma_heap *heap, struct intel_vma_block *block)
+{
+	int n = size_class(block->size);
+
+	DRMLISTDEL(&block->free_link);
+	if (DRMLISTEMPTY(&heap->free[n]))
+		heap->free_mask &= ~(1ull << n);
+	block->free = false;
+}
+
+drm_private int
+intel_vma_heap_init(struct intel_vma_heap *heap, uint64_t start, uint64_t size)
+{
+	struct intel_vma_block *block;
+	int i;
+
+	DRMINITLISTHEAD(&heap->blocks);
+	for (i = 0; i < INTEL_VMA_HEAP_NUM_CLASSES; i++)
+		DRMINITLISTHEAD(&heap->free[i]);
+	heap->free_mask = 0;
+	heap->free_bytes = 0;
+
+	if (size == 0)
+		return 0;
+
+	block = calloc(1, sizeof(*block));
+	if (!block)
+		return -ENOMEM;
+
+	block->offset = start;
+	block->size = size;
+	DRMLISTADDTAIL(&block->link, &heap->blocks);
+	add_free(heap, block);
+	heap->free_bytes = size;
+
+	return 0;
+}
+
+drm_private void
+intel_vma_heap_fini(struct intel_vma_heap *heap)
+{
+	struct intel_vma_block *block, *tmp;
+
+	DRMLISTFOREACHENTRYSAFE(block, tmp, &heap->blocks, link)
+		free(block);
+	DRMINITLISTHEAD(&heap->blocks);
+	heap->free_mask = 0;
+	heap->free_bytes = 0;
+}
+
+/* Carves [@start, @start + @size) out of the free @block. */
+static struct intel_vma_block *
+split(struct intel_vma_heap *heap, struct intel_vma_block *block,
+      uint64_t start, uint64_t size)
+{
+	struct intel_vma_block *head = NULL, *tail = NULL;
+	uint64_t end = block->offset + block->size;
+
+	if (start > block->offset) {
+		head = calloc(1, sizeof(*head));
+		if (!head)
+			return NULL;
+	}
+	if (start + size < end) {
+		tail = calloc(1, sizeof(*tail));
+		if (!tail) {
+			free(head);
+			return NULL;
+		}
+	}
+
+	remove_free(heap, block);
+
+	if (head) {
+		head->offset = block->offset;
+		head->size = start - block->offset;
+		DRMLISTADDTAIL(&head->link, &block->link);
+		add_free(heap, head);
+	}
+	if (tail) {
+		tail->offset = start + size;
+		tail->size = end - tail->offset;
+		DRMLISTADD(&tail->link, &block->link);
+		add_free(heap, tail);
+	}
+
+	block->offset = start;
+	block->size = size;
+	heap->free_bytes -= size;
+
+	return block;
+}
+
+drm_private struct intel_vma_block *
+intel_vma_heap_alloc(struct intel_vma_heap *heap, uint64_t size,
+		     uint64_t alignment)
+{
+	uint64_t mask;
+
+	if (size == 0)
+		return NULL;
+	if (alignment == 0)
+		alignment = 1;
+
+	/* Every block in a larger class than the request fits it, bar
+	 * alignment, so the search normally ends at the first block
+	 * looked at.  Only the request's own class needs a first fit.
+	 */
+	mask = heap->free_mask & (~0ull << size_class(size));
+	while (mask) {
+		int n = ffsll(mask) - 1;
+		struct intel_vma_block *block;
+
+		DRMLISTFOREACHENTRY(block, &heap->free[n], free_link) {
+			uint64_t start = (block->offset + alignment - 1) &
+				~(alignment - 1);
+
+			if (start >= block->offset &&
+			    start - block->offset + size <= block->size)
+				return split(heap, block, start, size);
+		}
+
+		mask &= ~(1ull << n);
+	}
+
+	return NULL;
+}
+
+drm_private void
+intel_vma_heap_free(struct intel_vma_heap *heap, struct intel_vma_block *block)
+{
+	struct intel_vma_block *prev, *next;
+
+	heap->free_bytes += block->size;
+
+	if (block->link.prev != &heap->blocks) {
+		prev = DRMLISTENTRY(struct intel_vma_block, block->link.prev,
+				    link);
+		if (prev->free) {
+			remove_free(heap, prev);
+			block->offset = prev->offset;
+			block->size += prev->size;
+			DRMLISTDEL(&prev->link);
+			free(prev);
+		}
+	}
+
+	if (block->link.next != &heap->blocks) {
+		next = DRMLISTENTRY(struct intel_vma_block, block->link.next,
+				    link);
+		if (next->free) {
+			remove_free(heap, next);
+			block->size += next->size;
+			DRMLISTDEL(&next->link);
+			free(next);
+		}
+	}
+
+	add_free(heap, block);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file intel_vma_heap.h
+ *
+ * Allocator for ranges of the GPU virtual address space, used to softpin
+ * BOs at addresses chosen by userspace.
+ *
+ * Free ranges are kept on free lists by power of two size class, so that
+ * an allocation only looks at ranges large enough for it, and freed
+ * ranges are merged with their free neighbours.  Recently freed ranges
+ * are reused first.  The allocator does no locking of its own.
+ */
+
+#ifndef INTEL_VMA_HEAP_H
+#define INTEL_VMA_HEAP_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+#include "libdrm_lists.h"
+
+#define INTEL_VMA_HEAP_NUM_CLASSES 64
+
+struct intel_vma_block {
+	/** Link in the list of all blocks of the heap, in address order. */
+	drmMMListHead link;
+	/** Link in the free list of the size class, while free. */
+	drmMMListHead free_link;
+	uint64_t offset;
+	uint64_t size;
+	bool free;
+};
+
+struct intel_vma_heap {
+	drmMMListHead blocks;
+	drmMMListHead free[INTEL_VMA_HEAP_NUM_CLASSES];
+	/** Bit n is set when free[n] is not empty. */
+	uint64_t free_mask;
+	uint64_t free_bytes;
+};
+
+/**
+ * Sets up @heap to hand out addresses in [@start, @start + @size).
+ * Returns 0, or -ENOMEM.
+ */
+drm_private int intel_vma_heap_init(struct intel_vma_heap *heap,
+				    uint64_t start, uint64_t size);
+
+/** Frees the heap, and all the blocks still allocated from it. */
+drm_private void intel_vma_heap_fini(struct intel_vma_heap *heap);
+
+/**
+ * Allocates @size bytes aligned to @alignment, which must be a power of
+ * two.  Returns NULL if no free range is large enough.
+ */
+drm_private struct intel_vma_block *
+intel_vma_heap_alloc(struct intel_vma_heap *heap, uint64_t size,
+		     uint64_t alignment);
+
+/** Returns the range of @block to the heap. */
+drm_private void intel_vma_heap_free(struct intel_vma_heap *heap,
+				     struct intel_vma_block *block);
+
+#endif /* INTEL_VMA_HEAP_H */
@@ -30,6 +30,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <err.h>
@@ -46,6 +48,8 @@ usage(void)
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode <batch> -json\n");
+	fprintf(stderr, "  test_decode -bench [-t threads] [-n iterations] [-f text|json|packets] <batch>...\n");
 	exit(1);
 }
 
@@ -72,7 +76,7 @@ read_file(const char *filename, void **ptr, size_t *size)
 }
 
 static void
-dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+dump_batch(struct drm_intel_decode *ctx, const char *batch_filename, int json)
 {
 	void *batch_ptr;
 	size_t batch_size;
@@ -81,40 +85,35 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 
 	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
 					   batch_size / 4);
-	drm_intel_decode_set_output_file(ctx, stdout);
+	if (json)
+		drm_intel_decode_set_json_output(ctx, stdout);
+	else
+		drm_intel_decode_set_output_file(ctx, stdout);
 
 	drm_intel_decode(ctx);
 }
 
-static void
-compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+/* Decodes the batch into memory and compares it with the reference,
+ * returning 0 on a match.
+ */
+static int
+check_batch(struct drm_intel_decode *ctx, void *batch_ptr, size_t batch_size,
+	    const char *ref)
 {
 	FILE *out = NULL;
-	void *ptr, *ref_ptr, *batch_ptr;
-#ifdef HAVE_OPEN_MEMSTREAM
+	char *ptr;
 	size_t size;
-#endif
-	size_t ref_size, batch_size;
-	const char *ref_suffix = "-ref.txt";
-	char *ref_filename;
-
-	ref_filename = malloc(strlen(batch_filename) + strlen(ref_suffix) + 1);
-	sprintf(ref_filename, "%s%s", batch_filename, ref_suffix);
-
-	/* Read the batch and reference. */
-	read_file(batch_filename, &batch_ptr, &batch_size);
-	read_file(ref_filename, &ref_ptr, &ref_size);
+	int ret;
 
 	/* Set up our decode output in memory, because I don't want to
 	 * figure out how to output to a file in a safe and sane way
 	 * inside of an automake project's test infrastructure.
 	 */
 #ifdef HAVE_OPEN_MEMSTREAM
-	out = open_memstream((char **)&ptr, &size);
-#else
-	fprintf(stderr, "platform lacks open_memstream, skipping.\n");
-	exit(77);
+	out = open_memstream(&ptr, &size);
 #endif
+	if (!out)
+		return -1;
 
 	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
 					   batch_size / 4);
@@ -122,7 +121,44 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 
 	drm_intel_decode(ctx);
 
-	if (strcmp(ref_ptr, ptr) != 0) {
+	fclose(out);
+	ret = strcmp(ref, ptr);
+	free(ptr);
+
+	return ret;
+}
+
+static char *
+ref_filename_for(const char *batch_filename)
+{
+	const char *ref_suffix = "-ref.txt";
+	char *ref_filename;
+
+	ref_filename = malloc(strlen(batch_filename) + strlen(ref_suffix) + 1);
+	sprintf(ref_filename, "%s%s", batch_filename, ref_suffix);
+
+	return ref_filename;
+}
+
+static void
+compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	void *ref_ptr, *batch_ptr;
+	size_t ref_size, batch_size;
+	char *ref_filename;
+
+#ifndef HAVE_OPEN_MEMSTREAM
+	fprintf(stderr, "platform lacks open_memstream, skipping.\n");
+	exit(77);
+#endif
+
+	ref_filename = ref_filename_for(batch_filename);
+
+	/* Read the batch and reference. */
+	read_file(batch_filename, &batch_ptr, &batch_size);
+	read_file(ref_filename, &ref_ptr, &ref_size);
+
+	if (check_batch(ctx, batch_ptr, batch_size, ref_ptr) != 0) {
 		fprintf(stderr, "Decode mismatch with reference `%s'.\n",
 			ref_filename);
 		fprintf(stderr, "You can dump the new output using:\n");
@@ -130,9 +166,7 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 		exit(1);
 	}
 
-	fclose(out);
 	free(ref_filename);
-	free(ptr);
 }
 
 static uint16_t
@@ -169,6 +203,188 @@ infer_devid(const char *batch_filename)
 	exit(1);
 }
 
+struct bench_batch {
+	const char *filename;
+	uint16_t devid;
+	void *ptr;
+	size_t size;
+	void *ref;
+};
+
+enum bench_format {
+	BENCH_TEXT,
+	BENCH_JSON,
+	BENCH_PACKETS,
+};
+
+static struct bench_batch *bench_batches;
+static int bench_nr_batches;
+static unsigned bench_iterations = 1000;
+static enum bench_format bench_format = BENCH_TEXT;
+
+static void
+bench_packet(void *data, const struct drm_intel_decode_packet *packet)
+{
+	unsigned *nr_packets = data;
+
+	(*nr_packets)++;
+}
+
+/* Only counts packets, to measure the decode without any formatting. */
+static const struct drm_intel_decode_visitor bench_visitor = {
+	.packet = bench_packet,
+};
+
+static uint64_t
+gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Each thread decodes every batch with its own contexts, checking the
+ * first pass against the references so that threads stepping on each
+ * other's decode state show up as a mismatch rather than a speedup.
+ */
+static void *
+bench_thread(void *arg)
+{
+	struct drm_intel_decode **ctx;
+	FILE *null;
+	unsigned i, nr_packets = 0;
+	int b;
+
+	(void)arg;
+
+	null = fopen("/dev/null", "w");
+	if (!null)
+		err(1, "couldn't open /dev/null");
+
+	ctx = calloc(bench_nr_batches, sizeof(*ctx));
+	for (b = 0; b < bench_nr_batches; b++)
+		ctx[b] = drm_intel_decode_context_alloc(bench_batches[b].devid);
+
+	for (b = 0; b < bench_nr_batches; b++) {
+		struct bench_batch *batch = &bench_batches[b];
+
+		if (check_batch(ctx[b], batch->ptr, batch->size,
+				batch->ref) != 0)
+			errx(1, "decode mismatch with reference for `%s'",
+			     batch->filename);
+	}
+
+	for (i = 0; i < bench_iterations; i++) {
+		for (b = 0; b < bench_nr_batches; b++) {
+			struct bench_batch *batch = &bench_batches[b];
+
+			drm_intel_decode_set_batch_pointer(ctx[b], batch->ptr,
+							   HW_OFFSET,
+							   batch->size / 4);
+			switch (bench_format) {
+			case BENCH_TEXT:
+				drm_intel_decode_set_output_file(ctx[b], null);
+				break;
+			case BENCH_JSON:
+				drm_intel_decode_set_json_output(ctx[b], null);
+				break;
+			case BENCH_PACKETS:
+				drm_intel_decode_set_visitor(ctx[b],
+							     &bench_visitor,
+							     &nr_packets);
+				break;
+			}
+			drm_intel_decode(ctx[b]);
+		}
+	}
+
+	for (b = 0; b < bench_nr_batches; b++)
+		drm_intel_decode_context_free(ctx[b]);
+	free(ctx);
+	fclose(null);
+
+	return NULL;
+}
+
+static int
+bench(int argc, char **argv)
+{
+	pthread_t threads[64];
+	unsigned max_threads = 8, nthreads, i;
+	size_t total = 0;
+	int opt, b;
+
+#ifndef HAVE_OPEN_MEMSTREAM
+	fprintf(stderr, "platform lacks open_memstream, skipping.\n");
+	exit(77);
+#endif
+
+	while ((opt = getopt(argc, argv, "t:n:f:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				bench_format = BENCH_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				bench_format = BENCH_JSON;
+			else if (strcmp(optarg, "packets") == 0)
+				bench_format = BENCH_PACKETS;
+			else
+				usage();
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			bench_iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind == argc || max_threads < 1 ||
+	    max_threads > sizeof(threads) / sizeof(threads[0]))
+		usage();
+
+	bench_nr_batches = argc - optind;
+	bench_batches = calloc(bench_nr_batches, sizeof(*bench_batches));
+	for (b = 0; b < bench_nr_batches; b++) {
+		struct bench_batch *batch = &bench_batches[b];
+		size_t ref_size;
+		char *ref_filename;
+
+		batch->filename = argv[optind + b];
+		batch->devid = infer_devid(batch->filename);
+		read_file(batch->filename, &batch->ptr, &batch->size);
+
+		ref_filename = ref_filename_for(batch->filename);
+		read_file(ref_filename, &batch->ref, &ref_size);
+		free(ref_filename);
+
+		total += batch->size;
+	}
+
+	printf("%8s %12s %12s\n", "threads", "MB/s", "MB/s/thread");
+
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		double mbps;
+		uint64_t t;
+
+		t = gettime_ns();
+		for (i = 0; i < nthreads; i++)
+			pthread_create(&threads[i], NULL, bench_thread, NULL);
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+		t = gettime_ns() - t;
+
+		mbps = (double)nthreads * bench_iterations * total * 1000 / t;
+		printf("%8u %12.2f %12.2f\n", nthreads, mbps, mbps / nthreads);
+	}
+
+	return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -178,6 +394,8 @@ main(int argc, char **argv)
 	if (argc < 2)
 		usage();
 
+	if (strcmp(argv[1], "-bench") == 0)
+		return bench(argc - 1, argv + 1);
 
 	devid = infer_devid(argv[1]);
 
@@ -185,7 +403,9 @@ main(int argc, char **argv)
 
 	if (argc == 3) {
 		if (strcmp(argv[2], "-dump") == 0)
-			dump_batch(ctx, argv[1]);
+			dump_batch(ctx, argv[1], 0);
+		else if (strcmp(argv[2], "-json") == 0)
+			dump_batch(ctx, argv[1], 1);
 		else
 			usage();
 	} else {
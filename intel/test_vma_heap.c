@@ -0,0 +1,190 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Unit test of the GPU address allocator behind softpin_va, which is
+ * pure userspace and so needs no hardware: random allocations and frees
+ * with the heap's invariants checked after each.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "intel_vma_heap.h"
+
+#define HEAP_START (1ull << 32)
+#define HEAP_SIZE  (1ull << 30)
+#define NR_SLOTS   512
+
+static struct intel_vma_block *slots[NR_SLOTS];
+
+static void
+check_heap(struct intel_vma_heap *heap)
+{
+	struct intel_vma_block *block;
+	uint64_t offset = HEAP_START, free_bytes = 0;
+	int prev_free = 0, i;
+
+	/* the blocks tile the heap, and free neighbours have been merged */
+	DRMLISTFOREACHENTRY(block, &heap->blocks, link) {
+		assert(block->offset == offset);
+		assert(block->size > 0);
+		assert(!(block->free && prev_free));
+		if (block->free)
+			free_bytes += block->size;
+		offset += block->size;
+		prev_free = block->free;
+	}
+	assert(offset == HEAP_START + HEAP_SIZE);
+	assert(free_bytes == heap->free_bytes);
+
+	/* free blocks are on the list of their size class */
+	free_bytes = 0;
+	for (i = 0; i < INTEL_VMA_HEAP_NUM_CLASSES; i++) {
+		assert(DRMLISTEMPTY(&heap->free[i]) ==
+		       !(heap->free_mask & (1ull << i)));
+		DRMLISTFOREACHENTRY(block, &heap->free[i], free_link) {
+			assert(block->free);
+			assert(block->size >= 1ull << i);
+			assert(i == 63 || block->size < 2ull << i);
+			free_bytes += block->size;
+		}
+	}
+	assert(free_bytes == heap->free_bytes);
+}
+
+static void
+test_reuse(void)
+{
+	struct intel_vma_heap heap;
+	struct intel_vma_block *a, *b, *c;
+	uint64_t offset;
+
+	assert(intel_vma_heap_init(&heap, HEAP_START, HEAP_SIZE) == 0);
+
+	a = intel_vma_heap_alloc(&heap, 4096, 4096);
+	b = intel_vma_heap_alloc(&heap, 8192, 4096);
+	assert(a && b);
+	assert(a->offset == HEAP_START);
+	assert(b->offset == HEAP_START + 4096);
+
+	/* a freed range is handed out again */
+	offset = b->offset;
+	intel_vma_heap_free(&heap, b);
+	b = intel_vma_heap_alloc(&heap, 8192, 4096);
+	assert(b && b->offset == offset);
+
+	/* alignment is honoured, and the padding stays usable */
+	c = intel_vma_heap_alloc(&heap, 4096, 1 << 20);
+	assert(c && (c->offset & ((1 << 20) - 1)) == 0);
+	intel_vma_heap_free(&heap, a);
+	a = intel_vma_heap_alloc(&heap, 4096, 4096);
+	assert(a && a->offset == HEAP_START);
+	check_heap(&heap);
+
+	/* too large for what's left */
+	assert(!intel_vma_heap_alloc(&heap, HEAP_SIZE, 4096));
+	assert(!intel_vma_heap_alloc(&heap, 0, 4096));
+
+	intel_vma_heap_free(&heap, a);
+	intel_vma_heap_free(&heap, b);
+	intel_vma_heap_free(&heap, c);
+	check_heap(&heap);
+	assert(heap.free_bytes == HEAP_SIZE);
+
+	/* everything merged back into one block */
+	a = intel_vma_heap_alloc(&heap, HEAP_SIZE, 4096);
+	assert(a && a->offset == HEAP_START);
+	check_heap(&heap);
+
+	intel_vma_heap_fini(&heap);
+}
+
+static void
+test_random(void)
+{
+	struct intel_vma_heap heap;
+	unsigned i, j;
+
+	assert(intel_vma_heap_init(&heap, HEAP_START, HEAP_SIZE) == 0);
+	srandom(0);
+
+	for (i = 0; i < 20000; i++) {
+		j = random() % NR_SLOTS;
+
+		if (slots[j]) {
+			intel_vma_heap_free(&heap, slots[j]);
+			slots[j] = NULL;
+		} else {
+			uint64_t size = (1 + random() % 512) << 12;
+			uint64_t alignment = 4096 << (random() % 6);
+
+			slots[j] = intel_vma_heap_alloc(&heap, size, alignment);
+			if (slots[j]) {
+				assert(slots[j]->size == size);
+				assert((slots[j]->offset & (alignment - 1)) == 0);
+				assert(!slots[j]->free);
+			}
+		}
+
+		if (i % 64 == 0)
+			check_heap(&heap);
+	}
+
+	/* no two live blocks overlap */
+	for (i = 0; i < NR_SLOTS; i++) {
+		for (j = i + 1; slots[i] && j < NR_SLOTS; j++) {
+			if (!slots[j])
+				continue;
+			assert(slots[i]->offset + slots[i]->size <=
+			       slots[j]->offset ||
+			       slots[j]->offset + slots[j]->size <=
+			       slots[i]->offset);
+		}
+	}
+
+	for (i = 0; i < NR_SLOTS; i++) {
+		if (slots[i])
+			intel_vma_heap_free(&heap, slots[i]);
+	}
+	check_heap(&heap);
+	assert(heap.free_bytes == HEAP_SIZE);
+	assert(DRMLISTSINGLE(&heap.blocks));
+
+	intel_vma_heap_fini(&heap);
+}
+
+int
+main(void)
+{
+	test_reuse();
+	test_random();
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Benchmark for the buffer reuse cache, against the fake amdgpu.  Each
+ * frame allocates and maps a number of short-lived buffers of random
+ * sizes, submits them, which keeps them busy for a while, and frees them
+ * right away, as with streaming uploads.  The same frames run with the
+ * cache disabled and enabled, reporting the time and the ioctls per
+ * allocation and free, and how many allocations the cache served.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "fake_amdgpu.h"
+
+static unsigned frames = 2000;
+static unsigned bos_per_frame = 32;
+static uint64_t cache_bytes = 64 << 20;
+static unsigned seed = 1;
+
+static uint64_t
+random_size(void)
+{
+	/* 4KiB to 1MiB, about as many of each power of two */
+	unsigned shift = 12 + rand() % 8;
+
+	return ((uint64_t)1 << shift) + (rand() % (1 << (shift - 12))) * 4096;
+}
+
+static void
+run(amdgpu_device_handle dev, uint64_t max_bytes)
+{
+	struct amdgpu_bo_alloc_request request = {};
+	struct amdgpu_bo_cache_stats stats;
+	amdgpu_bo_handle *bos;
+	amdgpu_bo_list_handle list;
+	uint64_t va, t, ns = 0;
+	unsigned nr_create, nr_close, nr_va, nr_wait_idle, allocs;
+	unsigned i, j;
+	int ret;
+
+	bos = calloc(bos_per_frame, sizeof(*bos));
+	assert(bos);
+
+	ret = amdgpu_device_set_bo_cache(dev, max_bytes);
+	assert(ret == 0);
+	amdgpu_device_get_bo_cache_stats(dev, &stats);
+
+	nr_create = atomic_read(&fake_nr_gem_create);
+	nr_close = atomic_read(&fake_nr_gem_close);
+	nr_va = atomic_read(&fake_nr_gem_va);
+	nr_wait_idle = atomic_read(&fake_nr_gem_wait_idle);
+	srand(seed);
+
+	request.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	request.phys_alignment = 4096;
+
+	for (i = 0; i < frames; i++) {
+		t = gettime_ns();
+		for (j = 0; j < bos_per_frame; j++) {
+			request.alloc_size = random_size();
+			ret = amdgpu_bo_alloc_and_map(dev, &request, 0,
+						      &bos[j], &va);
+			assert(ret == 0);
+			assert(va % request.phys_alignment == 0);
+		}
+		ns += gettime_ns() - t;
+
+		ret = amdgpu_bo_list_create(dev, bos_per_frame, bos, NULL,
+					    &list);
+		assert(ret == 0);
+		ret = amdgpu_bo_list_destroy(list);
+		assert(ret == 0);
+
+		t = gettime_ns();
+		for (j = 0; j < bos_per_frame; j++)
+			amdgpu_bo_free(bos[j]);
+		ns += gettime_ns() - t;
+	}
+
+	allocs = frames * bos_per_frame;
+	nr_create = atomic_read(&fake_nr_gem_create) - nr_create;
+	nr_close = atomic_read(&fake_nr_gem_close) - nr_close;
+	nr_va = atomic_read(&fake_nr_gem_va) - nr_va;
+	nr_wait_idle = atomic_read(&fake_nr_gem_wait_idle) - nr_wait_idle;
+
+	if (max_bytes)
+		printf("cache of %" PRIu64 " MiB\n", max_bytes >> 20);
+	else
+		printf("no cache\n");
+	printf("  alloc+free     %.2f us\n", ns / 1000.0 / allocs);
+	printf("  ioctls         %.2f per alloc+free: %.2f create, %.2f va, "
+	       "%.2f close, %.2f wait idle\n",
+	       (double)(nr_create + nr_close + nr_va + nr_wait_idle) / allocs,
+	       (double)nr_create / allocs, (double)nr_va / allocs,
+	       (double)nr_close / allocs, (double)nr_wait_idle / allocs);
+
+	if (max_bytes) {
+		uint64_t hits = stats.hits, misses = stats.misses;
+
+		amdgpu_device_get_bo_cache_stats(dev, &stats);
+		hits = stats.hits - hits;
+		misses = stats.misses - misses;
+		printf("  hits           %.1f%%, %u buffers, %" PRIu64
+		       " MiB left cached\n",
+		       100.0 * hits / (hits + misses), stats.count,
+		       stats.bytes >> 20);
+	}
+
+	/* release what is cached */
+	ret = amdgpu_device_set_bo_cache(dev, 0);
+	assert(ret == 0);
+	free(bos);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-b buffers] [-c MiB] [-g ns] [-i ns] "
+	       "[-s seed]\n"
+	       "\n"
+	       "  -n frames   frames to run (default 2000)\n"
+	       "  -b buffers  buffers per frame (default 32)\n"
+	       "  -c MiB      size of the cache (default 64)\n"
+	       "  -g ns       time the GPU is busy with a frame (default 200000)\n"
+	       "  -i ns       cost of an ioctl (default 1000)\n"
+	       "  -s seed     random seed (default 1)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int fd, opt, ret;
+
+	fake_gpu_busy_ns = 200000;
+	fake_ioctl_delay_ns = 1000;
+
+	while ((opt = getopt(argc, argv, "n:b:c:g:i:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bos_per_frame = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cache_bytes = (uint64_t)strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'g':
+			fake_gpu_busy_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			fake_ioctl_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!frames || !bos_per_frame || !cache_bytes) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_amdgpu_open();
+	assert(fd >= 0);
+	ret = amdgpu_device_initialize(fd, &major, &minor, &dev);
+	assert(ret == 0);
+
+	printf("%u frames of %u buffers, busy for %u us\n", frames,
+	       bos_per_frame, fake_gpu_busy_ns / 1000);
+	run(dev, 0);
+	run(dev, cache_bytes);
+
+	amdgpu_device_deinitialize(dev);
+
+	return 0;
+}
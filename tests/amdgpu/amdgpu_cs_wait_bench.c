@@ -0,0 +1,262 @@
+/*
+ * Copyright 2016 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Frame pacing benchmark for fence waits, against the fake amdgpu.  Each
+ * frame makes a number of submissions to the GFX, compute and SDMA rings,
+ * and before submitting a frame, the fences of the frame submitted
+ * before the ones in flight are waited for: one by one with
+ * amdgpu_cs_query_fence_status(), or all at once with
+ * amdgpu_cs_wait_fences().  Reports the time and the WAIT_CS ioctls per
+ * frame, and checks what amdgpu_cs_wait_fences() returns.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "fake_amdgpu.h"
+
+static const unsigned ip_types[] = {
+	AMDGPU_HW_IP_GFX, AMDGPU_HW_IP_COMPUTE, AMDGPU_HW_IP_DMA
+};
+#define NR_RINGS (sizeof(ip_types) / sizeof(ip_types[0]))
+
+static unsigned frames = 5000;
+static unsigned submits_per_ring = 4;
+static unsigned frames_in_flight = 2;
+
+static void
+submit(amdgpu_context_handle context, unsigned ip_type,
+       struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ib_info ib = {};
+	struct amdgpu_cs_request request = {};
+	int ret;
+
+	ib.ib_mc_address = 0x100000;
+	ib.size = 16;
+	request.ip_type = ip_type;
+	request.number_of_ibs = 1;
+	request.ibs = &ib;
+
+	ret = amdgpu_cs_submit(context, 0, &request, 1);
+	assert(ret == 0);
+
+	fence->context = context;
+	fence->ip_type = ip_type;
+	fence->ip_instance = 0;
+	fence->ring = 0;
+	fence->fence = request.seq_no;
+}
+
+static void
+wait_frame(struct amdgpu_cs_fence *fences, unsigned count, int wait_all)
+{
+	uint32_t expired, status;
+	unsigned i;
+	int ret;
+
+	if (!wait_all) {
+		for (i = 0; i < count; i++) {
+			ret = amdgpu_cs_query_fence_status(&fences[i],
+							   AMDGPU_TIMEOUT_INFINITE,
+							   0, &expired);
+			assert(ret == 0 && expired);
+		}
+		return;
+	}
+
+	ret = amdgpu_cs_wait_fences(fences, count, true,
+				    AMDGPU_TIMEOUT_INFINITE, &status, NULL);
+	assert(ret == 0 && status);
+}
+
+static void
+run(amdgpu_device_handle dev, int wait_all)
+{
+	unsigned per_frame = NR_RINGS * submits_per_ring;
+	struct amdgpu_cs_fence *fences;
+	amdgpu_context_handle context;
+	unsigned nr_wait_cs, i, j;
+	uint64_t t;
+	int ret;
+
+	ret = amdgpu_cs_ctx_create(dev, &context);
+	assert(ret == 0);
+	fences = calloc(frames_in_flight + 1, per_frame * sizeof(*fences));
+	assert(fences);
+
+	nr_wait_cs = atomic_read(&fake_nr_wait_cs);
+	t = gettime_ns();
+
+	for (i = 0; i < frames; i++) {
+		struct amdgpu_cs_fence *frame =
+			&fences[(i % (frames_in_flight + 1)) * per_frame];
+
+		/* the frame submitted frames_in_flight + 1 frames ago */
+		if (i > frames_in_flight)
+			wait_frame(frame, per_frame, wait_all);
+
+		for (j = 0; j < per_frame; j++)
+			submit(context, ip_types[j % NR_RINGS], &frame[j]);
+	}
+
+	t = gettime_ns() - t;
+	nr_wait_cs = atomic_read(&fake_nr_wait_cs) - nr_wait_cs;
+
+	printf("%-24s %11.2f %13.2f\n",
+	       wait_all ? "amdgpu_cs_wait_fences" : "one fence at a time",
+	       t / 1000.0 / frames, (double)nr_wait_cs / frames);
+
+	free(fences);
+	amdgpu_cs_ctx_free(context);
+}
+
+/* Waits for any fence, and for fences known to have signaled. */
+static void
+check_wait_any(amdgpu_device_handle dev)
+{
+	struct amdgpu_cs_fence fences[NR_RINGS * 2];
+	amdgpu_context_handle context;
+	uint32_t status, first, expired;
+	unsigned nr_wait_cs, i;
+	int ret;
+
+	ret = amdgpu_cs_ctx_create(dev, &context);
+	assert(ret == 0);
+
+	for (i = 0; i < NR_RINGS * 2; i++)
+		submit(context, ip_types[i % NR_RINGS], &fences[i]);
+
+	/* nothing has signaled yet */
+	if (fake_gpu_busy_ns >= 1000000) {
+		ret = amdgpu_cs_wait_fences(fences, NR_RINGS * 2, false, 0,
+					    &status, &first);
+		assert(ret == 0 && !status);
+	}
+
+	ret = amdgpu_cs_wait_fences(fences, NR_RINGS * 2, false,
+				    AMDGPU_TIMEOUT_INFINITE, &status, &first);
+	assert(ret == 0 && status && first < NR_RINGS * 2);
+	ret = amdgpu_cs_query_fence_status(&fences[first], 0, 0, &expired);
+	assert(ret == 0 && expired);
+
+	ret = amdgpu_cs_wait_fences(fences, NR_RINGS * 2, true,
+				    AMDGPU_TIMEOUT_INFINITE, &status, NULL);
+	assert(ret == 0 && status);
+
+	/* all known to have signaled now */
+	nr_wait_cs = atomic_read(&fake_nr_wait_cs);
+	for (i = 0; i < NR_RINGS * 2; i++) {
+		ret = amdgpu_cs_query_fence_status(&fences[i], 0, 0, &expired);
+		assert(ret == 0 && expired);
+	}
+	ret = amdgpu_cs_wait_fences(fences, NR_RINGS * 2, false, 0,
+				    &status, &first);
+	assert(ret == 0 && status && first == 0);
+	assert(atomic_read(&fake_nr_wait_cs) == (int)nr_wait_cs);
+
+	amdgpu_cs_ctx_free(context);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-s submissions] [-f frames] [-g ns] "
+	       "[-i ns]\n"
+	       "\n"
+	       "  -n frames       frames to run (default 5000)\n"
+	       "  -s submissions  submissions per ring and frame (default 4)\n"
+	       "  -f frames       frames in flight (default 2)\n"
+	       "  -g ns           time the GPU takes per submission "
+	       "(default 10000)\n"
+	       "  -i ns           cost of an ioctl (default 1000)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int fd, opt, ret;
+
+	fake_gpu_busy_ns = 10000;
+	fake_ioctl_delay_ns = 1000;
+
+	while ((opt = getopt(argc, argv, "n:s:f:g:i:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			submits_per_ring = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			frames_in_flight = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			fake_gpu_busy_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			fake_ioctl_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!frames || !submits_per_ring) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_amdgpu_open();
+	assert(fd >= 0);
+	ret = amdgpu_device_initialize(fd, &major, &minor, &dev);
+	assert(ret == 0);
+
+	check_wait_any(dev);
+
+	printf("%u frames of %u submissions to %u rings, %u in flight\n",
+	       frames, submits_per_ring, (unsigned)NR_RINGS,
+	       frames_in_flight);
+	printf("%-24s %11s %13s\n", "", "us/frame", "WAIT_CS/frame");
+	run(dev, 0);
+	run(dev, 1);
+
+	amdgpu_device_deinitialize(dev);
+
+	return 0;
+}
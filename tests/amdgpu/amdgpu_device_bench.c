@@ -0,0 +1,149 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Benchmark for amdgpu_device_initialize() and
+ * amdgpu_device_deinitialize(), against the fake amdgpu.  Each cycle
+ * initializes a device handle for a number of fds of the same GPU, like
+ * as many contexts opening it, which should all share one
+ * amdgpu_device, then releases them again.  What matters, besides the
+ * time per cycle, is how often the device behind an fd is looked up in
+ * sysfs to find it in the table of devices.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "fake_amdgpu.h"
+
+static unsigned cycles = 10000;
+static unsigned contexts = 8;
+
+static void
+run(int fd)
+{
+	amdgpu_device_handle *devs = calloc(contexts, sizeof(*devs));
+	int *fds = calloc(contexts, sizeof(*fds));
+	unsigned nr_ioctl, nr_primary_name, cycle, i;
+	uint32_t major, minor;
+	uint64_t t;
+	int ret;
+
+	assert(devs && fds);
+
+	nr_ioctl = atomic_read(&fake_nr_ioctl);
+	nr_primary_name = atomic_read(&fake_nr_primary_name);
+
+	t = gettime_ns();
+	for (cycle = 0; cycle < cycles; cycle++) {
+		for (i = 0; i < contexts; i++) {
+			fds[i] = dup(fd);
+			assert(fds[i] >= 0);
+			ret = amdgpu_device_initialize(fds[i], &major, &minor,
+						       &devs[i]);
+			assert(ret == 0 && major == 3);
+			/* all of them share the device of the first */
+			assert(devs[i] == devs[0]);
+		}
+		for (i = 0; i < contexts; i++) {
+			ret = amdgpu_device_deinitialize(devs[i]);
+			assert(ret == 0);
+			close(fds[i]);
+		}
+	}
+	t = gettime_ns() - t;
+
+	nr_ioctl = atomic_read(&fake_nr_ioctl) - nr_ioctl;
+	nr_primary_name = atomic_read(&fake_nr_primary_name) - nr_primary_name;
+
+	printf("%8u %12.2f %16.2f %12.2f\n", contexts,
+	       (double)t / cycles / 1000,
+	       (double)nr_primary_name / cycles,
+	       (double)nr_ioctl / cycles);
+
+	free(devs);
+	free(fds);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n cycles] [-c contexts] [-s ns] [-i ns]\n"
+	       "\n"
+	       "  -n cycles    initialize/deinitialize cycles (default 10000)\n"
+	       "  -c contexts  device handles per cycle (default 8)\n"
+	       "  -s ns        cost of a sysfs lookup (default 20000)\n"
+	       "  -i ns        cost of an ioctl (default 0)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd, opt;
+
+	fake_sysfs_delay_ns = 20000;
+
+	while ((opt = getopt(argc, argv, "n:c:s:i:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			contexts = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			fake_sysfs_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			fake_ioctl_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!cycles || !contexts) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_amdgpu_open();
+	assert(fd >= 0);
+
+	printf("%8s %12s %16s %12s\n", "contexts", "us/cycle",
+	       "sysfs/cycle", "ioctls/cycle");
+	run(fd);
+
+	return 0;
+}
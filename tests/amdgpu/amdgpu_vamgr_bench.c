@@ -0,0 +1,244 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Randomized benchmark for the VA range allocator, against the fake
+ * amdgpu.  It keeps around a number of live ranges of random sizes and
+ * alignments, allocating and freeing them in random order, and reports
+ * the time per amdgpu_va_range_alloc() and amdgpu_va_range_free() and
+ * how fragmented the address space is left.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "fake_amdgpu.h"
+
+struct range {
+	amdgpu_va_handle handle;
+	uint64_t address;
+	uint64_t size;
+};
+
+static unsigned ops = 200000;
+static unsigned live_target = 20000;
+static unsigned seed = 1;
+
+static struct range *ranges;
+static unsigned nr_ranges;
+
+static uint64_t alloc_ns, free_ns, max_alloc_ns;
+static unsigned nr_allocs, nr_frees;
+
+static uint64_t
+random_size(void)
+{
+	/* 4KiB to 2MiB, about as many of each power of two */
+	unsigned shift = 12 + rand() % 10;
+
+	return ((uint64_t)1 << shift) + (rand() % (1 << (shift - 12))) * 4096;
+}
+
+static uint64_t
+random_alignment(void)
+{
+	unsigned r = rand() % 10;
+
+	if (r < 7)
+		return 0;
+	if (r < 9)
+		return 64 * 1024;
+	return 2 * 1024 * 1024;
+}
+
+static void
+alloc_range(amdgpu_device_handle dev)
+{
+	struct range *range = &ranges[nr_ranges];
+	uint64_t alignment = random_alignment();
+	uint64_t t;
+	int ret;
+
+	range->size = random_size();
+
+	t = gettime_ns();
+	ret = amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+				    range->size, alignment, 0,
+				    &range->address, &range->handle, 0);
+	t = gettime_ns() - t;
+	assert(ret == 0);
+	assert(alignment == 0 || range->address % alignment == 0);
+
+	alloc_ns += t;
+	if (t > max_alloc_ns)
+		max_alloc_ns = t;
+	nr_allocs++;
+	nr_ranges++;
+}
+
+static void
+free_range(unsigned i)
+{
+	uint64_t t;
+	int ret;
+
+	t = gettime_ns();
+	ret = amdgpu_va_range_free(ranges[i].handle);
+	t = gettime_ns() - t;
+	assert(ret == 0);
+
+	free_ns += t;
+	nr_frees++;
+	ranges[i] = ranges[--nr_ranges];
+}
+
+static int
+compare_ranges(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+
+	return ra->address < rb->address ? -1 : ra->address > rb->address;
+}
+
+/* Checks that the live ranges do not overlap, and reports the holes
+ * left between them.
+ */
+static void
+report_fragmentation(void)
+{
+	uint64_t live = 0, holes = 0, largest = 0, span, end;
+	unsigned nr_holes = 0, i;
+
+	qsort(ranges, nr_ranges, sizeof(*ranges), compare_ranges);
+
+	end = ranges[0].address;
+	for (i = 0; i < nr_ranges; i++) {
+		assert(ranges[i].address >= end);
+		if (ranges[i].address > end) {
+			uint64_t hole = ranges[i].address - end;
+
+			holes += hole;
+			nr_holes++;
+			if (hole > largest)
+				largest = hole;
+		}
+		live += ranges[i].size;
+		end = ranges[i].address + ranges[i].size;
+	}
+	span = end - ranges[0].address;
+
+	printf("live ranges      %u, %" PRIu64 " MiB\n", nr_ranges, live >> 20);
+	printf("span             %" PRIu64 " MiB, %.1f%% in use\n",
+	       span >> 20, 100.0 * live / span);
+	printf("holes            %u, %" PRIu64 " MiB, largest %" PRIu64 " KiB\n",
+	       nr_holes, holes >> 20, largest >> 10);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n ops] [-l ranges] [-s seed]\n"
+	       "\n"
+	       "  -n ops     random allocations and frees (default 200000)\n"
+	       "  -l ranges  live ranges to keep around (default 20000)\n"
+	       "  -s seed    random seed (default 1)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	unsigned i;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "n:l:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			live_target = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!live_target) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_amdgpu_open();
+	assert(fd >= 0);
+	ret = amdgpu_device_initialize(fd, &major, &minor, &dev);
+	assert(ret == 0);
+
+	ranges = calloc(2 * live_target, sizeof(*ranges));
+	assert(ranges);
+	srand(seed);
+
+	while (nr_ranges < live_target)
+		alloc_range(dev);
+	nr_allocs = 0;
+	alloc_ns = max_alloc_ns = 0;
+
+	/* a random walk around live_target live ranges */
+	for (i = 0; i < ops; i++) {
+		if (nr_ranges < 2 * live_target && (rand() & 1))
+			alloc_range(dev);
+		else
+			free_range(rand() % nr_ranges);
+	}
+
+	printf("%u ops around %u live ranges\n", ops, live_target);
+	printf("alloc            %.0f ns avg, %.1f us max\n",
+	       nr_allocs ? (double)alloc_ns / nr_allocs : 0.0,
+	       max_alloc_ns / 1000.0);
+	printf("free             %.0f ns avg\n",
+	       nr_frees ? (double)free_ns / nr_frees : 0.0);
+	report_fragmentation();
+
+	while (nr_ranges)
+		free_range(nr_ranges - 1);
+	free(ranges);
+	amdgpu_device_deinitialize(dev);
+
+	return 0;
+}
@@ -0,0 +1,543 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "fake_amdgpu.h"
+
+atomic_t fake_nr_ioctl, fake_nr_primary_name;
+atomic_t fake_nr_gem_create, fake_nr_gem_close, fake_nr_gem_va;
+atomic_t fake_nr_gem_wait_idle, fake_nr_cs, fake_nr_wait_cs;
+unsigned fake_ioctl_delay_ns;
+unsigned fake_sysfs_delay_ns;
+unsigned fake_gpu_busy_ns;
+
+/* GEM objects, by handle - 1 */
+struct fake_bo {
+	int used;
+	uint64_t size;
+	uint64_t busy_until;
+};
+
+static pthread_mutex_t bo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_bo *bos;
+static uint32_t nr_bos, max_bos;
+static uint32_t next_bo_list = 1;
+
+#define FAKE_MAX_CTX	16
+
+/* Submissions complete in order, each fake_gpu_busy_ns after the ring
+ * got to it.
+ */
+struct fake_ring {
+	uint64_t seq;
+	uint64_t busy_until;
+	/* completion time of each submission, by sequence number - 1 */
+	uint64_t *done;
+	uint64_t max;
+};
+
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_ring rings[FAKE_MAX_CTX][AMDGPU_HW_IP_NUM][8];
+static int ctx_used[FAKE_MAX_CTX];
+
+static int fake_fd = -1;
+static dev_t fake_dev;
+static ino_t fake_ino;
+
+uint64_t
+gettime_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void
+spin(unsigned ns)
+{
+	uint64_t until;
+
+	if (!ns)
+		return;
+
+	until = gettime_ns() + ns;
+	while (gettime_ns() < until)
+		;
+}
+
+/* amdgpu_device_initialize() dups the fd it is given */
+static int
+is_fake_fd(int fd)
+{
+	struct stat st;
+
+	if (fake_fd < 0 || fstat(fd, &st))
+		return 0;
+
+	return st.st_dev == fake_dev && st.st_ino == fake_ino;
+}
+
+static void
+version_string(char *dst, size_t *len, const char *src)
+{
+	if (dst)
+		memcpy(dst, src, *len < strlen(src) ? *len : strlen(src));
+	*len = strlen(src);
+}
+
+static int
+fake_version(drm_version_t *version)
+{
+	version->version_major = 3;
+	version->version_minor = 0;
+	version->version_patchlevel = 0;
+	version_string(version->name, &version->name_len, "amdgpu");
+	version_string(version->date, &version->date_len, "20150101");
+	version_string(version->desc, &version->desc_len, "fake amdgpu");
+	return 0;
+}
+
+static int
+fake_info(struct drm_amdgpu_info *info)
+{
+	void *out = (void *)(uintptr_t)info->return_pointer;
+
+	switch (info->query) {
+	case AMDGPU_INFO_ACCEL_WORKING:
+		if (info->return_size < sizeof(uint32_t))
+			return -EINVAL;
+		*(uint32_t *)out = 1;
+		return 0;
+	case AMDGPU_INFO_DEV_INFO: {
+		struct drm_amdgpu_info_device dev_info;
+
+		memset(&dev_info, 0, sizeof(dev_info));
+		dev_info.device_id = 0x67df;	/* Polaris 10 */
+		dev_info.family = AMDGPU_FAMILY_VI;
+		dev_info.num_shader_engines = 4;
+		dev_info.num_shader_arrays_per_engine = 1;
+		dev_info.virtual_address_offset = 8 << 20;
+		dev_info.virtual_address_max = 1ull << 40;
+		dev_info.virtual_address_alignment = 4096;
+		dev_info.pte_fragment_size = 2 << 20;
+		dev_info.gart_page_size = 4096;
+
+		memcpy(out, &dev_info, info->return_size < sizeof(dev_info) ?
+		       info->return_size : sizeof(dev_info));
+		return 0;
+	}
+	case AMDGPU_INFO_READ_MMR_REG:
+		if (info->return_size < info->read_mmr_reg.count * 4)
+			return -EINVAL;
+		memset(out, 0, info->read_mmr_reg.count * 4);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Must be called with bo_mutex held. */
+static struct fake_bo *
+lookup_bo(uint32_t handle)
+{
+	if (handle == 0 || handle > nr_bos || !bos[handle - 1].used)
+		return NULL;
+	return &bos[handle - 1];
+}
+
+static int
+fake_gem_create(union drm_amdgpu_gem_create *args)
+{
+	uint32_t i;
+
+	atomic_inc(&fake_nr_gem_create);
+	if (args->in.bo_size == 0)
+		return -EINVAL;
+
+	pthread_mutex_lock(&bo_mutex);
+	for (i = 0; i < nr_bos && bos[i].used; i++)
+		;
+	if (i == nr_bos) {
+		if (nr_bos == max_bos) {
+			uint32_t max = max_bos ? 2 * max_bos : 256;
+			struct fake_bo *tmp = realloc(bos, max * sizeof(*bos));
+
+			if (!tmp) {
+				pthread_mutex_unlock(&bo_mutex);
+				return -ENOMEM;
+			}
+			bos = tmp;
+			max_bos = max;
+		}
+		nr_bos++;
+	}
+	bos[i].used = 1;
+	bos[i].size = args->in.bo_size;
+	bos[i].busy_until = 0;
+	pthread_mutex_unlock(&bo_mutex);
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.handle = i + 1;
+	return 0;
+}
+
+static int
+fake_gem_close(struct drm_gem_close *args)
+{
+	struct fake_bo *bo;
+
+	atomic_inc(&fake_nr_gem_close);
+	pthread_mutex_lock(&bo_mutex);
+	bo = lookup_bo(args->handle);
+	if (bo)
+		bo->used = 0;
+	pthread_mutex_unlock(&bo_mutex);
+
+	return bo ? 0 : -EINVAL;
+}
+
+static int
+fake_gem_va(struct drm_amdgpu_gem_va *args)
+{
+	struct fake_bo *bo;
+	int ret = 0;
+
+	atomic_inc(&fake_nr_gem_va);
+	pthread_mutex_lock(&bo_mutex);
+	bo = lookup_bo(args->handle);
+	if (!bo)
+		ret = -ENOENT;
+	else if (args->offset_in_bo + args->map_size > bo->size)
+		ret = -EINVAL;
+	pthread_mutex_unlock(&bo_mutex);
+
+	return ret;
+}
+
+static int
+fake_gem_wait_idle(union drm_amdgpu_gem_wait_idle *args)
+{
+	struct fake_bo *bo;
+	uint64_t busy_until = 0;
+
+	atomic_inc(&fake_nr_gem_wait_idle);
+	pthread_mutex_lock(&bo_mutex);
+	bo = lookup_bo(args->in.handle);
+	if (bo)
+		busy_until = bo->busy_until;
+	pthread_mutex_unlock(&bo_mutex);
+	if (!bo)
+		return -ENOENT;
+
+	/* args->in.timeout is absolute, in CLOCK_MONOTONIC ns */
+	while (gettime_ns() < busy_until && gettime_ns() < args->in.timeout)
+		;
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.status = gettime_ns() < busy_until;
+	return 0;
+}
+
+/* Creating a list stands in for a submission, keeping the listed
+ * buffers busy for fake_gpu_busy_ns.
+ */
+static int
+fake_bo_list(union drm_amdgpu_bo_list *args)
+{
+	const struct drm_amdgpu_bo_list_entry *entries =
+		(void *)(uintptr_t)args->in.bo_info_ptr;
+	uint64_t busy_until = gettime_ns() + fake_gpu_busy_ns;
+	struct fake_bo *bo;
+	uint32_t i;
+	int ret = 0;
+
+	switch (args->in.operation) {
+	case AMDGPU_BO_LIST_OP_CREATE:
+		pthread_mutex_lock(&bo_mutex);
+		for (i = 0; i < args->in.bo_number; i++) {
+			bo = lookup_bo(entries[i].bo_handle);
+			if (!bo) {
+				ret = -ENOENT;
+				break;
+			}
+			bo->busy_until = busy_until;
+		}
+		args->out.list_handle = next_bo_list++;
+		pthread_mutex_unlock(&bo_mutex);
+		return ret;
+	case AMDGPU_BO_LIST_OP_DESTROY:
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+fake_ctx(union drm_amdgpu_ctx *args)
+{
+	uint32_t id;
+	unsigned ip, ring;
+
+	pthread_mutex_lock(&ring_mutex);
+	switch (args->in.op) {
+	case AMDGPU_CTX_OP_ALLOC_CTX:
+		for (id = 1; id < FAKE_MAX_CTX && ctx_used[id]; id++)
+			;
+		if (id == FAKE_MAX_CTX) {
+			pthread_mutex_unlock(&ring_mutex);
+			return -ENOMEM;
+		}
+		ctx_used[id] = 1;
+		memset(&args->out, 0, sizeof(args->out));
+		args->out.alloc.ctx_id = id;
+		break;
+	case AMDGPU_CTX_OP_FREE_CTX:
+		id = args->in.ctx_id;
+		if (id >= FAKE_MAX_CTX || !ctx_used[id]) {
+			pthread_mutex_unlock(&ring_mutex);
+			return -EINVAL;
+		}
+		ctx_used[id] = 0;
+		for (ip = 0; ip < AMDGPU_HW_IP_NUM; ip++) {
+			for (ring = 0; ring < 8; ring++) {
+				free(rings[id][ip][ring].done);
+				memset(&rings[id][ip][ring], 0,
+				       sizeof(rings[id][ip][ring]));
+			}
+		}
+		break;
+	default:
+		pthread_mutex_unlock(&ring_mutex);
+		return -EINVAL;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+
+	return 0;
+}
+
+/* Must be called with ring_mutex held. */
+static struct fake_ring *
+lookup_ring(uint32_t ctx_id, uint32_t ip_type, uint32_t ip_instance,
+	    uint32_t ring)
+{
+	if (ctx_id >= FAKE_MAX_CTX || !ctx_used[ctx_id] ||
+	    ip_type >= AMDGPU_HW_IP_NUM || ip_instance != 0 || ring >= 8)
+		return NULL;
+	return &rings[ctx_id][ip_type][ring];
+}
+
+static int
+fake_cs(union drm_amdgpu_cs *args)
+{
+	const uint64_t *chunk_array = (void *)(uintptr_t)args->in.chunks;
+	const struct drm_amdgpu_cs_chunk_ib *ib = NULL;
+	struct fake_ring *ring;
+	uint64_t start;
+	uint32_t i;
+
+	atomic_inc(&fake_nr_cs);
+
+	for (i = 0; i < args->in.num_chunks && !ib; i++) {
+		const struct drm_amdgpu_cs_chunk *chunk =
+			(void *)(uintptr_t)chunk_array[i];
+
+		if (chunk->chunk_id == AMDGPU_CHUNK_ID_IB)
+			ib = (void *)(uintptr_t)chunk->chunk_data;
+	}
+	if (!ib)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring_mutex);
+	ring = lookup_ring(args->in.ctx_id, ib->ip_type, ib->ip_instance,
+			   ib->ring);
+	if (!ring) {
+		pthread_mutex_unlock(&ring_mutex);
+		return -EINVAL;
+	}
+
+	if (ring->seq == ring->max) {
+		uint64_t max = ring->max ? 2 * ring->max : 1024;
+		uint64_t *tmp = realloc(ring->done, max * sizeof(*tmp));
+
+		if (!tmp) {
+			pthread_mutex_unlock(&ring_mutex);
+			return -ENOMEM;
+		}
+		ring->done = tmp;
+		ring->max = max;
+	}
+
+	start = gettime_ns();
+	if (start < ring->busy_until)
+		start = ring->busy_until;
+	ring->busy_until = start + fake_gpu_busy_ns;
+	ring->done[ring->seq++] = ring->busy_until;
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.handle = ring->seq;
+	pthread_mutex_unlock(&ring_mutex);
+
+	return 0;
+}
+
+static int
+fake_wait_cs(union drm_amdgpu_wait_cs *args)
+{
+	struct fake_ring *ring;
+	uint64_t done;
+
+	atomic_inc(&fake_nr_wait_cs);
+
+	pthread_mutex_lock(&ring_mutex);
+	ring = lookup_ring(args->in.ctx_id, args->in.ip_type,
+			   args->in.ip_instance, args->in.ring);
+	if (!ring || args->in.handle == 0 || args->in.handle > ring->seq) {
+		pthread_mutex_unlock(&ring_mutex);
+		return -EINVAL;
+	}
+	done = ring->done[args->in.handle - 1];
+	pthread_mutex_unlock(&ring_mutex);
+
+	/* args->in.timeout is absolute, in CLOCK_MONOTONIC ns */
+	while (gettime_ns() < done && gettime_ns() < args->in.timeout)
+		;
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.status = gettime_ns() < done;
+	return 0;
+}
+
+static int
+fake_ioctl(unsigned long request, void *arg)
+{
+	atomic_inc(&fake_nr_ioctl);
+	spin(fake_ioctl_delay_ns);
+
+	switch (request) {
+	case DRM_IOCTL_VERSION:
+		return fake_version(arg);
+	case DRM_IOCTL_GET_CLIENT:
+		((drm_client_t *)arg)->auth = 1;
+		return 0;
+	case DRM_IOCTL_GEM_CLOSE:
+		return fake_gem_close(arg);
+	}
+
+	/* Like the kernel, tell driver ioctls apart by their number alone:
+	 * drmCommandWriteRead() issues DRM_IOW ones as DRM_IOWR.
+	 */
+	switch (DRM_IOCTL_NR(request) - DRM_COMMAND_BASE) {
+	case DRM_AMDGPU_INFO:
+		return fake_info(arg);
+	case DRM_AMDGPU_GEM_CREATE:
+		return fake_gem_create(arg);
+	case DRM_AMDGPU_GEM_VA:
+		return fake_gem_va(arg);
+	case DRM_AMDGPU_GEM_WAIT_IDLE:
+		return fake_gem_wait_idle(arg);
+	case DRM_AMDGPU_BO_LIST:
+		return fake_bo_list(arg);
+	case DRM_AMDGPU_CTX:
+		return fake_ctx(arg);
+	case DRM_AMDGPU_CS:
+		return fake_cs(arg);
+	case DRM_AMDGPU_WAIT_CS:
+		return fake_wait_cs(arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/* overrides the libdrm one, for the libraries as well as for us: */
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	if (!is_fake_fd(fd)) {
+		do {
+			ret = ioctl(fd, request, arg);
+		} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+		return ret;
+	}
+
+	ret = fake_ioctl(request, arg);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* overrides the libdrm one, which would find no device node in sysfs: */
+char *
+drmGetPrimaryDeviceNameFromFd(int fd)
+{
+	if (!is_fake_fd(fd))
+		return NULL;
+
+	atomic_inc(&fake_nr_primary_name);
+	spin(fake_sysfs_delay_ns);
+
+	return strdup("/dev/dri/card0");
+}
+
+int
+fake_amdgpu_open(void)
+{
+	struct stat st;
+
+	if (fake_fd >= 0)
+		return fake_fd;
+
+	fake_fd = memfd_create("fake-amdgpu", MFD_CLOEXEC);
+	if (fake_fd < 0)
+		return -1;
+
+	if (fstat(fake_fd, &st)) {
+		close(fake_fd);
+		fake_fd = -1;
+		return -1;
+	}
+	fake_dev = st.st_dev;
+	fake_ino = st.st_ino;
+
+	return fake_fd;
+}
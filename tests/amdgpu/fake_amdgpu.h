@@ -0,0 +1,72 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+#ifndef FAKE_AMDGPU_H
+#define FAKE_AMDGPU_H
+
+/*
+ * A userspace fake of the amdgpu kernel driver, for benchmarking
+ * libdrm_amdgpu without a GPU.  fake_amdgpu_open() returns an fd to hand
+ * to amdgpu_device_initialize(); the fake defines drmIoctl() itself,
+ * which takes precedence over the one in libdrm, and implements the
+ * ioctls device initialization issues on that fd, or on dups of it:
+ *
+ *   VERSION, GET_CLIENT, and AMDGPU_INFO for ACCEL_WORKING, DEV_INFO
+ *   and READ_MMR_REG
+ *
+ * and buffer management:
+ *
+ *   GEM_CREATE, GEM_CLOSE, GEM_VA, GEM_WAIT_IDLE and BO_LIST, where
+ *   creating a BO list stands in for a submission and keeps the buffers
+ *   in it busy for fake_gpu_busy_ns
+ *
+ * and command submission:
+ *
+ *   CTX, CS and WAIT_CS, where each ring of a context runs the
+ *   submissions to it in order, for fake_gpu_busy_ns each
+ *
+ * Other fds are passed through to the kernel.
+ *
+ * The fd is a memfd rather than a DRM device node, so the fake also
+ * defines drmGetPrimaryDeviceNameFromFd(), naming the same primary node
+ * for all its fds after spinning for fake_sysfs_delay_ns, to model the
+ * sysfs lookup the real one does.  Each ioctl can be made to spin for
+ * fake_ioctl_delay_ns, to model the cost of the syscall.
+ */
+
+#include <stdint.h>
+
+#include "xf86atomic.h"
+
+extern atomic_t fake_nr_ioctl, fake_nr_primary_name;
+extern atomic_t fake_nr_gem_create, fake_nr_gem_close, fake_nr_gem_va;
+extern atomic_t fake_nr_gem_wait_idle, fake_nr_cs, fake_nr_wait_cs;
+extern unsigned fake_ioctl_delay_ns;
+extern unsigned fake_sysfs_delay_ns;
+extern unsigned fake_gpu_busy_ns;
+
+int fake_amdgpu_open(void);
+
+uint64_t gettime_ns(void);
+
+#endif /* FAKE_AMDGPU_H */
@@ -0,0 +1,299 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Runs drmGetDevices() over a synthetic device directory and sysfs tree,
+ * checks what it finds as GPUs come and go, and times enumerations which
+ * have to walk the tree against ones answered from the cached snapshot.
+ *
+ *   drmenum [-g gpus] [-n iterations] [-k]
+ *
+ * -k keeps the synthetic tree around.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <xf86drm.h>
+
+static char root[] = "/tmp/drmenum-XXXXXX";
+static char dev_dir[64], class_dir[64];
+
+#define VENDOR_ID 0x8086
+
+static void die(const char *what)
+{
+    fprintf(stderr, "drmenum: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void write_file(const char *path, const void *data, size_t size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || write(fd, data, size) != (ssize_t)size)
+        die(path);
+    close(fd);
+}
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0755) && errno != EEXIST)
+        die(path);
+}
+
+/* Creates the sysfs device of GPU @gpu, on bus @gpu, and its nodes. */
+static void add_gpu(int gpu, const char *subsystem)
+{
+    static const char *names[] = { "card%d", "controlD%d", "renderD%d" };
+    static const int bases[] = { 0, 64, 128 };
+    unsigned char config[64];
+    char pci[128], path[256], name[32];
+    int i;
+
+    snprintf(pci, sizeof(pci), "%s/sys/devices/0000:%02x:00.0", root, gpu);
+    make_dir(pci);
+
+    snprintf(path, sizeof(path), "%s/uevent", pci);
+    snprintf(name, sizeof(name), "PCI_SLOT_NAME=0000:%02x:00.0\n", gpu);
+    write_file(path, name, strlen(name));
+
+    memset(config, 0, sizeof(config));
+    config[0] = VENDOR_ID & 0xff;
+    config[1] = VENDOR_ID >> 8;
+    config[2] = gpu;
+    snprintf(path, sizeof(path), "%s/config", pci);
+    write_file(path, config, sizeof(config));
+
+    snprintf(path, sizeof(path), "%s/subsystem", pci);
+    if (symlink(subsystem, path) && errno != EEXIST)
+        die(path);
+
+    for (i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), names[i], bases[i] + gpu);
+
+        snprintf(path, sizeof(path), "%s/%s", dev_dir, name);
+        write_file(path, "", 0);
+
+        snprintf(path, sizeof(path), "%s/%s", class_dir, name);
+        make_dir(path);
+        strcat(path, "/device");
+        if (symlink(pci, path) && errno != EEXIST)
+            die(path);
+    }
+}
+
+static void remove_gpu(int gpu)
+{
+    static const char *names[] = { "card%d", "controlD%d", "renderD%d" };
+    static const int bases[] = { 0, 64, 128 };
+    char path[256], name[32];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        snprintf(name, sizeof(name), names[i], bases[i] + gpu);
+        snprintf(path, sizeof(path), "%s/%s", dev_dir, name);
+        unlink(path);
+    }
+}
+
+/* Moves the modification time of the directories back by @age seconds,
+ * so that the snapshot taken next can be trusted.
+ */
+static void age_dirs(int age)
+{
+    struct timespec times[2];
+
+    clock_gettime(CLOCK_REALTIME, &times[0]);
+    times[0].tv_sec -= age;
+    times[1] = times[0];
+
+    if (utimensat(AT_FDCWD, dev_dir, times, 0) ||
+        utimensat(AT_FDCWD, class_dir, times, 0))
+        die("utimensat");
+}
+
+static int remove_entry(const char *path, const struct stat *sb,
+                        int type, struct FTW *ftw)
+{
+    (void)sb; (void)type; (void)ftw;
+    return remove(path);
+}
+
+static int check_devices(int gpus)
+{
+    drmDevicePtr devices[256];
+    int count, i, j;
+
+    count = drmGetDevices(NULL, 0);
+    if (count != gpus) {
+        fprintf(stderr, "drmGetDevices(NULL) found %d devices, not %d\n",
+                count, gpus);
+        return 1;
+    }
+
+    count = drmGetDevices(devices, gpus);
+    if (count != gpus) {
+        fprintf(stderr, "drmGetDevices() found %d devices, not %d\n",
+                count, gpus);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        drmDevicePtr d = devices[i];
+        int gpu = d->businfo.pci->bus;
+
+        if (d->available_nodes != ((1 << DRM_NODE_MAX) - 1) ||
+            d->deviceinfo.pci->vendor_id != VENDOR_ID ||
+            d->deviceinfo.pci->device_id != gpu) {
+            fprintf(stderr, "bad device for bus %d\n", gpu);
+            return 1;
+        }
+
+        for (j = 0; j < i; j++) {
+            if (devices[j]->businfo.pci->bus == gpu) {
+                fprintf(stderr, "bus %d found twice\n", gpu);
+                return 1;
+            }
+        }
+    }
+
+    drmFreeDevices(devices, count);
+    return 0;
+}
+
+static double time_enumeration(int iterations, int gpus, int cold)
+{
+    drmDevicePtr devices[256];
+    struct timespec start, end;
+    int i, count;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        if (cold)
+            age_dirs(2 + i % 2);
+
+        count = drmGetDevices(devices, gpus);
+        if (count != gpus) {
+            fprintf(stderr, "drmGetDevices() found %d devices, not %d\n",
+                    count, gpus);
+            exit(1);
+        }
+        drmFreeDevices(devices, count);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((end.tv_sec - start.tv_sec) * 1e6 +
+            (end.tv_nsec - start.tv_nsec) / 1e3) / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int gpus = 8, iterations = 200, keep = 0;
+    char path[256];
+    double cold, cached;
+    int opt, ret, i;
+
+    while ((opt = getopt(argc, argv, "g:n:k")) != -1) {
+        switch (opt) {
+        case 'g':
+            gpus = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g gpus] [-n iterations] [-k]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (gpus < 1 || gpus > 63 || iterations < 1) {
+        fprintf(stderr, "drmenum: bad arguments\n");
+        return 1;
+    }
+
+    if (!mkdtemp(root))
+        die("mkdtemp");
+
+    snprintf(dev_dir, sizeof(dev_dir), "%s/dri", root);
+    snprintf(class_dir, sizeof(class_dir), "%s/sys/class/drm", root);
+    make_dir(dev_dir);
+    snprintf(path, sizeof(path), "%s/sys", root);
+    make_dir(path);
+    snprintf(path, sizeof(path), "%s/sys/class", root);
+    make_dir(path);
+    make_dir(class_dir);
+    snprintf(path, sizeof(path), "%s/sys/devices", root);
+    make_dir(path);
+
+    for (i = 0; i < gpus; i++)
+        add_gpu(i, "../../bus/pci");
+    /* not a PCI device, skipped */
+    add_gpu(gpus + 1, "../../bus/platform");
+    age_dirs(2);
+
+    setenv("DRM_DEVICE_DIR", dev_dir, 1);
+    snprintf(path, sizeof(path), "%s/sys", root);
+    setenv("DRM_SYSFS_ROOT", path, 1);
+
+    ret = check_devices(gpus);
+
+    /* hotplug */
+    if (!ret) {
+        add_gpu(gpus, "../../bus/pci");
+        age_dirs(3);
+        ret = check_devices(gpus + 1);
+    }
+    if (!ret) {
+        remove_gpu(gpus);
+        age_dirs(4);
+        ret = check_devices(gpus);
+    }
+
+    if (!ret) {
+        cold = time_enumeration(iterations, gpus, 1);
+        age_dirs(5);
+        cached = time_enumeration(iterations, gpus, 0);
+
+        printf("%d GPUs: %.2f us per walk, %.2f us per cached enumeration\n",
+               gpus, cold, cached);
+    }
+
+    if (keep)
+        printf("synthetic tree kept in %s\n", root);
+    else
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return ret;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+
+atomic_t fake_completed_fence;
+atomic_t fake_nr_ioctl, fake_nr_gem_new, fake_nr_cpu_prep, fake_nr_submit;
+unsigned fake_gpu_latency = 2;
+void (*fake_submit_hook)(struct drm_msm_gem_submit *req);
+
+/*
+ * Per-handle state lives in fixed size chunks, which are never freed or
+ * moved, so lookups don't need the lock.  Like GEM handles, closed
+ * handles get reused.  Handle zero is never valid.
+ */
+#define CHUNK_SHIFT  10
+#define CHUNK_SIZE   (1 << CHUNK_SHIFT)
+#define MAX_CHUNKS   1024
+
+static struct fake_bo *chunks[MAX_CHUNKS];
+static uint32_t nr_handles = 1;
+static uint32_t free_handle;
+static uint64_t next_offset;
+static uint32_t last_fence;
+
+/* serializes handle allocation and submits, like struct_mutex: */
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct fake_bo * fake_bo_lookup(uint32_t handle)
+{
+	struct fake_bo *chunk;
+	if ((handle >> CHUNK_SHIFT) >= MAX_CHUNKS)
+		return NULL;
+	chunk = chunks[handle >> CHUNK_SHIFT];
+	if (!chunk)
+		return NULL;
+	chunk = &chunk[handle & (CHUNK_SIZE - 1)];
+	return chunk->valid ? chunk : NULL;
+}
+
+static int bo_busy(struct fake_bo *fake_bo)
+{
+	return (int32_t)(fake_bo->fence - atomic_read(&fake_completed_fence)) > 0;
+}
+
+/* the GPU has made it (at least) as far as 'fence': */
+static void retire(uint32_t fence)
+{
+	uint32_t old;
+
+	do {
+		old = atomic_read(&fake_completed_fence);
+		if ((int32_t)(fence - old) <= 0)
+			return;
+	} while (atomic_cmpxchg(&fake_completed_fence, old, fence) != (int)old);
+}
+
+static int fake_get_param(struct drm_msm_param *req)
+{
+	if (req->pipe != MSM_PIPE_3D0)
+		return -EINVAL;
+
+	switch (req->param) {
+	case MSM_PARAM_GPU_ID:
+		req->value = 330;
+		return 0;
+	case MSM_PARAM_GMEM_SIZE:
+		req->value = 1024 * 1024;
+		return 0;
+	case MSM_PARAM_CHIP_ID:
+		req->value = 0x03030002;
+		return 0;
+	case MSM_PARAM_MAX_FREQ:
+		req->value = 450000000;
+		return 0;
+	case MSM_PARAM_TIMESTAMP:
+		req->value = gettime_ns() / 52;   /* 19.2MHz always-on counter */
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int fake_gem_new(int fd, struct drm_msm_gem_new *req)
+{
+	struct fake_bo *fake_bo;
+	uint64_t size = (req->size + 4095) & ~4095ull;
+	uint32_t handle;
+	int ret = 0;
+
+	if (!size || size > UINT32_MAX)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake_lock);
+	if (free_handle) {
+		handle = free_handle;
+		fake_bo = &chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SIZE - 1)];
+		free_handle = fake_bo->next_free;
+	} else {
+		struct fake_bo **chunk;
+
+		handle = nr_handles;
+		chunk = &chunks[handle >> CHUNK_SHIFT];
+		if ((handle >> CHUNK_SHIFT) >= MAX_CHUNKS) {
+			ret = -ENOMEM;
+			goto out_unlock;
+		}
+		if (!*chunk) {
+			*chunk = calloc(CHUNK_SIZE, sizeof(**chunk));
+			if (!*chunk) {
+				ret = -ENOMEM;
+				goto out_unlock;
+			}
+		}
+		nr_handles++;
+		fake_bo = &(*chunk)[handle & (CHUNK_SIZE - 1)];
+	}
+
+	/* the backing memfd only ever grows, closed bo's punch holes: */
+	fake_bo->offset = next_offset;
+	next_offset += size;
+	if (ftruncate(fd, next_offset)) {
+		fake_bo->next_free = free_handle;
+		free_handle = handle;
+		ret = -errno;
+		goto out_unlock;
+	}
+
+	fake_bo->size = size;
+	fake_bo->fence = 0;
+	fake_bo->madv = MSM_MADV_WILLNEED;
+	fake_bo->owner = 0;
+	fake_bo->valid = 1;
+	req->handle = handle;
+
+	atomic_inc(&fake_nr_gem_new);
+
+out_unlock:
+	pthread_mutex_unlock(&fake_lock);
+	return ret;
+}
+
+static int fake_gem_close(int fd, struct drm_gem_close *req)
+{
+	struct fake_bo *fake_bo;
+
+	pthread_mutex_lock(&fake_lock);
+	fake_bo = fake_bo_lookup(req->handle);
+	if (!fake_bo) {
+		pthread_mutex_unlock(&fake_lock);
+		return -EINVAL;
+	}
+	fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			fake_bo->offset, fake_bo->size);
+	fake_bo->valid = 0;
+	fake_bo->next_free = free_handle;
+	free_handle = req->handle;
+	pthread_mutex_unlock(&fake_lock);
+
+	return 0;
+}
+
+static int fake_gem_info(struct drm_msm_gem_info *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+	if (!fake_bo)
+		return -ENOENT;
+	req->offset = fake_bo->offset;
+	return 0;
+}
+
+static int fake_gem_cpu_prep(struct drm_msm_gem_cpu_prep *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (req->op & ~MSM_PREP_FLAGS)
+		return -EINVAL;
+	if (!fake_bo)
+		return -ENOENT;
+
+	atomic_inc(&fake_nr_cpu_prep);
+
+	if (bo_busy(fake_bo)) {
+		if (req->op & MSM_PREP_NOSYNC)
+			return -EBUSY;
+		retire(fake_bo->fence);
+	}
+
+	return 0;
+}
+
+static int fake_gem_cpu_fini(struct drm_msm_gem_cpu_fini *req)
+{
+	return fake_bo_lookup(req->handle) ? 0 : -ENOENT;
+}
+
+static int fake_gem_madvise(struct drm_msm_gem_madvise *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (req->madv != MSM_MADV_WILLNEED && req->madv != MSM_MADV_DONTNEED)
+		return -EINVAL;
+	if (!fake_bo)
+		return -ENOENT;
+
+	/* there is no memory pressure, so backing pages are never purged: */
+	fake_bo->madv = req->madv;
+	req->retained = 1;
+
+	return 0;
+}
+
+static int validate_cmd(struct drm_msm_gem_submit *req,
+		struct drm_msm_gem_submit_cmd *cmd)
+{
+	struct drm_msm_gem_submit_bo *bos = U642VOID(req->bos);
+	struct drm_msm_gem_submit_reloc *relocs = U642VOID(cmd->relocs);
+	struct fake_bo *fake_bo;
+	uint32_t i, last_offset = 0;
+
+	switch (cmd->type) {
+	case MSM_SUBMIT_CMD_BUF:
+	case MSM_SUBMIT_CMD_IB_TARGET_BUF:
+	case MSM_SUBMIT_CMD_CTX_RESTORE_BUF:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (cmd->submit_idx >= req->nr_bos)
+		return -EINVAL;
+
+	fake_bo = fake_bo_lookup(bos[cmd->submit_idx].handle);
+	if ((cmd->size % 4) || (cmd->submit_offset % 4) ||
+			((uint64_t)cmd->submit_offset + cmd->size) > fake_bo->size)
+		return -EINVAL;
+
+	/* like the kernel, relocs must be in order of increasing offset: */
+	for (i = 0; i < cmd->nr_relocs; i++) {
+		struct drm_msm_gem_submit_reloc *reloc = &relocs[i];
+
+		if ((reloc->submit_offset % 4) ||
+				(reloc->submit_offset >= fake_bo->size) ||
+				(reloc->submit_offset < last_offset) ||
+				(reloc->reloc_idx >= req->nr_bos))
+			return -EINVAL;
+
+		last_offset = reloc->submit_offset;
+	}
+
+	return 0;
+}
+
+static int fake_gem_submit(struct drm_msm_gem_submit *req)
+{
+	struct drm_msm_gem_submit_bo *bos = U642VOID(req->bos);
+	struct drm_msm_gem_submit_cmd *cmds = U642VOID(req->cmds);
+	uint32_t i, fence;
+	int ret = 0;
+
+	if ((MSM_PIPE_ID(req->flags) != MSM_PIPE_3D0) ||
+			(MSM_PIPE_FLAGS(req->flags) & ~MSM_SUBMIT_FLAGS))
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake_lock);
+
+	for (i = 0; i < req->nr_bos; i++) {
+		if ((bos[i].flags & ~MSM_SUBMIT_BO_FLAGS) ||
+				!fake_bo_lookup(bos[i].handle)) {
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+	}
+
+	for (i = 0; i < req->nr_cmds; i++) {
+		ret = validate_cmd(req, &cmds[i]);
+		if (ret)
+			goto out_unlock;
+	}
+
+	fence = ++last_fence;
+	for (i = 0; i < req->nr_bos; i++)
+		fake_bo_lookup(bos[i].handle)->fence = fence;
+
+	req->fence = fence;
+	/* any fd will do in place of the sync_file: */
+	if (req->flags & MSM_SUBMIT_FENCE_FD_OUT)
+		req->fence_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+	atomic_inc(&fake_nr_submit);
+
+	if (fake_submit_hook)
+		fake_submit_hook(req);
+
+	if (fence > fake_gpu_latency)
+		retire(fence - fake_gpu_latency);
+
+out_unlock:
+	pthread_mutex_unlock(&fake_lock);
+	return ret;
+}
+
+static int fake_wait_fence(struct drm_msm_wait_fence *req)
+{
+	if ((int32_t)(req->fence - last_fence) > 0)
+		return -EINVAL;
+	retire(req->fence);
+	return 0;
+}
+
+static int fake_ioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	atomic_inc(&fake_nr_ioctl);
+
+	switch (request) {
+	case DRM_IOCTL_GEM_CLOSE:
+		ret = fake_gem_close(fd, arg);
+		break;
+	case DRM_IOCTL_MSM_GET_PARAM:
+		ret = fake_get_param(arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_NEW:
+		ret = fake_gem_new(fd, arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_INFO:
+		ret = fake_gem_info(arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_CPU_PREP:
+		ret = fake_gem_cpu_prep(arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_CPU_FINI:
+		ret = fake_gem_cpu_fini(arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_SUBMIT:
+		ret = fake_gem_submit(arg);
+		break;
+	case DRM_IOCTL_MSM_WAIT_FENCE:
+		ret = fake_wait_fence(arg);
+		break;
+	case DRM_IOCTL_MSM_GEM_MADVISE:
+		ret = fake_gem_madvise(arg);
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* referenced by fd_device_new(), which we don't use: */
+struct fd_device * kgsl_device_new(int fd);
+
+struct fd_device * kgsl_device_new(int fd)
+{
+	return NULL;
+}
+
+struct fd_device * fake_device_new(void)
+{
+	struct fd_device *dev;
+	int fd;
+
+	fd = memfd_create("fake-msm", MFD_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	dev = msm_device_new(fd);
+	if (!dev) {
+		close(fd);
+		return NULL;
+	}
+
+	dev->version = FD_VERSION_FENCE_FD;
+	fd_device_init(dev, fd);
+	dev->ioctl = fake_ioctl;
+	dev->closefd = 1;
+
+	return dev;
+}
+
+uint64_t gettime_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
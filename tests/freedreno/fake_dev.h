@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FAKE_DEV_H_
+#define FAKE_DEV_H_
+
+/*
+ * A userspace fake of the msm kernel driver, for benchmarking the real
+ * libdrm_freedreno msm backend without a GPU.  fake_device_new() creates
+ * an ordinary msm fd_device, but with fd_device::ioctl pointed at the
+ * fake, which implements the GEM and submit ioctls the backend uses:
+ *
+ *   GET_PARAM, GEM_NEW, GEM_INFO, GEM_CPU_PREP, GEM_CPU_FINI,
+ *   GEM_MADVISE, GEM_SUBMIT, WAIT_FENCE and GEM_CLOSE
+ *
+ * Bo's are backed by a memfd, which is also the device fd, so that
+ * fd_bo_map() can mmap the GEM_INFO offset just like with the kernel.
+ * Submits are validated like the kernel would (handles, cmd ranges and
+ * reloc ordering) and get the next fence (and, if requested, an fd of
+ * /dev/null as the out-fence).  GPU progress is simulated:
+ * a submit completes once fake_gpu_latency newer submits have been
+ * made, or when it is waited on (WAIT_FENCE or a blocking CPU_PREP).
+ * A bo is busy until fake_completed_fence catches up with the fence of
+ * the last submit that used it.
+ */
+
+#include "msm/msm_priv.h"
+
+/* the fake's per-handle state: */
+struct fake_bo {
+	uint32_t size;
+	uint32_t fence;          /* last fence which used the bo */
+	uint64_t offset;         /* mmap offset in the backing memfd */
+	uint32_t madv;
+	uint32_t next_free;      /* next free handle, when closed */
+	int valid;
+	unsigned owner;          /* for tests to check for double allocation */
+};
+
+struct fake_bo * fake_bo_lookup(uint32_t handle);
+
+static inline struct fake_bo * to_fake_bo(struct fd_bo *bo)
+{
+	return fake_bo_lookup(bo->handle);
+}
+
+extern atomic_t fake_completed_fence;
+extern atomic_t fake_nr_ioctl, fake_nr_gem_new, fake_nr_cpu_prep, fake_nr_submit;
+extern unsigned fake_gpu_latency;
+extern void (*fake_submit_hook)(struct drm_msm_gem_submit *req);
+
+struct fd_device * fake_device_new(void);
+
+uint64_t gettime_ns(void);
+
+#endif /* FAKE_DEV_H_ */
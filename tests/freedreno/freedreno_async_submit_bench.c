@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark/test for async submit: builds submits on a few persistent
+ * ringbuffers, round-robin, against the fake device whose submit "ioctl"
+ * takes a configurable amount of time, while the application spends some
+ * time building each submit.  Reports the total time, how long the flush
+ * call blocks, and how long after the flush call a submit reaches the
+ * "kernel", with and without async submit.  Also checks that submits reach the kernel in
+ * the order they were flushed, by making the first bo of each submit a
+ * marker bo which identifies it, that timestamps are handed out by the
+ * flush, and that only waiting on a submit (or its bo's, or out-fence)
+ * waits for the submit thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+#define NR_MARKERS 64
+#define MAX_RINGS  16
+
+static struct fd_bo *markers[NR_MARKERS];
+static unsigned nr_submitted, delay_us = 50, work_us = 50;
+static uint32_t *submitted_handles;
+static uint64_t *submitted_ns;
+
+static void submit_hook(struct drm_msm_gem_submit *req)
+{
+	struct drm_msm_gem_submit_bo *bos = U642VOID(req->bos);
+
+	/* pretend the kernel spends some time validating the submit: */
+	if (delay_us)
+		usleep(delay_us);
+
+	assert(req->nr_bos > 0);
+	submitted_handles[nr_submitted] = bos[0].handle;
+	submitted_ns[nr_submitted] = gettime_ns();
+	nr_submitted++;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n submits] [-r rings] [-f relocs] [-d delay] [-w work]\n"
+			"\n"
+			"  -n submits  number of submits (default 2000)\n"
+			"  -r rings    number of ringbuffers to round-robin (default 4)\n"
+			"  -f relocs   relocs per submit (default 200)\n"
+			"  -d delay    time the fake submit ioctl takes, in us (default 50)\n"
+			"  -w work     time spent building each submit, in us (default 50)\n",
+			name);
+}
+
+static void build(struct fd_ringbuffer *ring, struct fd_bo **bos,
+		unsigned nr_bos, unsigned per_submit, struct fd_bo *marker)
+{
+	unsigned j;
+
+	for (j = 0; j < per_submit; j++) {
+		if ((ring->cur + 1) > ring->end)
+			fd_ringbuffer_grow(ring, 1);
+
+		fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+			.bo = j ? bos[rand() % nr_bos] : marker,
+			.flags = FD_RELOC_READ,
+		});
+	}
+}
+
+/* an out-fence is taken once, by the timestamp of its submit: */
+static void check_out_fence(struct fd_pipe *pipe, struct fd_ringbuffer *ring,
+		struct fd_bo **bos, unsigned nr_bos, int async)
+{
+	uint32_t timestamp;
+	int fence_fd;
+
+	build(ring, bos, nr_bos, 2, markers[0]);
+	assert(fd_ringbuffer_flush2(ring, -1, &fence_fd) == 0);
+	timestamp = fd_ringbuffer_timestamp(ring);
+
+	if (async) {
+		assert(fence_fd == -1);
+		fence_fd = fd_pipe_get_fence_fd(pipe, timestamp);
+		assert(fd_pipe_get_fence_fd(pipe, timestamp) == -1);
+	} else {
+		assert(fd_pipe_get_fence_fd(pipe, timestamp) == -1);
+	}
+	assert(fence_fd >= 0);
+	close(fence_fd);
+
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+}
+
+static void run(struct fd_pipe *pipe, struct fd_bo **bos, unsigned nr_bos,
+		unsigned nr_submits, unsigned nr_rings, unsigned per_submit,
+		int async)
+{
+	struct fd_ringbuffer *rings[MAX_RINGS];
+	uint64_t *flush_start_ns = calloc(nr_submits, sizeof(*flush_start_ns));
+	uint64_t flush_ns = 0, latency_ns = 0, total_ns, t;
+	uint32_t timestamp = 0;
+	unsigned i;
+
+	assert(flush_start_ns);
+	assert(fd_pipe_set_async_submit(pipe, async) == 0);
+
+	for (i = 0; i < nr_rings; i++) {
+		rings[i] = fd_ringbuffer_new_flags(pipe, 0, FD_RINGBUFFER_PERSISTENT);
+		assert(rings[i]);
+	}
+
+	nr_submitted = 0;
+	total_ns = gettime_ns();
+
+	for (i = 0; i < nr_submits; i++) {
+		struct fd_ringbuffer *ring = rings[i % nr_rings];
+
+		/* pretend to do the rest of the work of building the submit: */
+		t = gettime_ns() + work_us * 1000;
+		while (gettime_ns() < t)
+			;
+
+		build(ring, bos, nr_bos, per_submit, markers[i % NR_MARKERS]);
+
+		flush_start_ns[i] = gettime_ns();
+		assert(fd_ringbuffer_flush(ring) == 0);
+		flush_ns += gettime_ns() - flush_start_ns[i];
+
+		assert((int32_t)(fd_ringbuffer_timestamp(ring) - timestamp) > 0);
+		timestamp = fd_ringbuffer_timestamp(ring);
+	}
+
+	/* the bo's of the last submit are busy at least until the submit
+	 * thread has got to it, and with it to all the submits before:
+	 */
+	assert(fd_bo_cpu_prep(markers[(nr_submits - 1) % NR_MARKERS], pipe,
+			DRM_FREEDRENO_PREP_READ) == 0);
+	fd_bo_cpu_fini(markers[(nr_submits - 1) % NR_MARKERS]);
+	assert(nr_submitted == nr_submits);
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+
+	fd_pipe_drain_submits(pipe);
+	total_ns = gettime_ns() - total_ns;
+
+	for (i = 0; i < nr_submits; i++) {
+		assert(submitted_handles[i] == fd_bo_handle(markers[i % NR_MARKERS]));
+		latency_ns += submitted_ns[i] - flush_start_ns[i];
+	}
+
+	/* all submits are done, so the timestamps must be final, and the
+	 * last ring flushed must have the last fence:
+	 */
+	t = fd_ringbuffer_timestamp(rings[(nr_submits - 1) % nr_rings]);
+	for (i = 0; i < nr_rings; i++)
+		assert((int32_t)(fd_ringbuffer_timestamp(rings[i]) - t) <= 0);
+
+	printf("%-6s total: %6.1f ms, flush: %9.1f ns, submitted after: %9.1f ns\n",
+			async ? "async" : "sync", (double)total_ns / 1000000,
+			(double)flush_ns / nr_submits,
+			(double)latency_ns / nr_submits);
+
+	nr_submitted = 0;
+	check_out_fence(pipe, rings[0], bos, nr_bos, async);
+
+	for (i = 0; i < nr_rings; i++)
+		fd_ringbuffer_del(rings[i]);
+	free(flush_start_ns);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nr_submits = 2000, nr_rings = 4, per_submit = 200;
+	unsigned nr_bos = 256, i;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	struct fd_bo **bos;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:f:d:w:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_submits = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_rings = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			per_submit = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			work_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_submits || !nr_rings || (nr_rings > MAX_RINGS) || !per_submit) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+
+	bos = calloc(nr_bos, sizeof(*bos));
+	submitted_handles = calloc(nr_submits, sizeof(*submitted_handles));
+	submitted_ns = calloc(nr_submits, sizeof(*submitted_ns));
+	assert(bos && submitted_handles && submitted_ns);
+
+	for (i = 0; i < nr_bos; i++) {
+		bos[i] = fd_bo_new(dev, 4096, 0);
+		assert(bos[i]);
+	}
+	for (i = 0; i < NR_MARKERS; i++) {
+		markers[i] = fd_bo_new(dev, 4096, 0);
+		assert(markers[i]);
+	}
+
+	fake_submit_hook = submit_hook;
+
+	run(pipe, bos, nr_bos, nr_submits, nr_rings, per_submit, 0);
+	run(pipe, bos, nr_bos, nr_submits, nr_rings, per_submit, 1);
+
+	fake_submit_hook = NULL;
+
+	for (i = 0; i < nr_bos; i++)
+		fd_bo_del(bos[i]);
+	for (i = 0; i < NR_MARKERS; i++)
+		fd_bo_del(markers[i]);
+	free(bos);
+	free(submitted_handles);
+	free(submitted_ns);
+
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
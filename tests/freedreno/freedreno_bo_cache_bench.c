@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for the freedreno bo cache.  The cache sits behind
+ * fd_bo_new()/fd_bo_del(), and those are exercised here against a fake
+ * device and fake fd_bo_funcs backend which simulate GPU busyness with
+ * a fence counter, so no kernel driver is needed.
+ *
+ * The workload roughly models a compositor: each frame allocates some
+ * small state buffers and a few render targets, "submits" them, and
+ * frees them again.  The GPU retires frames with a configurable latency.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+
+#define MAX_BOS_PER_FRAME 64
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-l latency] [-r] [-s seed] [-b bytes]\n"
+			"\n"
+			"  -n frames   number of frames to simulate (default 20000)\n"
+			"  -l latency  frames in flight on the fake GPU (default 2)\n"
+			"  -r          allocate render targets with ALLOC_FOR_RENDER\n"
+			"  -s seed     random seed (default 1)\n"
+			"  -b bytes    limit the bo cache to this many bytes\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	/* window sized render targets, in bytes: */
+	static const uint32_t rt_sizes[] = {
+			1920 * 1080 * 4, 1280 * 720 * 4, 800 * 600 * 4, 256 * 256 * 4,
+	};
+	struct fd_bo *bos[MAX_BOS_PER_FRAME];
+	unsigned frames = 20000, latency = 2, seed = 1;
+	uint32_t rt_flags = 0;
+	uint64_t max_bytes = 0;
+	struct fd_bo_cache_stats stats;
+	uint64_t alloc_ns = 0, free_ns = 0, t;
+	unsigned nr_allocs = 0, nr_gem_new, i, j;
+	uint32_t fence = 0;
+	struct fd_device *dev;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:rs:b:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rt_flags = DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			max_bytes = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	srand(seed);
+	dev = fake_device_new();
+	assert(dev);
+	fd_device_set_cache_limits(dev, max_bytes, 0);
+
+	for (i = 0; i < frames; i++) {
+		unsigned nr_state = 8 + rand() % 40;
+		unsigned nr_rt = 1 + rand() % 4;
+		unsigned n = 0;
+
+		fence++;
+
+		t = gettime_ns();
+		for (j = 0; j < nr_state; j++) {
+			/* small state/constant buffers, 256b .. 64k: */
+			uint32_t size = 256 << (rand() % 9);
+			bos[n++] = fd_bo_new(dev, size, 0);
+		}
+		for (j = 0; j < nr_rt; j++) {
+			uint32_t size = rt_sizes[rand() % ARRAY_SIZE(rt_sizes)];
+			bos[n++] = fd_bo_new(dev, size, rt_flags);
+		}
+		alloc_ns += gettime_ns() - t;
+		nr_allocs += n;
+
+		/* "submit" the frame: */
+		for (j = 0; j < n; j++) {
+			assert(bos[j]);
+			to_fake_bo(bos[j])->fence = fence;
+		}
+
+		t = gettime_ns();
+		for (j = 0; j < n; j++)
+			fd_bo_del(bos[j]);
+		free_ns += gettime_ns() - t;
+
+		/* and retire old frames: */
+		if (fence > latency)
+			atomic_set(&fake_completed_fence, fence - latency);
+	}
+
+	nr_gem_new = atomic_read(&fake_nr_gem_new);
+
+	printf("frames:        %u\n", frames);
+	printf("allocations:   %u\n", nr_allocs);
+	printf("GEM_NEW:       %u\n", nr_gem_new);
+	printf("CPU_PREP:      %u\n", atomic_read(&fake_nr_cpu_prep));
+	printf("hit rate:      %.2f%%\n",
+			100.0 * (nr_allocs - nr_gem_new) / nr_allocs);
+	printf("alloc latency: %.1f ns\n", (double)alloc_ns / nr_allocs);
+	printf("free latency:  %.1f ns\n", (double)free_ns / nr_allocs);
+
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.hits + stats.misses == nr_allocs);
+	assert(stats.misses == nr_gem_new);
+
+	printf("cached:        %u bo's, %"PRIu64" bytes\n", stats.count, stats.bytes);
+	/* the limit covers the threads' magazines too: */
+	assert(!max_bytes || (stats.bytes <= max_bytes));
+	printf("evictions:     %"PRIu64"\n", stats.evictions);
+
+	fd_device_trim_cache(dev, 0);
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 0 && stats.bytes == 0);
+
+	fd_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Multi-threaded stress test/benchmark for fd_bo_new()/fd_bo_del(),
+ * against the fake device (so all bo's are always idle, and what is
+ * measured is the cost of the cache and handle table locking).  Each
+ * thread keeps a window of live bo's, and repeatedly replaces a random
+ * one with a new allocation of random size.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+
+#define WINDOW 32
+
+static struct fd_device *dev;
+static unsigned iterations = 200000;
+
+static void *thread_main(void *arg)
+{
+	unsigned id = (uintptr_t)arg, seed = id;
+	struct fd_bo *bos[WINDOW] = { NULL };
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		unsigned slot = rand_r(&seed) % WINDOW;
+		uint32_t size = 4096 << (rand_r(&seed) % 7);
+
+		if (bos[slot]) {
+			to_fake_bo(bos[slot])->owner = 0;
+			fd_bo_del(bos[slot]);
+		}
+
+		bos[slot] = fd_bo_new(dev, size, 0);
+		assert(bos[slot]);
+		assert(fd_bo_size(bos[slot]) >= size);
+
+		/* make sure we didn't get a bo someone else is using: */
+		assert(to_fake_bo(bos[slot])->owner == 0);
+		to_fake_bo(bos[slot])->owner = id;
+	}
+
+	for (i = 0; i < WINDOW; i++) {
+		if (bos[i]) {
+			to_fake_bo(bos[i])->owner = 0;
+			fd_bo_del(bos[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-n iterations]\n"
+			"\n"
+			"  -t threads     max number of threads (default 8)\n"
+			"  -n iterations  alloc/free iterations per thread (default 200000)\n",
+			name);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[64];
+	unsigned max_threads = 8, nthreads, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:h")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (max_threads < 1 || max_threads > ARRAY_SIZE(threads)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	printf("%8s %16s %12s\n", "threads", "alloc+free/s", "GEM_NEW");
+
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		struct fd_bo_cache_stats stats;
+		uint64_t t;
+
+		dev = fake_device_new();
+		assert(dev);
+		atomic_set(&fake_nr_gem_new, 0);
+
+		t = gettime_ns();
+		for (i = 0; i < nthreads; i++)
+			pthread_create(&threads[i], NULL, thread_main,
+					(void *)(uintptr_t)(i + 1));
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+		t = gettime_ns() - t;
+
+		printf("%8u %16.0f %12u\n", nthreads,
+				(double)nthreads * iterations * 1000000000 / t,
+				atomic_read(&fake_nr_gem_new));
+
+		/* the bo's left in the magazines of the threads which exited
+		 * are back in the buckets, none lost:
+		 */
+		fd_device_get_cache_stats(dev, &stats);
+		assert(stats.count == (uint32_t)atomic_read(&fake_nr_gem_new));
+
+		fd_device_del(dev);
+	}
+
+	return 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Regression test of the bo cache, ringbuffers and submit paths against
+ * the fake msm kernel, so it needs no GPU: freed bo's are reused once
+ * idle and only then, flushes hand out increasing timestamps, and a bo
+ * is busy from the flush of a submit using it until that is waited on,
+ * with and without async submit, threads exiting with bo's in their
+ * magazines, while others trim the cache, lose none of them, and slab
+ * entries are reused once idle, whatever other size classes are busy.
+ * The fake GPU only retires submits when they are waited on.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+/* Flush a submit using @bo on @ring, and return its timestamp */
+static uint32_t submit(struct fd_ringbuffer *ring, struct fd_bo *bo)
+{
+	fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+		.bo = bo,
+		.flags = FD_RELOC_READ | FD_RELOC_WRITE,
+	});
+	assert(fd_ringbuffer_flush(ring) == 0);
+
+	return fd_ringbuffer_timestamp(ring);
+}
+
+static void
+test_reuse(struct fd_device *dev)
+{
+	struct fd_bo_cache_stats stats;
+	struct fd_bo *bo, *other;
+	uint32_t handle;
+	unsigned nr_gem_new;
+
+	bo = fd_bo_new(dev, 8192, 0);
+	assert(bo);
+	assert(fd_bo_size(bo) == 8192);
+	handle = fd_bo_handle(bo);
+	nr_gem_new = atomic_read(&fake_nr_gem_new);
+
+	/* a freed bo is cached, and handed out again for its size: */
+	fd_bo_del(bo);
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 1 && stats.bytes == 8192);
+
+	bo = fd_bo_new(dev, 8000, 0);
+	assert(bo);
+	assert(fd_bo_handle(bo) == handle);
+	assert(fd_bo_size(bo) == 8192);
+	assert((unsigned)atomic_read(&fake_nr_gem_new) == nr_gem_new);
+
+	/* but not for another size: */
+	fd_bo_del(bo);
+	other = fd_bo_new(dev, 65536, 0);
+	assert(other);
+	assert(fd_bo_handle(other) != handle);
+	assert((unsigned)atomic_read(&fake_nr_gem_new) == nr_gem_new + 1);
+	fd_bo_del(other);
+
+	/* and trimming frees them all: */
+	fd_device_trim_cache(dev, 0);
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 0 && stats.bytes == 0);
+	assert(!fake_bo_lookup(handle));
+}
+
+static void
+test_busy_reuse(struct fd_device *dev, struct fd_pipe *pipe)
+{
+	struct fd_ringbuffer *ring;
+	struct fd_bo *bo, *other;
+	uint32_t handle, timestamp;
+
+	bo = fd_bo_new(dev, 4096, 0);
+	assert(bo);
+	handle = fd_bo_handle(bo);
+
+	ring = fd_ringbuffer_new(pipe, 4096);
+	assert(ring);
+	timestamp = submit(ring, bo);
+	fd_ringbuffer_del(ring);
+
+	/* a bo freed while still busy is not handed out again: */
+	fd_bo_del(bo);
+	other = fd_bo_new(dev, 4096, 0);
+	assert(other);
+	assert(fd_bo_handle(other) != handle);
+
+	/* until the submit using it is done: */
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+	bo = fd_bo_new(dev, 4096, 0);
+	assert(bo);
+	assert(fd_bo_handle(bo) == handle);
+
+	/* except for render targets, which don't care: */
+	ring = fd_ringbuffer_new(pipe, 4096);
+	assert(ring);
+	submit(ring, bo);
+	fd_ringbuffer_del(ring);
+	fd_bo_del(bo);
+	bo = fd_bo_new(dev, 4096, DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER);
+	assert(bo);
+	assert(fd_bo_handle(bo) == handle);
+
+	fd_bo_del(bo);
+	fd_bo_del(other);
+	fd_device_trim_cache(dev, 0);
+}
+
+static void
+test_flush(struct fd_device *dev, struct fd_pipe *pipe, int async)
+{
+	struct fd_ringbuffer *ring;
+	struct fd_bo *bos[4];
+	uint32_t timestamp = 0, last;
+	unsigned i;
+
+	assert(fd_pipe_set_async_submit(pipe, async) == 0);
+
+	ring = fd_ringbuffer_new_flags(pipe, 0, FD_RINGBUFFER_PERSISTENT);
+	assert(ring);
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		bos[i] = fd_bo_new(dev, 4096, 0);
+		assert(bos[i]);
+		assert(fd_bo_cpu_prep(bos[i], pipe,
+				DRM_FREEDRENO_PREP_READ | DRM_FREEDRENO_PREP_NOSYNC) == 0);
+		fd_bo_cpu_fini(bos[i]);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		last = submit(ring, bos[i]);
+		assert((int32_t)(last - timestamp) > 0);
+		timestamp = last;
+	}
+
+	/* each bo is busy until waited on, and only a blocking cpu_prep
+	 * waits:
+	 */
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		assert(fd_bo_cpu_prep(bos[i], pipe,
+				DRM_FREEDRENO_PREP_READ | DRM_FREEDRENO_PREP_NOSYNC) == -EBUSY);
+	}
+	assert(fd_bo_cpu_prep(bos[1], pipe, DRM_FREEDRENO_PREP_WRITE) == 0);
+	fd_bo_cpu_fini(bos[1]);
+	assert(fd_bo_cpu_prep(bos[1], pipe,
+			DRM_FREEDRENO_PREP_READ | DRM_FREEDRENO_PREP_NOSYNC) == 0);
+	fd_bo_cpu_fini(bos[1]);
+
+	/* waiting on the last submit waits for the ones before it: */
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+	for (i = 0; i < ARRAY_SIZE(bos); i++) {
+		assert(fd_bo_cpu_prep(bos[i], pipe,
+				DRM_FREEDRENO_PREP_READ | DRM_FREEDRENO_PREP_NOSYNC) == 0);
+		fd_bo_cpu_fini(bos[i]);
+	}
+
+	fd_pipe_drain_submits(pipe);
+	fd_ringbuffer_del(ring);
+	for (i = 0; i < ARRAY_SIZE(bos); i++)
+		fd_bo_del(bos[i]);
+	fd_device_trim_cache(dev, 0);
+
+	assert(fd_pipe_set_async_submit(pipe, 0) == 0);
+}
+
+#define NR_THREADS 8
+
+static atomic_t trimming;
+
+static void *thread_alloc(void *arg)
+{
+	struct fd_device *dev = arg;
+	struct fd_bo *bos[8];
+	unsigned i, j;
+
+	/* exit with (idle) bo's of a few sizes left in the magazine: */
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < ARRAY_SIZE(bos); j++) {
+			bos[j] = fd_bo_new(dev, 4096 << (j % 4), 0);
+			assert(bos[j]);
+		}
+		for (j = 0; j < ARRAY_SIZE(bos); j++)
+			fd_bo_del(bos[j]);
+	}
+
+	return NULL;
+}
+
+static void *thread_trim(void *arg)
+{
+	struct fd_device *dev = arg;
+	unsigned i = 0;
+
+	while (atomic_read(&trimming)) {
+		if (i++ % 2)
+			fd_device_trim_cache(dev, 64 * 1024);
+		else
+			fd_device_set_cache_limits(dev, 256 * 1024, 32 * 1024);
+	}
+
+	return NULL;
+}
+
+/* bo's the fake has handed out and not had closed yet */
+static unsigned nr_live_bos(void)
+{
+	unsigned handle, count = 0;
+
+	for (handle = 1; handle <= (unsigned)atomic_read(&fake_nr_gem_new); handle++)
+		if (fake_bo_lookup(handle))
+			count++;
+
+	return count;
+}
+
+static void
+test_thread_exit(struct fd_device *dev)
+{
+	struct fd_bo_cache_stats stats;
+	pthread_t threads[NR_THREADS], trim;
+	unsigned i, round, nr_live = nr_live_bos();
+
+	fd_device_set_cache_limits(dev, 256 * 1024, 32 * 1024);
+	atomic_set(&trimming, 1);
+	assert(!pthread_create(&trim, NULL, thread_trim, dev));
+
+	for (round = 0; round < 200; round++) {
+		for (i = 0; i < NR_THREADS; i++)
+			assert(!pthread_create(&threads[i], NULL, thread_alloc, dev));
+		for (i = 0; i < NR_THREADS; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	atomic_set(&trimming, 0);
+	pthread_join(trim, NULL);
+
+	/* every bo the threads left behind is in the buckets, or freed: */
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.bytes <= 256 * 1024);
+
+	fd_device_set_cache_limits(dev, 0, 0);
+	fd_device_trim_cache(dev, 0);
+	fd_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 0 && stats.bytes == 0);
+	assert(atomic_read(&dev->bo_cache.magazine_pages) == 0);
+	assert(nr_live_bos() == nr_live);
+}
+
+#define NR_ENTRIES 64
+
+static void
+test_slab(struct fd_device *dev, struct fd_pipe *pipe)
+{
+	struct fd_suballoc *small[2 * NR_ENTRIES], *big[NR_ENTRIES / 2];
+	struct fd_slab_allocator *slabs;
+	struct fd_ringbuffer *ring;
+	uint32_t timestamp, other;
+	unsigned i, nr_gem_new;
+
+	/* slabs of NR_ENTRIES 64 byte entries, or half as many 128 byte ones: */
+	slabs = fd_slab_allocator_new(pipe, 64 * NR_ENTRIES, 0);
+	assert(slabs);
+	ring = fd_ringbuffer_new(pipe, 4096);
+	assert(ring);
+
+	for (i = 0; i < NR_ENTRIES; i++) {
+		small[i] = fd_suballoc_new(slabs, 64);
+		assert(small[i] && (small[i]->bo == small[0]->bo));
+	}
+	timestamp = submit(ring, small[0]->bo);
+	for (i = 0; i < NR_ENTRIES; i++)
+		fd_suballoc_del(small[i], timestamp);
+
+	for (i = 0; i < ARRAY_SIZE(big); i++) {
+		big[i] = fd_suballoc_new(slabs, 100);
+		assert(big[i]);
+	}
+	other = submit(ring, big[0]->bo);
+	for (i = 0; i < ARRAY_SIZE(big); i++)
+		fd_suballoc_del(big[i], other);
+
+	/* busy entries are not handed out again: */
+	for (i = NR_ENTRIES; i < ARRAY_SIZE(small); i++) {
+		small[i] = fd_suballoc_new(slabs, 64);
+		assert(small[i] && (small[i]->bo != small[0]->bo));
+	}
+
+	/* but once done, they are, while the other class is still busy: */
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+	for (i = NR_ENTRIES; i < ARRAY_SIZE(small); i++)
+		fd_suballoc_del(small[i], 0);
+	nr_gem_new = atomic_read(&fake_nr_gem_new);
+	for (i = 0; i < 2 * NR_ENTRIES; i++) {
+		small[i] = fd_suballoc_new(slabs, 64);
+		assert(small[i]);
+	}
+	assert((unsigned)atomic_read(&fake_nr_gem_new) == nr_gem_new);
+
+	for (i = 0; i < ARRAY_SIZE(small); i++)
+		fd_suballoc_del(small[i], 0);
+	assert(fd_pipe_wait(pipe, other) == 0);
+	fd_ringbuffer_del(ring);
+	fd_slab_allocator_del(slabs);
+	fd_device_trim_cache(dev, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+
+	/* submits are only retired by waiting on them: */
+	fake_gpu_latency = ~0u;
+
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+
+	test_reuse(dev);
+	test_busy_reuse(dev, pipe);
+	test_flush(dev, pipe, 0);
+	test_flush(dev, pipe, 1);
+	test_thread_exit(dev);
+	test_slab(dev, pipe);
+
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for building msm submits: emits relocs to a random
+ * selection of bo's into a growable ringbuffer, which is what the bo
+ * table lookup in the msm ringbuffer code is on the hot path of.  Like
+ * mesa's batches, each submit gets a new growable ringbuffer, unless a
+ * single FD_RINGBUFFER_PERSISTENT ringbuffer is requested.  Submits go
+ * to the fake msm kernel, which validates them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n relocs] [-m bos] [-f relocs] [-p] [-s seed]\n"
+			"\n"
+			"  -n relocs   total number of relocs to emit (default 4000000)\n"
+			"  -m bos      number of distinct bo's (default 256)\n"
+			"  -f relocs   relocs per submit (default 2000)\n"
+			"  -p          reuse one persistent ringbuffer for all submits\n"
+			"  -s seed     random seed (default 1)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nr_relocs = 4000000, nr_bos = 256, per_flush = 2000, seed = 1;
+	unsigned nr_flushes = 0, total, i;
+	unsigned nr_allocs = 0, steady_allocs = 0;
+	int persistent = 0;
+	uint64_t reloc_ns = 0, flush_ns = 0, t;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	struct fd_ringbuffer *ring = NULL;
+	struct fd_bo **bos;
+	unsigned *picks;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:m:f:ps:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_relocs = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nr_bos = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			per_flush = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			persistent = 1;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_bos || !per_flush) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	total = nr_relocs;
+	srand(seed);
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+	bos = calloc(nr_bos, sizeof(*bos));
+	picks = calloc(per_flush, sizeof(*picks));
+	assert(bos && picks);
+
+	for (i = 0; i < nr_bos; i++) {
+		bos[i] = fd_bo_new(dev, 4096, 0);
+		assert(bos[i]);
+	}
+
+	while (nr_relocs > 0) {
+		unsigned n = nr_relocs < per_flush ? nr_relocs : per_flush;
+
+		/* pick the bo's up front, to keep rand() out of the timing: */
+		for (i = 0; i < n; i++)
+			picks[i] = rand() % nr_bos;
+
+		if (!ring) {
+			ring = fd_ringbuffer_new_flags(pipe, 0,
+					persistent ? FD_RINGBUFFER_PERSISTENT : 0);
+			assert(ring);
+		}
+
+		t = gettime_ns();
+		for (i = 0; i < n; i++) {
+			/* leave room for the reloc, like BEGIN_RING() would: */
+			if ((ring->cur + 1) > ring->end)
+				fd_ringbuffer_grow(ring, 1);
+
+			fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+				.bo = bos[picks[i]],
+				.flags = (i & 1) ? FD_RELOC_READ : FD_RELOC_WRITE,
+				.offset = 16 * (i & 0xff),
+			});
+		}
+		reloc_ns += gettime_ns() - t;
+
+		t = gettime_ns();
+		assert(fd_ringbuffer_flush(ring) == 0);
+		flush_ns += gettime_ns() - t;
+
+		/* allocations after the first few submits should only happen
+		 * for a new high water mark of bo's per submit:
+		 */
+		nr_allocs += msm_ringbuffer_nr_allocs(ring);
+		if (nr_flushes >= 10)
+			steady_allocs += msm_ringbuffer_nr_allocs(ring);
+
+		if (!persistent) {
+			fd_ringbuffer_del(ring);
+			ring = NULL;
+		}
+
+		nr_relocs -= n;
+		nr_flushes++;
+	}
+
+	printf("relocs:         %u\n", total);
+	printf("submits:        %u\n", nr_flushes);
+	printf("bo's:           %u\n", nr_bos);
+	printf("reloc latency:  %.1f ns\n",
+			(double)reloc_ns / total);
+	printf("flush latency:  %.1f ns\n", (double)flush_ns / nr_flushes);
+	printf("allocations:    %u (%u after the first 10 submits)\n",
+			nr_allocs, steady_allocs);
+
+	if (ring)
+		fd_ringbuffer_del(ring);
+
+	for (i = 0; i < nr_bos; i++)
+		fd_bo_del(bos[i]);
+	free(bos);
+	free(picks);
+
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
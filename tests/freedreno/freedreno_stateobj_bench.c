@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for submits which reference many IB target rings (ie.
+ * state objects), which is where the handling of the submit's cmds table
+ * in the msm ringbuffer code matters.  Each submit emits a number of
+ * fd_ringbuffer_emit_reloc_ring_full() calls to a random selection of
+ * target rings, which stay around across submits.  Submits go to the
+ * fake msm kernel, which validates them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n submits] [-t targets] [-f relocs] [-s seed]\n"
+			"\n"
+			"  -n submits  number of submits (default 500)\n"
+			"  -t targets  number of target rings (default 1024)\n"
+			"  -f relocs   emit_reloc_ring calls per submit (default 4000)\n"
+			"  -s seed     random seed (default 1)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nr_submits = 500, nr_targets = 1024, per_submit = 4000, seed = 1;
+	uint64_t emit_ns = 0, flush_ns = 0, t;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	struct fd_ringbuffer *ring, **targets;
+	unsigned *picks;
+	unsigned i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:f:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_submits = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_targets = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			per_submit = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_targets) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	srand(seed);
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+
+	targets = calloc(nr_targets, sizeof(*targets));
+	picks = calloc(per_submit, sizeof(*picks));
+	assert(targets && picks);
+
+	/* small state objects, with some packets in them: */
+	for (i = 0; i < nr_targets; i++) {
+		targets[i] = fd_ringbuffer_new(pipe, 0);
+		assert(targets[i]);
+		for (j = 0; j < 4 + (i % 16); j++)
+			fd_ringbuffer_emit(targets[i], j);
+	}
+
+	for (i = 0; i < nr_submits; i++) {
+		for (j = 0; j < per_submit; j++)
+			picks[j] = rand() % nr_targets;
+
+		ring = fd_ringbuffer_new(pipe, 0);
+		assert(ring);
+
+		t = gettime_ns();
+		for (j = 0; j < per_submit; j++) {
+			/* leave room for the reloc, like BEGIN_RING() would: */
+			if ((ring->cur + 1) > ring->end)
+				fd_ringbuffer_grow(ring, 1);
+
+			fd_ringbuffer_emit_reloc_ring_full(ring, targets[picks[j]], 0);
+		}
+		emit_ns += gettime_ns() - t;
+
+		t = gettime_ns();
+		assert(fd_ringbuffer_flush(ring) == 0);
+		flush_ns += gettime_ns() - t;
+
+		fd_ringbuffer_del(ring);
+	}
+
+	printf("submits:        %u\n", nr_submits);
+	printf("target rings:   %u\n", nr_targets);
+	printf("emit latency:   %.1f ns\n",
+			(double)emit_ns / ((uint64_t)nr_submits * per_submit));
+	printf("flush latency:  %.1f ns\n", (double)flush_ns / nr_submits);
+
+	for (i = 0; i < nr_targets; i++)
+		fd_ringbuffer_del(targets[i]);
+	free(targets);
+	free(picks);
+
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark for small buffers (uniforms, constants, state), allocated
+ * either as bo's of their own or as sub-allocations from slabs.  Each
+ * frame allocates a number of small buffers, writes them, emits a reloc
+ * to each, flushes, and frees them with the timestamp of the submit.
+ * Reports the time per buffer and the ioctls and submit bo table entries
+ * per frame.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+static unsigned nr_submit_bos;
+
+static void submit_hook(struct drm_msm_gem_submit *req)
+{
+	nr_submit_bos += req->nr_bos;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-b buffers] [-z size] [-s seed]\n"
+			"\n"
+			"  -n frames   number of frames (default 2000)\n"
+			"  -b buffers  small buffers per frame (default 200)\n"
+			"  -z size     max size of the small buffers (default 1024)\n"
+			"  -s seed     random seed (default 1)\n", name);
+}
+
+struct buf {
+	struct fd_bo *bo;
+	struct fd_suballoc *sa;
+	uint32_t size;
+};
+
+static void run(struct fd_pipe *pipe, struct buf *bufs, unsigned nr_frames,
+		unsigned per_frame, unsigned max_size, int suballoc)
+{
+	struct fd_slab_allocator *slabs = NULL;
+	struct fd_ringbuffer *ring;
+	uint64_t alloc_ns = 0, t;
+	unsigned i, j, nr_ioctl;
+	uint32_t timestamp;
+
+	if (suballoc) {
+		slabs = fd_slab_allocator_new(pipe, 0, 0);
+		assert(slabs);
+	}
+
+	ring = fd_ringbuffer_new_flags(pipe, 0, FD_RINGBUFFER_PERSISTENT);
+	assert(ring);
+
+	atomic_set(&fake_nr_ioctl, 0);
+	nr_submit_bos = 0;
+
+	for (i = 0; i < nr_frames; i++) {
+		for (j = 0; j < per_frame; j++)
+			bufs[j].size = 16 + 16 * (rand() % (max_size / 16));
+
+		t = gettime_ns();
+		for (j = 0; j < per_frame; j++) {
+			uint32_t *ptr;
+
+			if (suballoc) {
+				bufs[j].sa = fd_suballoc_new(slabs, bufs[j].size);
+				assert(bufs[j].sa);
+				ptr = fd_suballoc_map(bufs[j].sa);
+			} else {
+				bufs[j].bo = fd_bo_new(pipe->dev, bufs[j].size, 0);
+				assert(bufs[j].bo);
+				ptr = fd_bo_map(bufs[j].bo);
+			}
+			assert(ptr);
+			ptr[0] = i;
+			ptr[(bufs[j].size / 4) - 1] = j;
+		}
+		alloc_ns += gettime_ns() - t;
+
+		for (j = 0; j < per_frame; j++) {
+			struct fd_reloc reloc = {
+				.bo = bufs[j].bo,
+				.flags = FD_RELOC_READ,
+			};
+
+			if ((ring->cur + 1) > ring->end)
+				fd_ringbuffer_grow(ring, 1);
+
+			if (suballoc)
+				fd_ringbuffer_reloc_suballoc(ring, bufs[j].sa, &reloc);
+			else
+				fd_ringbuffer_reloc(ring, &reloc);
+		}
+
+		assert(fd_ringbuffer_flush(ring) == 0);
+		timestamp = fd_ringbuffer_timestamp(ring);
+
+		t = gettime_ns();
+		for (j = 0; j < per_frame; j++) {
+			if (suballoc)
+				fd_suballoc_del(bufs[j].sa, timestamp);
+			else
+				fd_bo_del(bufs[j].bo);
+		}
+		alloc_ns += gettime_ns() - t;
+	}
+
+	nr_ioctl = atomic_read(&fake_nr_ioctl);
+
+	printf("%-8s alloc+free: %6.1f ns, ioctls/frame: %7.1f, submit bo's/frame: %6.1f\n",
+			suballoc ? "suballoc" : "bo",
+			(double)alloc_ns / ((uint64_t)nr_frames * per_frame),
+			(double)nr_ioctl / nr_frames,
+			(double)nr_submit_bos / nr_frames);
+
+	fd_ringbuffer_del(ring);
+	if (slabs)
+		fd_slab_allocator_del(slabs);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nr_frames = 2000, per_frame = 200, max_size = 1024, seed = 1;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	struct buf *bufs;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:b:z:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			per_frame = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_frames || !per_frame || (max_size < 16)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+	bufs = calloc(per_frame, sizeof(*bufs));
+	assert(bufs);
+
+	fake_submit_hook = submit_hook;
+
+	srand(seed);
+	run(pipe, bufs, nr_frames, per_frame, max_size, 0);
+	srand(seed);
+	run(pipe, bufs, nr_frames, per_frame, max_size, 1);
+
+	fake_submit_hook = NULL;
+
+	free(bufs);
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2016 Freedreno Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * End to end benchmark of the msm backend against the fake msm kernel,
+ * which is roughly what a driver does each frame: allocate some short
+ * lived bo's (which should mostly come from the bo cache), map and
+ * write them, emit relocs to them and to a set of long lived bo's, and
+ * flush.  Reports the time per bo allocated, per bo mapped, per reloc
+ * emitted and per flush, plus the ioctls that made it to the "kernel".
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fake_dev.h"
+#include "freedreno_ringbuffer.h"
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-b bos] [-z size] [-m bos] [-f relocs] [-l latency] [-p] [-s seed]\n"
+			"\n"
+			"  -n frames   number of frames (default 2000)\n"
+			"  -b bos      short lived bo's allocated per frame (default 32)\n"
+			"  -z size     max size of the short lived bo's (default 65536)\n"
+			"  -m bos      number of long lived bo's (default 256)\n"
+			"  -f relocs   relocs per frame (default 2000)\n"
+			"  -l latency  submits until the fake GPU retires one (default 2)\n"
+			"  -p          reuse one persistent ringbuffer for all frames\n"
+			"  -s seed     random seed (default 1)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nr_frames = 2000, per_frame = 32, max_size = 65536;
+	unsigned nr_bos = 256, per_flush = 2000, seed = 1;
+	unsigned i, j, nr_gem_new, nr_cpu_prep, nr_submit;
+	uint64_t alloc_ns = 0, map_ns = 0, reloc_ns = 0, flush_ns = 0, t;
+	struct fd_device *dev;
+	struct fd_pipe *pipe;
+	struct fd_ringbuffer *ring = NULL;
+	struct fd_bo **bos, **tmp;
+	unsigned *sizes, *picks;
+	uint32_t timestamp = 0;
+	int persistent = 0, opt;
+
+	while ((opt = getopt(argc, argv, "n:b:z:m:f:l:ps:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			per_frame = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nr_bos = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			per_flush = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			fake_gpu_latency = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			persistent = 1;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_frames || !per_frame || (max_size < 4096) || !nr_bos) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	srand(seed);
+	dev = fake_device_new();
+	assert(dev);
+	pipe = fd_pipe_new(dev, FD_PIPE_3D);
+	assert(pipe);
+
+	bos = calloc(nr_bos, sizeof(*bos));
+	tmp = calloc(per_frame, sizeof(*tmp));
+	sizes = calloc(per_frame, sizeof(*sizes));
+	picks = calloc(per_flush + 1, sizeof(*picks));
+	assert(bos && tmp && sizes && picks);
+
+	for (i = 0; i < nr_bos; i++) {
+		bos[i] = fd_bo_new(dev, 4096, 0);
+		assert(bos[i]);
+	}
+
+	for (i = 0; i < nr_frames; i++) {
+		/* pick sizes and bo's up front, to keep rand() out of the timing: */
+		for (j = 0; j < per_frame; j++)
+			sizes[j] = 4096 + rand() % (max_size - 4096 + 1);
+		for (j = 0; j < per_flush; j++)
+			picks[j] = rand() % (nr_bos + per_frame);
+
+		t = gettime_ns();
+		for (j = 0; j < per_frame; j++) {
+			tmp[j] = fd_bo_new(dev, sizes[j], 0);
+			assert(tmp[j]);
+		}
+		alloc_ns += gettime_ns() - t;
+
+		t = gettime_ns();
+		for (j = 0; j < per_frame; j++) {
+			uint32_t *ptr = fd_bo_map(tmp[j]);
+			assert(ptr);
+			assert(fd_bo_cpu_prep(tmp[j], pipe, DRM_FREEDRENO_PREP_WRITE) == 0);
+			ptr[0] = i;
+			ptr[(sizes[j] / 4) - 1] = j;
+			fd_bo_cpu_fini(tmp[j]);
+		}
+		map_ns += gettime_ns() - t;
+
+		if (!ring) {
+			ring = fd_ringbuffer_new_flags(pipe, 0,
+					persistent ? FD_RINGBUFFER_PERSISTENT : 0);
+			assert(ring);
+		}
+
+		t = gettime_ns();
+		for (j = 0; j < per_flush; j++) {
+			unsigned n = picks[j];
+
+			if ((ring->cur + 1) > ring->end)
+				fd_ringbuffer_grow(ring, 1);
+
+			fd_ringbuffer_reloc(ring, &(struct fd_reloc){
+				.bo = (n < nr_bos) ? bos[n] : tmp[n - nr_bos],
+				.flags = (j & 1) ? FD_RELOC_READ : FD_RELOC_WRITE,
+			});
+		}
+		reloc_ns += gettime_ns() - t;
+
+		t = gettime_ns();
+		assert(fd_ringbuffer_flush(ring) == 0);
+		flush_ns += gettime_ns() - t;
+
+		/* fences from the fake kernel are handed out in order: */
+		assert((int32_t)(fd_ringbuffer_timestamp(ring) - timestamp) > 0);
+		timestamp = fd_ringbuffer_timestamp(ring);
+
+		if (!persistent) {
+			fd_ringbuffer_del(ring);
+			ring = NULL;
+		}
+
+		for (j = 0; j < per_frame; j++)
+			fd_bo_del(tmp[j]);
+	}
+
+	assert(fd_pipe_wait(pipe, timestamp) == 0);
+
+	nr_gem_new = atomic_read(&fake_nr_gem_new);
+	nr_cpu_prep = atomic_read(&fake_nr_cpu_prep);
+	nr_submit = atomic_read(&fake_nr_submit);
+
+	printf("frames:         %u\n", nr_frames);
+	printf("alloc latency:  %.1f ns\n",
+			(double)alloc_ns / ((uint64_t)nr_frames * per_frame));
+	printf("map latency:    %.1f ns\n",
+			(double)map_ns / ((uint64_t)nr_frames * per_frame));
+	printf("reloc latency:  %.1f ns\n",
+			(double)reloc_ns / ((uint64_t)nr_frames * per_flush));
+	printf("flush latency:  %.1f ns\n", (double)flush_ns / nr_frames);
+	printf("frame time:     %.1f us\n",
+			(double)(alloc_ns + map_ns + reloc_ns + flush_ns) /
+			nr_frames / 1000);
+	printf("GEM_NEW:        %u\n", nr_gem_new);
+	printf("GEM_CPU_PREP:   %u\n", nr_cpu_prep);
+	printf("GEM_SUBMIT:     %u\n", nr_submit);
+
+	if (ring)
+		fd_ringbuffer_del(ring);
+	for (i = 0; i < nr_bos; i++)
+		fd_bo_del(bos[i]);
+	free(bos);
+	free(tmp);
+	free(sizes);
+	free(picks);
+
+	fd_pipe_del(pipe);
+	fd_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,595 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "fake_i915.h"
+
+atomic_t fake_nr_ioctl, fake_nr_create, fake_nr_madvise, fake_nr_busy;
+atomic_t fake_nr_execbuf, fake_nr_no_reloc, fake_nr_relocs;
+atomic_t fake_nr_mmap, fake_nr_pwrite, fake_nr_wait;
+int fake_legacy_exec;
+int fake_has_llc = 1, fake_mmap_version = 1;
+unsigned fake_purge_interval;
+unsigned fake_ioctl_delay_ns;
+unsigned fake_exec_ns;
+
+static int fake_fd = -1;
+static atomic_t nr_willneed;
+
+/*
+ * Per-handle state lives in fixed size chunks, which are never freed or
+ * moved, so lookups don't need the lock.  Like GEM handles, closed
+ * handles get reused.  Handle zero is never valid.
+ */
+#define CHUNK_SHIFT  10
+#define CHUNK_SIZE   (1 << CHUNK_SHIFT)
+#define MAX_CHUNKS   1024
+
+static struct fake_bo *chunks[MAX_CHUNKS];
+static uint32_t nr_handles = 1;
+static uint32_t free_handle;
+static uint64_t next_offset;
+static uint64_t next_gtt_offset = 1 << 20;
+static uint32_t exec_stamp;
+static uint64_t ring_busy_until[I915_EXEC_RING_MASK + 1];
+
+/* serializes handle allocation and execbuffers, like struct_mutex: */
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct fake_bo *
+fake_bo_lookup(uint32_t handle)
+{
+	struct fake_bo *chunk;
+
+	if ((handle >> CHUNK_SHIFT) >= MAX_CHUNKS)
+		return NULL;
+	chunk = chunks[handle >> CHUNK_SHIFT];
+	if (!chunk)
+		return NULL;
+	chunk = &chunk[handle & (CHUNK_SIZE - 1)];
+	return chunk->valid ? chunk : NULL;
+}
+
+static int
+fake_getparam(drm_i915_getparam_t *gp)
+{
+	switch (gp->param) {
+	case I915_PARAM_CHIPSET_ID:
+		*gp->value = 0x1616;	/* Broadwell GT2 */
+		return 0;
+	case I915_PARAM_HAS_EXECBUF2:
+	case I915_PARAM_HAS_BSD:
+	case I915_PARAM_HAS_BLT:
+	case I915_PARAM_HAS_RELAXED_FENCING:
+	case I915_PARAM_HAS_WAIT_TIMEOUT:
+	case I915_PARAM_HAS_VEBOX:
+	case I915_PARAM_HAS_EXEC_SOFTPIN:
+		*gp->value = 1;
+		return 0;
+	case I915_PARAM_HAS_EXEC_NO_RELOC:
+	case I915_PARAM_HAS_EXEC_HANDLE_LUT:
+		if (fake_legacy_exec)
+			return -EINVAL;
+		*gp->value = 1;
+		return 0;
+	case I915_PARAM_HAS_LLC:
+		*gp->value = fake_has_llc;
+		return 0;
+	case I915_PARAM_MMAP_VERSION:
+		*gp->value = fake_mmap_version;
+		return 0;
+	case I915_PARAM_HAS_ALIASING_PPGTT:
+		*gp->value = 3;		/* full 48b ppgtt */
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+fake_get_aperture(struct drm_i915_gem_get_aperture *req)
+{
+	req->aper_size = 4ull << 30;
+	req->aper_available_size = req->aper_size;
+	return 0;
+}
+
+static int
+fake_gem_create(struct drm_i915_gem_create *req)
+{
+	struct fake_bo *fake_bo;
+	uint64_t size = (req->size + 4095) & ~4095ull;
+	uint32_t handle;
+	int ret = 0;
+
+	if (!size)
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake_lock);
+	if (free_handle) {
+		handle = free_handle;
+		fake_bo = &chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SIZE - 1)];
+		free_handle = fake_bo->next_free;
+	} else {
+		struct fake_bo **chunk;
+
+		handle = nr_handles;
+		if ((handle >> CHUNK_SHIFT) >= MAX_CHUNKS) {
+			ret = -ENOMEM;
+			goto out_unlock;
+		}
+		chunk = &chunks[handle >> CHUNK_SHIFT];
+		if (!*chunk) {
+			*chunk = calloc(CHUNK_SIZE, sizeof(**chunk));
+			if (!*chunk) {
+				ret = -ENOMEM;
+				goto out_unlock;
+			}
+		}
+		nr_handles++;
+		fake_bo = &(*chunk)[handle & (CHUNK_SIZE - 1)];
+	}
+
+	/* the backing memfd only ever grows, closed BOs punch holes: */
+	fake_bo->offset = next_offset;
+	next_offset += size;
+	if (ftruncate(fake_fd, next_offset)) {
+		fake_bo->next_free = free_handle;
+		free_handle = handle;
+		ret = -errno;
+		goto out_unlock;
+	}
+
+	fake_bo->size = size;
+	fake_bo->madv = I915_MADV_WILLNEED;
+	fake_bo->tiling_mode = I915_TILING_NONE;
+	fake_bo->stride = 0;
+	fake_bo->gtt_offset = 0;
+	fake_bo->exec_stamp = 0;
+	fake_bo->busy_until = 0;
+	fake_bo->owner = 0;
+	fake_bo->valid = 1;
+	req->size = size;
+	req->handle = handle;
+
+	atomic_inc(&fake_nr_create);
+
+out_unlock:
+	pthread_mutex_unlock(&fake_lock);
+	return ret;
+}
+
+static int
+fake_gem_close(struct drm_gem_close *req)
+{
+	struct fake_bo *fake_bo;
+
+	pthread_mutex_lock(&fake_lock);
+	fake_bo = fake_bo_lookup(req->handle);
+	if (!fake_bo) {
+		pthread_mutex_unlock(&fake_lock);
+		return -EINVAL;
+	}
+	fallocate(fake_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		  fake_bo->offset, fake_bo->size);
+	fake_bo->valid = 0;
+	fake_bo->next_free = free_handle;
+	free_handle = req->handle;
+	pthread_mutex_unlock(&fake_lock);
+
+	return 0;
+}
+
+static int
+fake_gem_busy(struct drm_i915_gem_busy *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (!fake_bo)
+		return -ENOENT;
+
+	atomic_inc(&fake_nr_busy);
+	req->busy = gettime_ns() < fake_bo->busy_until;
+	return 0;
+}
+
+static int
+fake_gem_wait(struct drm_i915_gem_wait *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->bo_handle);
+	uint64_t now, until;
+
+	if (!fake_bo)
+		return -ENOENT;
+
+	atomic_inc(&fake_nr_wait);
+
+	now = gettime_ns();
+	until = fake_bo->busy_until;
+	if (until <= now)
+		return 0;
+
+	if (req->timeout_ns >= 0 && now + req->timeout_ns < until) {
+		if (req->timeout_ns) {
+			struct timespec ts = {
+				req->timeout_ns / 1000000000,
+				req->timeout_ns % 1000000000
+			};
+			nanosleep(&ts, NULL);
+		}
+		req->timeout_ns = 0;
+		return -ETIME;
+	}
+
+	while ((now = gettime_ns()) < until) {
+		struct timespec ts = { 0, until - now };
+		nanosleep(&ts, NULL);
+	}
+	return 0;
+}
+
+static int
+fake_gem_madvise(struct drm_i915_gem_madvise *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (req->madv != I915_MADV_WILLNEED && req->madv != I915_MADV_DONTNEED)
+		return -EINVAL;
+	if (!fake_bo)
+		return -ENOENT;
+
+	atomic_inc(&fake_nr_madvise);
+
+	if (fake_purge_interval && fake_bo->madv == I915_MADV_DONTNEED &&
+	    req->madv == I915_MADV_WILLNEED &&
+	    (unsigned)atomic_inc_return(&nr_willneed) % fake_purge_interval == 0)
+		fake_bo->madv = __I915_MADV_PURGED;
+
+	if (fake_bo->madv != __I915_MADV_PURGED)
+		fake_bo->madv = req->madv;
+	req->retained = fake_bo->madv != __I915_MADV_PURGED;
+
+	return 0;
+}
+
+static int
+fake_gem_set_tiling(struct drm_i915_gem_set_tiling *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (!fake_bo)
+		return -ENOENT;
+	if (req->tiling_mode > I915_TILING_Y)
+		return -EINVAL;
+
+	fake_bo->tiling_mode = req->tiling_mode;
+	fake_bo->stride = req->tiling_mode == I915_TILING_NONE ? 0 : req->stride;
+	req->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	return 0;
+}
+
+static int
+fake_gem_get_tiling(struct drm_i915_gem_get_tiling *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (!fake_bo)
+		return -ENOENT;
+
+	req->tiling_mode = fake_bo->tiling_mode;
+	req->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	req->phys_swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
+	return 0;
+}
+
+static int
+fake_gem_mmap(struct drm_i915_gem_mmap *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+	void *ptr;
+
+	if (!fake_bo)
+		return -ENOENT;
+	if ((req->flags & ~I915_MMAP_WC) ||
+	    ((req->flags & I915_MMAP_WC) && fake_mmap_version < 1))
+		return -EINVAL;
+	if (req->offset + req->size > fake_bo->size)
+		return -EINVAL;
+
+	ptr = mmap(NULL, req->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fake_fd, fake_bo->offset + req->offset);
+	if (ptr == MAP_FAILED)
+		return -errno;
+
+	atomic_inc(&fake_nr_mmap);
+	req->addr_ptr = (uintptr_t)ptr;
+	return 0;
+}
+
+static int
+fake_gem_mmap_gtt(struct drm_i915_gem_mmap_gtt *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+
+	if (!fake_bo)
+		return -ENOENT;
+
+	req->offset = fake_bo->offset;
+	return 0;
+}
+
+static int
+fake_gem_pwrite(struct drm_i915_gem_pwrite *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+	ssize_t ret;
+
+	if (!fake_bo)
+		return -ENOENT;
+	if (req->offset + req->size > fake_bo->size)
+		return -EINVAL;
+
+	atomic_inc(&fake_nr_pwrite);
+	ret = pwrite(fake_fd, (void *)(uintptr_t)req->data_ptr, req->size,
+		     fake_bo->offset + req->offset);
+	return ret == (ssize_t)req->size ? 0 : -EFAULT;
+}
+
+static int
+fake_gem_pread(struct drm_i915_gem_pread *req)
+{
+	struct fake_bo *fake_bo = fake_bo_lookup(req->handle);
+	ssize_t ret;
+
+	if (!fake_bo)
+		return -ENOENT;
+	if (req->offset + req->size > fake_bo->size)
+		return -EINVAL;
+
+	ret = pread(fake_fd, (void *)(uintptr_t)req->data_ptr, req->size,
+		    fake_bo->offset + req->offset);
+	return ret == (ssize_t)req->size ? 0 : -EFAULT;
+}
+
+static struct fake_bo *
+exec_lookup(struct drm_i915_gem_execbuffer2 *req,
+	    struct drm_i915_gem_exec_object2 *objs, uint32_t target)
+{
+	struct fake_bo *fake_bo;
+
+	if (req->flags & I915_EXEC_HANDLE_LUT)
+		return target < req->buffer_count ?
+			fake_bo_lookup(objs[target].handle) : NULL;
+
+	/* like the kernel, a target has to be part of the execbuffer: */
+	fake_bo = fake_bo_lookup(target);
+	return fake_bo && fake_bo->exec_stamp == exec_stamp ? fake_bo : NULL;
+}
+
+static int
+fake_gem_execbuffer2(struct drm_i915_gem_execbuffer2 *req)
+{
+	struct drm_i915_gem_exec_object2 *objs =
+		(void *)(uintptr_t)req->buffers_ptr;
+	uint32_t i, j;
+	int moved = 0, ret = 0;
+
+	if (req->buffer_count == 0)
+		return -EINVAL;
+	if (fake_legacy_exec &&
+	    (req->flags & (I915_EXEC_NO_RELOC | I915_EXEC_HANDLE_LUT)))
+		return -EINVAL;
+
+	pthread_mutex_lock(&fake_lock);
+	exec_stamp++;
+
+	for (i = 0; i < req->buffer_count; i++) {
+		struct fake_bo *fake_bo = fake_bo_lookup(objs[i].handle);
+
+		if (!fake_bo || fake_bo->exec_stamp == exec_stamp ||
+		    (objs[i].flags & __EXEC_OBJECT_UNKNOWN_FLAGS)) {
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+		fake_bo->exec_stamp = exec_stamp;
+
+		/* bind on first use, and never move afterwards: */
+		if (objs[i].flags & EXEC_OBJECT_PINNED) {
+			if ((objs[i].offset & 4095) ||
+			    (objs[i].offset + fake_bo->size > 1ull << 32 &&
+			     !(objs[i].flags & EXEC_OBJECT_SUPPORTS_48B_ADDRESS))) {
+				ret = -EINVAL;
+				goto out_unlock;
+			}
+			fake_bo->gtt_offset = objs[i].offset;
+		} else if (!fake_bo->gtt_offset) {
+			fake_bo->gtt_offset = next_gtt_offset;
+			next_gtt_offset += fake_bo->size;
+		}
+		if (fake_bo->gtt_offset != objs[i].offset)
+			moved = 1;
+	}
+
+	for (i = 0; i < req->buffer_count; i++) {
+		struct drm_i915_gem_relocation_entry *relocs =
+			(void *)(uintptr_t)objs[i].relocs_ptr;
+
+		for (j = 0; j < objs[i].relocation_count; j++) {
+			if (!exec_lookup(req, objs, relocs[j].target_handle)) {
+				ret = -ENOENT;
+				goto out_unlock;
+			}
+		}
+	}
+
+	if ((req->flags & I915_EXEC_NO_RELOC) && !moved) {
+		atomic_inc(&fake_nr_no_reloc);
+	} else {
+		for (i = 0; i < req->buffer_count; i++) {
+			struct drm_i915_gem_relocation_entry *relocs =
+				(void *)(uintptr_t)objs[i].relocs_ptr;
+
+			for (j = 0; j < objs[i].relocation_count; j++) {
+				struct fake_bo *target =
+					exec_lookup(req, objs,
+						    relocs[j].target_handle);
+
+				relocs[j].presumed_offset = target->gtt_offset;
+				atomic_inc(&fake_nr_relocs);
+			}
+		}
+	}
+
+	if (fake_exec_ns) {
+		uint64_t *ring = &ring_busy_until[req->flags & I915_EXEC_RING_MASK];
+		uint64_t now = gettime_ns();
+
+		*ring = (*ring > now ? *ring : now) + fake_exec_ns;
+		for (i = 0; i < req->buffer_count; i++) {
+			struct fake_bo *fake_bo = fake_bo_lookup(objs[i].handle);
+
+			if (fake_bo->busy_until < *ring)
+				fake_bo->busy_until = *ring;
+		}
+	}
+
+	for (i = 0; i < req->buffer_count; i++)
+		objs[i].offset = fake_bo_lookup(objs[i].handle)->gtt_offset;
+
+	atomic_inc(&fake_nr_execbuf);
+
+out_unlock:
+	pthread_mutex_unlock(&fake_lock);
+	return ret;
+}
+
+static void
+fake_delay(void)
+{
+	uint64_t end;
+
+	if (!fake_ioctl_delay_ns)
+		return;
+
+	end = gettime_ns() + fake_ioctl_delay_ns;
+	while (gettime_ns() < end)
+		;
+}
+
+static int
+fake_ioctl(unsigned long request, void *arg)
+{
+	atomic_inc(&fake_nr_ioctl);
+	fake_delay();
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM:
+		return fake_getparam(arg);
+	case DRM_IOCTL_I915_GEM_GET_APERTURE:
+		return fake_get_aperture(arg);
+	case DRM_IOCTL_I915_GEM_CREATE:
+		return fake_gem_create(arg);
+	case DRM_IOCTL_GEM_CLOSE:
+		return fake_gem_close(arg);
+	case DRM_IOCTL_I915_GEM_BUSY:
+		return fake_gem_busy(arg);
+	case DRM_IOCTL_I915_GEM_WAIT:
+		return fake_gem_wait(arg);
+	case DRM_IOCTL_I915_GEM_MADVISE:
+		return fake_gem_madvise(arg);
+	case DRM_IOCTL_I915_GEM_SET_TILING:
+		return fake_gem_set_tiling(arg);
+	case DRM_IOCTL_I915_GEM_GET_TILING:
+		return fake_gem_get_tiling(arg);
+	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
+		return fake_gem_execbuffer2(arg);
+	case DRM_IOCTL_I915_GEM_MMAP:
+		return fake_gem_mmap(arg);
+	case DRM_IOCTL_I915_GEM_MMAP_GTT:
+		return fake_gem_mmap_gtt(arg);
+	case DRM_IOCTL_I915_GEM_PWRITE:
+		return fake_gem_pwrite(arg);
+	case DRM_IOCTL_I915_GEM_PREAD:
+		return fake_gem_pread(arg);
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+	case DRM_IOCTL_I915_GEM_SW_FINISH:
+		/* the memfd is coherent, there is nothing to flush */
+		return fake_bo_lookup(*(uint32_t *)arg) ? 0 : -ENOENT;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/* overrides the libdrm one, for the library as well as for us: */
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	if (fd != fake_fd) {
+		do {
+			ret = ioctl(fd, request, arg);
+		} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+		return ret;
+	}
+
+	ret = fake_ioctl(request, arg);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+fake_i915_open(void)
+{
+	if (fake_fd < 0)
+		fake_fd = memfd_create("fake-i915", MFD_CLOEXEC);
+
+	return fake_fd;
+}
+
+uint64_t
+gettime_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
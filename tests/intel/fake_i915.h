@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FAKE_I915_H
+#define FAKE_I915_H
+
+/*
+ * A userspace fake of the i915 kernel driver, for benchmarking
+ * libdrm_intel's GEM buffer manager without a GPU.  fake_i915_open()
+ * returns an fd to hand to drm_intel_bufmgr_gem_init(); the fake defines
+ * drmIoctl() itself, which takes precedence over the one in libdrm, and
+ * implements the ioctls the bufmgr issues on that fd:
+ *
+ *   GET_APERTURE, GETPARAM, GEM_CREATE, GEM_CLOSE, GEM_BUSY,
+ *   GEM_MADVISE, GEM_SET_TILING, GEM_GET_TILING, GEM_EXECBUFFER2,
+ *   GEM_MMAP, GEM_MMAP_GTT, GEM_PWRITE, GEM_PREAD, GEM_SET_DOMAIN,
+ *   GEM_SW_FINISH and GEM_WAIT
+ *
+ * Other fds are passed through to the kernel.  The bufmgr issues
+ * SET_TILING with a raw ioctl(), so only untiled BOs can be used.
+ *
+ * Execbuffers are validated like the kernel would (handles, or indices
+ * with I915_EXEC_HANDLE_LUT, and relocation targets), and bind each BO
+ * at a fixed GTT offset on first use.  Relocations are processed, and
+ * their presumed offsets updated, unless I915_EXEC_NO_RELOC is given
+ * and no BO moved.  Setting fake_legacy_exec before creating the bufmgr
+ * makes the fake behave like a kernel without NO_RELOC and HANDLE_LUT.
+ *
+ * BOs are backed by a memfd, which is also the device fd, so that CPU,
+ * WC and GTT mmaps of them all end up in the same pages.  Clearing
+ * fake_has_llc, or setting fake_mmap_version to 0 for no WC mmaps,
+ * before creating the bufmgr models older hardware and kernels.
+ *
+ * Each batch keeps its ring busy for fake_exec_ns after the previous
+ * one on the ring completes, and its BOs busy until it does.  By
+ * default batches complete immediately, and BOs are never busy.  Every fake_purge_interval'th time a BO marked
+ * DONTNEED is marked WILLNEED again, its pages are reported as purged,
+ * like the kernel does under memory pressure.  Each ioctl can be made
+ * to spin for fake_ioctl_delay_ns, to model the cost of the syscall.
+ */
+
+#include <stdint.h>
+
+#include "xf86atomic.h"
+
+/* the fake's per-handle state: */
+struct fake_bo {
+	uint64_t size;
+	uint64_t offset;         /* in the backing memfd */
+	uint32_t madv;
+	uint32_t tiling_mode;
+	uint32_t stride;
+	uint64_t gtt_offset;     /* 0 until first executed */
+	uint32_t exec_stamp;     /* last execbuffer the BO was part of */
+	uint64_t busy_until;     /* completion time of its last batch */
+	uint32_t next_free;      /* next free handle, when closed */
+	int valid;
+	unsigned owner;          /* for tests to check for double allocation */
+};
+
+struct fake_bo *fake_bo_lookup(uint32_t handle);
+
+extern atomic_t fake_nr_ioctl, fake_nr_create, fake_nr_madvise, fake_nr_busy;
+extern atomic_t fake_nr_execbuf, fake_nr_no_reloc, fake_nr_relocs;
+extern atomic_t fake_nr_mmap, fake_nr_pwrite, fake_nr_wait;
+extern int fake_legacy_exec;
+extern int fake_has_llc, fake_mmap_version;
+extern unsigned fake_purge_interval;
+extern unsigned fake_ioctl_delay_ns;
+extern unsigned fake_exec_ns;
+
+int fake_i915_open(void);
+
+uint64_t gettime_ns(void);
+
+#endif /* FAKE_I915_H */
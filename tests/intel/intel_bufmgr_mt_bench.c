@@ -0,0 +1,219 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Multi-threaded stress test/benchmark for drm_intel_bo_alloc() and
+ * drm_intel_bo_unreference() with BO reuse enabled, against the fake
+ * i915 (so BOs are always idle, and what is measured is the cost of the
+ * bucket cache and its locking).  Each thread keeps a window of live
+ * BOs, and repeatedly replaces a random one with a new allocation of a
+ * random number of pages.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "intel_bufmgr.h"
+#include "fake_i915.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define WINDOW 32
+
+static drm_intel_bufmgr *bufmgr;
+static unsigned iterations = 200000;
+static unsigned max_pages = 256;
+static int for_render;
+
+static void *
+thread_main(void *arg)
+{
+	unsigned id = (uintptr_t)arg, seed = id;
+	drm_intel_bo *bos[WINDOW] = { NULL };
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		unsigned slot = rand_r(&seed) % WINDOW;
+		unsigned long size = 4096 * (1 + rand_r(&seed) % max_pages);
+
+		if (bos[slot]) {
+			fake_bo_lookup(bos[slot]->handle)->owner = 0;
+			drm_intel_bo_unreference(bos[slot]);
+		}
+
+		if (for_render)
+			bos[slot] = drm_intel_bo_alloc_for_render(bufmgr, "bench",
+								  size, 4096);
+		else
+			bos[slot] = drm_intel_bo_alloc(bufmgr, "bench", size, 0);
+		assert(bos[slot]);
+		assert(bos[slot]->size >= size);
+
+		/* make sure we didn't get a BO someone else is using: */
+		assert(fake_bo_lookup(bos[slot]->handle)->owner == 0);
+		fake_bo_lookup(bos[slot]->handle)->owner = id;
+	}
+
+	for (i = 0; i < WINDOW; i++) {
+		if (bos[i]) {
+			fake_bo_lookup(bos[i]->handle)->owner = 0;
+			drm_intel_bo_unreference(bos[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+print_buckets(struct drm_intel_gem_bucket_stats *stats, int n)
+{
+	int i;
+
+	printf("\n%10s %8s %10s %10s %10s %8s\n",
+	       "bucket", "count", "bytes", "hits", "misses", "purges");
+	for (i = 0; i < n; i++) {
+		if (!stats[i].hits && !stats[i].misses)
+			continue;
+		printf("%10lu %8lu %10llu %10llu %10llu %8llu\n",
+		       stats[i].size, stats[i].count,
+		       (unsigned long long)stats[i].bytes,
+		       (unsigned long long)stats[i].hits,
+		       (unsigned long long)stats[i].misses,
+		       (unsigned long long)stats[i].purges);
+	}
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-t threads] [-n iterations] [-m pages] [-r] "
+	       "[-p interval] [-d ns] [-v]\n"
+	       "\n"
+	       "  -t threads     max number of threads (default 8)\n"
+	       "  -n iterations  alloc/free iterations per thread (default 200000)\n"
+	       "  -m pages       max pages per allocation (default 256)\n"
+	       "  -r             allocate for render (MRU, no busy check)\n"
+	       "  -p interval    purge every interval'th cached BO on reuse\n"
+	       "  -d ns          time spent in each ioctl (default 0)\n"
+	       "  -v             print per-bucket statistics\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct drm_intel_gem_bucket_stats stats[64];
+	pthread_t threads[64];
+	unsigned max_threads = 8, nthreads, i;
+	int verbose = 0, fd, n, opt;
+
+	while ((opt = getopt(argc, argv, "t:n:m:rp:d:vh")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			for_render = 1;
+			break;
+		case 'p':
+			fake_purge_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			fake_ioctl_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (max_threads < 1 || max_threads > ARRAY_SIZE(threads) ||
+	    max_pages < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_i915_open();
+	assert(fd >= 0);
+
+	printf("%8s %16s %12s %12s %12s %10s\n", "threads", "alloc+free/s",
+	       "ioctl/alloc", "hits", "misses", "purges");
+
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		uint64_t t, hits = 0, misses = 0, purges = 0;
+
+		bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+		assert(bufmgr);
+		drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+		atomic_set(&fake_nr_ioctl, 0);
+
+		t = gettime_ns();
+		for (i = 0; i < nthreads; i++)
+			pthread_create(&threads[i], NULL, thread_main,
+				       (void *)(uintptr_t)(i + 1));
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+		t = gettime_ns() - t;
+
+		n = drm_intel_bufmgr_gem_get_cache_stats(bufmgr, stats,
+							 ARRAY_SIZE(stats));
+		assert(n <= (int)ARRAY_SIZE(stats));
+		for (i = 0; i < (unsigned)n; i++) {
+			hits += stats[i].hits;
+			misses += stats[i].misses;
+			purges += stats[i].purges;
+		}
+		assert(hits + misses <= (uint64_t)nthreads * iterations);
+
+		printf("%8u %16.0f %12.2f %12llu %12llu %10llu\n", nthreads,
+		       (double)nthreads * iterations * 1000000000 / t,
+		       (double)atomic_read(&fake_nr_ioctl) /
+		       (nthreads * iterations),
+		       (unsigned long long)hits, (unsigned long long)misses,
+		       (unsigned long long)purges);
+		if (verbose)
+			print_buckets(stats, n);
+
+		drm_intel_bufmgr_destroy(bufmgr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark for building the execbuffer2 validation list, against the
+ * fake i915.  The batch references a number of state buffers, each of
+ * which references a chain of buffers of its own, and every buffer of a
+ * chain shared by all of them, so the relocation tree is both wide and
+ * deep and has plenty of duplicate references.  The same batch is executed repeatedly, with
+ * and without I915_EXEC_NO_RELOC and I915_EXEC_HANDLE_LUT support in
+ * the fake kernel, and with every BO softpinned by the bufmgr, which
+ * leaves no relocations at all.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "intel_bufmgr.h"
+#include "i915_drm.h"
+#include "fake_i915.h"
+
+#define BATCH_SIZE (16 * 1024)
+
+static unsigned iterations = 10000;
+static unsigned width = 64, depth = 8, shared = 16;
+
+static void
+emit(drm_intel_bo *bo, unsigned slot, drm_intel_bo *target, uint32_t domain)
+{
+	int ret;
+
+	ret = drm_intel_bo_emit_reloc(bo, slot * 4, target, 0,
+				      I915_GEM_DOMAIN_RENDER, domain);
+	assert(ret == 0);
+}
+
+static void
+run(drm_intel_bufmgr *bufmgr, const char *mode)
+{
+	unsigned nr_bos = 1 + width * (1 + depth) + shared;
+	drm_intel_bo **bos = calloc(nr_bos, sizeof(*bos));
+	drm_intel_bo *batch, **shared_bos, **state_bos, **chain;
+	unsigned nr_relocs = 0, i, j;
+	uint64_t t;
+	int ret;
+
+	assert(bos);
+	batch = bos[0] = drm_intel_bo_alloc(bufmgr, "batch", BATCH_SIZE, 0);
+	state_bos = &bos[1];
+	chain = &bos[1 + width];
+	shared_bos = &bos[1 + width * (1 + depth)];
+	for (i = 1; i < nr_bos; i++) {
+		bos[i] = drm_intel_bo_alloc(bufmgr, "bench", 4096, 0);
+		assert(bos[i]);
+	}
+
+	/* relocations can only be added bottom-up */
+	for (j = shared; j-- > 1; nr_relocs++)
+		emit(shared_bos[j - 1], 0, shared_bos[j], 0);
+
+	for (i = 0; i < width; i++) {
+		drm_intel_bo **c = &chain[i * depth];
+
+		for (j = depth; j-- > 1; nr_relocs++)
+			emit(c[j - 1], 0, c[j], 0);
+		if (depth) {
+			emit(state_bos[i], 0, c[0], 0);
+			nr_relocs++;
+		}
+		for (j = 0; j < shared; j++, nr_relocs++)
+			emit(state_bos[i], 1 + j, shared_bos[j],
+			     j & 1 ? I915_GEM_DOMAIN_RENDER : 0);
+		emit(batch, i, state_bos[i], 0);
+		nr_relocs++;
+	}
+
+	atomic_set(&fake_nr_execbuf, 0);
+	atomic_set(&fake_nr_no_reloc, 0);
+	atomic_set(&fake_nr_relocs, 0);
+
+	t = gettime_ns();
+	for (i = 0; i < iterations; i++) {
+		ret = drm_intel_bo_mrb_exec(batch, 8, NULL, 0, 0,
+					    I915_EXEC_RENDER);
+		assert(ret == 0);
+	}
+	t = gettime_ns() - t;
+
+	/* every BO was submitted, and knows where the kernel put it */
+	for (i = 0; i < nr_bos; i++)
+		assert(bos[i]->offset64 != 0 &&
+		       bos[i]->offset64 == fake_bo_lookup(bos[i]->handle)->gtt_offset);
+	assert(atomic_read(&fake_nr_execbuf) == (int)iterations);
+
+	printf("%-12s %8u %8u %12.2f %16.1f %10u\n", mode, nr_bos, nr_relocs,
+	       (double)t / iterations / 1000,
+	       (double)atomic_read(&fake_nr_relocs) / iterations,
+	       atomic_read(&fake_nr_no_reloc));
+
+	for (i = 0; i < nr_bos; i++)
+		drm_intel_bo_unreference(bos[i]);
+	free(bos);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n iterations] [-w width] [-d depth] [-s shared]\n"
+	       "\n"
+	       "  -n iterations  execbuffers per mode (default 10000)\n"
+	       "  -w width       state buffers referenced by the batch (default 64)\n"
+	       "  -d depth       length of the chain below each of them (default 8)\n"
+	       "  -s shared      length of the chain shared by all of them (default 16)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		int legacy, softpin;
+	} modes[] = {
+		{ "legacy", 1, 0 },
+		{ "lut+noreloc", 0, 0 },
+		{ "softpin", 0, 1 },
+	};
+	drm_intel_bufmgr *bufmgr;
+	unsigned i;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "n:w:d:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			shared = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (width < 1 || width > BATCH_SIZE / 4 || shared >= 1024) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_i915_open();
+	assert(fd >= 0);
+
+	printf("%-12s %8s %8s %12s %16s %10s\n", "kernel", "bos", "relocs",
+	       "us/exec", "relocs/exec", "NO_RELOC");
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		fake_legacy_exec = modes[i].legacy;
+		bufmgr = drm_intel_bufmgr_gem_init(fd, BATCH_SIZE);
+		assert(bufmgr);
+		if (modes[i].softpin)
+			assert(drm_intel_bufmgr_gem_enable_softpin_va(bufmgr) == 0);
+		run(bufmgr, modes[i].name);
+		drm_intel_bufmgr_destroy(bufmgr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,962 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays captured batches through libdrm_intel against the fake i915,
+ * reporting the CPU time spent in each stage of submitting them: BO
+ * allocation, uploading their contents, emitting relocations,
+ * execbuffer, and freeing the BOs again.
+ *
+ * Two kinds of capture are understood.  AUB files, as written by
+ * drm_intel_bufmgr_gem_set_aub_dump() in earlier releases and by this
+ * tool's -o option, hold every buffer the GPU saw at its GTT address,
+ * and which batches were executed on which ring.  Raw batches, such as
+ * the ones in intel/tests, hold a single batch with the GTT addresses of
+ * what it referenced at the time it was captured; the chipset is
+ * guessed from the file name like test_decode does.
+ *
+ * Neither kind records the relocations themselves, so they are
+ * recovered: in AUB files, any DWORD of a batch or state buffer that
+ * points into another buffer is taken to be one, and in raw batches,
+ * the address fields of the decoded packets are, with each 4KiB page
+ * they point into becoming a buffer of its own.  Buffers are allocated
+ * and relocations emitted fresh for every iteration, the way a driver
+ * builds a frame.  After one replay to warm up the bufmgr, the
+ * relocation lists should all be recycled, allocating nothing.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "intel_bufmgr.h"
+#include "intel_chipset.h"
+#include "intel_aub.h"
+#include "i915_drm.h"
+#include "fake_i915.h"
+
+/* where test_decode, and so the reference output, places raw batches */
+#define HW_OFFSET 0x12300000
+
+/* Smaller values are much more likely to be flags or offsets from a base
+ * address than GTT addresses, which start above the ring and the
+ * hardware status page.
+ */
+#define MIN_ADDRESS 0x10000
+
+#define ALIGN(value, alignment) (((value) + (alignment) - 1) & ~((alignment) - 1))
+
+struct replay_buffer {
+	uint64_t addr;
+	uint32_t size;
+	/* AUB_TRACE_TYPE_* and subtype, as in the capture */
+	uint32_t type, subtype;
+	/* NULL if the contents were not captured */
+	uint32_t *data;
+	/* relocations from this buffer, relocs[first_reloc...] */
+	unsigned first_reloc, nr_relocs;
+	drm_intel_bo *bo;
+	int visit;
+};
+
+struct replay_reloc {
+	unsigned buffer;
+	uint32_t offset;
+	unsigned target;
+	uint32_t delta;
+	bool write;
+	/* dropped to break a cycle */
+	bool dropped;
+};
+
+struct replay_exec {
+	unsigned batch;
+	uint32_t used;
+	unsigned ring;
+};
+
+struct workload {
+	uint32_t devid;
+	struct replay_buffer *buffers;
+	unsigned nr_buffers, max_buffers;
+	struct replay_reloc *relocs;
+	unsigned nr_relocs, max_relocs;
+	struct replay_exec *execs;
+	unsigned nr_execs, max_execs;
+	/* buffers in the order to emit their relocations in */
+	unsigned *order;
+	unsigned nr_dropped;
+};
+
+enum stage {
+	STAGE_ALLOC,
+	STAGE_UPLOAD,
+	STAGE_RELOC,
+	STAGE_EXEC,
+	STAGE_FREE,
+	NR_STAGES
+};
+
+static const char *stage_names[NR_STAGES] = {
+	"alloc", "upload", "reloc", "exec", "free",
+};
+
+static unsigned iterations = 1000;
+static uint32_t devid_override;
+static bool softpin, verbose;
+
+static uint64_t
+cputime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *
+grow(void *ptr, unsigned *max, unsigned count, size_t elt_size)
+{
+	if (count < *max)
+		return ptr;
+
+	*max = *max ? *max * 2 : 16;
+	ptr = realloc(ptr, *max * elt_size);
+	if (!ptr)
+		errx(1, "out of memory");
+	return ptr;
+}
+
+static unsigned
+add_buffer(struct workload *w, uint64_t addr, uint32_t size, uint32_t type,
+	   uint32_t subtype, const void *data)
+{
+	struct replay_buffer *buf;
+
+	w->buffers = grow(w->buffers, &w->max_buffers, w->nr_buffers,
+			  sizeof(*w->buffers));
+	buf = &w->buffers[w->nr_buffers];
+	memset(buf, 0, sizeof(*buf));
+	buf->addr = addr;
+	buf->size = size;
+	buf->type = type;
+	buf->subtype = subtype;
+	if (data) {
+		buf->data = calloc(1, ALIGN(size, 4));
+		if (!buf->data)
+			errx(1, "out of memory");
+		memcpy(buf->data, data, size);
+	}
+
+	return w->nr_buffers++;
+}
+
+static void
+add_reloc(struct workload *w, unsigned buffer, uint32_t offset,
+	  unsigned target, uint32_t delta, bool write)
+{
+	struct replay_reloc *reloc;
+
+	w->relocs = grow(w->relocs, &w->max_relocs, w->nr_relocs,
+			 sizeof(*w->relocs));
+	reloc = &w->relocs[w->nr_relocs++];
+	reloc->buffer = buffer;
+	reloc->offset = offset;
+	reloc->target = target;
+	reloc->delta = delta;
+	reloc->write = write;
+	reloc->dropped = false;
+}
+
+static void
+add_exec(struct workload *w, unsigned batch, uint32_t used, unsigned ring)
+{
+	struct replay_exec *exec;
+
+	w->execs = grow(w->execs, &w->max_execs, w->nr_execs,
+			sizeof(*w->execs));
+	exec = &w->execs[w->nr_execs++];
+	exec->batch = batch;
+	exec->used = used;
+	exec->ring = ring;
+}
+
+/* Returns the buffer containing @addr, or -1. */
+static int
+find_buffer(const struct workload *w, uint64_t addr)
+{
+	unsigned i;
+
+	for (i = 0; i < w->nr_buffers; i++) {
+		if (addr >= w->buffers[i].addr &&
+		    addr - w->buffers[i].addr < w->buffers[i].size)
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+read_file(const char *filename, void **ptr, size_t *size)
+{
+	FILE *file;
+	long len;
+
+	file = fopen(filename, "rb");
+	if (!file)
+		err(1, "couldn't open `%s'", filename);
+	if (fseek(file, 0, SEEK_END) || (len = ftell(file)) < 0 ||
+	    fseek(file, 0, SEEK_SET))
+		err(1, "couldn't size `%s'", filename);
+
+	*size = len;
+	*ptr = malloc(len + 4);
+	if (!*ptr)
+		errx(1, "out of memory");
+	if (fread(*ptr, 1, len, file) != (size_t)len)
+		err(1, "couldn't read `%s'", filename);
+	fclose(file);
+}
+
+static uint32_t
+infer_devid(const char *batch_filename)
+{
+	struct {
+		const char *name;
+		uint16_t devid;
+	} chipsets[] = {
+		{ "830",  0x3577},
+		{ "855",  0x3582},
+		{ "945",  0x2772},
+		{ "gen4", 0x2a02 },
+		{ "gm45", 0x2a42 },
+		{ "gen5", PCI_CHIP_ILD_G },
+		{ "gen6", PCI_CHIP_SANDYBRIDGE_GT2 },
+		{ "gen7", PCI_CHIP_IVYBRIDGE_GT2 },
+		{ "gen8", 0x1616 },
+		{ NULL, 0 },
+	};
+	int i;
+
+	for (i = 0; chipsets[i].name != NULL; i++) {
+		if (strstr(batch_filename, chipsets[i].name))
+			return chipsets[i].devid;
+	}
+
+	errx(1, "couldn't guess chipset id from batch filename `%s', use -d",
+	     batch_filename);
+}
+
+static bool
+is_gen8_plus(uint32_t devid)
+{
+	return IS_GEN8(devid) || IS_GEN9(devid);
+}
+
+/* Takes the fields the decoder describes as an address or bound of
+ * something as relocations; "pointers" in the decode are offsets from a
+ * state base address instead.
+ */
+static void DRM_PRINTFLIKE(5, 0)
+raw_field(void *data, uint32_t offset, unsigned int index, uint32_t value,
+	  const char *fmt, va_list va)
+{
+	struct workload *w = data;
+	bool write;
+	int target;
+
+	(void)index;
+	(void)va;
+
+	if (!strstr(fmt, "address") && !strstr(fmt, "upper bound") &&
+	    strncmp(fmt, "dst offset", 10) != 0 &&
+	    strncmp(fmt, "src offset", 10) != 0)
+		return;
+	if (value < MIN_ADDRESS)
+		return;
+
+	write = strncmp(fmt, "dst", 3) == 0 || strstr(fmt, "destination");
+
+	target = find_buffer(w, value);
+	if (target < 0)
+		target = add_buffer(w, value & ~0xfff, 4096,
+				    AUB_TRACE_TYPE_NOTYPE, 0, NULL);
+	if (write)
+		w->buffers[target].type = AUB_TRACE_TYPE_2D_MAP;
+
+	add_reloc(w, 0, offset - HW_OFFSET, target,
+		  value - w->buffers[target].addr, write);
+}
+
+static const struct drm_intel_decode_visitor raw_visitor = {
+	.field = raw_field,
+};
+
+static void
+load_raw(struct workload *w, const char *filename, uint32_t *data,
+	 size_t size)
+{
+	struct drm_intel_decode *ctx;
+
+	w->devid = devid_override ? devid_override : infer_devid(filename);
+
+	add_buffer(w, HW_OFFSET, size, AUB_TRACE_TYPE_BATCH, 0, data);
+
+	ctx = drm_intel_decode_context_alloc(w->devid);
+	if (!ctx)
+		errx(1, "can't decode batches for chipset 0x%04x", w->devid);
+	drm_intel_decode_set_batch_pointer(ctx, data, HW_OFFSET, size / 4);
+	drm_intel_decode_set_visitor(ctx, &raw_visitor, w);
+	drm_intel_decode(ctx);
+	drm_intel_decode_context_free(ctx);
+
+	/* 2D commands go to the blitter */
+	add_exec(w, 0, size, size >= 4 && (data[0] >> 29) == 2 ?
+		 I915_EXEC_BLT : I915_EXEC_RENDER);
+}
+
+static unsigned
+ring_flag(uint32_t aub_ring)
+{
+	switch (aub_ring) {
+	case AUB_TRACE_TYPE_RING_PRB1:
+		return I915_EXEC_BSD;
+	case AUB_TRACE_TYPE_RING_PRB2:
+		return I915_EXEC_BLT;
+	default:
+		return I915_EXEC_RENDER;
+	}
+}
+
+static uint32_t
+aub_ring(unsigned ring_flag)
+{
+	switch (ring_flag) {
+	case I915_EXEC_BSD:
+		return AUB_TRACE_TYPE_RING_PRB1;
+	case I915_EXEC_BLT:
+		return AUB_TRACE_TYPE_RING_PRB2;
+	default:
+		return AUB_TRACE_TYPE_RING_PRB0;
+	}
+}
+
+/* Adds an exec for each MI_BATCH_BUFFER_START written to a ring. */
+static void
+aub_ring_write(struct workload *w, uint32_t ring, const uint32_t *data,
+	       uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i + 1 < count; i++) {
+		uint64_t addr;
+		int batch;
+
+		if ((data[i] & 0xff800000) != AUB_MI_BATCH_BUFFER_START)
+			continue;
+
+		addr = data[i + 1];
+		if ((data[i] & 0xff) == 1 && i + 2 < count)
+			addr |= (uint64_t)data[i + 2] << 32;
+
+		batch = find_buffer(w, addr);
+		if (batch < 0)
+			errx(1, "batch at 0x%llx was never written",
+			     (unsigned long long)addr);
+		add_exec(w, batch, w->buffers[batch].size, ring_flag(ring));
+		i += 1 + (data[i] & 0xff);
+	}
+}
+
+static void
+aub_data_write(struct workload *w, uint32_t type, uint32_t subtype,
+	       uint64_t addr, uint32_t size, const uint32_t *data)
+{
+	struct replay_buffer *buf;
+	unsigned i;
+
+	/* rewriting a buffer replaces its contents */
+	for (i = 0; i < w->nr_buffers; i++) {
+		buf = &w->buffers[i];
+		if (buf->addr != addr)
+			continue;
+
+		if (size > buf->size || !buf->data) {
+			free(buf->data);
+			buf->data = calloc(1, ALIGN(size, 4));
+			if (!buf->data)
+				errx(1, "out of memory");
+			buf->size = size;
+		}
+		memcpy(buf->data, data, size);
+		buf->type = type;
+		buf->subtype = subtype;
+		return;
+	}
+
+	add_buffer(w, addr, size, type, subtype, data);
+}
+
+static const struct workload *sort_workload;
+
+static int
+cmp_addr(const void *a, const void *b)
+{
+	uint64_t addr_a = sort_workload->buffers[*(const unsigned *)a].addr;
+	uint64_t addr_b = sort_workload->buffers[*(const unsigned *)b].addr;
+
+	return addr_a < addr_b ? -1 : addr_a > addr_b;
+}
+
+/* Like find_buffer(), over the buffer indices in @sorted by address. */
+static int
+find_sorted(const struct workload *w, const unsigned *sorted, uint64_t addr)
+{
+	unsigned lo = 0, hi = w->nr_buffers;
+
+	/* the last buffer starting at or below addr */
+	while (hi - lo > 1) {
+		unsigned mid = (lo + hi) / 2;
+
+		if (w->buffers[sorted[mid]].addr <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (hi == 0 || addr < w->buffers[sorted[lo]].addr ||
+	    addr - w->buffers[sorted[lo]].addr >= w->buffers[sorted[lo]].size)
+		return -1;
+	return sorted[lo];
+}
+
+/* Recovers relocations from the buffers that can hold pointers. */
+static void
+aub_scan_relocs(struct workload *w)
+{
+	unsigned *sorted;
+	unsigned i, j;
+
+	sorted = calloc(w->nr_buffers, sizeof(*sorted));
+	if (!sorted && w->nr_buffers)
+		errx(1, "out of memory");
+	for (i = 0; i < w->nr_buffers; i++)
+		sorted[i] = i;
+	sort_workload = w;
+	qsort(sorted, w->nr_buffers, sizeof(*sorted), cmp_addr);
+
+	for (i = 0; i < w->nr_buffers; i++) {
+		struct replay_buffer *buf = &w->buffers[i];
+
+		if (!buf->data)
+			continue;
+		if (buf->type != AUB_TRACE_TYPE_BATCH &&
+		    buf->type != AUB_TRACE_TYPE_GENERAL &&
+		    buf->type != AUB_TRACE_TYPE_SURFACE &&
+		    buf->type != AUB_TRACE_TYPE_NOTYPE)
+			continue;
+
+		for (j = 0; j < buf->size / 4; j++) {
+			uint32_t value = buf->data[j];
+			int target;
+
+			if (value < MIN_ADDRESS)
+				continue;
+			target = find_sorted(w, sorted, value);
+			if (target < 0 || (unsigned)target == i)
+				continue;
+
+			add_reloc(w, i, j * 4, target,
+				  value - w->buffers[target].addr,
+				  w->buffers[target].type ==
+				  AUB_TRACE_TYPE_2D_MAP);
+		}
+	}
+
+	free(sorted);
+}
+
+static void
+load_aub(struct workload *w, const char *filename, uint32_t *data,
+	 size_t size)
+{
+	size_t count = size / 4, i = 0;
+
+	w->devid = devid_override;
+
+	while (i < count) {
+		uint32_t header = data[i];
+		uint32_t len = (header & 0xffff) + 2;
+
+		if ((header & 0xe0000000) != (uint32_t)CMD_AUB || i + len > count)
+			errx(1, "`%s' is corrupt at 0x%zx", filename, i * 4);
+
+		if ((header & 0xffff0000) == (uint32_t)CMD_AUB_HEADER) {
+			char name[33];
+			unsigned devid;
+
+			if (len >= 10) {
+				memcpy(name, &data[i + 2], 32);
+				name[32] = '\0';
+				if (!w->devid &&
+				    sscanf(name, "PCI-ID=0x%x", &devid) == 1)
+					w->devid = devid;
+			}
+		} else if ((header & 0xffff0000) ==
+			   (uint32_t)CMD_AUB_TRACE_HEADER_BLOCK &&
+			   len >= 5) {
+			uint32_t op = data[i + 1];
+			uint64_t addr = data[i + 3];
+			uint32_t block_size = data[i + 4];
+			uint32_t dwords = ALIGN(block_size, 4) / 4;
+
+			if (len >= 6)
+				addr |= (uint64_t)data[i + 5] << 32;
+			if (i + len + dwords > count)
+				errx(1, "`%s' is truncated", filename);
+
+			switch (op & AUB_TRACE_OPERATION_MASK) {
+			case AUB_TRACE_OP_DATA_WRITE:
+				if ((op & AUB_TRACE_ADDRESS_SPACE_MASK) ==
+				    AUB_TRACE_MEMTYPE_GTT)
+					aub_data_write(w,
+						       op & AUB_TRACE_TYPE_MASK,
+						       data[i + 2], addr,
+						       block_size,
+						       &data[i + len]);
+				break;
+			case AUB_TRACE_OP_COMMAND_WRITE:
+				aub_ring_write(w, op & AUB_TRACE_TYPE_MASK,
+					       &data[i + len], dwords);
+				break;
+			}
+			i += dwords;
+		}
+
+		i += len;
+	}
+
+	if (!w->devid)
+		errx(1, "`%s' does not say which chipset it is for, use -d",
+		     filename);
+
+	aub_scan_relocs(w);
+}
+
+static void
+aub_out(FILE *file, uint32_t dword)
+{
+	if (fwrite(&dword, sizeof(dword), 1, file) != 1)
+		err(1, "couldn't write AUB");
+}
+
+static void
+aub_trace_block(FILE *file, bool gen8, uint32_t op, uint32_t subtype,
+		uint64_t addr, uint32_t size)
+{
+	aub_out(file, CMD_AUB_TRACE_HEADER_BLOCK | ((gen8 ? 6 : 5) - 2));
+	aub_out(file, op);
+	aub_out(file, subtype);
+	aub_out(file, addr & 0xffffffff);
+	aub_out(file, size);
+	if (gen8)
+		aub_out(file, addr >> 32);
+}
+
+/* Writes @w out as an AUB file, in the layout load_aub() reads. */
+static void
+write_aub(const struct workload *w, const char *filename)
+{
+	bool gen8 = is_gen8_plus(w->devid);
+	uint32_t name[8];
+	FILE *file;
+	unsigned i, j;
+
+	file = fopen(filename, "wb");
+	if (!file)
+		err(1, "couldn't open `%s'", filename);
+
+	aub_out(file, CMD_AUB_HEADER | (13 - 2));
+	aub_out(file, (4 << AUB_HEADER_MAJOR_SHIFT) |
+		(0 << AUB_HEADER_MINOR_SHIFT));
+	memset(name, 0, sizeof(name));
+	snprintf((char *)name, sizeof(name), "PCI-ID=0x%X", w->devid);
+	for (i = 0; i < 8; i++)
+		aub_out(file, name[i]);
+	aub_out(file, 0); /* timestamp */
+	aub_out(file, 0); /* timestamp */
+	aub_out(file, 0); /* comment length */
+
+	for (i = 0; i < w->nr_buffers; i++) {
+		const struct replay_buffer *buf = &w->buffers[i];
+
+		aub_trace_block(file, gen8,
+				AUB_TRACE_OP_DATA_WRITE | AUB_TRACE_MEMTYPE_GTT |
+				buf->type, buf->subtype, buf->addr, buf->size);
+		for (j = 0; j < ALIGN(buf->size, 4) / 4; j++)
+			aub_out(file, buf->data ? buf->data[j] : 0);
+	}
+
+	for (i = 0; i < w->nr_execs; i++) {
+		const struct replay_exec *exec = &w->execs[i];
+		uint64_t addr = w->buffers[exec->batch].addr;
+		uint32_t ring[4];
+		unsigned count = 0;
+
+		if (gen8) {
+			ring[count++] = AUB_MI_BATCH_BUFFER_START | (3 - 2);
+			ring[count++] = addr & 0xffffffff;
+			ring[count++] = addr >> 32;
+		} else {
+			ring[count++] = AUB_MI_BATCH_BUFFER_START;
+			ring[count++] = addr;
+		}
+		if (count & 1)
+			ring[count++] = AUB_MI_NOOP;
+
+		aub_trace_block(file, gen8,
+				AUB_TRACE_OP_COMMAND_WRITE |
+				aub_ring(exec->ring), 0, 0, count * 4);
+		for (j = 0; j < count; j++)
+			aub_out(file, ring[j]);
+	}
+
+	if (fclose(file))
+		err(1, "couldn't write `%s'", filename);
+}
+
+static int
+cmp_reloc(const void *a, const void *b)
+{
+	const struct replay_reloc *ra = a, *rb = b;
+
+	if (ra->buffer != rb->buffer)
+		return ra->buffer < rb->buffer ? -1 : 1;
+	if (ra->offset != rb->offset)
+		return ra->offset < rb->offset ? -1 : 1;
+	return 0;
+}
+
+/* A buffer can't gain relocations once it is the target of one, so
+ * each buffer's relocations are emitted after those of the buffers it
+ * points to.  Relocations closing a cycle are dropped.
+ */
+static void
+order_visit(struct workload *w, unsigned i, unsigned *nr_order)
+{
+	struct replay_buffer *buf = &w->buffers[i];
+	unsigned j;
+
+	buf->visit = 1;
+	for (j = buf->first_reloc; j < buf->first_reloc + buf->nr_relocs; j++) {
+		struct replay_reloc *reloc = &w->relocs[j];
+		struct replay_buffer *target = &w->buffers[reloc->target];
+
+		if (reloc->target == i)
+			continue;
+		if (target->visit == 1) {
+			reloc->dropped = true;
+			w->nr_dropped++;
+		} else if (target->visit == 0) {
+			order_visit(w, reloc->target, nr_order);
+		}
+	}
+	buf->visit = 2;
+	w->order[(*nr_order)++] = i;
+}
+
+static void
+prepare(struct workload *w)
+{
+	unsigned i, nr_order = 0;
+
+	qsort(w->relocs, w->nr_relocs, sizeof(*w->relocs), cmp_reloc);
+	for (i = 0; i < w->nr_relocs; i++) {
+		struct replay_buffer *buf = &w->buffers[w->relocs[i].buffer];
+
+		if (buf->nr_relocs++ == 0)
+			buf->first_reloc = i;
+	}
+
+	w->order = calloc(w->nr_buffers, sizeof(*w->order));
+	if (!w->order && w->nr_buffers)
+		errx(1, "out of memory");
+	for (i = 0; i < w->nr_buffers; i++) {
+		if (w->buffers[i].visit == 0)
+			order_visit(w, i, &nr_order);
+	}
+}
+
+static void
+free_workload(struct workload *w)
+{
+	unsigned i;
+
+	for (i = 0; i < w->nr_buffers; i++)
+		free(w->buffers[i].data);
+	free(w->buffers);
+	free(w->relocs);
+	free(w->execs);
+	free(w->order);
+}
+
+static void
+dump_workload(const struct workload *w)
+{
+	unsigned i, j;
+
+	for (i = 0; i < w->nr_buffers; i++) {
+		const struct replay_buffer *buf = &w->buffers[i];
+
+		printf("  buffer %u: 0x%08llx, %u bytes, type 0x%x%s\n", i,
+		       (unsigned long long)buf->addr, buf->size, buf->type >> 8,
+		       buf->data ? "" : ", not captured");
+		for (j = buf->first_reloc;
+		     j < buf->first_reloc + buf->nr_relocs; j++) {
+			const struct replay_reloc *reloc = &w->relocs[j];
+
+			printf("    0x%04x -> buffer %u + 0x%x%s%s\n",
+			       reloc->offset, reloc->target, reloc->delta,
+			       reloc->write ? ", write" : "",
+			       reloc->dropped ? ", dropped" : "");
+		}
+	}
+	for (i = 0; i < w->nr_execs; i++)
+		printf("  exec %u: buffer %u, %u bytes, ring %u\n", i,
+		       w->execs[i].batch, w->execs[i].used, w->execs[i].ring);
+}
+
+static void
+replay(const struct workload *w, drm_intel_bufmgr *bufmgr, uint64_t *stage_ns)
+{
+	uint64_t t[NR_STAGES + 1];
+	unsigned i, j;
+	int ret;
+
+	t[STAGE_ALLOC] = cputime_ns();
+	for (i = 0; i < w->nr_buffers; i++) {
+		w->buffers[i].bo = drm_intel_bo_alloc(bufmgr, "replay",
+						      w->buffers[i].size, 4096);
+		assert(w->buffers[i].bo);
+	}
+
+	t[STAGE_UPLOAD] = cputime_ns();
+	for (i = 0; i < w->nr_buffers; i++) {
+		if (!w->buffers[i].data)
+			continue;
+		ret = drm_intel_bo_subdata(w->buffers[i].bo, 0,
+					   w->buffers[i].size,
+					   w->buffers[i].data);
+		assert(ret == 0);
+	}
+
+	t[STAGE_RELOC] = cputime_ns();
+	for (i = 0; i < w->nr_buffers; i++) {
+		const struct replay_buffer *buf = &w->buffers[w->order[i]];
+
+		for (j = buf->first_reloc;
+		     j < buf->first_reloc + buf->nr_relocs; j++) {
+			const struct replay_reloc *reloc = &w->relocs[j];
+
+			if (reloc->dropped)
+				continue;
+			ret = drm_intel_bo_emit_reloc(buf->bo, reloc->offset,
+						      w->buffers[reloc->target].bo,
+						      reloc->delta,
+						      I915_GEM_DOMAIN_RENDER,
+						      reloc->write ?
+						      I915_GEM_DOMAIN_RENDER : 0);
+			assert(ret == 0);
+		}
+	}
+
+	t[STAGE_EXEC] = cputime_ns();
+	for (i = 0; i < w->nr_execs; i++) {
+		ret = drm_intel_bo_mrb_exec(w->buffers[w->execs[i].batch].bo,
+					    ALIGN(w->execs[i].used, 8),
+					    NULL, 0, 0, w->execs[i].ring);
+		assert(ret == 0);
+	}
+
+	t[STAGE_FREE] = cputime_ns();
+	for (i = 0; i < w->nr_buffers; i++) {
+		drm_intel_bo_unreference(w->buffers[i].bo);
+		w->buffers[i].bo = NULL;
+	}
+	t[NR_STAGES] = cputime_ns();
+
+	for (i = 0; i < NR_STAGES; i++)
+		stage_ns[i] += t[i + 1] - t[i];
+}
+
+static void
+run(int fd, const char *filename, const char *aub_filename)
+{
+	struct workload w;
+	drm_intel_bufmgr *bufmgr;
+	struct drm_intel_gem_reloc_stats reloc_stats;
+	uint64_t reloc_allocs, stage_ns[NR_STAGES] = { 0 }, t, total = 0, bytes = 0;
+	unsigned i, max_relocs = 0, nr_ioctl;
+	uint32_t *data;
+	void *ptr;
+	size_t size;
+
+	memset(&w, 0, sizeof(w));
+
+	t = cputime_ns();
+	read_file(filename, &ptr, &size);
+	data = ptr;
+	if (size >= 4 && (data[0] & 0xffff0000) == (uint32_t)CMD_AUB_HEADER)
+		load_aub(&w, filename, data, size);
+	else
+		load_raw(&w, filename, data, size);
+	prepare(&w);
+	t = cputime_ns() - t;
+	free(data);
+
+	if (aub_filename)
+		write_aub(&w, aub_filename);
+
+	for (i = 0; i < w.nr_buffers; i++) {
+		bytes += w.buffers[i].size;
+		if (max_relocs < w.buffers[i].nr_relocs)
+			max_relocs = w.buffers[i].nr_relocs;
+	}
+
+	printf("%s: chipset 0x%04x, %u buffers (%llu KiB), %u relocations "
+	       "(%u dropped), %u execs\n", filename, w.devid, w.nr_buffers,
+	       (unsigned long long)bytes / 1024, w.nr_relocs, w.nr_dropped,
+	       w.nr_execs);
+	if (verbose)
+		dump_workload(&w);
+
+	/* the bufmgr sizes the relocation lists from the batch size */
+	bufmgr = drm_intel_bufmgr_gem_init(fd, ALIGN((max_relocs + 2) * 8,
+						     4096));
+	assert(bufmgr);
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+	if (softpin)
+		assert(drm_intel_bufmgr_gem_enable_softpin_va(bufmgr) == 0);
+
+	/* the first replay sizes the relocation lists */
+	replay(&w, bufmgr, stage_ns);
+	memset(stage_ns, 0, sizeof(stage_ns));
+
+	drm_intel_bufmgr_gem_get_reloc_stats(bufmgr, &reloc_stats);
+	reloc_allocs = reloc_stats.allocs;
+	nr_ioctl = atomic_read(&fake_nr_ioctl);
+	for (i = 0; i < iterations; i++)
+		replay(&w, bufmgr, stage_ns);
+	nr_ioctl = atomic_read(&fake_nr_ioctl) - nr_ioctl;
+	drm_intel_bufmgr_gem_get_reloc_stats(bufmgr, &reloc_stats);
+	reloc_allocs = reloc_stats.allocs - reloc_allocs;
+
+	printf("%-8s %12s\n", "stage", "us/iter");
+	printf("%-8s %12.2f (once)\n", "parse", (double)t / 1000);
+	for (i = 0; i < NR_STAGES; i++) {
+		printf("%-8s %12.2f\n", stage_names[i],
+		       (double)stage_ns[i] / iterations / 1000);
+		total += stage_ns[i];
+	}
+	printf("%-8s %12.2f\n", "total", (double)total / iterations / 1000);
+	printf("%-8s %12.2f\n", "ioctls", (double)nr_ioctl / iterations);
+	printf("%-8s %12.2f (relocation list allocations)\n", "allocs",
+	       (double)reloc_allocs / iterations);
+
+	drm_intel_bufmgr_destroy(bufmgr);
+	free_workload(&w);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n iterations] [-s] [-d devid] [-o out.aub] [-v] "
+	       "file...\n"
+	       "\n"
+	       "  -n iterations  replays of each file (default 1000)\n"
+	       "  -s             softpin every BO at a bufmgr-assigned address\n"
+	       "  -d devid       chipset the capture is for, if the file\n"
+	       "                 does not say\n"
+	       "  -o out.aub     also write the (last) file out as an AUB\n"
+	       "  -v             list the buffers, relocations and execs\n"
+	       "\n"
+	       "Files are AUB captures, or raw batches like the ones in\n"
+	       "intel/tests.\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *aub_filename = NULL;
+	int fd, opt, i;
+
+	while ((opt = getopt(argc, argv, "n:sd:o:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			softpin = true;
+			break;
+		case 'd':
+			devid_override = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			aub_filename = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind == argc || iterations == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_i915_open();
+	assert(fd >= 0);
+
+	for (i = optind; i < argc; i++)
+		run(fd, argv[i], i == argc - 1 ? aub_filename : NULL);
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark for uploading data to BOs with drm_intel_bo_subdata(),
+ * against the fake i915.  A working set of BOs is overwritten round
+ * robin, as if streaming vertex or constant data, with the bufmgr set up
+ * for an LLC platform (through a CPU mmap), a non-LLC one with WC mmaps,
+ * and one without them (through pwrite).  The fake backs every BO with
+ * shared memory, so what this measures is the ioctl and mapping
+ * overhead rather than the cost of writing to uncached memory.  The
+ * fake's ioctls are plain function calls, except for pwrite, which
+ * makes a pwrite() syscall on the backing memfd, so give the ioctls
+ * the cost of a syscall with -d for a fair comparison.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "intel_bufmgr.h"
+#include "i915_drm.h"
+#include "fake_i915.h"
+
+static unsigned iterations = 100000;
+static unsigned nr_bos = 256;
+static unsigned long bo_size = 16 * 1024;
+static unsigned long upload_size = 4096;
+static uint64_t vma_bytes;
+
+static void
+run(drm_intel_bufmgr *bufmgr, const char *mode)
+{
+	drm_intel_bo **bos = calloc(nr_bos, sizeof(*bos));
+	struct drm_intel_gem_vma_stats stats;
+	unsigned nr_mmap, nr_pwrite, i;
+	char *data, *check;
+	uint64_t t;
+	int ret;
+
+	data = malloc(upload_size);
+	check = malloc(upload_size);
+	assert(bos && data && check);
+
+	for (i = 0; i < nr_bos; i++) {
+		bos[i] = drm_intel_bo_alloc(bufmgr, "upload", bo_size, 0);
+		assert(bos[i]);
+	}
+
+	nr_mmap = atomic_read(&fake_nr_mmap);
+	nr_pwrite = atomic_read(&fake_nr_pwrite);
+
+	t = gettime_ns();
+	for (i = 0; i < iterations; i++) {
+		unsigned long offset = (i / nr_bos * upload_size) %
+			(bo_size - upload_size + 1);
+
+		memset(data, i, upload_size);
+		ret = drm_intel_bo_subdata(bos[i % nr_bos], offset,
+					   upload_size, data);
+		assert(ret == 0);
+	}
+	t = gettime_ns() - t;
+
+	nr_mmap = atomic_read(&fake_nr_mmap) - nr_mmap;
+	nr_pwrite = atomic_read(&fake_nr_pwrite) - nr_pwrite;
+
+	/* uploads past the end of the BO are rejected, mapped or not: */
+	assert(drm_intel_bo_subdata(bos[0], bos[0]->size - 1, 2, data) != 0);
+	assert(drm_intel_bo_subdata(bos[0], bos[0]->size + 4096, 1, data) != 0);
+
+	/* the last upload to each BO has to have landed: */
+	for (i = iterations > nr_bos ? iterations - nr_bos : 0;
+	     i < iterations; i++) {
+		unsigned long offset = (i / nr_bos * upload_size) %
+			(bo_size - upload_size + 1);
+
+		memset(data, i, upload_size);
+		ret = drm_intel_bo_get_subdata(bos[i % nr_bos], offset,
+					       upload_size, check);
+		assert(ret == 0);
+		assert(memcmp(data, check, upload_size) == 0);
+	}
+
+	drm_intel_bufmgr_gem_get_vma_stats(bufmgr, &stats);
+
+	printf("%-10s %10.2f %10.0f %8u %8u %10llu %10llu %10llu %10llu\n",
+	       mode, (double)t / iterations / 1000,
+	       (double)iterations * upload_size / t * 1e9 / (1 << 20),
+	       nr_mmap, nr_pwrite,
+	       (unsigned long long)stats.hits,
+	       (unsigned long long)stats.misses,
+	       (unsigned long long)stats.evictions,
+	       (unsigned long long)stats.bytes);
+
+	for (i = 0; i < nr_bos; i++)
+		drm_intel_bo_unreference(bos[i]);
+	free(bos);
+	free(data);
+	free(check);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n iterations] [-c bos] [-s size] [-u size] [-b bytes] [-d ns]\n"
+	       "\n"
+	       "  -n iterations  uploads per mode (default 100000)\n"
+	       "  -c bos         BOs in the working set (default 256)\n"
+	       "  -s size        size of each BO (default 16384)\n"
+	       "  -u size        size of each upload (default 4096)\n"
+	       "  -b bytes       limit of the VMA cache (default unlimited)\n"
+	       "  -d ns          time spent in each ioctl (default 0)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		int has_llc, mmap_version;
+	} modes[] = {
+		{ "llc", 1, 1 },
+		{ "wc", 0, 1 },
+		{ "pwrite", 0, 0 },
+	};
+	drm_intel_bufmgr *bufmgr;
+	unsigned i;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "n:c:s:u:b:d:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nr_bos = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			bo_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			upload_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			vma_bytes = strtoull(optarg, NULL, 0);
+			break;
+		case 'd':
+			fake_ioctl_delay_ns = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_bos || !upload_size || upload_size > bo_size) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_i915_open();
+	assert(fd >= 0);
+
+	printf("%-10s %10s %10s %8s %8s %10s %10s %10s %10s\n", "mode",
+	       "us/upload", "MiB/s", "mmaps", "pwrites", "vma hits",
+	       "misses", "evictions", "bytes");
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		fake_has_llc = modes[i].has_llc;
+		fake_mmap_version = modes[i].mmap_version;
+		bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+		assert(bufmgr);
+		drm_intel_bufmgr_gem_set_vma_cache_bytes(bufmgr, vma_bytes);
+		run(bufmgr, modes[i].name);
+		drm_intel_bufmgr_destroy(bufmgr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2016 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark for synchronizing with the end of a frame, against the fake
+ * i915.  Each frame submits a few batches alternately to the render and
+ * blitter rings, each rendering to its share of the targets, then waits
+ * for, or polls, all targets: one BO at a time with drm_intel_gem_bo_wait()
+ * and drm_intel_bo_busy(), or all at once with drm_intel_bo_wait_many()
+ * and drm_intel_bo_busy_many().  What matters is how many ioctls that
+ * takes per frame.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#undef NDEBUG
+#include <assert.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "intel_bufmgr.h"
+#include "i915_drm.h"
+#include "fake_i915.h"
+
+#define BATCH_SIZE 4096
+
+static unsigned frames = 2000;
+static unsigned nr_targets = 24;
+static unsigned nr_batches = 4;
+
+enum mode {
+	WAIT_EACH,
+	WAIT_MANY,
+	POLL_EACH,
+	POLL_MANY,
+};
+
+static const char *mode_names[] = {
+	"wait each", "wait_many", "poll each", "busy_many",
+};
+
+/* Sleeps until the fake has completed the frame, for the polls to
+ * find everything idle, so that they issue a repeatable number of
+ * ioctls.
+ */
+static void
+wait_for_fake(drm_intel_bo **targets)
+{
+	uint64_t until = 0, now;
+	unsigned i;
+
+	for (i = 0; i < nr_targets; i++) {
+		struct fake_bo *fake_bo = fake_bo_lookup(targets[i]->handle);
+
+		if (until < fake_bo->busy_until)
+			until = fake_bo->busy_until;
+	}
+
+	while ((now = gettime_ns()) < until) {
+		struct timespec ts = { 0, until - now };
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void
+run(drm_intel_bufmgr *bufmgr, enum mode mode)
+{
+	drm_intel_bo **targets = calloc(nr_targets, sizeof(*targets));
+	drm_intel_bo **batches = calloc(nr_batches, sizeof(*batches));
+	unsigned nr_ioctl, nr_wait, nr_busy, i, j, frame;
+	uint64_t t;
+	int ret;
+
+	assert(targets && batches);
+	for (i = 0; i < nr_targets; i++) {
+		targets[i] = drm_intel_bo_alloc(bufmgr, "target", 64 * 1024, 0);
+		assert(targets[i]);
+	}
+
+	nr_ioctl = atomic_read(&fake_nr_ioctl);
+	nr_wait = atomic_read(&fake_nr_wait);
+	nr_busy = atomic_read(&fake_nr_busy);
+
+	t = gettime_ns();
+	for (frame = 0; frame < frames; frame++) {
+		for (j = 0; j < nr_batches; j++) {
+			batches[j] = drm_intel_bo_alloc(bufmgr, "batch",
+							BATCH_SIZE, 0);
+			assert(batches[j]);
+			for (i = j; i < nr_targets; i += nr_batches) {
+				ret = drm_intel_bo_emit_reloc(batches[j], i * 4,
+							      targets[i], 0,
+							      I915_GEM_DOMAIN_RENDER,
+							      I915_GEM_DOMAIN_RENDER);
+				assert(ret == 0);
+			}
+			ret = drm_intel_bo_mrb_exec(batches[j], 8, NULL, 0, 0,
+						    j & 1 ? I915_EXEC_BLT :
+						    I915_EXEC_RENDER);
+			assert(ret == 0);
+		}
+
+		switch (mode) {
+		case WAIT_EACH:
+			for (i = 0; i < nr_targets; i++)
+				assert(drm_intel_gem_bo_wait(targets[i], -1) == 0);
+			break;
+		case WAIT_MANY:
+			assert(drm_intel_bo_wait_many(targets, nr_targets,
+						      -1) == 0);
+			break;
+		case POLL_EACH:
+			wait_for_fake(targets);
+			for (i = 0; i < nr_targets; i++)
+				assert(!drm_intel_bo_busy(targets[i]));
+			break;
+		case POLL_MANY:
+			wait_for_fake(targets);
+			assert(!drm_intel_bo_busy_many(targets, nr_targets));
+			break;
+		}
+
+		/* everything has to be idle now */
+		for (i = 0; i < nr_targets; i++)
+			assert(fake_bo_lookup(targets[i]->handle)->busy_until <=
+			       gettime_ns());
+
+		for (j = 0; j < nr_batches; j++)
+			drm_intel_bo_unreference(batches[j]);
+	}
+	t = gettime_ns() - t;
+
+	nr_ioctl = atomic_read(&fake_nr_ioctl) - nr_ioctl;
+	nr_wait = atomic_read(&fake_nr_wait) - nr_wait;
+	nr_busy = atomic_read(&fake_nr_busy) - nr_busy;
+
+	printf("%-10s %10.2f %12.2f %12.2f %12.2f\n", mode_names[mode],
+	       (double)t / frames / 1000,
+	       (double)nr_wait / frames, (double)nr_busy / frames,
+	       (double)nr_ioctl / frames);
+
+	for (i = 0; i < nr_targets; i++)
+		drm_intel_bo_unreference(targets[i]);
+	free(targets);
+	free(batches);
+}
+
+static void
+usage(const char *name)
+{
+	printf("Usage: %s [-n frames] [-t targets] [-b batches] [-e ns]\n"
+	       "\n"
+	       "  -n frames   frames per mode (default 2000)\n"
+	       "  -t targets  render targets waited for (default 24)\n"
+	       "  -b batches  batches per frame, over 2 rings (default 4)\n"
+	       "  -e ns       GPU time per batch (default 20000)\n",
+	       name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	drm_intel_bufmgr *bufmgr;
+	int fd, opt, mode;
+
+	fake_exec_ns = 20000;
+
+	while ((opt = getopt(argc, argv, "n:t:b:e:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_targets = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nr_batches = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			fake_exec_ns = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!nr_targets || !nr_batches || nr_targets > BATCH_SIZE / 4) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = fake_i915_open();
+	assert(fd >= 0);
+
+	printf("%-10s %10s %12s %12s %12s\n", "mode", "us/frame",
+	       "waits/frame", "busy/frame", "ioctls/frame");
+
+	for (mode = WAIT_EACH; mode <= POLL_MANY; mode++) {
+		bufmgr = drm_intel_bufmgr_gem_init(fd, BATCH_SIZE);
+		assert(bufmgr);
+		drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+		run(bufmgr, mode);
+		drm_intel_bufmgr_destroy(bufmgr);
+	}
+
+	return 0;
+}
@@ -37,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <strings.h>
@@ -48,6 +49,7 @@
 #include <limits.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #define stat_t struct stat
@@ -2833,15 +2835,99 @@ char *drmGetRenderDeviceNameFromFd(int fd)
     return drmGetMinorNameForFD(fd, DRM_NODE_RENDER);
 }
 
-static int drmParseSubsystemType(int maj, int min)
+/*
+ * Device enumeration.
+ *
+ * drmGetDevices() and drmGetDevice() walk DRM_DIR_NAME and read the sysfs
+ * attributes of every node they find there.  The result is kept in a
+ * process wide snapshot which is handed out again for as long as the
+ * device directory and /sys/class/drm keep the modification time they had
+ * when the snapshot was taken, so that repeated enumerations cost two
+ * stat() calls instead of a walk of the whole tree.
+ *
+ * The DRM_DEVICE_DIR and DRM_SYSFS_ROOT environment variables point the
+ * walk at another device directory and sysfs root, so that it can be
+ * tested on a synthetic tree.  Such a device directory may hold regular
+ * files in place of the device nodes.  Both are ignored in setuid and
+ * setgid processes.
+ */
+
+#define DRM_SYSFS_ROOT "/sys"
+
+/* A snapshot taken within this long of the last change to a directory it
+ * depends on is not reused: a change made later in the same timestamp
+ * granule would go unnoticed.
+ */
+#define DRM_SNAPSHOT_RACY_NS 1000000000ll
+
+struct drm_dir_stamp {
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+struct drm_device_node {
+    dev_t rdev;
+    int device;                 /* index in drm_device_snapshot::devices */
+};
+
+struct drm_device_snapshot {
+    char *dev_dir;
+    char *sysfs_root;
+    bool fake_nodes;            /* regular files stand in for the nodes */
+    int max_node_str;
+
+    struct drm_dir_stamp dev_stamp;
+    struct drm_dir_stamp sysfs_stamp;
+    bool trusted;               /* the stamps are old enough to be reused */
+    bool has_deviceinfo;
+
+    drmDevicePtr *devices;
+    int device_count;
+    struct drm_device_node *nodes;
+    int node_count;
+};
+
+static pthread_mutex_t drm_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct drm_device_snapshot *drm_devices;
+
+/* Ignores the environment of setuid and setgid programs. */
+static char *drmSecureGetenv(const char *name)
+{
+#if defined(HAVE_SECURE_GETENV)
+    return secure_getenv(name);
+#elif defined(HAVE___SECURE_GETENV)
+    return __secure_getenv(name);
+#else
+    if (getuid() != geteuid() || getgid() != getegid())
+        return NULL;
+
+    return getenv(name);
+#endif
+}
+
+static const char *drmGetRootFromEnv(const char *name)
+{
+    const char *root;
+
+    root = drmSecureGetenv(name);
+    if (root == NULL || root[0] == '\0')
+        return NULL;
+
+    return root;
+}
+
+static int drmParseSubsystemType(const char *device_dir)
 {
 #ifdef __linux__
     char path[PATH_MAX + 1];
     char link[PATH_MAX + 1] = "";
     char *name;
 
-    snprintf(path, PATH_MAX, "/sys/dev/char/%d:%d/device/subsystem",
-             maj, min);
+    if (snprintf(path, PATH_MAX, "%s/subsystem", device_dir) >= PATH_MAX)
+        return -ENAMETOOLONG;
 
     if (readlink(path, link, PATH_MAX) < 0)
         return -errno;
@@ -2860,7 +2946,7 @@ static int drmParseSubsystemType(int maj, int min)
 #endif
 }
 
-static int drmParsePciBusInfo(int maj, int min, drmPciBusInfoPtr info)
+static int drmParsePciBusInfo(const char *device_dir, drmPciBusInfoPtr info)
 {
 #ifdef __linux__
     char path[PATH_MAX + 1];
@@ -2869,16 +2955,17 @@ static int drmParsePciBusInfo(int maj, int min, drmPciBusInfoPtr info)
     int domain, bus, dev, func;
     int fd, ret;
 
-    snprintf(path, PATH_MAX, "/sys/dev/char/%d:%d/device/uevent", maj, min);
+    if (snprintf(path, PATH_MAX, "%s/uevent", device_dir) >= PATH_MAX)
+        return -ENAMETOOLONG;
     fd = open(path, O_RDONLY);
     if (fd < 0)
         return -errno;
 
-    ret = read(fd, data, sizeof(data));
-    data[sizeof(data)-1] = '\0';
+    ret = read(fd, data, sizeof(data) - 1);
     close(fd);
     if (ret < 0)
         return -errno;
+    data[ret] = '\0';
 
 #define TAG "PCI_SLOT_NAME="
     str = strstr(data, TAG);
@@ -2920,6 +3007,18 @@ static int drmCompareBusInfo(drmDevicePtr a, drmDevicePtr b)
     return -1;
 }
 
+/* Key of the bus location of @device for drmFoldDuplicatedDevices().
+ * Locations with a device or function number out of the PCI range share
+ * keys, so a match still has to be confirmed with drmCompareBusInfo().
+ */
+static unsigned long drmBusInfoKey(drmDevicePtr device)
+{
+    drmPciBusInfoPtr pci = device->businfo.pci;
+
+    return ((unsigned long)pci->domain << 16) | (pci->bus << 8) |
+           ((pci->dev << 3 | pci->func) & 0xff);
+}
+
 static int drmGetNodeType(const char *name)
 {
     if (strncmp(name, DRM_PRIMARY_MINOR_NAME,
@@ -2937,16 +3036,16 @@ static int drmGetNodeType(const char *name)
     return -EINVAL;
 }
 
-static int drmGetMaxNodeName(void)
+static int drmGetMaxNodeName(const char *dev_dir)
 {
-    return sizeof(DRM_DIR_NAME) +
+    return strlen(dev_dir) + 1 /* '/' */ +
            MAX3(sizeof(DRM_PRIMARY_MINOR_NAME),
                 sizeof(DRM_CONTROL_MINOR_NAME),
                 sizeof(DRM_RENDER_MINOR_NAME)) +
            3 /* length of the node number */;
 }
 
-static int drmParsePciDeviceInfo(const char *d_name,
+static int drmParsePciDeviceInfo(const char *device_dir,
                                  drmPciDeviceInfoPtr device)
 {
 #ifdef __linux__
@@ -2954,7 +3053,8 @@ static int drmParsePciDeviceInfo(const char *d_name,
     unsigned char config[64];
     int fd, ret;
 
-    snprintf(path, PATH_MAX, "/sys/class/drm/%s/device/config", d_name);
+    if (snprintf(path, PATH_MAX, "%s/config", device_dir) >= PATH_MAX)
+        return -ENAMETOOLONG;
     fd = open(path, O_RDONLY);
     if (fd < 0)
         return -errno;
@@ -2998,48 +3098,65 @@ void drmFreeDevices(drmDevicePtr devices[], int count)
             drmFreeDevice(&devices[i]);
 }
 
-static int drmProcessPciDevice(drmDevicePtr *device, const char *d_name,
-                               const char *node, int node_type,
-                               int maj, int min, bool fetch_deviceinfo)
+/* Allocates a PCI device, along with its node names and bus and device
+ * info, in a single block so that drmFreeDevice() can free it.
+ */
+static drmDevicePtr drmAllocPciDevice(int max_node_str, bool with_deviceinfo)
 {
-    const int max_node_str = ALIGN(drmGetMaxNodeName(), sizeof(void *));
-    int ret, i;
+    drmDevicePtr device;
     char *addr;
+    int i;
 
-    *device = calloc(1, sizeof(drmDevice) +
-                     (DRM_NODE_MAX * (sizeof(void *) + max_node_str)) +
-                     sizeof(drmPciBusInfo) +
-                     sizeof(drmPciDeviceInfo));
-    if (!*device)
-        return -ENOMEM;
+    device = calloc(1, sizeof(drmDevice) +
+                    (DRM_NODE_MAX * (sizeof(void *) + max_node_str)) +
+                    sizeof(drmPciBusInfo) +
+                    sizeof(drmPciDeviceInfo));
+    if (!device)
+        return NULL;
 
-    addr = (char*)*device;
+    addr = (char*)device;
 
-    (*device)->bustype = DRM_BUS_PCI;
-    (*device)->available_nodes = 1 << node_type;
+    device->bustype = DRM_BUS_PCI;
 
     addr += sizeof(drmDevice);
-    (*device)->nodes = (char**)addr;
+    device->nodes = (char**)addr;
 
     addr += DRM_NODE_MAX * sizeof(void *);
     for (i = 0; i < DRM_NODE_MAX; i++) {
-        (*device)->nodes[i] = addr;
+        device->nodes[i] = addr;
         addr += max_node_str;
     }
-    memcpy((*device)->nodes[node_type], node, max_node_str);
 
-    (*device)->businfo.pci = (drmPciBusInfoPtr)addr;
+    device->businfo.pci = (drmPciBusInfoPtr)addr;
+
+    if (with_deviceinfo) {
+        addr += sizeof(drmPciBusInfo);
+        device->deviceinfo.pci = (drmPciDeviceInfoPtr)addr;
+    }
+
+    return device;
+}
+
+static int drmProcessPciDevice(drmDevicePtr *device, const char *device_dir,
+                               const char *node, int node_type,
+                               int max_node_str, bool fetch_deviceinfo)
+{
+    int ret;
+
+    *device = drmAllocPciDevice(max_node_str, fetch_deviceinfo);
+    if (!*device)
+        return -ENOMEM;
+
+    (*device)->available_nodes = 1 << node_type;
+    strncpy((*device)->nodes[node_type], node, max_node_str - 1);
 
-    ret = drmParsePciBusInfo(maj, min, (*device)->businfo.pci);
+    ret = drmParsePciBusInfo(device_dir, (*device)->businfo.pci);
     if (ret)
         goto free_device;
 
     // Fetch the device info if the user has requested it
     if (fetch_deviceinfo) {
-        addr += sizeof(drmPciBusInfo);
-        (*device)->deviceinfo.pci = (drmPciDeviceInfoPtr)addr;
-
-        ret = drmParsePciDeviceInfo(d_name, (*device)->deviceinfo.pci);
+        ret = drmParsePciDeviceInfo(device_dir, (*device)->deviceinfo.pci);
         if (ret)
             goto free_device;
     }
@@ -3051,255 +3168,398 @@ free_device:
     return ret;
 }
 
-/* Consider devices located on the same bus as duplicate and fold the respective
- * entries into a single one.
- *
- * Note: this leaves "gaps" in the array, while preserving the length.
- */
-static void drmFoldDuplicatedDevices(drmDevicePtr local_devices[], int count)
+static drmDevicePtr drmCopyDevice(drmDevicePtr src, int max_node_str,
+                                  bool with_deviceinfo)
 {
-    int node_type, i, j;
+    drmDevicePtr device;
+    int i;
 
-    for (i = 0; i < count; i++) {
-        for (j = i + 1; j < count; j++) {
-            if (drmCompareBusInfo(local_devices[i], local_devices[j]) == 0) {
-                local_devices[i]->available_nodes |= local_devices[j]->available_nodes;
-                node_type = log2(local_devices[j]->available_nodes);
-                memcpy(local_devices[i]->nodes[node_type],
-                       local_devices[j]->nodes[node_type], drmGetMaxNodeName());
-                drmFreeDevice(&local_devices[j]);
-            }
+    with_deviceinfo = with_deviceinfo && src->deviceinfo.pci;
+
+    device = drmAllocPciDevice(max_node_str, with_deviceinfo);
+    if (!device)
+        return NULL;
+
+    device->available_nodes = src->available_nodes;
+    for (i = 0; i < DRM_NODE_MAX; i++)
+        memcpy(device->nodes[i], src->nodes[i], max_node_str);
+    *device->businfo.pci = *src->businfo.pci;
+    if (with_deviceinfo)
+        *device->deviceinfo.pci = *src->deviceinfo.pci;
+
+    return device;
+}
+
+/* Consider devices located on the same bus as duplicate and fold @device
+ * into the entry found for its bus in @bus_hash, if any; @device is freed
+ * then.  Otherwise @device is appended to @devices.
+ */
+static int drmFoldDuplicatedDevices(void *bus_hash, drmDevicePtr devices[],
+                                    int *count, drmDevicePtr device,
+                                    int max_node_str)
+{
+    unsigned long key = drmBusInfoKey(device);
+    void *value;
+    int node_type, i;
+
+    i = -1;
+    if (drmHashLookup(bus_hash, key, &value) == 0) {
+        i = (int)(intptr_t)value;
+        if (drmCompareBusInfo(devices[i], device) != 0) {
+            /* Out of range location, look for it the slow way. */
+            for (i = *count - 1; i >= 0; i--)
+                if (drmCompareBusInfo(devices[i], device) == 0)
+                    break;
         }
     }
+
+    if (i >= 0) {
+        devices[i]->available_nodes |= device->available_nodes;
+        node_type = log2(device->available_nodes);
+        memcpy(devices[i]->nodes[node_type], device->nodes[node_type],
+               max_node_str);
+        drmFreeDevice(&device);
+        return i;
+    }
+
+    i = (*count)++;
+    devices[i] = device;
+    if (drmHashLookup(bus_hash, key, &value) != 0 &&
+        drmHashInsert(bus_hash, key, (void *)(intptr_t)i) != 0)
+        return -ENOMEM;
+
+    return i;
 }
 
-/**
- * Get information about the opened drm device
- *
- * \param fd file descriptor of the drm device
- * \param device the address of a drmDevicePtr where the information
- *               will be allocated in stored
- *
- * \return zero on success, negative error code otherwise.
- */
-int drmGetDevice(int fd, drmDevicePtr *device)
+static void drmGetDirStamp(const char *path, struct drm_dir_stamp *stamp)
 {
-    drmDevicePtr *local_devices;
-    drmDevicePtr d;
-    DIR *sysdir;
-    struct dirent *dent;
     struct stat sbuf;
-    char node[PATH_MAX + 1];
-    int node_type, subsystem_type;
-    int maj, min;
-    int ret, i, node_count;
-    int max_count = 16;
-    dev_t find_rdev;
 
-    if (fd == -1 || device == NULL)
-        return -EINVAL;
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(path, &sbuf))
+        return;
 
-    if (fstat(fd, &sbuf))
-        return -errno;
+    stamp->exists = true;
+    stamp->dev = sbuf.st_dev;
+    stamp->ino = sbuf.st_ino;
+    stamp->mtime = sbuf.st_mtim;
+    stamp->ctime = sbuf.st_ctim;
+}
 
-    find_rdev = sbuf.st_rdev;
-    maj = major(sbuf.st_rdev);
-    min = minor(sbuf.st_rdev);
+static bool drmDirStampEqual(const struct drm_dir_stamp *a,
+                             const struct drm_dir_stamp *b)
+{
+    return a->exists == b->exists &&
+           a->dev == b->dev && a->ino == b->ino &&
+           a->mtime.tv_sec == b->mtime.tv_sec &&
+           a->mtime.tv_nsec == b->mtime.tv_nsec &&
+           a->ctime.tv_sec == b->ctime.tv_sec &&
+           a->ctime.tv_nsec == b->ctime.tv_nsec;
+}
 
-    if (maj != DRM_MAJOR || !S_ISCHR(sbuf.st_mode))
-        return -EINVAL;
+static bool drmDirStampIsRacy(const struct drm_dir_stamp *stamp,
+                              const struct timespec *now)
+{
+    long long age;
 
-    subsystem_type = drmParseSubsystemType(maj, min);
+    if (!stamp->exists)
+        return false;
 
-    local_devices = calloc(max_count, sizeof(drmDevicePtr));
-    if (local_devices == NULL)
-        return -ENOMEM;
+    age = (now->tv_sec - stamp->mtime.tv_sec) * 1000000000ll +
+          (now->tv_nsec - stamp->mtime.tv_nsec);
+
+    return age < DRM_SNAPSHOT_RACY_NS;
+}
+
+static void drmFreeDeviceSnapshot(struct drm_device_snapshot *snap)
+{
+    if (snap == NULL)
+        return;
+
+    drmFreeDevices(snap->devices, snap->device_count);
+    free(snap->devices);
+    free(snap->nodes);
+    free(snap->dev_dir);
+    free(snap->sysfs_root);
+    free(snap);
+}
+
+static bool drmIsDeviceNode(struct drm_device_snapshot *snap,
+                            const struct stat *sbuf)
+{
+    if (S_ISCHR(sbuf->st_mode) && major(sbuf->st_rdev) == DRM_MAJOR)
+        return true;
+
+    return snap->fake_nodes && S_ISREG(sbuf->st_mode);
+}
+
+/* Walks the device directory of @snap and fills in its devices. */
+static int drmScanDevices(struct drm_device_snapshot *snap,
+                          bool fetch_deviceinfo)
+{
+    char node[PATH_MAX + 1];
+    char device_dir[PATH_MAX + 1];
+    struct timespec now;
+    struct dirent *dent;
+    struct stat sbuf;
+    drmDevicePtr device;
+    void *bus_hash;
+    DIR *sysdir;
+    int node_type;
+    int ret, i;
+    int max_count = 0;
+
+    /* Stamp the directories first, so that whatever changes while they
+     * are walked invalidates the snapshot.
+     */
+    snprintf(device_dir, PATH_MAX, "%s/class/drm", snap->sysfs_root);
+    drmGetDirStamp(snap->dev_dir, &snap->dev_stamp);
+    drmGetDirStamp(device_dir, &snap->sysfs_stamp);
+
+    sysdir = opendir(snap->dev_dir);
+    if (!sysdir)
+        return -errno;
 
-    sysdir = opendir(DRM_DIR_NAME);
-    if (!sysdir) {
-        ret = -errno;
-        goto free_locals;
+    bus_hash = drmHashCreate();
+    if (!bus_hash) {
+        ret = -ENOMEM;
+        goto close_dir;
     }
 
-    i = 0;
     while ((dent = readdir(sysdir))) {
         node_type = drmGetNodeType(dent->d_name);
         if (node_type < 0)
             continue;
 
-        snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, dent->d_name);
+        snprintf(node, PATH_MAX, "%s/%s", snap->dev_dir, dent->d_name);
         if (stat(node, &sbuf))
             continue;
 
-        maj = major(sbuf.st_rdev);
-        min = minor(sbuf.st_rdev);
-
-        if (maj != DRM_MAJOR || !S_ISCHR(sbuf.st_mode))
+        if (!drmIsDeviceNode(snap, &sbuf))
             continue;
 
-        if (drmParseSubsystemType(maj, min) != subsystem_type)
-            continue;
+        snprintf(device_dir, PATH_MAX, "%s/class/drm/%s/device",
+                 snap->sysfs_root, dent->d_name);
 
-        switch (subsystem_type) {
+        switch (drmParseSubsystemType(device_dir)) {
         case DRM_BUS_PCI:
-            ret = drmProcessPciDevice(&d, dent->d_name, node, node_type,
-                                      maj, min, true);
+            ret = drmProcessPciDevice(&device, device_dir, node, node_type,
+                                      snap->max_node_str, fetch_deviceinfo);
             if (ret)
-                goto free_devices;
+                goto destroy_hash;
 
             break;
         default:
             continue;
         }
 
-        if (i >= max_count) {
-            drmDevicePtr *temp;
+        /* There are never more devices than nodes. */
+        if (snap->node_count >= max_count) {
+            struct drm_device_node *nodes;
+            drmDevicePtr *devices;
 
             max_count += 16;
-            temp = realloc(local_devices, max_count * sizeof(drmDevicePtr));
-            if (!temp)
-                goto free_devices;
-            local_devices = temp;
+            devices = realloc(snap->devices, max_count * sizeof(*devices));
+            if (devices)
+                snap->devices = devices;
+            nodes = realloc(snap->nodes, max_count * sizeof(*nodes));
+            if (nodes)
+                snap->nodes = nodes;
+            if (!devices || !nodes) {
+                drmFreeDevice(&device);
+                ret = -ENOMEM;
+                goto destroy_hash;
+            }
         }
 
-        /* store target at local_devices[0] for ease to use below */
-        if (find_rdev == sbuf.st_rdev && i) {
-            local_devices[i] = local_devices[0];
-            local_devices[0] = d;
+        i = drmFoldDuplicatedDevices(bus_hash, snap->devices,
+                                     &snap->device_count, device,
+                                     snap->max_node_str);
+        if (i < 0) {
+            ret = i;
+            goto destroy_hash;
         }
-        else
-            local_devices[i] = d;
-        i++;
-    }
-    node_count = i;
 
-    drmFoldDuplicatedDevices(local_devices, node_count);
+        snap->nodes[snap->node_count].rdev = sbuf.st_rdev;
+        snap->nodes[snap->node_count].device = i;
+        snap->node_count++;
+    }
 
-    *device = local_devices[0];
-    drmFreeDevices(&local_devices[1], node_count - 1);
+    clock_gettime(CLOCK_REALTIME, &now);
+    snap->trusted = !drmDirStampIsRacy(&snap->dev_stamp, &now) &&
+                    !drmDirStampIsRacy(&snap->sysfs_stamp, &now);
+    snap->has_deviceinfo = fetch_deviceinfo;
+    ret = 0;
 
+destroy_hash:
+    drmHashDestroy(bus_hash);
+close_dir:
     closedir(sysdir);
-    free(local_devices);
-    if (*device == NULL)
-	return -ENODEV;
-    return 0;
+    return ret;
+}
 
-free_devices:
-    drmFreeDevices(local_devices, i);
-    closedir(sysdir);
+static bool drmDeviceSnapshotIsValid(struct drm_device_snapshot *snap,
+                                     const char *dev_dir,
+                                     const char *sysfs_root,
+                                     bool need_deviceinfo)
+{
+    struct drm_dir_stamp stamp;
+    char path[PATH_MAX + 1];
 
-free_locals:
-    free(local_devices);
-    return ret;
+    if (snap == NULL || !snap->trusted)
+        return false;
+
+    if (need_deviceinfo && !snap->has_deviceinfo)
+        return false;
+
+    if (strcmp(snap->dev_dir, dev_dir) != 0 ||
+        strcmp(snap->sysfs_root, sysfs_root) != 0)
+        return false;
+
+    drmGetDirStamp(dev_dir, &stamp);
+    if (!drmDirStampEqual(&stamp, &snap->dev_stamp))
+        return false;
+
+    snprintf(path, PATH_MAX, "%s/class/drm", sysfs_root);
+    drmGetDirStamp(path, &stamp);
+    return drmDirStampEqual(&stamp, &snap->sysfs_stamp);
 }
 
-/**
- * Get drm devices on the system
- *
- * \param devices the array of devices with drmDevicePtr elements
- *                can be NULL to get the device number first
- * \param max_devices the maximum number of devices for the array
- *
- * \return on error - negative error code,
- *         if devices is NULL - total number of devices available on the system,
- *         alternatively the number of devices stored in devices[], which is
- *         capped by the max_devices.
+/* Returns the current snapshot in @snap, taking a new one if the devices
+ * may have changed since the last.  Called with drm_devices_lock held.
  */
-int drmGetDevices(drmDevicePtr devices[], int max_devices)
+static int drmGetDeviceSnapshot(struct drm_device_snapshot **snap,
+                                bool need_deviceinfo)
 {
-    drmDevicePtr *local_devices;
-    drmDevicePtr device;
-    DIR *sysdir;
-    struct dirent *dent;
-    struct stat sbuf;
-    char node[PATH_MAX + 1];
-    int node_type, subsystem_type;
-    int maj, min;
-    int ret, i, node_count, device_count;
-    int max_count = 16;
+    struct drm_device_snapshot *new_snap;
+    const char *dev_dir, *sysfs_root;
+    bool fake_nodes;
+    int ret;
+
+    dev_dir = drmGetRootFromEnv("DRM_DEVICE_DIR");
+    fake_nodes = dev_dir != NULL;
+    if (!dev_dir)
+        dev_dir = DRM_DIR_NAME;
+
+    sysfs_root = drmGetRootFromEnv("DRM_SYSFS_ROOT");
+    if (!sysfs_root)
+        sysfs_root = DRM_SYSFS_ROOT;
+
+    if (drmDeviceSnapshotIsValid(drm_devices, dev_dir, sysfs_root,
+                                 need_deviceinfo)) {
+        *snap = drm_devices;
+        return 0;
+    }
 
-    local_devices = calloc(max_count, sizeof(drmDevicePtr));
-    if (local_devices == NULL)
+    new_snap = calloc(1, sizeof(*new_snap));
+    if (!new_snap)
         return -ENOMEM;
 
-    sysdir = opendir(DRM_DIR_NAME);
-    if (!sysdir) {
-        ret = -errno;
-        goto free_locals;
+    new_snap->dev_dir = strdup(dev_dir);
+    new_snap->sysfs_root = strdup(sysfs_root);
+    if (!new_snap->dev_dir || !new_snap->sysfs_root) {
+        ret = -ENOMEM;
+        goto free_snap;
     }
+    new_snap->fake_nodes = fake_nodes;
+    new_snap->max_node_str = ALIGN(drmGetMaxNodeName(dev_dir),
+                                   sizeof(void *));
 
-    i = 0;
-    while ((dent = readdir(sysdir))) {
-        node_type = drmGetNodeType(dent->d_name);
-        if (node_type < 0)
-            continue;
+    ret = drmScanDevices(new_snap, need_deviceinfo);
+    if (ret)
+        goto free_snap;
 
-        snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, dent->d_name);
-        if (stat(node, &sbuf))
-            continue;
+    drmFreeDeviceSnapshot(drm_devices);
+    drm_devices = new_snap;
+    *snap = new_snap;
+    return 0;
 
-        maj = major(sbuf.st_rdev);
-        min = minor(sbuf.st_rdev);
+free_snap:
+    drmFreeDeviceSnapshot(new_snap);
+    return ret;
+}
 
-        if (maj != DRM_MAJOR || !S_ISCHR(sbuf.st_mode))
-            continue;
+/**
+ * Get information about the opened drm device
+ *
+ * \param fd file descriptor of the drm device
+ * \param device the address of a drmDevicePtr where the information
+ *               will be allocated in stored
+ *
+ * \return zero on success, negative error code otherwise.
+ */
+int drmGetDevice(int fd, drmDevicePtr *device)
+{
+    struct drm_device_snapshot *snap;
+    struct stat sbuf;
+    int ret, i;
 
-        subsystem_type = drmParseSubsystemType(maj, min);
+    if (fd == -1 || device == NULL)
+        return -EINVAL;
 
-        if (subsystem_type < 0)
-            continue;
+    if (fstat(fd, &sbuf))
+        return -errno;
 
-        switch (subsystem_type) {
-        case DRM_BUS_PCI:
-            ret = drmProcessPciDevice(&device, dent->d_name, node, node_type,
-                                      maj, min, devices != NULL);
-            if (ret)
-                goto free_devices;
+    if (major(sbuf.st_rdev) != DRM_MAJOR || !S_ISCHR(sbuf.st_mode))
+        return -EINVAL;
 
-            break;
-        default:
-            continue;
-        }
+    pthread_mutex_lock(&drm_devices_lock);
 
-        if (i >= max_count) {
-            drmDevicePtr *temp;
+    ret = drmGetDeviceSnapshot(&snap, true);
+    if (ret)
+        goto out;
 
-            max_count += 16;
-            temp = realloc(local_devices, max_count * sizeof(drmDevicePtr));
-            if (!temp)
-                goto free_devices;
-            local_devices = temp;
-        }
+    ret = -ENODEV;
+    for (i = 0; i < snap->node_count; i++) {
+        if (snap->nodes[i].rdev != sbuf.st_rdev)
+            continue;
 
-        local_devices[i] = device;
-        i++;
+        *device = drmCopyDevice(snap->devices[snap->nodes[i].device],
+                                snap->max_node_str, true);
+        ret = *device ? 0 : -ENOMEM;
+        break;
     }
-    node_count = i;
-
-    drmFoldDuplicatedDevices(local_devices, node_count);
 
-    device_count = 0;
-    for (i = 0; i < node_count; i++) {
-        if (!local_devices[i])
-            continue;
+out:
+    pthread_mutex_unlock(&drm_devices_lock);
+    return ret;
+}
 
-        if ((devices != NULL) && (device_count < max_devices))
-            devices[device_count] = local_devices[i];
-        else
-            drmFreeDevice(&local_devices[i]);
+/**
+ * Get drm devices on the system
+ *
+ * \param devices the array of devices with drmDevicePtr elements
+ *                can be NULL to get the device number first
+ * \param max_devices the maximum number of devices for the array
+ *
+ * \return on error - negative error code,
+ *         if devices is NULL - total number of devices available on the system,
+ *         alternatively the number of devices stored in devices[], which is
+ *         capped by the max_devices.
+ */
+int drmGetDevices(drmDevicePtr devices[], int max_devices)
+{
+    struct drm_device_snapshot *snap;
+    int ret, i;
 
-        device_count++;
-    }
+    pthread_mutex_lock(&drm_devices_lock);
 
-    closedir(sysdir);
-    free(local_devices);
-    return device_count;
+    ret = drmGetDeviceSnapshot(&snap, devices != NULL);
+    if (ret)
+        goto out;
 
-free_devices:
-    drmFreeDevices(local_devices, i);
-    closedir(sysdir);
+    for (i = 0; devices != NULL && i < MIN2(snap->device_count, max_devices); i++) {
+        devices[i] = drmCopyDevice(snap->devices[i], snap->max_node_str,
+                                   true);
+        if (!devices[i]) {
+            drmFreeDevices(devices, i);
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+    ret = snap->device_count;
 
-free_locals:
-    free(local_devices);
+out:
+    pthread_mutex_unlock(&drm_devices_lock);
     return ret;
 }